@@ -11,13 +11,82 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <memory>
+#include <string>
+#include <woff2/dictionary.h>
 #include <woff2/output.h>
+#include <woff2/stats.h>
 
 namespace woff2 {
 
+struct WOFF2DecodeParams {
+  WOFF2DecodeParams() : num_threads(1), stats(NULL), dictionary(NULL) {}
+
+  // Threads used to rebuild the glyf table of large fonts, or the glyf
+  // tables of the fonts of a collection side by side. 0 uses one per
+  // hardware thread. The output is identical whatever the value.
+  int num_threads;
+  // If set, receives timings and counters of each conversion.
+  WOFF2Stats* stats;
+  // Needed, and not owned, for fonts compressed with a dictionary; fonts
+  // compressed without one decode as usual. Only when it is set is the
+  // reserved field of the header read as the id of the dictionary a font
+  // needs, and a font that names another one rejected. Without it, as
+  // before dictionaries, the field is ignored, and a font that needs one
+  // fails to decompress. WOFF2GlyphAccessor takes no params, so it can't
+  // decode such fonts.
+  const WOFF2Dictionary* dictionary;
+};
+
 // Compute the size of the final uncompressed font, or 0 on error.
 size_t ComputeWOFF2FinalSize(const uint8_t *data, size_t length);
 
+// An entry of the table directory of a WOFF2 file.
+struct WOFF2TableEntry {
+  uint32_t tag;
+  // From the flags byte. Version 0 means transformed for glyf and loca,
+  // untransformed for every other table.
+  uint8_t transform_version;
+  bool transformed;
+  uint32_t orig_length;       // in the decoded font
+  uint32_t transform_length;  // in the decompressed data
+};
+
+// The header of a WOFF2 file, and what its directories tell about the font.
+struct WOFF2ProbeInfo {
+  uint32_t flavor;
+  uint32_t length;
+  uint16_t num_tables;
+  uint16_t major_version;
+  uint16_t minor_version;
+  // The reserved field. This library writes 0, or the id of the
+  // WOFF2Dictionary the font was compressed with; other encoders may leave
+  // anything there.
+  uint16_t dictionary_id;
+  // As the file claims it; the decoder doesn't rely on it.
+  uint32_t total_sfnt_size;
+  uint32_t collection_version;  // 0 unless flavor is 'ttcf'
+  uint32_t num_fonts;           // 1 unless flavor is 'ttcf'
+  uint32_t compressed_offset;
+  uint32_t compressed_length;
+  uint32_t uncompressed_size;  // of the table data, before Brotli
+  uint32_t meta_offset;
+  uint32_t meta_length;
+  uint32_t meta_orig_length;
+  uint32_t priv_offset;
+  uint32_t priv_length;
+};
+
+// Parses and checks the header and table directories of the WOFF2 file in
+// data, the way the decoder does before decompressing anything, for callers
+// that classify or reject fonts without decoding them. Nothing is allocated
+// and the table data isn't looked at. The directory goes to tables, which
+// must have room for max_tables entries; 64 is plenty for a single font.
+// Returns false if the file is malformed, or if it has more tables than
+// max_tables: info->num_tables then tells how many.
+bool WOFF2Probe(const uint8_t *data, size_t length, WOFF2ProbeInfo *info,
+                WOFF2TableEntry *tables, size_t max_tables);
+
 // Decompresses the font into the target buffer. The result_length should
 // be the same as determined by ComputeFinalSize(). Returns true on successful
 // decompression.
@@ -30,6 +99,163 @@ bool ConvertWOFF2ToTTF(uint8_t *result, size_t result_length,
 // Please prefer this API.
 bool ConvertWOFF2ToTTF(const uint8_t *data, size_t length,
                        WOFF2Out* out);
+bool ConvertWOFF2ToTTF(const uint8_t *data, size_t length,
+                       WOFF2Out* out, const WOFF2DecodeParams& params);
+
+// One font of a WOFF2Decoder::DecodeBatch call.
+struct WOFF2DecodeJob {
+  const uint8_t *data;
+  size_t length;
+  WOFF2Out* out;
+  bool ok;  // set by DecodeBatch
+};
+
+// Decodes fonts one after another, keeping its buffers, glyph scratch space
+// and Brotli memory from one font to the next. Much cheaper than repeated
+// ConvertWOFF2ToTTF calls when decoding many small fonts. Not thread-safe;
+// use one per thread.
+class WOFF2Decoder {
+ public:
+  WOFF2Decoder();
+  explicit WOFF2Decoder(const WOFF2DecodeParams& params);
+  ~WOFF2Decoder();
+
+  // Decompresses the font into out, as ConvertWOFF2ToTTF does. Tables that
+  // are stored untransformed go to out->WriteReference, pointing into the
+  // decoder's buffers; they stay valid until the next call on the decoder
+  // or its destruction. Together with a WOFF2GatherOut, they reach the sink
+  // straight from the Brotli output.
+  bool Decode(const uint8_t *data, size_t length, WOFF2Out* out);
+
+  // Decodes num_jobs fonts in order, setting ok on each. Returns the number
+  // that succeeded. Every table is copied to the outputs, since the buffers
+  // are reused from one font to the next.
+  size_t DecodeBatch(WOFF2DecodeJob* jobs, size_t num_jobs);
+
+  // Frees the memory kept between fonts. The decoder remains usable.
+  void Reset();
+
+ private:
+  WOFF2Decoder(const WOFF2Decoder&) = delete;
+  WOFF2Decoder& operator=(const WOFF2Decoder&) = delete;
+
+  struct State;
+  std::unique_ptr<State> state_;
+};
+
+// Decompresses a font that arrives in pieces, for example from the network.
+// Each table is written to the output as soon as the compressed data it is
+// built from has been decompressed, so reconstruction starts before the whole
+// file is available and the caller never has to hold the complete input.
+class WOFF2StreamDecoder {
+ public:
+  explicit WOFF2StreamDecoder(WOFF2Out* out);
+  WOFF2StreamDecoder(WOFF2Out* out, const WOFF2DecodeParams& params);
+  ~WOFF2StreamDecoder();
+
+  // Consumes the next length bytes of the file. Returns false if the data is
+  // not a valid font; every later call fails as well.
+  bool Write(const uint8_t *data, size_t length);
+
+  // Signals the end of the input. Returns true if the complete font has been
+  // reconstructed.
+  bool Finish();
+
+  // The same decoder driven in bounded slices, for event loops and coroutines
+  // that must not block on a large font: Append() only queues input, and
+  // each Step() does a bounded share of the work and returns. Use either
+  // Write() or Append(), not both.
+  enum StepResult {
+    kMoreWork,    // the budget ran out; call Step() again
+    kNeedsInput,  // everything queued has been used; Append() more
+    kDone,        // every table has been written
+    kFailed,      // not a valid font; every later call fails as well
+  };
+
+  // Queues the next length bytes of the file, copying them. Returns false
+  // if the decoder has failed.
+  bool Append(const uint8_t *data, size_t length);
+
+  // Decompresses or writes about max_bytes bytes and rebuilds at most
+  // max_glyphs glyphs. A table is written in slices down to single glyphs,
+  // except head and hmtx, which are written whole. Once it returns kDone,
+  // call Finish() after appending the rest of the file.
+  StepResult Step(size_t max_bytes, size_t max_glyphs);
+
+ private:
+  WOFF2StreamDecoder(const WOFF2StreamDecoder&) = delete;
+  WOFF2StreamDecoder& operator=(const WOFF2StreamDecoder&) = delete;
+
+  struct State;
+  std::unique_ptr<State> state_;
+};
+
+// Rebuilds single glyphs of a font on demand, for callers that only need a
+// few glyphs of a large font. Open decompresses the font once and indexes
+// its glyf table; a glyph then costs about the same wherever it is in the
+// font, and walking glyphs in order costs no more than a full decode. Not
+// thread-safe; use one per thread.
+class WOFF2GlyphAccessor {
+ public:
+  WOFF2GlyphAccessor();
+  ~WOFF2GlyphAccessor();
+
+  // Decompresses the font and indexes its glyphs; for a collection, those
+  // of font font_index. data need not outlive the call. Returns false if the
+  // font is invalid or has no glyf table, leaving no font open.
+  bool Open(const uint8_t *data, size_t length);
+  bool Open(const uint8_t *data, size_t length, size_t font_index);
+
+  // Number of glyphs of the open font.
+  size_t NumGlyphs() const;
+
+  // Writes glyph glyph_id to out as it appears in the glyf table of the
+  // decoded font, without padding; an empty glyph writes nothing. Returns
+  // false if there is no such glyph or it is invalid.
+  bool GetGlyph(unsigned int glyph_id, WOFF2Out* out);
+
+ private:
+  WOFF2GlyphAccessor(const WOFF2GlyphAccessor&) = delete;
+  WOFF2GlyphAccessor& operator=(const WOFF2GlyphAccessor&) = delete;
+
+  struct State;
+  std::unique_ptr<State> state_;
+};
+
+// Keeps decoded fonts in memory, keyed by a hash of their WOFF2 bytes, so a
+// font that was decoded before is handed out again without going through
+// the decoder. The fonts are immutable buffers shared with the callers, so
+// a hit costs a lookup, a comparison of the input and a reference count.
+// The least recently used fonts are dropped once they take more than
+// max_bytes. Lookups are spread over independently locked shards, so any
+// number of threads can share one cache. Thread-safe.
+class WOFF2DecodeCache {
+ public:
+  explicit WOFF2DecodeCache(size_t max_bytes);
+  // params.stats is ignored, since decodes run on the callers' threads.
+  WOFF2DecodeCache(size_t max_bytes, const WOFF2DecodeParams& params);
+  ~WOFF2DecodeCache();
+
+  // Returns the decoded font, from the cache if the same bytes were decoded
+  // before, or NULL if the font is invalid. data need not outlive the call.
+  std::shared_ptr<const std::string> Decode(const uint8_t *data,
+                                            size_t length);
+
+  // Same, writing the decoded font to out, for example a WOFF2StringOut.
+  bool Decode(const uint8_t *data, size_t length, WOFF2Out* out);
+
+  // Drops every font. The counters are kept.
+  void Clear();
+
+  WOFF2CacheStats Stats() const;
+
+ private:
+  WOFF2DecodeCache(const WOFF2DecodeCache&) = delete;
+  WOFF2DecodeCache& operator=(const WOFF2DecodeCache&) = delete;
+
+  struct State;
+  std::unique_ptr<State> state_;
+};
 
 } // namespace woff2
 
@@ -0,0 +1,77 @@
+/* Copyright 2026 Google Inc. All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+*/
+
+/* Brotli dictionaries shared by the WOFF2 files of a closed deployment. */
+
+#ifndef WOFF2_WOFF2_DICTIONARY_H_
+#define WOFF2_WOFF2_DICTIONARY_H_
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <memory>
+#include <string>
+
+namespace woff2 {
+
+// The most data a dictionary may hold. Fonts compressed with a dictionary
+// cost its decompression on top of their own on every decode, about 8 us
+// per KiB on a current x86 core, so at most ~0.5 ms a font.
+const size_t kMaxDictionarySize = 64 << 10;
+
+/**
+ * Font data common to a family, such as the cmap, GSUB and name tables and
+ * the glyf substreams its weights and subsets share, which the compressed
+ * data of each font can refer back to instead of carrying it again.
+ *
+ * Brotli 1.0 cannot attach a dictionary to a stream, so the dictionary
+ * stands in for the start of the stream of every font compressed with it:
+ * the encoder compresses it ahead of each font and leaves that part out of
+ * the file, and the decoder puts its compressed form, kept here, back in
+ * front. That part is decompressed again on every decode, so a dictionary
+ * should only hold data the fonts really share; see kMaxDictionarySize.
+ * Such files only decode with the same dictionary, and the reserved field
+ * of their header holds its id. Decoders given a dictionary check it;
+ * others, this one without a dictionary included, ignore the field, try to
+ * decompress a stream that starts mid-way and fail with a generic Brotli
+ * error, if they notice at all. So such files are only meant for closed
+ * deployments, like fonts bundled with an app.
+ */
+class WOFF2Dictionary {
+ public:
+  // Reads a dictionary written by Serialize(). Returns NULL if it is
+  // malformed or holds more than kMaxDictionarySize bytes of data.
+  static std::shared_ptr<const WOFF2Dictionary> Parse(const uint8_t* data,
+                                                      size_t length);
+
+  // The file format read by Parse().
+  std::string Serialize() const;
+
+  // The data Brotli can refer back to.
+  const std::string& data() const { return data_; }
+  // data compressed at the settings below and flushed, the Brotli stream
+  // every font compressed with the dictionary continues.
+  const std::string& prefix() const { return prefix_; }
+  // The whole stream is compressed with these, whatever the WOFF2Params.
+  int brotli_quality() const { return brotli_quality_; }
+  int brotli_window() const { return brotli_window_; }
+  // Never 0, which marks files compressed without a dictionary.
+  uint16_t id() const { return id_; }
+
+  // Use CreateWOFF2Dictionary() in <woff2/encode.h> to build one.
+  WOFF2Dictionary(const std::string& data, const std::string& prefix,
+                  int brotli_quality, int brotli_window);
+
+ private:
+  std::string data_;
+  std::string prefix_;
+  int brotli_quality_;
+  int brotli_window_;
+  uint16_t id_;
+};
+
+} // namespace woff2
+
+#endif  // WOFF2_WOFF2_DICTIONARY_H_
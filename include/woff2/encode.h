@@ -11,19 +11,107 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include <woff2/dictionary.h>
+#include <woff2/stats.h>
 
 namespace woff2 {
 
+class GlyphCache;
+class WOFF2EncodeCache;
+
+// One trial compression of the autotuner.
+struct WOFF2AutotuneTrial {
+  int brotli_quality;
+  size_t compressed_size;  // of the sample
+  double ms;               // time taken on the sample
+  double predicted_ms;     // extrapolated to the whole font
+};
+
+// The settings the autotuner picked, and how it got there.
+struct WOFF2AutotuneResult {
+  int brotli_quality;
+  int brotli_window;
+  size_t sample_size;
+  std::vector<WOFF2AutotuneTrial> trials;
+  double tune_ms;      // spent on the trials
+  double compress_ms;  // spent compressing the font with the chosen settings
+};
+
 struct WOFF2Params {
   WOFF2Params() : extended_metadata(""), brotli_quality(11),
-                  allow_transforms(true) {}
+                  allow_transforms(true), brotli_window(22),
+                  brotli_lgblock(0), brotli_window_fit(false),
+                  glyf_normalized(false), glyf_transform_min_size(0),
+                  autotune_budget_ms(0),
+                  autotune_result(NULL), compression_chunk_size(0),
+                  num_threads(1), stats(NULL), dictionary(NULL),
+                  cache(NULL) {}
 
   std::string extended_metadata;
   int brotli_quality;
   bool allow_transforms;
+  // Brotli window (lgwin) and input block (lgblock, 0 for automatic) sizes
+  // in bits, for the font data.
+  int brotli_window;
+  int brotli_lgblock;
+  // Shrinks the window to the smallest one covering the font data, so that
+  // neither side sets up more window than the font needs. Sizes change by a
+  // fraction of a percent either way.
+  bool brotli_window_fit;
+  // Set when the glyphs are known to be in the normalized form the decoder
+  // writes, e.g. fonts decoded from WOFF2 or made by a subsetter that stores
+  // glyphs that way. glyf and loca are then taken as they are, rather than
+  // parsed and written again, and only parsed to be transformed. Otherwise
+  // the font decodes with a glyf table of a different size than recorded.
+  bool glyf_normalized;
+  // glyf tables smaller than this many bytes are stored untransformed.
+  size_t glyf_transform_min_size;
+  // If positive, test-compresses a sample of the font at several qualities
+  // up to brotli_quality and uses the one compressing best among those
+  // expected to finish the whole font within this many milliseconds of
+  // wall-clock time, trials included. The window is widened to cover the
+  // font if needed.
+  double autotune_budget_ms;
+  // If set, receives the autotuner's choice and timings.
+  WOFF2AutotuneResult* autotune_result;
+  // If non-zero, the font data is compressed as independent chunks of this
+  // many bytes that still form a single Brotli stream. Chunks can be
+  // compressed in parallel but cannot share matches, so the output grows a
+  // little; it depends only on the chunk size, never on num_threads.
+  size_t compression_chunk_size;
+  // Threads used for chunked compression and to normalize and transform the
+  // fonts of a collection. 0 uses one per hardware thread.
+  int num_threads;
+  // If set, receives timings and counters of the conversion.
+  WOFF2Stats* stats;
+  // If set, and not owned, the font data is compressed on top of it, at its
+  // Brotli quality and window, in one stream: the Brotli settings above,
+  // autotuning and chunking are ignored. The result decodes only with the
+  // same dictionary.
+  const WOFF2Dictionary* dictionary;
+  // If set, and not owned, glyphs found unchanged in it are taken from it
+  // rather than normalized and transformed again, and the others are added.
+  // Unused with glyf_normalized, which skips most of that work anyway.
+  WOFF2EncodeCache* cache;
 };
 
+// Settings for encoding fonts on request, where latency matters more than
+// the last few percent of size: a low fixed Brotli quality and a window
+// fitted to the font. Set glyf_normalized on top where it holds.
+WOFF2Params FastWOFF2Params();
+
+// Builds a dictionary from data, for fonts compressed at the given Brotli
+// quality and window. The window should cover the dictionary and the
+// largest font to compress with it. Returns NULL if data is empty or longer
+// than kMaxDictionarySize, or the settings are out of Brotli's range.
+std::shared_ptr<const WOFF2Dictionary> CreateWOFF2Dictionary(
+    const uint8_t* data, size_t length, int brotli_quality,
+    int brotli_window);
+
 // Returns an upper bound on the size of the compressed file.
 size_t MaxWOFF2CompressedSize(const uint8_t* data, size_t length);
 size_t MaxWOFF2CompressedSize(const uint8_t *data, size_t length,
@@ -38,6 +126,41 @@ bool ConvertTTFToWOFF2(const uint8_t *data, size_t length,
                        uint8_t *result, size_t *result_length,
                        const WOFF2Params& params);
 
+// Keeps what the encoder made of each glyph across conversions, keyed by a
+// hash of the glyph's bytes, for encoding revisions of the same fonts over
+// and over, as a font editor does: passed in WOFF2Params::cache, only the
+// glyphs that changed since an earlier conversion are normalized and
+// transformed again. The output is the same as without the cache; Brotli
+// still compresses everything, so pair it with FastWOFF2Params() for quick
+// previews. The glyphs unused by the latest conversion go first once the
+// cache takes more than max_bytes, which it does by at most what the
+// conversions in progress add. Thread-safe.
+//
+// The cache lives in memory only, so it helps a long-lived caller, such as
+// an editor process that encodes on every save. Separate runs of
+// woff2_compress each start from scratch and don't use one.
+class WOFF2EncodeCache {
+ public:
+  explicit WOFF2EncodeCache(size_t max_bytes);
+  ~WOFF2EncodeCache();
+
+  // Drops every glyph. The counters are kept.
+  void Clear();
+
+  // Hits and misses count glyphs.
+  WOFF2CacheStats Stats() const;
+
+ private:
+  WOFF2EncodeCache(const WOFF2EncodeCache&) = delete;
+  WOFF2EncodeCache& operator=(const WOFF2EncodeCache&) = delete;
+
+  friend bool ConvertTTFToWOFF2(const uint8_t *data, size_t length,
+                                uint8_t *result, size_t *result_length,
+                                const WOFF2Params& params);
+
+  std::unique_ptr<GlyphCache> glyphs_;
+};
+
 } // namespace woff2
 
 #endif  // WOFF2_WOFF2_ENC_H_
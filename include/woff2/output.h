@@ -13,12 +13,20 @@
 #include <cstring>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace woff2 {
 
 // Suggested max size for output.
 const size_t kDefaultMaxSize = 30 * 1024 * 1024;
 
+// A piece of memory, with the same members in the same order as struct
+// iovec, for scatter/gather writes.
+struct WOFF2Span {
+  const void *data;
+  size_t size;
+};
+
 /**
  * Output interface for the woff2 decoding.
  *
@@ -41,6 +49,40 @@ class WOFF2Out {
   virtual bool Write(const void *buf, size_t offset, size_t n) = 0;
 
   virtual size_t Size() = 0;
+
+  // Number of times the output had to move its data to grow, for
+  // WOFF2Stats. Outputs that never move report 0.
+  virtual size_t Reallocations() { return 0; }
+
+  // Called by the decoder, before most of the font is written, with the
+  // size the output is expected to reach. Decoding a whole font in memory
+  // gives an upper bound for valid fonts, so an output that reserves this
+  // much need never grow again. Writes past it must still be accepted.
+  virtual void SizeHint(size_t /* size */) {}
+
+  // Appends the num_spans pieces in order. The default writes them one by
+  // one.
+  virtual bool WriteV(const WOFF2Span *spans, size_t num_spans) {
+    for (size_t i = 0; i < num_spans; ++i) {
+      if (!Write(spans[i].data, spans[i].size)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Appends n bytes for the caller to fill in and returns where they start,
+  // valid until the next call on the output. Returns NULL if the output
+  // can't hand out its memory, the default; the caller then writes instead.
+  virtual uint8_t *Reserve(size_t /* n */) { return NULL; }
+
+  // Appends n bytes of buf that the caller guarantees stay valid and
+  // unchanged for as long as the output may read them. Outputs that gather
+  // their data for a later scatter/gather write can keep a reference instead
+  // of a copy. The default copies.
+  virtual bool WriteReference(const void *buf, size_t n) {
+    return Write(buf, n);
+  }
 };
 
 /**
@@ -56,12 +98,43 @@ class WOFF2StringOut : public WOFF2Out {
   bool Write(const void *buf, size_t n) override;
   bool Write(const void *buf, size_t offset, size_t n) override;
   size_t Size() override { return offset_; }
+  size_t Reallocations() override { return reallocations_; }
+  // Reserves size bytes, up to MaxSize().
+  void SizeHint(size_t size) override;
+  uint8_t *Reserve(size_t n) override;
   size_t MaxSize() { return max_size_; }
   void SetMaxSize(size_t max_size);
  private:
   std::string *buf_;
   size_t max_size_;
   size_t offset_;
+  size_t reallocations_;
+};
+
+/**
+ * Expanding memory block whose contents are handed out, once written, as an
+ * immutable reference counted buffer that any number of readers can share.
+ * By default limited to kDefaultMaxSize.
+ */
+class WOFF2SharedOut : public WOFF2Out {
+ public:
+  WOFF2SharedOut();
+
+  bool Write(const void *buf, size_t n) override;
+  bool Write(const void *buf, size_t offset, size_t n) override;
+  size_t Size() override { return out_.Size(); }
+  size_t Reallocations() override { return out_.Reallocations(); }
+  void SizeHint(size_t size) override { out_.SizeHint(size); }
+  uint8_t *Reserve(size_t n) override { return out_.Reserve(n); }
+  size_t MaxSize() { return out_.MaxSize(); }
+  void SetMaxSize(size_t max_size) { out_.SetMaxSize(max_size); }
+
+  // Hands out everything written so far, trimmed to size, and leaves the
+  // output empty for the next font.
+  std::shared_ptr<const std::string> Release();
+ private:
+  std::shared_ptr<std::string> buf_;
+  WOFF2StringOut out_;
 };
 
 /**
@@ -75,12 +148,63 @@ class WOFF2MemoryOut : public WOFF2Out {
   bool Write(const void *buf, size_t n) override;
   bool Write(const void *buf, size_t offset, size_t n) override;
   size_t Size() override { return offset_; }
+  uint8_t *Reserve(size_t n) override;
  private:
   uint8_t* buf_;
   size_t buf_size_;
   size_t offset_;
 };
 
+/**
+ * Collects the font as a list of spans, for a scatter/gather write such as
+ * writev once decoding is done. Written data is copied into memory of the
+ * output, but WriteReference only records where the data is, so the tables
+ * WOFF2Decoder hands out by reference go from its Brotli output to the sink
+ * without another copy. A positional write into referenced data copies just
+ * the bytes it covers. By default limited to kDefaultMaxSize.
+ */
+class WOFF2GatherOut : public WOFF2Out {
+ public:
+  WOFF2GatherOut();
+
+  bool Write(const void *buf, size_t n) override;
+  bool Write(const void *buf, size_t offset, size_t n) override;
+  bool WriteReference(const void *buf, size_t n) override;
+  uint8_t *Reserve(size_t n) override;
+  size_t Size() override { return size_; }
+  size_t MaxSize() { return max_size_; }
+  void SetMaxSize(size_t max_size) { max_size_ = max_size; }
+
+  // Fills spans with the font in order. The spans point into the output,
+  // valid until it is next written to or cleared, and into the referenced
+  // memory.
+  void Spans(std::vector<WOFF2Span> *spans) const;
+
+  // Drops the font, keeping the memory for the next one.
+  void Clear();
+
+ private:
+  // size bytes at start in the font, from ref or, if ref is NULL, at offset
+  // in owned_.
+  struct Segment {
+    size_t start;
+    size_t size;
+    const uint8_t *ref;
+    size_t offset;
+  };
+
+  // Appends n bytes of owned memory and returns where they start.
+  uint8_t *Append(size_t n);
+  // Replaces n bytes at begin in referenced segment i with an owned copy.
+  // Returns the index of the copy.
+  size_t Own(size_t i, size_t begin, size_t n);
+
+  std::vector<Segment> segments_;
+  std::string owned_;
+  size_t size_;
+  size_t max_size_;
+};
+
 } // namespace woff2
 
 #endif  // WOFF2_WOFF2_OUT_H_
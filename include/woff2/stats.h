@@ -0,0 +1,81 @@
+/* Copyright 2026 Google Inc. All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+*/
+
+/* Timings and counters of WOFF2 conversions. */
+
+#ifndef WOFF2_WOFF2_STATS_H_
+#define WOFF2_WOFF2_STATS_H_
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <vector>
+
+namespace woff2 {
+
+// Number of substreams of a transformed glyf table.
+const int kWOFF2GlyfSubStreams = 7;
+
+// One table written by the decoder.
+struct WOFF2TableStats {
+  uint32_t tag;
+  uint64_t ns;     // time taken to reconstruct the table
+  size_t length;   // reconstructed length, before padding
+};
+
+/**
+ * Filled in by a conversion when passed through WOFF2Params::stats or
+ * WOFF2DecodeParams::stats; reset at the start of each conversion. Nothing
+ * is measured when no stats are requested. Times are in nanoseconds.
+ */
+struct WOFF2Stats {
+  uint64_t total_ns = 0;
+  uint64_t parse_ns = 0;        // font or WOFF2 header and table directory
+  // Encoding only: normalization and the glyf/loca transform, which run in
+  // the same pass and aren't timed apart.
+  uint64_t normalize_ns = 0;
+  uint64_t brotli_ns = 0;
+  uint64_t reconstruct_ns = 0;  // decoding only: sum over tables
+
+  // Decoding only: every table written, in output order. Tables shared by
+  // the fonts of a collection appear once.
+  std::vector<WOFF2TableStats> tables;
+
+  // Glyphs of the transformed glyf tables; zero when glyf isn't
+  // transformed.
+  size_t glyphs = 0;
+  size_t simple_glyphs = 0;
+  size_t composite_glyphs = 0;
+  size_t empty_glyphs = 0;
+  size_t contours = 0;
+  size_t points = 0;
+  // nContour, nPoints, flag, glyph, composite, bbox, instruction.
+  size_t glyf_substream_bytes[kWOFF2GlyfSubStreams] = {};
+
+  size_t input_bytes = 0;
+  size_t brotli_uncompressed_bytes = 0;
+  size_t brotli_compressed_bytes = 0;
+  size_t brotli_chunks = 0;  // encoding only: independent Brotli streams
+  size_t output_bytes = 0;
+  // Decoding only: times the output moved to a larger buffer, as reported
+  // by WOFF2Out::Reallocations().
+  size_t output_reallocations = 0;
+};
+
+// Counters of a WOFF2DecodeCache or a WOFF2EncodeCache.
+struct WOFF2CacheStats {
+  WOFF2CacheStats()
+      : hits(0), misses(0), evictions(0), entries(0), bytes(0) {}
+
+  uint64_t hits;
+  uint64_t misses;  // including invalid input, which is never cached
+  uint64_t evictions;
+  size_t entries;
+  size_t bytes;  // the cached output plus the input kept to confirm hits
+};
+
+} // namespace woff2
+
+#endif  // WOFF2_WOFF2_STATS_H_
@@ -0,0 +1,224 @@
+/* Copyright 2026 Google Inc. All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+*/
+
+/* Batch mode for the commandline tools: converts every font in a directory
+   or manifest on a pool of worker threads. */
+
+#ifndef WOFF2_BATCH_H_
+#define WOFF2_BATCH_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace woff2 {
+
+// Sizes of one converted file, filled in by the conversion callback.
+struct BatchFileResult {
+  BatchFileResult() : input_size(0), output_size(0) {}
+
+  size_t input_size;
+  size_t output_size;
+};
+
+// Converts one file on the given worker, 0 <= worker < number of workers,
+// so callers can keep per-thread state. Returns false on failure.
+typedef std::function<bool(size_t worker, const std::string& filename,
+                           BatchFileResult* result)> BatchConvertFunc;
+
+inline bool HasExtension(const std::string& filename,
+                         const std::vector<std::string>& extensions) {
+  for (const std::string& ext : extensions) {
+    if (filename.size() > ext.size() &&
+        filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Lists the files to convert. A directory contributes the files directly in
+// it that have one of the extensions, in name order. Anything else is read
+// as a manifest holding one path per line; blank lines and lines starting
+// with '#' are skipped. Returns false if path can't be read.
+inline bool ListBatchInputs(const std::string& path,
+                            const std::vector<std::string>& extensions,
+                            std::vector<std::string>* files) {
+#if !defined(_WIN32)
+  DIR* dir = opendir(path.c_str());
+  if (dir != NULL) {
+    const std::string prefix = path.back() == '/' ? path : path + "/";
+    std::vector<std::string> names;
+    while (struct dirent* entry = readdir(dir)) {
+      std::string name = prefix + entry->d_name;
+      struct stat st;
+      if (HasExtension(name, extensions) && stat(name.c_str(), &st) == 0 &&
+          S_ISREG(st.st_mode)) {
+        names.push_back(name);
+      }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    files->insert(files->end(), names.begin(), names.end());
+    return true;
+  }
+#endif
+  FILE* manifest = fopen(path.c_str(), "r");
+  if (manifest == NULL) {
+    return false;
+  }
+  std::string line;
+  int c;
+  do {
+    c = fgetc(manifest);
+    if (c != EOF && c != '\n') {
+      line.push_back(static_cast<char>(c));
+      continue;
+    }
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+      line.pop_back();
+    }
+    if (!line.empty() && line[0] != '#') {
+      files->push_back(line);
+    }
+    line.clear();
+  } while (c != EOF);
+  fclose(manifest);
+  return true;
+}
+
+// Number of workers RunBatch uses for num_files files.
+inline size_t BatchWorkers(int num_threads, size_t num_files) {
+  size_t workers = num_threads > 0 ? num_threads
+                                   : std::thread::hardware_concurrency();
+  return std::max<size_t>(1, std::min(workers, num_files));
+}
+
+/**
+ * Converts files on num_threads workers (0 for one per hardware thread) and
+ * prints a line per file and a summary. Files are dealt out largest first,
+ * each worker to its own queue; a worker that runs dry steals from the back
+ * of the others, so a few huge fonts don't leave the rest of the pool idle.
+ * Returns the number of files that failed.
+ */
+inline size_t RunBatch(const std::vector<std::string>& files, int num_threads,
+                       const BatchConvertFunc& convert) {
+  const size_t workers = BatchWorkers(num_threads, files.size());
+
+  // Largest first, so the long conversions start early.
+  std::vector<std::pair<size_t, size_t>> order;  // (size, index)
+  for (size_t i = 0; i < files.size(); ++i) {
+    size_t size = 0;
+#if !defined(_WIN32)
+    struct stat st;
+    if (stat(files[i].c_str(), &st) == 0) {
+      size = st.st_size;
+    }
+#endif
+    order.push_back(std::make_pair(size, i));
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [](const std::pair<size_t, size_t>& a,
+                      const std::pair<size_t, size_t>& b) {
+                     return a.first > b.first;
+                   });
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<size_t> items;
+  };
+  std::vector<Queue> queues(workers);
+  for (size_t i = 0; i < order.size(); ++i) {
+    queues[i % workers].items.push_back(order[i].second);
+  }
+
+  std::mutex print_mutex;
+  size_t failures = 0;
+  size_t total_in = 0;
+  size_t total_out = 0;
+
+  auto next = [&queues, workers](size_t worker, size_t* index) {
+    for (size_t k = 0; k < workers; ++k) {
+      Queue& q = queues[(worker + k) % workers];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (q.items.empty()) {
+        continue;
+      }
+      if (k == 0) {
+        *index = q.items.front();
+        q.items.pop_front();
+      } else {
+        *index = q.items.back();
+        q.items.pop_back();
+      }
+      return true;
+    }
+    return false;
+  };
+
+  auto work = [&](size_t worker) {
+    size_t index;
+    while (next(worker, &index)) {
+      BatchFileResult result;
+      auto start = std::chrono::steady_clock::now();
+      bool ok = convert(worker, files[index], &result);
+      std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      std::lock_guard<std::mutex> lock(print_mutex);
+      if (ok) {
+        total_in += result.input_size;
+        total_out += result.output_size;
+        fprintf(stdout, "%10.1f ms %10zu -> %10zu  %s\n", elapsed.count(),
+                result.input_size, result.output_size, files[index].c_str());
+      } else {
+        ++failures;
+        fprintf(stdout, "%10.1f ms %10s    %10s  %s\n", elapsed.count(),
+                "FAILED", "", files[index].c_str());
+      }
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < workers; ++i) {
+    try {
+      threads.emplace_back(work, i);
+    } catch (const std::system_error&) {
+      // Fall back to fewer threads; the queues of missing workers are
+      // emptied by stealing.
+      break;
+    }
+  }
+  work(0);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  const double seconds = std::max(elapsed.count(), 1e-9);
+  fprintf(stdout, "%zu files, %zu failed, %zu -> %zu bytes in %.2f s on "
+          "%zu threads: %.1f files/s, %.2f MB/s in\n",
+          files.size(), failures, total_in, total_out, elapsed.count(),
+          threads.size() + 1, (files.size() - failures) / seconds,
+          total_in / seconds / (1 << 20));
+  return failures;
+}
+
+} // namespace woff2
+#endif  // WOFF2_BATCH_H_
@@ -48,6 +48,50 @@ inline bool Failure(const char *f, int l, const char *fn) {
 }
 #endif
 
+// -----------------------------------------------------------------------------
+// UncheckedCursor helper class
+//
+// Reads big-endian fields out of a span whose bounds were checked once up
+// front by Buffer::ReadSpan(), so the reads themselves check nothing. Reading
+// past the span handed out is a bug in the caller.
+// -----------------------------------------------------------------------------
+class UncheckedCursor {
+ public:
+  UncheckedCursor() : data_(NULL) { }
+  explicit UncheckedCursor(const uint8_t *data) : data_(data) { }
+
+  void Skip(size_t n_bytes) { data_ += n_bytes; }
+
+  void Read(uint8_t *data, size_t n_bytes) {
+    std::memcpy(data, data_, n_bytes);
+    data_ += n_bytes;
+  }
+
+  uint8_t ReadU8() { return *data_++; }
+
+  uint16_t ReadU16() {
+    const uint16_t value = static_cast<uint16_t>(data_[0] << 8 | data_[1]);
+    data_ += 2;
+    return value;
+  }
+
+  int16_t ReadS16() { return static_cast<int16_t>(ReadU16()); }
+
+  uint32_t ReadU32() {
+    const uint32_t value = static_cast<uint32_t>(data_[0]) << 24 |
+        static_cast<uint32_t>(data_[1]) << 16 |
+        static_cast<uint32_t>(data_[2]) << 8 |
+        static_cast<uint32_t>(data_[3]);
+    data_ += 4;
+    return value;
+  }
+
+  const uint8_t *data() const { return data_; }
+
+ private:
+  const uint8_t *data_;
+};
+
 // -----------------------------------------------------------------------------
 // Buffer helper class
 //
@@ -147,6 +191,17 @@ class Buffer {
     return true;
   }
 
+  // Checks that n_bytes are left and skips past them, handing out a cursor
+  // over them that reads without further checks.
+  bool ReadSpan(size_t n_bytes, UncheckedCursor *span) {
+    const size_t offset = offset_;
+    if (!Skip(n_bytes)) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    *span = UncheckedCursor(buffer_ + offset);
+    return true;
+  }
+
   const uint8_t *buffer() const { return buffer_; }
   size_t offset() const { return offset_; }
   size_t length() const { return length_; }
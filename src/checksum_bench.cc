@@ -0,0 +1,98 @@
+/* Copyright 2026 Google Inc. All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+*/
+
+/* Microbenchmark comparing every ComputeULongSum implementation the CPU
+   supports, and ComputeULongSum itself, with the scalar reference. Also
+   checks that all of them agree for every size and alignment it times. */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "./woff2_common.h"
+
+namespace {
+
+typedef uint32_t (*ULongSumFunc)(const uint8_t* buf, size_t size);
+
+// Returns MB/s for checksumming size bytes at buf, repeated until roughly
+// 256MB have been processed.
+double Throughput(ULongSumFunc sum, const uint8_t* buf, size_t size,
+                  uint32_t* result) {
+  const size_t iterations = std::max<size_t>(1, (256 << 20) / size);
+  uint32_t acc = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    acc += sum(buf, size);
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  *result = acc;
+  return iterations * size / elapsed.count() / (1 << 20);
+}
+
+}  // namespace
+
+int main() {
+  std::vector<uint8_t> data((1 << 20) + 64);
+  srand(1);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = rand();
+  }
+
+  // The variants, then what ComputeULongSum makes of them.
+  std::vector<woff2::ULongSumVariant> variants = woff2::ULongSumVariants();
+  variants.push_back({"dispatch", woff2::ComputeULongSum});
+
+  // Exhaustive agreement check over small sizes and all alignments.
+  for (const woff2::ULongSumVariant& variant : variants) {
+    for (size_t align = 0; align < 32; ++align) {
+      for (size_t size = 0; size < 300; ++size) {
+        const uint8_t* buf = &data[align];
+        if (variant.sum(buf, size) !=
+            woff2::ComputeULongSumScalar(buf, size)) {
+          fprintf(stderr, "Mismatch in %s at size %zu, alignment %zu\n",
+                  variant.name, size, align);
+          return 1;
+        }
+      }
+    }
+  }
+
+  const size_t sizes[] = {12, 24, 32, 48, 64, 100, 1 << 10, 64 << 10, 1 << 20};
+  printf("%10s", "MB/s");
+  for (const woff2::ULongSumVariant& variant : variants) {
+    printf(" %10s", variant.name);
+  }
+  printf(" %8s\n", "speedup");
+  for (size_t size : sizes) {
+    // Odd alignment, as for glyphs in a decompressed buffer.
+    const uint8_t* buf = &data[1];
+    printf("%10zu", size);
+    // The scalar version comes first.
+    uint32_t scalar_result = 0;
+    double scalar = 0;
+    double mbs = 0;
+    for (size_t v = 0; v < variants.size(); ++v) {
+      uint32_t result;
+      mbs = Throughput(variants[v].sum, buf, size, &result);
+      if (v == 0) {
+        scalar = mbs;
+        scalar_result = result;
+      } else if (result != scalar_result) {
+        fprintf(stderr, "Mismatch in %s at size %zu\n", variants[v].name,
+                size);
+        return 1;
+      }
+      printf(" %10.0f", mbs);
+    }
+    // ComputeULongSum, against the scalar version.
+    printf(" %7.2fx\n", mbs / scalar);
+  }
+  return 0;
+}
@@ -1,12 +1,22 @@
+#include <cstdlib>
 #include <string>
+#include <unistd.h>
+
+#include "./file.h"
 #include <woff2/decode.h>
 
 extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t data_size) {
   // Decode using newer entry pattern.
-  // Same pattern as woff2_decompress.
-  std::string output(std::min(woff2::ComputeWOFF2FinalSize(data, data_size),
-                              woff2::kDefaultMaxSize), 0);
-  woff2::WOFF2StringOut out(&output);
-  woff2::ConvertWOFF2ToTTF(data, data_size, &out);
+  // Same pattern as woff2_decompress: one decoder reused from font to font,
+  // writing to a mapped file, which is dropped afterwards.
+  static woff2::WOFF2Decoder decoder;
+  static const std::string outfilename =
+      std::string(getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp") +
+      "/woff2_fuzzer_" + std::to_string(getpid()) + ".ttf";
+  woff2::WOFF2FileOut out(outfilename,
+      std::min(woff2::ComputeWOFF2FinalSize(data, data_size),
+               woff2::kDefaultMaxSize));
+  decoder.Decode(data, data_size, &out);
+  out.Discard();
   return 0;
 }
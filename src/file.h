@@ -9,22 +9,349 @@
 #ifndef WOFF2_FILE_H_
 #define WOFF2_FILE_H_
 
-#include <fstream>
-#include <iterator>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define WOFF2_HAVE_MMAP 1
+#endif
+
+#include <woff2/output.h>
 
 namespace woff2 {
 
+// Reads the whole file through stdio. Returns false if it can't be read.
+inline bool ReadFileContent(const std::string& filename, std::string* out) {
+  FILE* f = fopen(filename.c_str(), "rb");
+  if (f == NULL) {
+    return false;
+  }
+  out->clear();
+  char buf[1 << 16];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    out->append(buf, n);
+  }
+  const bool ok = !ferror(f);
+  fclose(f);
+  return ok;
+}
+
 inline std::string GetFileContent(std::string filename) {
-  std::ifstream ifs(filename.c_str(), std::ios::binary);
-  return std::string(std::istreambuf_iterator<char>(ifs.rdbuf()),
-                     std::istreambuf_iterator<char>());
+  std::string content;
+  ReadFileContent(filename, &content);
+  return content;
+}
+
+inline bool WriteFileContent(const std::string& filename, const void* data,
+                             size_t size) {
+  FILE* f = fopen(filename.c_str(), "wb");
+  if (f == NULL) {
+    return false;
+  }
+  const bool ok = fwrite(data, 1, size, f) == size;
+  return fclose(f) == 0 && ok;
 }
 
 inline void SetFileContents(std::string filename, std::string::iterator start,
                             std::string::iterator end) {
-  std::ofstream ofs(filename.c_str(), std::ios::binary);
-  std::copy(start, end, std::ostream_iterator<char>(ofs));
+  WriteFileContent(filename, start == end ? NULL : &*start, end - start);
+}
+
+#ifdef WOFF2_HAVE_MMAP
+// Writes the spans to fd in order with as few writev calls as the system
+// allows, for example those of a WOFF2GatherOut.
+inline bool WriteSpans(int fd, const std::vector<WOFF2Span>& spans) {
+  std::vector<struct iovec> iov(spans.size());
+  for (size_t i = 0; i < spans.size(); ++i) {
+    iov[i].iov_base = const_cast<void*>(spans[i].data);
+    iov[i].iov_len = spans[i].size;
+  }
+  size_t next = 0;
+  while (next < iov.size()) {
+    const int count = static_cast<int>(
+        std::min<size_t>(iov.size() - next, IOV_MAX));
+    ssize_t written = writev(fd, &iov[next], count);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    // Move past what went out, which may end within a span.
+    while (next < iov.size() &&
+           static_cast<size_t>(written) >= iov[next].iov_len) {
+      written -= iov[next].iov_len;
+      ++next;
+    }
+    if (written > 0) {
+      iov[next].iov_base = static_cast<char*>(iov[next].iov_base) + written;
+      iov[next].iov_len -= written;
+    }
+  }
+  return true;
 }
+#endif
+
+/**
+ * Read-only view of a whole file. Regular files are mapped into memory,
+ * anything else (pipes, platforms without mmap) is read into a buffer.
+ */
+class InputFile {
+ public:
+  explicit InputFile(const std::string& filename)
+      : data_(NULL), size_(0), mapped_(false), ok_(false) {
+#ifdef WOFF2_HAVE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        data_ = static_cast<const uint8_t*>(p);
+        size_ = st.st_size;
+        mapped_ = true;
+        ok_ = true;
+      }
+    }
+    close(fd);
+    if (mapped_) {
+      return;
+    }
+#endif
+    ok_ = ReadFileContent(filename, &buffer_);
+    data_ = reinterpret_cast<const uint8_t*>(buffer_.data());
+    size_ = buffer_.size();
+  }
+
+  ~InputFile() {
+#ifdef WOFF2_HAVE_MMAP
+    if (mapped_) {
+      munmap(const_cast<uint8_t*>(data_), size_);
+    }
+#endif
+  }
+
+  bool ok() const { return ok_; }
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  InputFile(const InputFile&);
+  void operator=(const InputFile&);
+
+  const uint8_t* data_;
+  size_t size_;
+  bool mapped_;
+  bool ok_;
+  std::string buffer_;
+};
+
+/**
+ * WOFF2Out that writes straight into a file through a shared mapping, so the
+ * decoded font never needs a second copy in memory. The file is created
+ * with size_hint bytes and grows as needed, up to kDefaultMaxSize like
+ * WOFF2StringOut. The mapped file is written under a temporary name and
+ * moved into place by Close(), so a failed conversion never clobbers an
+ * existing file. Falls back to a memory buffer written out on Close() when
+ * the file can't be mapped.
+ */
+class WOFF2FileOut : public WOFF2Out {
+ public:
+  WOFF2FileOut(const std::string& filename, size_t size_hint)
+      : filename_(filename), fd_(-1), map_(NULL), capacity_(0), size_(0),
+        max_size_(kDefaultMaxSize), reallocations_(0), ok_(true) {
+#ifdef WOFF2_HAVE_MMAP
+    temp_filename_ = filename + ".partial";
+    fd_ = open(temp_filename_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    struct stat st;
+    if (fd_ >= 0 && (fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode))) {
+      close(fd_);
+      fd_ = -1;
+      remove(temp_filename_.c_str());
+    }
+    if (fd_ >= 0) {
+      if (Remap(std::min(std::max<size_t>(size_hint, 1), max_size_))) {
+        return;
+      }
+      close(fd_);
+      fd_ = -1;
+      remove(temp_filename_.c_str());
+    }
+#endif
+    buffer_.reserve(std::min(size_hint, max_size_));
+  }
+
+  ~WOFF2FileOut() override { Close(); }
+
+  bool Write(const void* buf, size_t n) override {
+    return Write(buf, size_, n);
+  }
+
+  bool Write(const void* buf, size_t offset, size_t n) override {
+    uint8_t* dst = Span(offset, n);
+    if (dst == NULL) {
+      return false;
+    }
+    if (n > 0) {
+      std::memcpy(dst, buf, n);
+    }
+    return true;
+  }
+
+  size_t Size() override { return size_; }
+  size_t Reallocations() override { return reallocations_; }
+
+  void SizeHint(size_t size) override {
+    size = std::min(size, max_size_);
+#ifdef WOFF2_HAVE_MMAP
+    if (fd_ >= 0) {
+      if (ok_ && size > capacity_ && !Remap(size)) {
+        ok_ = false;
+      }
+      return;
+    }
+#endif
+    if (size > buffer_.capacity()) {
+      reallocations_ += size_ > 0;
+      buffer_.reserve(size);
+    }
+  }
+
+  size_t MaxSize() { return max_size_; }
+  void SetMaxSize(size_t max_size) { max_size_ = max_size; }
+
+  // Grows the file by n bytes and returns where they start, for producers
+  // that want a plain buffer. The pointer is valid until the next call that
+  // writes or extends. Returns NULL on failure.
+  uint8_t* Extend(size_t n) { return Span(size_, n); }
+
+  // Drops everything past size.
+  void Truncate(size_t size) { size_ = std::min(size_, size); }
+
+  // Trims the file to Size() and closes it. Returns false if any write
+  // failed along the way. Safe to call more than once.
+  bool Close() {
+#ifdef WOFF2_HAVE_MMAP
+    if (fd_ >= 0) {
+      if (map_ != NULL) {
+        munmap(map_, capacity_);
+        map_ = NULL;
+      }
+      if (ftruncate(fd_, size_) != 0) {
+        ok_ = false;
+      }
+      if (close(fd_) != 0) {
+        ok_ = false;
+      }
+      fd_ = -1;
+      if (ok_ && !filename_.empty() &&
+          rename(temp_filename_.c_str(), filename_.c_str()) != 0) {
+        ok_ = false;
+      }
+      if (!ok_) {
+        remove(temp_filename_.c_str());
+      }
+      filename_.clear();
+      return ok_;
+    }
+#endif
+    if (ok_ && !filename_.empty()) {
+      ok_ = WriteFileContent(filename_, buffer_.data(), size_);
+      filename_.clear();
+    }
+    return ok_;
+  }
+
+  // Closes the file without keeping it, for when the output turned out
+  // invalid.
+  void Discard() {
+    ok_ = false;
+    Close();
+  }
+
+ private:
+  WOFF2FileOut(const WOFF2FileOut&);
+  void operator=(const WOFF2FileOut&);
+
+  // Returns the n bytes at offset, growing the output to cover them.
+  uint8_t* Span(size_t offset, size_t n) {
+    if (!ok_ || offset > max_size_ || n > max_size_ - offset) {
+      return NULL;
+    }
+    const size_t end = offset + n;
+#ifdef WOFF2_HAVE_MMAP
+    if (fd_ >= 0) {
+      if (end > capacity_ &&
+          !Remap(std::min(max_size_, std::max(end, 2 * capacity_)))) {
+        ok_ = false;
+        return NULL;
+      }
+      size_ = std::max(size_, end);
+      return map_ + offset;
+    }
+#endif
+    if (end > buffer_.size()) {
+      reallocations_ += size_ > 0 && end > buffer_.capacity();
+      buffer_.resize(std::max(end, std::min(max_size_, 2 * buffer_.size())));
+    }
+    size_ = std::max(size_, end);
+    return reinterpret_cast<uint8_t*>(&buffer_[0]) + offset;
+  }
+
+#ifdef WOFF2_HAVE_MMAP
+  // Resizes the file to capacity bytes and maps all of it.
+  bool Remap(size_t capacity) {
+    if (map_ != NULL) {
+      munmap(map_, capacity_);
+      map_ = NULL;
+      capacity_ = 0;
+      reallocations_ += size_ > 0;
+    }
+    if (ftruncate(fd_, capacity) != 0) {
+      return false;
+    }
+#if defined(__linux__)
+    // Claim the blocks up front: running out of disk space while writing
+    // through a mapping raises SIGBUS instead of failing a write.
+    if (posix_fallocate(fd_, 0, capacity) != 0) {
+      return false;
+    }
+#endif
+    void* p = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) {
+      return false;
+    }
+    map_ = static_cast<uint8_t*>(p);
+    capacity_ = capacity;
+    return true;
+  }
+#endif
+
+  std::string filename_;
+  std::string temp_filename_;
+  int fd_;
+  uint8_t* map_;
+  size_t capacity_;
+  size_t size_;
+  size_t max_size_;
+  size_t reallocations_;
+  bool ok_;
+  std::string buffer_;
+};
 
 } // namespace woff2
 #endif  // WOFF2_FILE_H_
@@ -9,6 +9,7 @@
 #include "./font.h"
 
 #include <algorithm>
+#include <utility>
 
 #include "./buffer.h"
 #include "./port.h"
@@ -18,41 +19,112 @@
 
 namespace woff2 {
 
+namespace {
+
+// glyf, loca and hmtx
+const size_t kMaxTransformedTables = 3;
+
+bool TagLess(const Font::TableSlot& entry, uint32_t tag) {
+  return entry.tag < tag;
+}
+
+bool SlotLess(const Font::TableSlot& a, const Font::TableSlot& b) {
+  return a.tag < b.tag;
+}
+
+bool OffsetLess(const std::pair<uint32_t, uint32_t>& a,
+                const std::pair<uint32_t, uint32_t>& b) {
+  return a.first < b.first;
+}
+
+}  // namespace
+
 Font::Table* Font::FindTable(uint32_t tag) {
-  std::map<uint32_t, Font::Table>::iterator it = tables.find(tag);
-  return it == tables.end() ? 0 : &it->second;
+  std::vector<TableSlot>::const_iterator it =
+      std::lower_bound(index_.begin(), index_.end(), tag, TagLess);
+  return it == index_.end() || it->tag != tag ? 0 : &tables_[it->slot];
 }
 
 const Font::Table* Font::FindTable(uint32_t tag) const {
-  std::map<uint32_t, Font::Table>::const_iterator it = tables.find(tag);
-  return it == tables.end() ? 0 : &it->second;
+  std::vector<TableSlot>::const_iterator it =
+      std::lower_bound(index_.begin(), index_.end(), tag, TagLess);
+  return it == index_.end() || it->tag != tag ? 0 : &tables_[it->slot];
+}
+
+bool Font::SetTables(std::vector<Table>* tables) {
+  tables_.swap(*tables);
+  tables->clear();
+  tables_.reserve(tables_.size() + kMaxTransformedTables);
+  index_.resize(tables_.size());
+  for (size_t i = 0; i < tables_.size(); ++i) {
+    index_[i].tag = tables_[i].tag;
+    index_[i].slot = i;
+  }
+  // The table directory is supposed to be sorted already.
+  if (!std::is_sorted(index_.begin(), index_.end(), SlotLess)) {
+    std::sort(index_.begin(), index_.end(), SlotLess);
+  }
+  for (size_t i = 1; i < index_.size(); ++i) {
+    if (index_[i - 1].tag == index_[i].tag) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+  }
+  UpdateOutputOrder();
+  return true;
 }
 
-std::vector<uint32_t> Font::OutputOrderedTags() const {
-  std::vector<uint32_t> output_order;
+Font::Table* Font::AddTable(uint32_t tag) {
+  std::vector<TableSlot>::iterator it =
+      std::lower_bound(index_.begin(), index_.end(), tag, TagLess);
+  if (it != index_.end() && it->tag == tag) {
+    return &tables_[it->slot];
+  }
+  TableSlot entry;
+  entry.tag = tag;
+  entry.slot = tables_.size();
+  index_.insert(it, entry);
+  tables_.push_back(Table());
+  tables_.back().tag = tag;
+  // Transformed tables are not part of the output order.
+  if (!(tag & 0x80808080)) {
+    UpdateOutputOrder();
+  }
+  return &tables_.back();
+}
 
-  for (const auto& i : tables) {
-    const Font::Table& table = i.second;
+// The table itself stays in the array, unreachable, so that the others
+// don't move.
+void Font::RemoveTable(uint32_t tag) {
+  std::vector<TableSlot>::iterator it =
+      std::lower_bound(index_.begin(), index_.end(), tag, TagLess);
+  if (it != index_.end() && it->tag == tag) {
+    index_.erase(it);
+    UpdateOutputOrder();
+  }
+}
+
+void Font::UpdateOutputOrder() {
+  output_order_.clear();
+
+  for (const TableSlot& entry : index_) {
     // This is a transformed table, we will write it together with the
     // original version.
-    if (table.tag & 0x80808080) {
+    if (entry.tag & 0x80808080) {
       continue;
     }
-    output_order.push_back(table.tag);
+    output_order_.push_back(entry.tag);
   }
 
   // Alphabetize then put loca immediately after glyf
-  auto glyf_loc = std::find(output_order.begin(), output_order.end(),
+  auto glyf_loc = std::find(output_order_.begin(), output_order_.end(),
       kGlyfTableTag);
-  auto loca_loc = std::find(output_order.begin(), output_order.end(),
+  auto loca_loc = std::find(output_order_.begin(), output_order_.end(),
       kLocaTableTag);
-  if (glyf_loc != output_order.end() && loca_loc != output_order.end()) {
-    output_order.erase(loca_loc);
-    output_order.insert(std::find(output_order.begin(), output_order.end(),
+  if (glyf_loc != output_order_.end() && loca_loc != output_order_.end()) {
+    output_order_.erase(loca_loc);
+    output_order_.insert(std::find(output_order_.begin(), output_order_.end(),
       kGlyfTableTag) + 1, kLocaTableTag);
   }
-
-  return output_order;
 }
 
 bool ReadTrueTypeFont(Buffer* file, const uint8_t* data, size_t len,
@@ -64,10 +136,14 @@ bool ReadTrueTypeFont(Buffer* file, const uint8_t* data, size_t len,
     return FONT_COMPRESSION_FAILURE();
   }
 
-  std::map<uint32_t, uint32_t> intervals;
+  std::vector<Font::Table> tables;
+  tables.reserve(font->num_tables + kMaxTransformedTables);
+  tables.resize(font->num_tables);
+  std::vector<std::pair<uint32_t, uint32_t> > intervals(font->num_tables);
   for (uint16_t i = 0; i < font->num_tables; ++i) {
-    Font::Table table;
+    Font::Table& table = tables[i];
     table.flag_byte = 0;
+    table.data_dropped = false;
     table.reuse_of = NULL;
     if (!file->ReadU32(&table.tag) ||
         !file->ReadU32(&table.checksum) ||
@@ -80,21 +156,28 @@ bool ReadTrueTypeFont(Buffer* file, const uint8_t* data, size_t len,
         len - table.length < table.offset) {
       return FONT_COMPRESSION_FAILURE();
     }
-    intervals[table.offset] = table.length;
+    intervals[i] = std::make_pair(table.offset, table.length);
     table.data = data + table.offset;
-    if (font->tables.find(table.tag) != font->tables.end()) {
-      return FONT_COMPRESSION_FAILURE();
-    }
-    font->tables[table.tag] = table;
+  }
+  if (!font->SetTables(&tables)) {
+    return FONT_COMPRESSION_FAILURE();
   }
 
-  // Check that tables are non-overlapping.
+  // Check that tables are non-overlapping. Of tables starting at the same
+  // offset only the one listed last is checked.
+  std::stable_sort(intervals.begin(), intervals.end(), OffsetLess);
   uint32_t last_offset = 12UL + 16UL * font->num_tables;
-  for (const auto& i : intervals) {
-    if (i.first < last_offset || i.first + i.second < i.first) {
+  for (size_t i = 0; i < intervals.size(); ++i) {
+    if (i + 1 < intervals.size() &&
+        intervals[i + 1].first == intervals[i].first) {
+      continue;
+    }
+    const std::pair<uint32_t, uint32_t>& interval = intervals[i];
+    if (interval.first < last_offset ||
+        interval.first + interval.second < interval.first) {
       return FONT_COMPRESSION_FAILURE();
     }
-    last_offset = i.first + i.second;
+    last_offset = interval.first + interval.second;
   }
 
   // Sanity check key tables
@@ -116,11 +199,9 @@ bool ReadCollectionFont(Buffer* file, const uint8_t* data, size_t len,
     return FONT_COMPRESSION_FAILURE();
   }
 
-  for (auto& entry : font->tables) {
-    Font::Table& table = entry.second;
-
+  for (Font::Table& table : font->Tables()) {
     if (all_tables->find(table.offset) == all_tables->end()) {
-      (*all_tables)[table.offset] = font->FindTable(table.tag);
+      (*all_tables)[table.offset] = &table;
     } else {
       table.reuse_of = (*all_tables)[table.offset];
       if (table.tag != table.reuse_of->tag) {
@@ -197,8 +278,7 @@ bool ReadFontCollection(const uint8_t* data, size_t len,
 
 size_t FontFileSize(const Font& font) {
   size_t max_offset = 12ULL + 16ULL * font.num_tables;
-  for (const auto& i : font.tables) {
-    const Font::Table& table = i.second;
+  for (const Font::Table& table : font.Tables()) {
     size_t padding_size = (4 - (table.length & 3)) & 3;
     size_t end_offset = (padding_size + table.offset) + table.length;
     max_offset = std::max(max_offset, end_offset);
@@ -272,8 +352,8 @@ bool WriteFont(const Font& font, size_t* offset, uint8_t* dst,
   Store16(max_pow2, offset, dst);
   Store16(range_shift, offset, dst);
 
-  for (const auto& i : font.tables) {
-    if (!WriteTable(i.second, offset, dst, dst_size)) {
+  for (const Font::Table& table : font.Tables()) {
+    if (!WriteTable(table, offset, dst, dst_size)) {
       return false;
     }
   }
@@ -388,11 +468,9 @@ bool GetGlyphData(const Font& font, int glyph_index,
 }
 
 bool RemoveDigitalSignature(Font* font) {
-  std::map<uint32_t, Font::Table>::iterator it =
-      font->tables.find(kDsigTableTag);
-  if (it != font->tables.end()) {
-    font->tables.erase(it);
-    font->num_tables = font->tables.size();
+  if (font->FindTable(kDsigTableTag) != NULL) {
+    font->RemoveTable(kDsigTableTag);
+    font->num_tables = font->Tables().size();
   }
   return true;
 }
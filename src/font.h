@@ -41,14 +41,96 @@ struct Font {
 
     uint8_t flag_byte;
 
+    // Set when only the length and checksum of the data were kept, for a
+    // table that is written in transformed form only; data is NULL then.
+    bool data_dropped;
+
     // Is this table reused by a TTC
     bool IsReused() const;
   };
-  std::map<uint32_t, Table> tables;
-  std::vector<uint32_t> OutputOrderedTags() const;
+
+  // Position of a table in the table array, the index is sorted by tag.
+  struct TableSlot {
+    uint32_t tag;
+    uint32_t slot;
+  };
+
+  // Walks the tables in tag order.
+  template <typename T>
+  class TableIterator {
+   public:
+    TableIterator(T* tables, const TableSlot* entry)
+        : tables_(tables), entry_(entry) {}
+    T& operator*() const { return tables_[entry_->slot]; }
+    T* operator->() const { return &tables_[entry_->slot]; }
+    TableIterator& operator++() {
+      ++entry_;
+      return *this;
+    }
+    bool operator!=(const TableIterator& other) const {
+      return entry_ != other.entry_;
+    }
+
+   private:
+    T* tables_;
+    const TableSlot* entry_;
+  };
+
+  template <typename T>
+  class TableRange {
+   public:
+    TableRange(T* tables, const std::vector<TableSlot>& index)
+        : tables_(tables), index_(index) {}
+    TableIterator<T> begin() const {
+      return TableIterator<T>(tables_, index_.data());
+    }
+    TableIterator<T> end() const {
+      return TableIterator<T>(tables_, index_.data() + index_.size());
+    }
+    size_t size() const { return index_.size(); }
+
+   private:
+    T* tables_;
+    const std::vector<TableSlot>& index_;
+  };
+
+  // All tables in tag order, transformed ones included.
+  TableRange<Table> Tables() {
+    return TableRange<Table>(tables_.data(), index_);
+  }
+  TableRange<const Table> Tables() const {
+    return TableRange<const Table>(tables_.data(), index_);
+  }
+
+  // Tags of the tables as they are laid out in the font: alphabetically,
+  // except that loca follows glyf, without the transformed tables. Kept up
+  // to date as tables are added and removed.
+  const std::vector<uint32_t>& OutputOrderedTags() const {
+    return output_order_;
+  }
 
   Table* FindTable(uint32_t tag);
   const Table* FindTable(uint32_t tag) const;
+
+  // Replaces all tables with the given ones, which may come in any order.
+  // Returns false if two of them have the same tag.
+  bool SetTables(std::vector<Table>* tables);
+
+  // Returns the table with the given tag, adding an empty one if there is
+  // none yet.
+  Table* AddTable(uint32_t tag);
+
+  void RemoveTable(uint32_t tag);
+
+ private:
+  void UpdateOutputOrder();
+
+  // Tables stay where they were added, so pointers to them, such as
+  // reuse_of, keep pointing at the same table. SetTables leaves room for the
+  // transformed tables; only outgrowing that moves them.
+  std::vector<Table> tables_;
+  std::vector<TableSlot> index_;
+  std::vector<uint32_t> output_order_;
 };
 
 // Accomodates both singular (OTF, TTF) and collection (TTC) fonts
@@ -63,7 +63,26 @@ bool ReadCompositeGlyphData(Buffer* buffer, Glyph* glyph) {
   return true;
 }
 
+void Glyph::Clear() {
+  x_min = x_max = y_min = y_max = 0;
+  instructions_size = 0;
+  instructions_data = NULL;
+  overlap_simple_flag_set = false;
+  x.clear();
+  y.clear();
+  on_curve.clear();
+  contour_ends.clear();
+  composite_data = NULL;
+  composite_data_size = 0;
+  have_instructions = false;
+}
+
 bool ReadGlyph(const uint8_t* data, size_t len, Glyph* glyph) {
+  glyph->Clear();
+  if (len == 0) {
+    return true;
+  }
+
   Buffer buffer(data, len);
 
   int16_t num_contours;
@@ -86,17 +105,20 @@ bool ReadGlyph(const uint8_t* data, size_t len, Glyph* glyph) {
 
   if (num_contours > 0) {
     // Simple glyph.
-    glyph->contours.resize(num_contours);
+    glyph->contour_ends.resize(num_contours);
 
     // Read the number of points per contour.
     uint16_t last_point_index = 0;
+    uint32_t num_points = 0;
     for (int i = 0; i < num_contours; ++i) {
       uint16_t point_index;
       if (!buffer.ReadU16(&point_index)) {
         return FONT_COMPRESSION_FAILURE();
       }
-      uint16_t num_points = point_index - last_point_index + (i == 0 ? 1 : 0);
-      glyph->contours[i].resize(num_points);
+      uint16_t contour_points =
+          point_index - last_point_index + (i == 0 ? 1 : 0);
+      num_points += contour_points;
+      glyph->contour_ends[i] = num_points;
       last_point_index = point_index;
     }
 
@@ -109,88 +131,85 @@ bool ReadGlyph(const uint8_t* data, size_t len, Glyph* glyph) {
       return FONT_COMPRESSION_FAILURE();
     }
 
-    // Read the run-length coded flags.
-    std::vector<std::vector<uint8_t> > flags(num_contours);
+    // Read the run-length coded flags. They're kept in on_curve until the
+    // coordinates are read, then reduced to the on-curve bit.
+    glyph->x.resize(num_points);
+    glyph->y.resize(num_points);
+    glyph->on_curve.resize(num_points);
+    uint8_t* flags = num_points ? &glyph->on_curve[0] : NULL;
     {
       uint8_t flag = 0;
       uint8_t flag_repeat = 0;
-      for (int i = 0; i < num_contours; ++i) {
-        flags[i].resize(glyph->contours[i].size());
-        for (size_t j = 0; j < glyph->contours[i].size(); ++j) {
-          if (flag_repeat == 0) {
-            if (!buffer.ReadU8(&flag)) {
+      for (uint32_t i = 0; i < num_points; ++i) {
+        if (flag_repeat == 0) {
+          if (!buffer.ReadU8(&flag)) {
+            return FONT_COMPRESSION_FAILURE();
+          }
+          if (flag & kFLAG_REPEAT) {
+            if (!buffer.ReadU8(&flag_repeat)) {
               return FONT_COMPRESSION_FAILURE();
             }
-            if (flag & kFLAG_REPEAT) {
-              if (!buffer.ReadU8(&flag_repeat)) {
-                return FONT_COMPRESSION_FAILURE();
-              }
-            }
-          } else {
-            flag_repeat--;
           }
-          flags[i][j] = flag;
-          glyph->contours[i][j].on_curve = flag & kFLAG_ONCURVE;
+        } else {
+          flag_repeat--;
         }
+        flags[i] = flag;
       }
     }
 
-    if (!flags.empty() && !flags[0].empty()) {
-      glyph->overlap_simple_flag_set = (flags[0][0] & kFLAG_OVERLAP_SIMPLE);
+    if (glyph->contour_ends[0] > 0) {
+      glyph->overlap_simple_flag_set = (flags[0] & kFLAG_OVERLAP_SIMPLE);
     }
 
     // Read the x coordinates.
     int prev_x = 0;
-    for (int i = 0; i < num_contours; ++i) {
-      for (size_t j = 0; j < glyph->contours[i].size(); ++j) {
-        uint8_t flag = flags[i][j];
-        if (flag & kFLAG_XSHORT) {
-          // single byte x-delta coord value
-          uint8_t x_delta;
-          if (!buffer.ReadU8(&x_delta)) {
+    for (uint32_t i = 0; i < num_points; ++i) {
+      uint8_t flag = flags[i];
+      if (flag & kFLAG_XSHORT) {
+        // single byte x-delta coord value
+        uint8_t x_delta;
+        if (!buffer.ReadU8(&x_delta)) {
+          return FONT_COMPRESSION_FAILURE();
+        }
+        int sign = (flag & kFLAG_XREPEATSIGN) ? 1 : -1;
+        prev_x += sign * x_delta;
+      } else {
+        // double byte x-delta coord value
+        int16_t x_delta = 0;
+        if (!(flag & kFLAG_XREPEATSIGN)) {
+          if (!buffer.ReadS16(&x_delta)) {
             return FONT_COMPRESSION_FAILURE();
           }
-          int sign = (flag & kFLAG_XREPEATSIGN) ? 1 : -1;
-          glyph->contours[i][j].x = prev_x + sign * x_delta;
-        } else {
-          // double byte x-delta coord value
-          int16_t x_delta = 0;
-          if (!(flag & kFLAG_XREPEATSIGN)) {
-            if (!buffer.ReadS16(&x_delta)) {
-              return FONT_COMPRESSION_FAILURE();
-            }
-          }
-          glyph->contours[i][j].x = prev_x + x_delta;
         }
-        prev_x = glyph->contours[i][j].x;
+        prev_x += x_delta;
       }
+      glyph->x[i] = prev_x;
     }
 
     // Read the y coordinates.
     int prev_y = 0;
-    for (int i = 0; i < num_contours; ++i) {
-      for (size_t j = 0; j < glyph->contours[i].size(); ++j) {
-        uint8_t flag = flags[i][j];
-        if (flag & kFLAG_YSHORT) {
-          // single byte y-delta coord value
-          uint8_t y_delta;
-          if (!buffer.ReadU8(&y_delta)) {
+    for (uint32_t i = 0; i < num_points; ++i) {
+      uint8_t flag = flags[i];
+      if (flag & kFLAG_YSHORT) {
+        // single byte y-delta coord value
+        uint8_t y_delta;
+        if (!buffer.ReadU8(&y_delta)) {
+          return FONT_COMPRESSION_FAILURE();
+        }
+        int sign = (flag & kFLAG_YREPEATSIGN) ? 1 : -1;
+        prev_y += sign * y_delta;
+      } else {
+        // double byte y-delta coord value
+        int16_t y_delta = 0;
+        if (!(flag & kFLAG_YREPEATSIGN)) {
+          if (!buffer.ReadS16(&y_delta)) {
             return FONT_COMPRESSION_FAILURE();
           }
-          int sign = (flag & kFLAG_YREPEATSIGN) ? 1 : -1;
-          glyph->contours[i][j].y = prev_y + sign * y_delta;
-        } else {
-          // double byte y-delta coord value
-          int16_t y_delta = 0;
-          if (!(flag & kFLAG_YREPEATSIGN)) {
-            if (!buffer.ReadS16(&y_delta)) {
-              return FONT_COMPRESSION_FAILURE();
-            }
-          }
-          glyph->contours[i][j].y = prev_y + y_delta;
         }
-        prev_y = glyph->contours[i][j].y;
+        prev_y += y_delta;
       }
+      glyph->y[i] = prev_y;
+      flags[i] = flag & kFLAG_ONCURVE;
     }
   } else if (num_contours == -1) {
     // Composite glyph.
@@ -230,14 +249,13 @@ void StoreInstructions(const Glyph& glyph, size_t* offset, uint8_t* dst) {
 }
 
 bool StoreEndPtsOfContours(const Glyph& glyph, size_t* offset, uint8_t* dst) {
-  int end_point = -1;
-  for (const auto& contour : glyph.contours) {
-    end_point += contour.size();
-    if (contour.size() > std::numeric_limits<uint16_t>::max() ||
-        end_point > std::numeric_limits<uint16_t>::max()) {
+  for (size_t i = 0; i < glyph.num_contours(); ++i) {
+    const uint32_t end = glyph.contour_ends[i];
+    if (end - glyph.contour_start(i) > std::numeric_limits<uint16_t>::max() ||
+        end > std::numeric_limits<uint16_t>::max() + 1U) {
       return FONT_COMPRESSION_FAILURE();
     }
-    Store16(end_point, offset, dst);
+    Store16(static_cast<int>(end) - 1, offset, dst);
   }
   return true;
 }
@@ -252,51 +270,50 @@ bool StorePoints(const Glyph& glyph, size_t* offset,
   size_t y_bytes = 0;
 
   // Store the flags and calculate the total size of the x and y coordinates.
-  for (const auto& contour : glyph.contours) {
-    for (const auto& point : contour) {
-      int flag = point.on_curve ? kFLAG_ONCURVE : 0;
-      if (previous_flag == -1 && glyph.overlap_simple_flag_set) {
-        // First flag needs to have overlap simple bit set.
-        flag = flag | kFLAG_OVERLAP_SIMPLE;
-      }
-      int dx = point.x - last_x;
-      int dy = point.y - last_y;
-      if (dx == 0) {
-        flag |= kFLAG_XREPEATSIGN;
-      } else if (dx > -256 && dx < 256) {
-        flag |= kFLAG_XSHORT | (dx > 0 ? kFLAG_XREPEATSIGN : 0);
-        x_bytes += 1;
-      } else {
-        x_bytes += 2;
-      }
-      if (dy == 0) {
-        flag |= kFLAG_YREPEATSIGN;
-      } else if (dy > -256 && dy < 256) {
-        flag |= kFLAG_YSHORT | (dy > 0 ? kFLAG_YREPEATSIGN : 0);
-        y_bytes += 1;
-      } else {
-        y_bytes += 2;
-      }
-      if (flag == previous_flag && repeat_count != 255) {
-        dst[*offset - 1] |= kFLAG_REPEAT;
-        repeat_count++;
-      } else {
-        if (repeat_count != 0) {
-          if (*offset >= dst_size) {
-            return FONT_COMPRESSION_FAILURE();
-          }
-          dst[(*offset)++] = repeat_count;
-        }
+  const size_t num_points = glyph.num_points();
+  for (size_t i = 0; i < num_points; ++i) {
+    int flag = glyph.on_curve[i] ? kFLAG_ONCURVE : 0;
+    if (previous_flag == -1 && glyph.overlap_simple_flag_set) {
+      // First flag needs to have overlap simple bit set.
+      flag = flag | kFLAG_OVERLAP_SIMPLE;
+    }
+    int dx = glyph.x[i] - last_x;
+    int dy = glyph.y[i] - last_y;
+    if (dx == 0) {
+      flag |= kFLAG_XREPEATSIGN;
+    } else if (dx > -256 && dx < 256) {
+      flag |= kFLAG_XSHORT | (dx > 0 ? kFLAG_XREPEATSIGN : 0);
+      x_bytes += 1;
+    } else {
+      x_bytes += 2;
+    }
+    if (dy == 0) {
+      flag |= kFLAG_YREPEATSIGN;
+    } else if (dy > -256 && dy < 256) {
+      flag |= kFLAG_YSHORT | (dy > 0 ? kFLAG_YREPEATSIGN : 0);
+      y_bytes += 1;
+    } else {
+      y_bytes += 2;
+    }
+    if (flag == previous_flag && repeat_count != 255) {
+      dst[*offset - 1] |= kFLAG_REPEAT;
+      repeat_count++;
+    } else {
+      if (repeat_count != 0) {
         if (*offset >= dst_size) {
           return FONT_COMPRESSION_FAILURE();
         }
-        dst[(*offset)++] = flag;
-        repeat_count = 0;
+        dst[(*offset)++] = repeat_count;
       }
-      last_x = point.x;
-      last_y = point.y;
-      previous_flag = flag;
+      if (*offset >= dst_size) {
+        return FONT_COMPRESSION_FAILURE();
+      }
+      dst[(*offset)++] = flag;
+      repeat_count = 0;
     }
+    last_x = glyph.x[i];
+    last_y = glyph.y[i];
+    previous_flag = flag;
   }
   if (repeat_count != 0) {
     if (*offset >= dst_size) {
@@ -314,27 +331,25 @@ bool StorePoints(const Glyph& glyph, size_t* offset,
   size_t y_offset = *offset + x_bytes;
   last_x = 0;
   last_y = 0;
-  for (const auto& contour : glyph.contours) {
-    for (const auto& point : contour) {
-      int dx = point.x - last_x;
-      int dy = point.y - last_y;
-      if (dx == 0) {
-        // pass
-      } else if (dx > -256 && dx < 256) {
-        dst[x_offset++] = std::abs(dx);
-      } else {
-        Store16(dx, &x_offset, dst);
-      }
-      if (dy == 0) {
-        // pass
-      } else if (dy > -256 && dy < 256) {
-        dst[y_offset++] = std::abs(dy);
-      } else {
-        Store16(dy, &y_offset, dst);
-      }
-      last_x += dx;
-      last_y += dy;
+  for (size_t i = 0; i < num_points; ++i) {
+    int dx = glyph.x[i] - last_x;
+    int dy = glyph.y[i] - last_y;
+    if (dx == 0) {
+      // pass
+    } else if (dx > -256 && dx < 256) {
+      dst[x_offset++] = std::abs(dx);
+    } else {
+      Store16(dx, &x_offset, dst);
+    }
+    if (dy == 0) {
+      // pass
+    } else if (dy > -256 && dy < 256) {
+      dst[y_offset++] = std::abs(dy);
+    } else {
+      Store16(dy, &y_offset, dst);
     }
+    last_x += dx;
+    last_y += dy;
   }
   *offset = y_offset;
   return true;
@@ -357,16 +372,16 @@ bool StoreGlyph(const Glyph& glyph, uint8_t* dst, size_t* dst_size) {
     if (glyph.have_instructions) {
       StoreInstructions(glyph, &offset, dst);
     }
-  } else if (glyph.contours.size() > 0) {
+  } else if (glyph.num_contours() > 0) {
     // Simple glyph.
-    if (glyph.contours.size() > std::numeric_limits<int16_t>::max()) {
+    if (glyph.num_contours() > std::numeric_limits<int16_t>::max()) {
       return FONT_COMPRESSION_FAILURE();
     }
-    if (*dst_size < ((12ULL + 2 * glyph.contours.size()) +
+    if (*dst_size < ((12ULL + 2 * glyph.num_contours()) +
                      glyph.instructions_size)) {
       return FONT_COMPRESSION_FAILURE();
     }
-    Store16(glyph.contours.size(), &offset, dst);
+    Store16(glyph.num_contours(), &offset, dst);
     StoreBbox(glyph, &offset, dst);
     if (!StoreEndPtsOfContours(glyph, &offset, dst)) {
       return FONT_COMPRESSION_FAILURE();
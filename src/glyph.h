@@ -21,13 +21,33 @@ namespace woff2 {
 // Represents a parsed simple or composite glyph. The composite glyph data and
 // instructions are un-parsed and we keep only pointers to the raw data,
 // therefore the glyph is valid only so long the data from which it was parsed
-// is around.
+// is around. A Glyph can be read into again and again; its point arrays keep
+// their capacity, so going over a whole font allocates only for the largest
+// glyphs.
 class Glyph {
  public:
   Glyph()
-      : instructions_size(0),
+      : x_min(0),
+        x_max(0),
+        y_min(0),
+        y_max(0),
+        instructions_size(0),
+        instructions_data(NULL),
         overlap_simple_flag_set(false),
-        composite_data_size(0) {}
+        composite_data(NULL),
+        composite_data_size(0),
+        have_instructions(false) {}
+
+  // Makes this an empty glyph, keeping the capacity of the point arrays.
+  void Clear();
+
+  size_t num_contours() const { return contour_ends.size(); }
+  size_t num_points() const { return x.size(); }
+
+  // Index of the first point of contour i.
+  size_t contour_start(size_t i) const {
+    return i == 0 ? 0 : contour_ends[i - 1];
+  }
 
   // Bounding box.
   int16_t x_min;
@@ -42,13 +62,12 @@ class Glyph {
   // Flags.
   bool overlap_simple_flag_set;
 
-  // Data model for simple glyphs.
-  struct Point {
-    int x;
-    int y;
-    bool on_curve;
-  };
-  std::vector<std::vector<Point> > contours;
+  // Data model for simple glyphs: the points of all contours in order, and
+  // for each contour the index one past its last point.
+  std::vector<int> x;
+  std::vector<int> y;
+  std::vector<uint8_t> on_curve;  // 1 for on-curve points, 0 otherwise
+  std::vector<uint32_t> contour_ends;
 
   // Data for composite glyphs.
   const uint8_t* composite_data;
@@ -56,7 +75,8 @@ class Glyph {
   bool have_instructions;
 };
 
-// Parses the glyph from the given data. Returns false on parsing failure or
+// Parses the glyph from the given data, replacing whatever glyph was there.
+// Empty data gives an empty glyph. Returns false on parsing failure or
 // buffer overflow. The glyph is valid only so long the input data pointer is
 // valid.
 bool ReadGlyph(const uint8_t* data, size_t len, Glyph* glyph);
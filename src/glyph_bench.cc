@@ -0,0 +1,569 @@
+/* Copyright 2026 Google Inc. All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+*/
+
+/* Microbenchmark comparing the decoder's simple glyph steps, TripletDecode
+   and StorePoints, with the straightforward versions they replaced. Also
+   checks that both agree on random input, including input they must
+   reject. */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "./glyph_decode.h"
+#include "./store_bytes.h"
+
+namespace {
+
+// The triplet decoder before the table of flag encodings: a chain of range
+// checks per flag, and an overflow check per coordinate.
+
+int WithSign(int flag, int baseval) {
+  // Precondition: 0 <= baseval < 65536 (to avoid integer overflow)
+  return (flag & 1) ? baseval : -baseval;
+}
+
+bool SafeIntAddition(int a, int b, int* result) {
+  if (((a > 0) && (b > std::numeric_limits<int>::max() - a)) ||
+      ((a < 0) && (b < std::numeric_limits<int>::min() - a))) {
+    return false;
+  }
+  *result = a + b;
+  return true;
+}
+
+bool ReferenceTripletDecode(const uint8_t* flags_in, const uint8_t* in,
+    size_t in_size, unsigned int n_points, woff2::Point* result,
+    size_t* in_bytes_consumed) {
+  int x = 0;
+  int y = 0;
+
+  if (n_points > in_size) {
+    return false;
+  }
+  unsigned int triplet_index = 0;
+
+  for (unsigned int i = 0; i < n_points; ++i) {
+    uint8_t flag = flags_in[i];
+    bool on_curve = !(flag >> 7);
+    flag &= 0x7f;
+    unsigned int n_data_bytes;
+    if (flag < 84) {
+      n_data_bytes = 1;
+    } else if (flag < 120) {
+      n_data_bytes = 2;
+    } else if (flag < 124) {
+      n_data_bytes = 3;
+    } else {
+      n_data_bytes = 4;
+    }
+    if (triplet_index + n_data_bytes > in_size ||
+        triplet_index + n_data_bytes < triplet_index) {
+      return false;
+    }
+    int dx, dy;
+    if (flag < 10) {
+      dx = 0;
+      dy = WithSign(flag, ((flag & 14) << 7) + in[triplet_index]);
+    } else if (flag < 20) {
+      dx = WithSign(flag, (((flag - 10) & 14) << 7) + in[triplet_index]);
+      dy = 0;
+    } else if (flag < 84) {
+      int b0 = flag - 20;
+      int b1 = in[triplet_index];
+      dx = WithSign(flag, 1 + (b0 & 0x30) + (b1 >> 4));
+      dy = WithSign(flag >> 1, 1 + ((b0 & 0x0c) << 2) + (b1 & 0x0f));
+    } else if (flag < 120) {
+      int b0 = flag - 84;
+      dx = WithSign(flag, 1 + ((b0 / 12) << 8) + in[triplet_index]);
+      dy = WithSign(flag >> 1,
+                    1 + (((b0 % 12) >> 2) << 8) + in[triplet_index + 1]);
+    } else if (flag < 124) {
+      int b2 = in[triplet_index + 1];
+      dx = WithSign(flag, (in[triplet_index] << 4) + (b2 >> 4));
+      dy = WithSign(flag >> 1, ((b2 & 0x0f) << 8) + in[triplet_index + 2]);
+    } else {
+      dx = WithSign(flag, (in[triplet_index] << 8) + in[triplet_index + 1]);
+      dy = WithSign(flag >> 1,
+          (in[triplet_index + 2] << 8) + in[triplet_index + 3]);
+    }
+    triplet_index += n_data_bytes;
+    if (!SafeIntAddition(x, dx, &x)) {
+      return false;
+    }
+    if (!SafeIntAddition(y, dy, &y)) {
+      return false;
+    }
+    *result++ = {x, y, on_curve};
+  }
+  *in_bytes_consumed = triplet_index;
+  return true;
+}
+
+typedef bool (*TripletDecodeFunc)(const uint8_t* flags_in, const uint8_t* in,
+    size_t in_size, unsigned int n_points, woff2::Point* result,
+    size_t* in_bytes_consumed);
+
+void RandomBytes(std::vector<uint8_t>* bytes) {
+  for (size_t i = 0; i < bytes->size(); ++i) {
+    (*bytes)[i] = rand();
+  }
+}
+
+bool SamePoints(const woff2::Point* a, const woff2::Point* b, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    if (a[i].x != b[i].x || a[i].y != b[i].y ||
+        a[i].on_curve != b[i].on_curve) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Decodes the same stream with both; returns false if they disagree.
+bool TripletsAgree(const std::vector<uint8_t>& flags,
+                   const std::vector<uint8_t>& data, size_t in_size,
+                   unsigned int n_points) {
+  std::vector<woff2::Point> expected(n_points), actual(n_points);
+  size_t expected_consumed = 0, actual_consumed = 0;
+  const bool expected_ok = ReferenceTripletDecode(
+      flags.data(), data.data(), in_size, n_points, expected.data(),
+      &expected_consumed);
+  const bool actual_ok = woff2::TripletDecode(
+      flags.data(), data.data(), in_size, n_points, actual.data(),
+      &actual_consumed);
+  if (expected_ok != actual_ok) {
+    return false;
+  }
+  return !expected_ok || (expected_consumed == actual_consumed &&
+                          SamePoints(expected.data(), actual.data(),
+                                     n_points));
+}
+
+// Random flags and data of every length up to 300 points, whole and cut
+// short, then glyphs past the point count where the decoder starts checking
+// for overflow, with small deltas and with the largest ones.
+bool CheckTriplets() {
+  std::vector<uint8_t> flags, data;
+  for (unsigned int n_points = 0; n_points < 300; ++n_points) {
+    for (int round = 0; round < 20; ++round) {
+      flags.resize(n_points);
+      data.resize(4 * n_points);
+      RandomBytes(&flags);
+      RandomBytes(&data);
+      const size_t in_size = round == 0 ? data.size() :
+          static_cast<size_t>(rand()) % (data.size() + 1);
+      if (!TripletsAgree(flags, data, in_size, n_points)) {
+        fprintf(stderr, "Triplet mismatch at %u points, %zu bytes\n",
+                n_points, in_size);
+        return false;
+      }
+    }
+  }
+  const unsigned int large[] = {32767, 32768, 40000, 70000};
+  for (unsigned int n_points : large) {
+    flags.resize(n_points);
+    data.resize(4 * n_points);
+    // Flags of 4 data bytes with positive deltas, which overflow beyond
+    // 32768 points of 0xffff, then random ones.
+    for (int round = 0; round < 3; ++round) {
+      for (size_t i = 0; i < flags.size(); ++i) {
+        flags[i] = round == 2 ? rand() : 127 | (rand() & 0x80);
+      }
+      if (round == 0) {
+        std::fill(data.begin(), data.end(), 0xff);
+      } else {
+        RandomBytes(&data);
+      }
+      if (!TripletsAgree(flags, data, data.size(), n_points)) {
+        fprintf(stderr, "Triplet mismatch at %u points\n", n_points);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Returns ns per point for decoding glyphs of n_points random triplets,
+// repeated until roughly 32M points have been decoded.
+double TripletTime(TripletDecodeFunc decode, const std::vector<uint8_t>& flags,
+                   const std::vector<uint8_t>& data, unsigned int n_points,
+                   size_t* result) {
+  const size_t glyphs = flags.size() / n_points;
+  const size_t iterations = std::max<size_t>(1, (32 << 20) / flags.size());
+  std::vector<woff2::Point> points(n_points);
+  size_t acc = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    size_t offset = 0;
+    for (size_t g = 0; g < glyphs; ++g) {
+      size_t consumed;
+      decode(&flags[g * n_points], &data[offset], data.size() - offset,
+             n_points, points.data(), &consumed);
+      offset += consumed;
+      acc += points[n_points - 1].x;
+    }
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  *result = acc;
+  return elapsed.count() / (iterations * glyphs * n_points);
+}
+
+bool BenchTriplets() {
+  // Flags as random as the data; about two thirds take one data byte, as
+  // in typical fonts.
+  std::vector<uint8_t> flags(1 << 16), data(4 << 16);
+  RandomBytes(&flags);
+  RandomBytes(&data);
+  const unsigned int sizes[] = {8, 32, 128, 1024};
+  printf("%10s %16s %16s %8s\n", "points", "reference ns/pt", "table ns/pt",
+         "speedup");
+  for (unsigned int n_points : sizes) {
+    size_t reference_result, fast_result;
+    const double reference = TripletTime(ReferenceTripletDecode, flags, data,
+                                         n_points, &reference_result);
+    const double fast = TripletTime(woff2::TripletDecode, flags, data,
+                                    n_points, &fast_result);
+    if (reference_result != fast_result) {
+      fprintf(stderr, "Triplet mismatch at %u points\n", n_points);
+      return false;
+    }
+    printf("%10u %16.2f %16.2f %7.2fx\n", n_points, reference, fast,
+           reference / fast);
+  }
+  return true;
+}
+
+// The point writer before the single size check: flags written with a
+// bounds check per byte, then a second pass for the x and y arrays and a
+// third in ComputeBbox.
+
+const int kGlyfOnCurve = 1 << 0;
+const int kGlyfXShort = 1 << 1;
+const int kGlyfYShort = 1 << 2;
+const int kGlyfRepeat = 1 << 3;
+const int kGlyfThisXIsSame = 1 << 4;
+const int kGlyfThisYIsSame = 1 << 5;
+const int kOverlapSimple = 1 << 6;
+
+const size_t kEndPtsOfContoursOffset = 10;
+
+bool ReferenceStorePointData(unsigned int n_points,
+                             const woff2::Point* points,
+                             unsigned int n_contours,
+                             unsigned int instruction_length,
+                             bool has_overlap_bit, uint8_t* dst,
+                             size_t dst_size, size_t* glyph_size) {
+  unsigned int flag_offset = kEndPtsOfContoursOffset + 2 * n_contours + 2 +
+    instruction_length;
+  int last_flag = -1;
+  int repeat_count = 0;
+  int last_x = 0;
+  int last_y = 0;
+  unsigned int x_bytes = 0;
+  unsigned int y_bytes = 0;
+
+  for (unsigned int i = 0; i < n_points; ++i) {
+    const woff2::Point& point = points[i];
+    int flag = point.on_curve ? kGlyfOnCurve : 0;
+    if (has_overlap_bit && i == 0) {
+      flag |= kOverlapSimple;
+    }
+
+    int dx = point.x - last_x;
+    int dy = point.y - last_y;
+    if (dx == 0) {
+      flag |= kGlyfThisXIsSame;
+    } else if (dx > -256 && dx < 256) {
+      flag |= kGlyfXShort | (dx > 0 ? kGlyfThisXIsSame : 0);
+      x_bytes += 1;
+    } else {
+      x_bytes += 2;
+    }
+    if (dy == 0) {
+      flag |= kGlyfThisYIsSame;
+    } else if (dy > -256 && dy < 256) {
+      flag |= kGlyfYShort | (dy > 0 ? kGlyfThisYIsSame : 0);
+      y_bytes += 1;
+    } else {
+      y_bytes += 2;
+    }
+
+    if (flag == last_flag && repeat_count != 255) {
+      dst[flag_offset - 1] |= kGlyfRepeat;
+      repeat_count++;
+    } else {
+      if (repeat_count != 0) {
+        if (flag_offset >= dst_size) {
+          return false;
+        }
+        dst[flag_offset++] = repeat_count;
+      }
+      if (flag_offset >= dst_size) {
+        return false;
+      }
+      dst[flag_offset++] = flag;
+      repeat_count = 0;
+    }
+    last_x = point.x;
+    last_y = point.y;
+    last_flag = flag;
+  }
+
+  if (repeat_count != 0) {
+    if (flag_offset >= dst_size) {
+      return false;
+    }
+    dst[flag_offset++] = repeat_count;
+  }
+  unsigned int xy_bytes = x_bytes + y_bytes;
+  if (xy_bytes < x_bytes ||
+      flag_offset + xy_bytes < flag_offset ||
+      flag_offset + xy_bytes > dst_size) {
+    return false;
+  }
+
+  int x_offset = flag_offset;
+  int y_offset = flag_offset + x_bytes;
+  last_x = 0;
+  last_y = 0;
+  for (unsigned int i = 0; i < n_points; ++i) {
+    int dx = points[i].x - last_x;
+    if (dx == 0) {
+      // pass
+    } else if (dx > -256 && dx < 256) {
+      dst[x_offset++] = std::abs(dx);
+    } else {
+      x_offset = woff2::Store16(dst, x_offset, dx);
+    }
+    last_x += dx;
+    int dy = points[i].y - last_y;
+    if (dy == 0) {
+      // pass
+    } else if (dy > -256 && dy < 256) {
+      dst[y_offset++] = std::abs(dy);
+    } else {
+      y_offset = woff2::Store16(dst, y_offset, dy);
+    }
+    last_y += dy;
+  }
+  *glyph_size = y_offset;
+  return true;
+}
+
+void ReferenceComputeBbox(unsigned int n_points, const woff2::Point* points,
+                          uint8_t* dst) {
+  int x_min = 0;
+  int y_min = 0;
+  int x_max = 0;
+  int y_max = 0;
+
+  if (n_points > 0) {
+    x_min = points[0].x;
+    x_max = points[0].x;
+    y_min = points[0].y;
+    y_max = points[0].y;
+  }
+  for (unsigned int i = 1; i < n_points; ++i) {
+    int x = points[i].x;
+    int y = points[i].y;
+    x_min = std::min(x, x_min);
+    x_max = std::max(x, x_max);
+    y_min = std::min(y, y_min);
+    y_max = std::max(y, y_max);
+  }
+  size_t offset = 2;
+  offset = woff2::Store16(dst, offset, x_min);
+  offset = woff2::Store16(dst, offset, y_min);
+  offset = woff2::Store16(dst, offset, x_max);
+  offset = woff2::Store16(dst, offset, y_max);
+}
+
+// The two passes as the decoder called them, in StorePoints' signature.
+bool ReferenceStorePoints(unsigned int n_points, const woff2::Point* points,
+                          unsigned int n_contours,
+                          unsigned int instruction_length,
+                          bool has_overlap_bit, bool compute_bbox,
+                          uint8_t* /* coords */, uint8_t* dst,
+                          size_t dst_size, size_t* glyph_size) {
+  if (!ReferenceStorePointData(n_points, points, n_contours,
+                               instruction_length, has_overlap_bit, dst,
+                               dst_size, glyph_size)) {
+    return false;
+  }
+  if (compute_bbox) {
+    ReferenceComputeBbox(n_points, points, dst);
+  }
+  return true;
+}
+
+typedef bool (*StorePointsFunc)(unsigned int n_points,
+    const woff2::Point* points, unsigned int n_contours,
+    unsigned int instruction_length, bool has_overlap_bit, bool compute_bbox,
+    uint8_t* coords, uint8_t* dst, size_t dst_size, size_t* glyph_size);
+
+// Points decoded from random triplets, as the decoder sees them.
+std::vector<woff2::Point> RandomPoints(unsigned int n_points) {
+  std::vector<uint8_t> flags(n_points), data(4 * n_points);
+  RandomBytes(&flags);
+  RandomBytes(&data);
+  std::vector<woff2::Point> points(n_points);
+  size_t consumed;
+  woff2::TripletDecode(flags.data(), data.data(), data.size(), n_points,
+                       points.data(), &consumed);
+  return points;
+}
+
+// Stores the points with both into buffers of dst_size bytes holding the
+// same header; returns false if they disagree. Sets *glyph_size to the size
+// the reference wrote, or 0 if it failed.
+bool StorePointsAgree(const std::vector<woff2::Point>& points,
+                      unsigned int n_contours,
+                      unsigned int instruction_length, bool has_overlap_bit,
+                      bool compute_bbox, size_t dst_size,
+                      size_t* glyph_size) {
+  const unsigned int n_points = points.size();
+  std::vector<uint8_t> header(dst_size);
+  RandomBytes(&header);
+  std::vector<uint8_t> expected = header, actual = header;
+  std::vector<uint8_t> coords(4 * n_points);
+  size_t expected_size = 0, actual_size = 0;
+  const bool expected_ok = ReferenceStorePoints(
+      n_points, points.data(), n_contours, instruction_length,
+      has_overlap_bit, compute_bbox, NULL, expected.data(), dst_size,
+      &expected_size);
+  const bool actual_ok = woff2::StorePoints(
+      n_points, points.data(), n_contours, instruction_length,
+      has_overlap_bit, compute_bbox, coords.data(), actual.data(), dst_size,
+      &actual_size);
+  *glyph_size = expected_ok ? expected_size : 0;
+  if (expected_ok != actual_ok) {
+    return false;
+  }
+  return !expected_ok ||
+      (expected_size == actual_size &&
+       std::memcmp(expected.data(), actual.data(), expected_size) == 0);
+}
+
+// Glyphs of every point count up to 300 from random triplets, runs of
+// identical points longer than a repeat count holds, and deltas too large
+// for a short coordinate, each into a buffer of the decoder's size, of the
+// exact size, one byte short and much too short.
+bool CheckStorePoints() {
+  for (unsigned int n_points = 0; n_points < 600; ++n_points) {
+    for (int kind = 0; kind < 3; ++kind) {
+      if (kind < 2 && n_points >= 300) {
+        continue;
+      }
+      std::vector<woff2::Point> points;
+      if (kind == 0) {
+        points = RandomPoints(n_points);
+      } else {
+        points.resize(n_points);
+        for (woff2::Point& point : points) {
+          point.on_curve = (rand() & 7) != 0;
+          point.x = kind == 1 ? rand() % 80000 - 40000 : 7;
+          point.y = kind == 1 ? rand() % 80000 - 40000 : -3;
+        }
+      }
+      const unsigned int n_contours = 1 + rand() % 4;
+      const unsigned int instruction_length = rand() % 20;
+      const bool has_overlap_bit = rand() & 1;
+      const bool compute_bbox = rand() & 1;
+      const size_t decoder_size =
+          12 + 2 * n_contours + 5 * n_points + instruction_length;
+      size_t glyph_size;
+      if (!StorePointsAgree(points, n_contours, instruction_length,
+                            has_overlap_bit, compute_bbox, decoder_size,
+                            &glyph_size) ||
+          glyph_size == 0) {
+        fprintf(stderr, "StorePoints mismatch at %u points\n", n_points);
+        return false;
+      }
+      const size_t short_sizes[] = {
+          glyph_size, glyph_size - 1,
+          static_cast<size_t>(rand()) % glyph_size};
+      for (size_t dst_size : short_sizes) {
+        size_t unused;
+        if (!StorePointsAgree(points, n_contours, instruction_length,
+                              has_overlap_bit, compute_bbox, dst_size,
+                              &unused)) {
+          fprintf(stderr, "StorePoints mismatch at %u points, %zu bytes\n",
+                  n_points, dst_size);
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// Returns ns per point for storing glyphs of n_points points with their
+// bbox, repeated until roughly 32M points have been stored.
+double StorePointsTime(StorePointsFunc store,
+                       const std::vector<woff2::Point>& points,
+                       unsigned int n_points, size_t* result) {
+  const size_t glyphs = points.size() / n_points;
+  const size_t iterations = std::max<size_t>(1, (32 << 20) / points.size());
+  const size_t dst_size = 14 + 5 * n_points;
+  std::vector<uint8_t> dst(dst_size), coords(4 * n_points);
+  size_t acc = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    for (size_t g = 0; g < glyphs; ++g) {
+      size_t glyph_size;
+      store(n_points, &points[g * n_points], 1, 0, false, true,
+            coords.data(), dst.data(), dst_size, &glyph_size);
+      acc += glyph_size + dst[2];
+    }
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  *result = acc;
+  return elapsed.count() / (iterations * glyphs * n_points);
+}
+
+bool BenchStorePoints() {
+  const unsigned int sizes[] = {8, 32, 128, 1024};
+  printf("%10s %16s %16s %8s\n", "points", "reference ns/pt",
+         "one pass ns/pt", "speedup");
+  for (unsigned int n_points : sizes) {
+    // Each glyph starts from the origin, as in a font.
+    std::vector<woff2::Point> points;
+    for (size_t g = 0; g < (1 << 16) / n_points; ++g) {
+      std::vector<woff2::Point> glyph = RandomPoints(n_points);
+      points.insert(points.end(), glyph.begin(), glyph.end());
+    }
+    size_t reference_result, fast_result;
+    const double reference = StorePointsTime(ReferenceStorePoints, points,
+                                             n_points, &reference_result);
+    const double fast = StorePointsTime(woff2::StorePoints, points, n_points,
+                                        &fast_result);
+    if (reference_result != fast_result) {
+      fprintf(stderr, "StorePoints mismatch at %u points\n", n_points);
+      return false;
+    }
+    printf("%10u %16.2f %16.2f %7.2fx\n", n_points, reference, fast,
+           reference / fast);
+  }
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  srand(1);
+  if (!CheckTriplets() || !CheckStorePoints() || !BenchTriplets() ||
+      !BenchStorePoints()) {
+    return 1;
+  }
+  return 0;
+}
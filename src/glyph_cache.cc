@@ -0,0 +1,159 @@
+/* Copyright 2026 Google Inc. All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+*/
+
+/* Glyphs the encoder already normalized and transformed. */
+
+#include "./glyph_cache.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "./hash.h"
+#include "./port.h"
+#include <woff2/encode.h>
+
+namespace woff2 {
+
+namespace {
+
+// Rough bookkeeping cost of an entry on top of its buffers.
+const size_t kEntryOverhead = 160;
+
+size_t EntryBytes(const CachedGlyph& cached) {
+  return cached.input.size() + cached.stored.size() +
+      cached.encoded.bytes.size() + kEntryOverhead;
+}
+
+}  // namespace
+
+GlyphCache::GlyphCache(size_t max_bytes)
+    : max_bytes_(max_bytes), bytes_(0), generation_(0) {
+  seed_ = static_cast<uint64_t>(
+      std::chrono::steady_clock::now().time_since_epoch().count()) ^
+      reinterpret_cast<uintptr_t>(this);
+}
+
+void GlyphCache::BeginConversion() {
+  ++generation_;
+}
+
+uint64_t GlyphCache::Hash(const uint8_t* data, size_t length,
+                          bool transform) const {
+  return HashBytes(data, length, seed_ + transform);
+}
+
+std::shared_ptr<const CachedGlyph> GlyphCache::Find(const uint8_t* data,
+                                                    size_t length,
+                                                    bool transform) {
+  const uint64_t hash = Hash(data, length, transform);
+  Shard& shard = ShardFor(hash);
+  std::shared_ptr<const CachedGlyph> cached;
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.entries.find(hash);
+    if (found != shard.entries.end()) {
+      found->second.last_used = generation_;
+      cached = found->second.cached;
+    }
+  }
+  if (!cached || PREDICT_FALSE(cached->input.size() != length ||
+                               std::memcmp(cached->input.data(), data,
+                                           length) != 0)) {
+    ++shard.misses;
+    return NULL;
+  }
+  ++shard.hits;
+  return cached;
+}
+
+void GlyphCache::Insert(bool transform,
+                        const std::shared_ptr<const CachedGlyph>& cached) {
+  const uint64_t hash = Hash(
+      reinterpret_cast<const uint8_t*>(cached->input.data()),
+      cached->input.size(), transform);
+  Shard& shard = ShardFor(hash);
+  Entry entry;
+  entry.last_used = generation_;
+  entry.bytes = EntryBytes(*cached);
+  entry.cached = cached;
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  // The same glyph may have been added meanwhile, or a different one with
+  // the same hash; the latest wins either way.
+  auto found = shard.entries.find(hash);
+  if (found != shard.entries.end()) {
+    bytes_ -= found->second.bytes;
+    found->second = entry;
+  } else {
+    shard.entries.emplace(hash, entry);
+  }
+  bytes_ += entry.bytes;
+}
+
+template <typename Predicate>
+void GlyphCache::Evict(Predicate drop) {
+  for (size_t i = 0; i < kNumShards && bytes_ > max_bytes_; ++i) {
+    Shard& shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    for (auto it = shard.entries.begin();
+         it != shard.entries.end() && bytes_ > max_bytes_;) {
+      if (drop(it->second)) {
+        bytes_ -= it->second.bytes;
+        it = shard.entries.erase(it);
+        ++shard.evictions;
+      } else {
+        ++it;
+      }
+    }
+  }
+}
+
+void GlyphCache::Trim() {
+  const uint64_t generation = generation_;
+  Evict([generation](const Entry& entry) {
+    return entry.last_used < generation;
+  });
+  Evict([](const Entry&) { return true; });
+}
+
+void GlyphCache::Clear() {
+  for (size_t i = 0; i < kNumShards; ++i) {
+    Shard& shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    for (const auto& entry : shard.entries) {
+      bytes_ -= entry.second.bytes;
+    }
+    shard.entries.clear();
+  }
+}
+
+WOFF2CacheStats GlyphCache::Stats() const {
+  WOFF2CacheStats stats;
+  for (size_t i = 0; i < kNumShards; ++i) {
+    const Shard& shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    stats.hits += shard.hits;
+    stats.misses += shard.misses;
+    stats.evictions += shard.evictions;
+    stats.entries += shard.entries.size();
+  }
+  stats.bytes = bytes_;
+  return stats;
+}
+
+WOFF2EncodeCache::WOFF2EncodeCache(size_t max_bytes)
+    : glyphs_(new GlyphCache(max_bytes)) {}
+
+WOFF2EncodeCache::~WOFF2EncodeCache() {}
+
+void WOFF2EncodeCache::Clear() {
+  glyphs_->Clear();
+}
+
+WOFF2CacheStats WOFF2EncodeCache::Stats() const {
+  return glyphs_->Stats();
+}
+
+} // namespace woff2
@@ -0,0 +1,106 @@
+/* Copyright 2026 Google Inc. All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+*/
+
+/* Glyphs the encoder already normalized and transformed, kept across
+   conversions by a WOFF2EncodeCache. */
+
+#ifndef WOFF2_GLYPH_CACHE_H_
+#define WOFF2_GLYPH_CACHE_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "./transform.h"
+#include <woff2/stats.h>
+
+namespace woff2 {
+
+// What the encoder made of one glyph of a glyf table.
+struct CachedGlyph {
+  CachedGlyph() : stored_size(0), checksum(0) {}
+
+  std::string input;  // the glyph as found in the font, to confirm hits
+  // The normalized glyph, before padding, when glyf isn't transformed;
+  // only its size and checksum otherwise, as the table isn't written then.
+  std::vector<uint8_t> stored;
+  size_t stored_size;
+  uint32_t checksum;
+  // What it adds to the transformed glyf table, when it is transformed.
+  EncodedGlyph encoded;
+};
+
+// Glyphs keyed by a hash of their bytes in the font and whether glyf is
+// transformed. Glyphs are looked up by any number of normalizations at
+// once, through independently locked shards. Entries are only dropped by
+// Trim(), so the cache can outgrow max_bytes by what the conversions in
+// progress add.
+class GlyphCache {
+ public:
+  explicit GlyphCache(size_t max_bytes);
+
+  // Called by each conversion using the cache before its first lookup.
+  void BeginConversion();
+
+  // Returns the glyph stored as data in the font, or NULL.
+  std::shared_ptr<const CachedGlyph> Find(const uint8_t* data, size_t length,
+                                          bool transform);
+  // Adds the glyph made from cached->input.
+  void Insert(bool transform, const std::shared_ptr<const CachedGlyph>& cached);
+
+  // Gets back under max_bytes: drops the glyphs no conversion used since
+  // the last BeginConversion() first, then any.
+  void Trim();
+
+  void Clear();
+  WOFF2CacheStats Stats() const;
+
+ private:
+  GlyphCache(const GlyphCache&) = delete;
+  GlyphCache& operator=(const GlyphCache&) = delete;
+
+  struct Entry {
+    uint64_t last_used;  // generation of the conversion that used it last
+    size_t bytes;
+    std::shared_ptr<const CachedGlyph> cached;
+  };
+
+  struct Shard {
+    Shard() : hits(0), misses(0), evictions(0) {}
+
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, Entry> entries;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> evictions;
+  };
+
+  static const size_t kNumShards = 16;
+
+  uint64_t Hash(const uint8_t* data, size_t length, bool transform) const;
+  Shard& ShardFor(uint64_t hash) {
+    return shards_[(hash >> 32) & (kNumShards - 1)];
+  }
+  // Drops the entries of every shard for which drop() holds, until the cache
+  // fits.
+  template <typename Predicate>
+  void Evict(Predicate drop);
+
+  const size_t max_bytes_;
+  uint64_t seed_;
+  std::atomic<size_t> bytes_;
+  std::atomic<uint64_t> generation_;
+  Shard shards_[kNumShards];
+};
+
+} // namespace woff2
+
+#endif  // WOFF2_GLYPH_CACHE_H_
@@ -0,0 +1,40 @@
+/* Copyright 2026 Google Inc. All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+*/
+
+/* The per-point steps of rebuilding simple glyphs in the decoder, exposed
+   so glyph_bench can check and time them in isolation. */
+
+#ifndef WOFF2_GLYPH_DECODE_H_
+#define WOFF2_GLYPH_DECODE_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "./woff2_common.h"
+
+namespace woff2 {
+
+// Decodes the triplets of n_points points from the flags at flags_in and
+// the data at in, which holds in_size bytes, into absolute coordinates in
+// result. Sets *in_bytes_consumed to the data used. Returns false if the
+// data runs out or a coordinate overflows an int.
+bool TripletDecode(const uint8_t* flags_in, const uint8_t* in, size_t in_size,
+    unsigned int n_points, Point* result, size_t* in_bytes_consumed);
+
+// Writes the flag, x and y arrays of the points of a simple glyph to dst,
+// which holds dst_size bytes and starts with the glyph header, n_contours
+// end points and instruction_length bytes of instructions. coords is scratch
+// space for 4 * n_points bytes. With compute_bbox, also stores the bounding
+// box of the points in the header. Sets *glyph_size to the size of the
+// glyph. Returns false if it doesn't fit.
+bool StorePoints(unsigned int n_points, const Point* points,
+                 unsigned int n_contours, unsigned int instruction_length,
+                 bool has_overlap_bit, bool compute_bbox, uint8_t* coords,
+                 uint8_t* dst, size_t dst_size, size_t* glyph_size);
+
+}  // namespace woff2
+
+#endif  // WOFF2_GLYPH_DECODE_H_
@@ -0,0 +1,77 @@
+/* Copyright 2026 Google Inc. All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+*/
+
+/* Hashing of byte strings for the in-memory caches. */
+
+#ifndef WOFF2_HASH_H_
+#define WOFF2_HASH_H_
+
+#include <cstring>
+#include <inttypes.h>
+#include <stddef.h>
+
+namespace woff2 {
+
+namespace hash_internal {
+
+const uint64_t kPrime1 = 0x9e3779b185ebca87ULL;
+const uint64_t kPrime2 = 0xc2b2ae3d27d4eb4fULL;
+const uint64_t kPrime3 = 0x165667b19e3779f9ULL;
+
+inline uint64_t Rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t Load64(const uint8_t* p) {
+  uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t Round(uint64_t acc, uint64_t v) {
+  return Rotl(acc + v * kPrime2, 31) * kPrime1;
+}
+
+}  // namespace hash_internal
+
+// A fast seeded 64-bit hash, four independent lanes of 8 bytes at a time.
+// It isn't meant to resist collisions on purpose: callers only take a hit
+// once the input compares equal.
+inline uint64_t HashBytes(const uint8_t* data, size_t length, uint64_t seed) {
+  using namespace hash_internal;
+  uint64_t h = seed + kPrime3 + length;
+  size_t i = 0;
+  if (length >= 32) {
+    uint64_t lanes[4] = {seed + kPrime1 + kPrime2, seed + kPrime2, seed,
+                         seed - kPrime1};
+    for (; i + 32 <= length; i += 32) {
+      for (int k = 0; k < 4; ++k) {
+        lanes[k] = Round(lanes[k], Load64(data + i + 8 * k));
+      }
+    }
+    h += Rotl(lanes[0], 1) + Rotl(lanes[1], 7) + Rotl(lanes[2], 12) +
+        Rotl(lanes[3], 18);
+    for (int k = 0; k < 4; ++k) {
+      h = (h ^ Round(0, lanes[k])) * kPrime1 + kPrime3;
+    }
+  }
+  for (; i + 8 <= length; i += 8) {
+    h = Rotl(h ^ Round(0, Load64(data + i)), 27) * kPrime1 + kPrime3;
+  }
+  for (; i < length; ++i) {
+    h = Rotl(h ^ (data[i] * kPrime3), 11) * kPrime1;
+  }
+  h ^= h >> 33;
+  h *= kPrime2;
+  h ^= h >> 29;
+  h *= kPrime3;
+  h ^= h >> 32;
+  return h;
+}
+
+} // namespace woff2
+
+#endif  // WOFF2_HASH_H_
@@ -10,14 +10,20 @@
 
 #include <inttypes.h>
 #include <stddef.h>
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <vector>
 
 #include "./buffer.h"
 #include "./port.h"
 #include "./font.h"
 #include "./glyph.h"
+#include "./glyph_cache.h"
 #include "./round.h"
 #include "./store_bytes.h"
 #include "./table_tags.h"
+#include "./transform.h"
 #include "./woff2_common.h"
 
 namespace woff2 {
@@ -36,49 +42,10 @@ void StoreLoca(int index_fmt, uint32_t value, size_t* offset, uint8_t* dst) {
 
 namespace {
 
-bool WriteNormalizedLoca(int index_fmt, int num_glyphs, Font* font) {
-  Font::Table* glyf_table = font->FindTable(kGlyfTableTag);
-  Font::Table* loca_table = font->FindTable(kLocaTableTag);
-
-  int glyph_sz = index_fmt == 0 ? 2 : 4;
-  loca_table->buffer.resize(Round4(num_glyphs + 1) * glyph_sz);
-  loca_table->length = (num_glyphs + 1) * glyph_sz;
-
-  uint8_t* glyf_dst = num_glyphs ? &glyf_table->buffer[0] : NULL;
-  uint8_t* loca_dst = &loca_table->buffer[0];
-  uint32_t glyf_offset = 0;
-  size_t loca_offset = 0;
-
-  for (int i = 0; i < num_glyphs; ++i) {
-    StoreLoca(index_fmt, glyf_offset, &loca_offset, loca_dst);
-    Glyph glyph;
-    const uint8_t* glyph_data;
-    size_t glyph_size;
-    if (!GetGlyphData(*font, i, &glyph_data, &glyph_size) ||
-        (glyph_size > 0 && !ReadGlyph(glyph_data, glyph_size, &glyph))) {
-      return FONT_COMPRESSION_FAILURE();
-    }
-    size_t glyf_dst_size = glyf_table->buffer.size() - glyf_offset;
-    if (!StoreGlyph(glyph, glyf_dst + glyf_offset, &glyf_dst_size)) {
-      return FONT_COMPRESSION_FAILURE();
-    }
-    glyf_dst_size = Round4(glyf_dst_size);
-    if (glyf_dst_size > std::numeric_limits<uint32_t>::max() ||
-        glyf_offset + static_cast<uint32_t>(glyf_dst_size) < glyf_offset ||
-        (index_fmt == 0 && glyf_offset + glyf_dst_size >= (1UL << 17))) {
-      return FONT_COMPRESSION_FAILURE();
-    }
-    glyf_offset += glyf_dst_size;
-  }
-
-  StoreLoca(index_fmt, glyf_offset, &loca_offset, loca_dst);
-
-  glyf_table->buffer.resize(glyf_offset);
-  glyf_table->data = glyf_offset ? &glyf_table->buffer[0] : NULL;
-  glyf_table->length = glyf_offset;
-  loca_table->data = loca_offset ? &loca_table->buffer[0] : NULL;
-
-  return true;
+// Upper bound on the size StoreGlyph() writes for the glyph.
+size_t MaxStoredGlyphSize(const Glyph& glyph) {
+  return 12 + 2 * glyph.num_contours() + glyph.instructions_size +
+      5 * glyph.num_points() + glyph.composite_data_size;
 }
 
 }  // namespace
@@ -106,7 +73,14 @@ bool MakeEditableBuffer(Font* font, int tableTag) {
 
 }  // namespace
 
-bool NormalizeGlyphs(Font* font) {
+namespace {
+
+// Normalizes the glyphs as NormalizeGlyphs() does. With transform set, the
+// same parse of each glyph also feeds the transformed glyf table, and only
+// the length and checksum of the normalized glyf are kept. With a cache,
+// the glyphs found in it are copied from it rather than parsed, and the
+// others are added to it.
+bool NormalizeGlyphs(Font* font, bool transform, GlyphCache* cache) {
   Font::Table* head_table = font->FindTable(kHeadTableTag);
   Font::Table* glyf_table = font->FindTable(kGlyfTableTag);
   Font::Table* loca_table = font->FindTable(kLocaTableTag);
@@ -128,45 +102,172 @@ bool NormalizeGlyphs(Font* font) {
   if (loca_table->IsReused()) {
     return true;
   }
+  if (transform && head_table->length < 52) {
+    return FONT_COMPRESSION_FAILURE();
+  }
 
   int index_fmt = head_table->data[51];
   int num_glyphs = NumGlyphs(*font);
 
-  // We need to allocate a bit more than its original length for the normalized
-  // glyf table, since it can happen that the glyphs in the original table are
-  // 2-byte aligned, while in the normalized table they are 4-byte aligned.
-  // That gives a maximum of 2 bytes increase per glyph. However, there is no
-  // theoretical guarantee that the total size of the flags plus the coordinates
-  // is the smallest possible in the normalized version, so we have to allow
-  // some general overhead.
-  // TODO(user) Figure out some more precise upper bound on the size of
-  // the overhead.
-  size_t max_normalized_glyf_size = 1.1 * glyf_table->length + 2 * num_glyphs;
-
-  glyf_table->buffer.resize(max_normalized_glyf_size);
+  std::unique_ptr<GlyfTransformer> transformer;
+  std::vector<uint8_t> glyph_buf;
+  size_t max_normalized_glyf_size = 0;
+  if (transform) {
+    transformer.reset(new GlyfTransformer(num_glyphs, glyf_table->length));
+  } else {
+    // We need to allocate a bit more than its original length for the
+    // normalized glyf table, since it can happen that the glyphs in the
+    // original table are 2-byte aligned, while in the normalized table they
+    // are 4-byte aligned. That gives a maximum of 2 bytes increase per glyph.
+    // However, there is no theoretical guarantee that the total size of the
+    // flags plus the coordinates is the smallest possible in the normalized
+    // version, so we have to allow some general overhead.
+    // TODO(user) Figure out some more precise upper bound on the size of
+    // the overhead.
+    max_normalized_glyf_size = 1.1 * glyf_table->length + 2 * num_glyphs;
+    glyf_table->buffer.resize(max_normalized_glyf_size);
+  }
 
-  // if we can't write a loca using short's (index_fmt 0)
-  // try again using longs (index_fmt 1)
-  if (!WriteNormalizedLoca(index_fmt, num_glyphs, font)) {
-    if (index_fmt != 0) {
+  std::vector<uint32_t> glyph_offsets(num_glyphs + 1);
+  uint32_t glyf_offset = 0;
+  uint32_t glyf_checksum = 0;
+  Glyph glyph;
+  for (int i = 0; i < num_glyphs; ++i) {
+    glyph_offsets[i] = glyf_offset;
+    const uint8_t* glyph_data;
+    size_t glyph_size;
+    if (!GetGlyphData(*font, i, &glyph_data, &glyph_size)) {
       return FONT_COMPRESSION_FAILURE();
     }
-
-    // Rewrite loca with 4-byte entries & update head to match
-    index_fmt = 1;
-    if (!WriteNormalizedLoca(index_fmt, num_glyphs, font)) {
+    // Empty glyphs are cheaper to redo than to look up.
+    std::shared_ptr<const CachedGlyph> cached;
+    if (cache != NULL && glyph_size > 0) {
+      cached = cache->Find(glyph_data, glyph_size, transform);
+    }
+    std::shared_ptr<CachedGlyph> added;
+    size_t glyf_dst_size;
+    if (cached) {
+      glyf_dst_size = cached->stored_size;
+      if (transformer) {
+        transformer->AddEncodedGlyph(i, cached->encoded);
+        glyf_checksum += cached->checksum;
+      } else if (glyf_offset > max_normalized_glyf_size ||
+                 max_normalized_glyf_size - glyf_offset < glyf_dst_size) {
+        return FONT_COMPRESSION_FAILURE();
+      } else {
+        std::copy(cached->stored.begin(), cached->stored.end(),
+                  glyf_table->buffer.begin() + glyf_offset);
+      }
+    } else {
+      if (!ReadGlyph(glyph_data, glyph_size, &glyph)) {
+        return FONT_COMPRESSION_FAILURE();
+      }
+      if (cache != NULL && glyph_size > 0) {
+        added = std::make_shared<CachedGlyph>();
+        added->input.assign(reinterpret_cast<const char*>(glyph_data),
+                            glyph_size);
+      }
+      uint8_t* glyf_dst;
+      if (transformer) {
+        if (added) {
+          transformer->AddGlyph(i, glyph, &added->encoded);
+        } else {
+          transformer->AddGlyph(i, glyph);
+        }
+        // Glyphs start 4-aligned, so the checksum of the table is the sum
+        // of those of its glyphs.
+        glyf_dst_size = MaxStoredGlyphSize(glyph);
+        if (glyph_buf.size() < glyf_dst_size) {
+          glyph_buf.resize(glyf_dst_size);
+        }
+        glyf_dst = glyph_buf.data();
+      } else {
+        glyf_dst = &glyf_table->buffer[0] + glyf_offset;
+        glyf_dst_size = glyf_offset < max_normalized_glyf_size
+            ? max_normalized_glyf_size - glyf_offset : 0;
+      }
+      if (!StoreGlyph(glyph, glyf_dst, &glyf_dst_size)) {
+        return FONT_COMPRESSION_FAILURE();
+      }
+      const uint32_t checksum =
+          transformer ? ComputeULongSum(glyf_dst, glyf_dst_size) : 0;
+      glyf_checksum += checksum;
+      if (added) {
+        added->stored_size = glyf_dst_size;
+        added->checksum = checksum;
+        if (!transformer) {
+          added->stored.assign(glyf_dst, glyf_dst + glyf_dst_size);
+        }
+        cache->Insert(transform, added);
+      }
+    }
+    glyf_dst_size = Round4(glyf_dst_size);
+    if (glyf_dst_size > std::numeric_limits<uint32_t>::max() ||
+        glyf_offset + static_cast<uint32_t>(glyf_dst_size) < glyf_offset) {
       return FONT_COMPRESSION_FAILURE();
     }
+    glyf_offset += glyf_dst_size;
+  }
+  glyph_offsets[num_glyphs] = glyf_offset;
+
+  // if we can't write a loca using short's (index_fmt 0)
+  // use longs (index_fmt 1) & update head to match
+  if (index_fmt == 0 && glyf_offset >= (1UL << 17)) {
+    index_fmt = 1;
     head_table->buffer[51] = 1;
   }
 
+  int glyph_sz = index_fmt == 0 ? 2 : 4;
+  loca_table->buffer.resize(Round4(num_glyphs + 1) * glyph_sz);
+  loca_table->length = (num_glyphs + 1) * glyph_sz;
+  size_t loca_offset = 0;
+  for (uint32_t offset : glyph_offsets) {
+    StoreLoca(index_fmt, offset, &loca_offset, &loca_table->buffer[0]);
+  }
+  loca_table->data = &loca_table->buffer[0];
+
+  glyf_table->length = glyf_offset;
+  if (transformer) {
+    glyf_table->data = NULL;
+    glyf_table->checksum = glyf_checksum;
+    glyf_table->data_dropped = true;
+    transformer->Finish(index_fmt, font);
+  } else {
+    glyf_table->buffer.resize(glyf_offset);
+    glyf_table->data = glyf_offset ? &glyf_table->buffer[0] : NULL;
+  }
+
   return true;
 }
 
+}  // namespace
+
+namespace {
+
+bool NormalizeGlyphs(Font* font, const GlyfNormalization& glyf) {
+  const Font::Table* glyf_table = font->FindTable(kGlyfTableTag);
+  const bool transform = glyf.transform && glyf_table != NULL &&
+      glyf_table->length >= glyf.transform_min_size;
+  if (!glyf.normalized) {
+    return NormalizeGlyphs(font, transform, glyf.cache);
+  }
+  return !transform || TransformGlyfAndLocaTables(font);
+}
+
+}  // namespace
+
+bool NormalizeGlyphs(Font* font) {
+  return NormalizeGlyphs(font, false, NULL);
+}
+
+bool NormalizeAndTransformGlyphs(Font* font) {
+  return NormalizeGlyphs(font, true, NULL);
+}
+
 bool NormalizeOffsets(Font* font) {
   uint32_t offset = 12 + 16 * font->num_tables;
   for (auto tag : font->OutputOrderedTags()) {
-    auto& table = font->tables[tag];
+    Font::Table& table = *font->FindTable(tag);
     table.offset = offset;
     offset += Round4(table.length);
   }
@@ -182,8 +283,11 @@ uint32_t ComputeHeaderChecksum(const Font& font) {
   uint16_t range_shift = (font.num_tables << 4) - search_range;
   checksum += (font.num_tables << 16 | search_range);
   checksum += (max_pow2 << 16 | range_shift);
-  for (const auto& i : font.tables) {
-    const Font::Table* table = &i.second;
+  for (const Font::Table& entry : font.Tables()) {
+    const Font::Table* table = &entry;
+    if (table->tag & 0x80808080) {
+      continue;  // transformed, not part of the font
+    }
     if (table->IsReused()) {
       table = table->reuse_of;
     }
@@ -214,12 +318,17 @@ bool FixChecksums(Font* font) {
   StoreU32(0, &offset, head_buf);
   uint32_t file_checksum = 0;
   uint32_t head_checksum = 0;
-  for (auto& i : font->tables) {
-    Font::Table* table = &i.second;
+  for (Font::Table& entry : font->Tables()) {
+    Font::Table* table = &entry;
+    if (table->tag & 0x80808080) {
+      continue;  // transformed, not part of the font
+    }
     if (table->IsReused()) {
       table = table->reuse_of;
     }
-    table->checksum = ComputeULongSum(table->data, table->length);
+    if (!table->data_dropped) {
+      table->checksum = ComputeULongSum(table->data, table->length);
+    }
     file_checksum += table->checksum;
 
     if (table->tag == kHeadTableTag) {
@@ -255,28 +364,100 @@ bool MarkTransformed(Font* font) {
 }  // namespace
 
 
-bool NormalizeWithoutFixingChecksums(Font* font) {
+namespace {
+
+bool NormalizeWithoutFixingChecksums(Font* font,
+                                     const GlyfNormalization& glyf) {
   return (MakeEditableBuffer(font, kHeadTableTag) &&
           RemoveDigitalSignature(font) &&
           MarkTransformed(font) &&
-          NormalizeGlyphs(font) &&
+          NormalizeGlyphs(font, glyf) &&
           NormalizeOffsets(font));
 }
 
+}  // namespace
+
+bool NormalizeWithoutFixingChecksums(Font* font) {
+  return NormalizeWithoutFixingChecksums(font, GlyfNormalization());
+}
+
 bool NormalizeFont(Font* font) {
   return (NormalizeWithoutFixingChecksums(font) &&
           FixChecksums(font));
 }
 
 bool NormalizeFontCollection(FontCollection* font_collection) {
+  return NormalizeFontCollection(font_collection, 1, false);
+}
+
+bool NormalizeFontCollection(FontCollection* font_collection,
+                             int num_threads) {
+  return NormalizeFontCollection(font_collection, num_threads, false);
+}
+
+bool NormalizeFontCollection(FontCollection* font_collection,
+                             int num_threads, bool transform_glyf) {
+  GlyfNormalization glyf;
+  glyf.transform = transform_glyf;
+  return NormalizeFontCollection(font_collection, num_threads, glyf);
+}
+
+bool NormalizeFontCollection(FontCollection* font_collection,
+                             int num_threads, const GlyfNormalization& glyf) {
   if (font_collection->fonts.size() == 1) {
-    return NormalizeFont(&font_collection->fonts[0]);
+    Font* font = &font_collection->fonts[0];
+    return (NormalizeWithoutFixingChecksums(font, glyf) &&
+            FixChecksums(font));
+  }
+
+  for (auto& font : font_collection->fonts) {
+    if (!MakeEditableBuffer(&font, kHeadTableTag) ||
+        !RemoveDigitalSignature(&font) ||
+        !MarkTransformed(&font)) {
+#ifdef FONT_COMPRESSION_BIN
+      fprintf(stderr, "Font normalization failed.\n");
+#endif
+      return FONT_COMPRESSION_FAILURE();
+    }
+  }
+
+  // Glyph normalization only touches the glyf, loca and head tables of the
+  // font, so fonts that share none of them can be done concurrently. The
+  // rest keep their order, as one may depend on the head of another.
+  std::set<const Font::Table*> shared_heads;
+  for (const auto& font : font_collection->fonts) {
+    const Font::Table* head_table = font.FindTable(kHeadTableTag);
+    if (head_table != NULL && head_table->IsReused()) {
+      shared_heads.insert(head_table->reuse_of);
+    }
+  }
+  std::vector<Font*> independent;
+  std::vector<Font*> dependent;
+  for (auto& font : font_collection->fonts) {
+    const Font::Table* head_table = font.FindTable(kHeadTableTag);
+    const Font::Table* glyf_table = font.FindTable(kGlyfTableTag);
+    if (glyf_table != NULL && !glyf_table->IsReused() &&
+        head_table != NULL && !head_table->IsReused() &&
+        shared_heads.count(head_table) == 0) {
+      independent.push_back(&font);
+    } else {
+      dependent.push_back(&font);
+    }
+  }
+  std::vector<char> glyphs_ok(independent.size(), false);
+  ParallelFor(independent.size(), num_threads, [&](size_t i) {
+    glyphs_ok[i] = NormalizeGlyphs(independent[i], glyf);
+  });
+  bool ok = std::find(glyphs_ok.begin(), glyphs_ok.end(), false) ==
+      glyphs_ok.end();
+  for (size_t i = 0; ok && i < dependent.size(); ++i) {
+    ok = NormalizeGlyphs(dependent[i], glyf);
   }
 
   uint32_t offset = CollectionHeaderSize(font_collection->header_version,
     font_collection->fonts.size());
   for (auto& font : font_collection->fonts) {
-    if (!NormalizeWithoutFixingChecksums(&font)) {
+    if (!ok || !NormalizeOffsets(&font)) {
 #ifdef FONT_COMPRESSION_BIN
       fprintf(stderr, "Font normalization failed.\n");
 #endif
@@ -288,7 +469,7 @@ bool NormalizeFontCollection(FontCollection* font_collection) {
   // Start table offsets after TTC Header and Sfnt Headers
   for (auto& font : font_collection->fonts) {
     for (auto tag : font.OutputOrderedTags()) {
-      Font::Table& table = font.tables[tag];
+      Font::Table& table = *font.FindTable(tag);
       if (table.IsReused()) {
         table.offset = table.reuse_of->offset;
       } else {
@@ -11,10 +11,13 @@
 #ifndef WOFF2_NORMALIZE_H_
 #define WOFF2_NORMALIZE_H_
 
+#include <stddef.h>
+
 namespace woff2 {
 
 struct Font;
 struct FontCollection;
+class GlyphCache;
 
 // Changes the offset fields of the table headers so that the data for the
 // tables will be written in order of increasing tag values, without any gaps
@@ -30,9 +33,43 @@ bool FixChecksums(Font* font);
 // the loca table accordigly.
 bool NormalizeGlyphs(Font* font);
 
+// As above, also adding the transformed glyf and loca tables the way
+// TransformGlyfAndLocaTables() does, from the same parse of each glyph. Only
+// the length and checksum of the normalized glyf table are kept, so the font
+// can only be written out with its glyf transformed.
+bool NormalizeAndTransformGlyphs(Font* font);
+
 // Performs all of the normalization steps above.
 bool NormalizeFont(Font* font);
 bool NormalizeFontCollection(FontCollection* font_collection);
+// As above, normalizing the glyphs of fonts that share neither glyf nor
+// head on up to num_threads threads, 0 for one per hardware thread.
+bool NormalizeFontCollection(FontCollection* font_collection,
+                             int num_threads);
+// As above, with NormalizeAndTransformGlyphs() in place of NormalizeGlyphs()
+// when transform_glyf is set.
+bool NormalizeFontCollection(FontCollection* font_collection,
+                             int num_threads, bool transform_glyf);
+
+// How NormalizeFontCollection() handles the glyphs of each font.
+struct GlyfNormalization {
+  GlyfNormalization() : transform(false), normalized(false),
+                        transform_min_size(0), cache(NULL) {}
+
+  // Transform glyf and loca, as with transform_glyf above.
+  bool transform;
+  // The glyphs are normalized already: glyf and loca are kept as they are,
+  // and only parsed to be transformed.
+  bool normalized;
+  // glyf tables smaller than this are not transformed.
+  size_t transform_min_size;
+  // If set, glyphs are taken from it when found and added otherwise; not
+  // used when normalized is set.
+  GlyphCache* cache;
+};
+
+bool NormalizeFontCollection(FontCollection* font_collection,
+                             int num_threads, const GlyfNormalization& glyf);
 
 } // namespace woff2
 
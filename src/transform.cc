@@ -8,11 +8,16 @@
 
 #include "./transform.h"
 
+#include <algorithm>
 #include <complex>  // for std::abs
+#include <cstring>
+#include <memory>
 
 #include "./buffer.h"
 #include "./font.h"
 #include "./glyph.h"
+#include "./port.h"
+#include "./store_bytes.h"
 #include "./table_tags.h"
 #include "./variable_length.h"
 
@@ -24,101 +29,211 @@ const int FLAG_ARG_1_AND_2_ARE_WORDS = 1 << 0;
 const int FLAG_WE_HAVE_INSTRUCTIONS = 1 << 8;
 const int FLAG_OVERLAP_SIMPLE_BITMAP = 1 << 0;
 
-void WriteBytes(std::vector<uint8_t>* out, const uint8_t* data, size_t len) {
-  if (len == 0) return;
-  size_t offset = out->size();
-  out->resize(offset + len);
-  memcpy(&(*out)[offset], data, len);
-}
+// Size of the transformed glyf header: version, flags, numGlyphs,
+// indexFormat and the sizes of the seven substreams.
+const size_t kTransformedGlyfHeaderSize = 36;
+
+// Append-only byte stream written through a raw cursor. Writers make room for
+// a whole glyph with Reserve() and then store without bounds checks.
+class StreamBuilder {
+ public:
+  StreamBuilder() : capacity_(0), size_(0) {}
 
-void WriteBytes(std::vector<uint8_t>* out, const std::vector<uint8_t>& in) {
-  for (size_t i = 0; i < in.size(); ++i) {
-    out->push_back(in[i]);
+  // Makes room for n more bytes.
+  void Reserve(size_t n) {
+    if (PREDICT_FALSE(capacity_ - size_ < n)) {
+      Grow(std::max(size_ + n, 2 * capacity_));
+    }
   }
-}
 
-void WriteUShort(std::vector<uint8_t>* out, int value) {
-  out->push_back(value >> 8);
-  out->push_back(value & 255);
-}
+  void Put8(int value) { data_[size_++] = value; }
+  void Put16(int value) { Store16(value, &size_, data_.get()); }
+  void Put255UShort(int value) { Store255UShort(value, &size_, data_.get()); }
+  void PutBytes(const uint8_t* data, size_t len) {
+    if (len > 0) {
+      StoreBytes(data, len, &size_, data_.get());
+    }
+  }
 
-void WriteLong(std::vector<uint8_t>* out, int value) {
-  out->push_back((value >> 24) & 255);
-  out->push_back((value >> 16) & 255);
-  out->push_back((value >> 8) & 255);
-  out->push_back(value & 255);
-}
+  // Copies the stream to dst + *offset and advances *offset past it.
+  void StoreTo(size_t* offset, uint8_t* dst) const {
+    if (size_ > 0) {
+      StoreBytes(data_.get(), size_, offset, dst);
+    }
+  }
+
+  const uint8_t* data() const { return data_.get(); }
+  size_t size() const { return size_; }
+
+ private:
+  void Grow(size_t capacity) {
+    std::unique_ptr<uint8_t[]> data(new uint8_t[capacity]);
+    if (size_ > 0) {
+      memcpy(data.get(), data_.get(), size_);
+    }
+    data_.swap(data);
+    capacity_ = capacity;
+  }
+
+  std::unique_ptr<uint8_t[]> data_;  // uninitialized past size_
+  size_t capacity_;
+  size_t size_;
+};
+
+}  // namespace
 
 // Glyf table preprocessing, based on
 // GlyfEncoder.java
 class GlyfEncoder {
  public:
-  explicit GlyfEncoder(int num_glyphs)
+  // The substreams are sized up front from the glyph count and from the
+  // length of the glyf table, by their usual share of it, and grow from
+  // there if need be.
+  GlyfEncoder(int num_glyphs, size_t glyf_length)
       : n_glyphs_(num_glyphs) {
     bbox_bitmap_.resize(((num_glyphs + 31) >> 5) << 2);
+    n_contour_stream_.Reserve(2 * num_glyphs);
+    n_points_stream_.Reserve(glyf_length / 32);
+    flag_byte_stream_.Reserve(glyf_length / 4);
+    glyph_stream_.Reserve(glyf_length / 2);
+    composite_stream_.Reserve(glyf_length / 16);
+    bbox_stream_.Reserve(8 * num_glyphs);
+    instruction_stream_.Reserve(glyf_length / 4);
   }
 
   bool Encode(int glyph_id, const Glyph& glyph) {
+    // Room for everything the glyph can add, so the writes below don't
+    // need to check.
+    n_contour_stream_.Reserve(2);
+    n_points_stream_.Reserve(3 * glyph.num_contours());
+    flag_byte_stream_.Reserve(glyph.num_points());
+    glyph_stream_.Reserve(4 * glyph.num_points() + 3);
+    composite_stream_.Reserve(glyph.composite_data_size);
+    bbox_stream_.Reserve(8);
+    instruction_stream_.Reserve(glyph.instructions_size);
+
     if (glyph.composite_data_size > 0) {
       WriteCompositeGlyph(glyph_id, glyph);
-    } else if (glyph.contours.size() > 0) {
+    } else if (glyph.num_contours() > 0) {
       WriteSimpleGlyph(glyph_id, glyph);
     } else {
-      WriteUShort(&n_contour_stream_, 0);
+      n_contour_stream_.Put16(0);
     }
     return true;
   }
 
+  // Encodes the glyph as above and records what it added in *encoded.
+  void Encode(int glyph_id, const Glyph& glyph, EncodedGlyph* encoded) {
+    StreamBuilder* streams[kWOFF2GlyfSubStreams];
+    Streams(streams);
+    size_t started[kWOFF2GlyfSubStreams];
+    for (int i = 0; i < kWOFF2GlyfSubStreams; ++i) {
+      started[i] = streams[i]->size();
+    }
+    Encode(glyph_id, glyph);
+    encoded->bytes.clear();
+    for (int i = 0; i < kWOFF2GlyfSubStreams; ++i) {
+      encoded->stream_sizes[i] = streams[i]->size() - started[i];
+      encoded->bytes.insert(encoded->bytes.end(),
+                            streams[i]->data() + started[i],
+                            streams[i]->data() + streams[i]->size());
+    }
+    const uint8_t bit = 0x80 >> (glyph_id & 7);
+    encoded->has_bbox = (bbox_bitmap_[glyph_id >> 3] & bit) != 0;
+    encoded->overlap_simple = !overlap_bitmap_.empty() &&
+        (overlap_bitmap_[glyph_id >> 3] & bit) != 0;
+  }
+
+  // Adds a glyph recorded by the above.
+  void Add(int glyph_id, const EncodedGlyph& encoded) {
+    StreamBuilder* streams[kWOFF2GlyfSubStreams];
+    Streams(streams);
+    const uint8_t* bytes = encoded.bytes.data();
+    for (int i = 0; i < kWOFF2GlyfSubStreams; ++i) {
+      streams[i]->Reserve(encoded.stream_sizes[i]);
+      streams[i]->PutBytes(bytes, encoded.stream_sizes[i]);
+      bytes += encoded.stream_sizes[i];
+    }
+    const uint8_t bit = 0x80 >> (glyph_id & 7);
+    if (encoded.has_bbox) {
+      bbox_bitmap_[glyph_id >> 3] |= bit;
+    }
+    if (encoded.overlap_simple) {
+      EnsureOverlapBitmap();
+      overlap_bitmap_[glyph_id >> 3] |= bit;
+    }
+  }
+
+  // Replaces *result with the transformed glyf table, gathering the header
+  // and the substreams with one copy each.
   void GetTransformedGlyfBytes(std::vector<uint8_t>* result) {
-    WriteUShort(result, 0);  // Version
-    WriteUShort(result, overlap_bitmap_.empty()
-                            ? 0x00
-                            : FLAG_OVERLAP_SIMPLE_BITMAP);  // Flags
-    WriteUShort(result, n_glyphs_);
-    WriteUShort(result, 0);  // index_format, will be set later
-    WriteLong(result, n_contour_stream_.size());
-    WriteLong(result, n_points_stream_.size());
-    WriteLong(result, flag_byte_stream_.size());
-    WriteLong(result, glyph_stream_.size());
-    WriteLong(result, composite_stream_.size());
-    WriteLong(result, bbox_bitmap_.size() + bbox_stream_.size());
-    WriteLong(result, instruction_stream_.size());
-    WriteBytes(result, n_contour_stream_);
-    WriteBytes(result, n_points_stream_);
-    WriteBytes(result, flag_byte_stream_);
-    WriteBytes(result, glyph_stream_);
-    WriteBytes(result, composite_stream_);
-    WriteBytes(result, bbox_bitmap_);
-    WriteBytes(result, bbox_stream_);
-    WriteBytes(result, instruction_stream_);
+    result->resize(kTransformedGlyfHeaderSize + n_contour_stream_.size() +
+                   n_points_stream_.size() + flag_byte_stream_.size() +
+                   glyph_stream_.size() + composite_stream_.size() +
+                   bbox_bitmap_.size() + bbox_stream_.size() +
+                   instruction_stream_.size() + overlap_bitmap_.size());
+    uint8_t* dst = &(*result)[0];
+    size_t offset = 0;
+    Store16(0, &offset, dst);  // Version
+    Store16(overlap_bitmap_.empty() ? 0x00 : FLAG_OVERLAP_SIMPLE_BITMAP,
+            &offset, dst);  // Flags
+    Store16(n_glyphs_, &offset, dst);
+    Store16(0, &offset, dst);  // index_format, will be set later
+    StoreU32(n_contour_stream_.size(), &offset, dst);
+    StoreU32(n_points_stream_.size(), &offset, dst);
+    StoreU32(flag_byte_stream_.size(), &offset, dst);
+    StoreU32(glyph_stream_.size(), &offset, dst);
+    StoreU32(composite_stream_.size(), &offset, dst);
+    StoreU32(bbox_bitmap_.size() + bbox_stream_.size(), &offset, dst);
+    StoreU32(instruction_stream_.size(), &offset, dst);
+    n_contour_stream_.StoreTo(&offset, dst);
+    n_points_stream_.StoreTo(&offset, dst);
+    flag_byte_stream_.StoreTo(&offset, dst);
+    glyph_stream_.StoreTo(&offset, dst);
+    composite_stream_.StoreTo(&offset, dst);
+    StoreBytes(bbox_bitmap_.data(), bbox_bitmap_.size(), &offset, dst);
+    bbox_stream_.StoreTo(&offset, dst);
+    instruction_stream_.StoreTo(&offset, dst);
     if (!overlap_bitmap_.empty()) {
-      WriteBytes(result, overlap_bitmap_);
+      StoreBytes(overlap_bitmap_.data(), overlap_bitmap_.size(), &offset, dst);
     }
   }
 
  private:
+  // The substreams in the order of the header.
+  void Streams(StreamBuilder** streams) {
+    streams[0] = &n_contour_stream_;
+    streams[1] = &n_points_stream_;
+    streams[2] = &flag_byte_stream_;
+    streams[3] = &glyph_stream_;
+    streams[4] = &composite_stream_;
+    streams[5] = &bbox_stream_;
+    streams[6] = &instruction_stream_;
+  }
+
   void WriteInstructions(const Glyph& glyph) {
-    Write255UShort(&glyph_stream_, glyph.instructions_size);
-    WriteBytes(&instruction_stream_,
-               glyph.instructions_data, glyph.instructions_size);
+    glyph_stream_.Put255UShort(glyph.instructions_size);
+    instruction_stream_.PutBytes(glyph.instructions_data,
+                                 glyph.instructions_size);
   }
 
   bool ShouldWriteSimpleGlyphBbox(const Glyph& glyph) {
-    if (glyph.contours.empty() || glyph.contours[0].empty()) {
+    if (glyph.num_contours() == 0 || glyph.contour_ends[0] == 0) {
       return glyph.x_min || glyph.y_min || glyph.x_max || glyph.y_max;
     }
 
-    int16_t x_min = glyph.contours[0][0].x;
-    int16_t y_min = glyph.contours[0][0].y;
+    int16_t x_min = glyph.x[0];
+    int16_t y_min = glyph.y[0];
     int16_t x_max = x_min;
     int16_t y_max = y_min;
-    for (const auto& contour : glyph.contours) {
-      for (const auto& point : contour) {
-        if (point.x < x_min) x_min = point.x;
-        if (point.x > x_max) x_max = point.x;
-        if (point.y < y_min) y_min = point.y;
-        if (point.y > y_max) y_max = point.y;
-      }
+    const size_t num_points = glyph.num_points();
+    for (size_t i = 0; i < num_points; ++i) {
+      const int x = glyph.x[i];
+      const int y = glyph.y[i];
+      if (x < x_min) x_min = x;
+      if (x > x_max) x_max = x;
+      if (y < y_min) y_min = y;
+      if (y > y_max) y_max = y;
     }
 
     if (glyph.x_min != x_min)
@@ -138,27 +253,26 @@ class GlyfEncoder {
       EnsureOverlapBitmap();
       overlap_bitmap_[glyph_id >> 3] |= 0x80 >> (glyph_id & 7);
     }
-    int num_contours = glyph.contours.size();
-    WriteUShort(&n_contour_stream_, num_contours);
+    int num_contours = glyph.num_contours();
+    n_contour_stream_.Put16(num_contours);
     if (ShouldWriteSimpleGlyphBbox(glyph)) {
       WriteBbox(glyph_id, glyph);
     }
     for (int i = 0; i < num_contours; i++) {
-      Write255UShort(&n_points_stream_, glyph.contours[i].size());
+      n_points_stream_.Put255UShort(glyph.contour_ends[i] -
+                                    glyph.contour_start(i));
     }
     int lastX = 0;
     int lastY = 0;
-    for (int i = 0; i < num_contours; i++) {
-      int num_points = glyph.contours[i].size();
-      for (int j = 0; j < num_points; j++) {
-        int x = glyph.contours[i][j].x;
-        int y = glyph.contours[i][j].y;
-        int dx = x - lastX;
-        int dy = y - lastY;
-        WriteTriplet(glyph.contours[i][j].on_curve, dx, dy);
-        lastX = x;
-        lastY = y;
-      }
+    const size_t num_points = glyph.num_points();
+    for (size_t i = 0; i < num_points; i++) {
+      int x = glyph.x[i];
+      int y = glyph.y[i];
+      int dx = x - lastX;
+      int dy = y - lastY;
+      WriteTriplet(glyph.on_curve[i], dx, dy);
+      lastX = x;
+      lastY = y;
     }
     if (num_contours > 0) {
       WriteInstructions(glyph);
@@ -166,11 +280,10 @@ class GlyfEncoder {
   }
 
   void WriteCompositeGlyph(int glyph_id, const Glyph& glyph) {
-    WriteUShort(&n_contour_stream_, -1);
+    n_contour_stream_.Put16(-1);
     WriteBbox(glyph_id, glyph);
-    WriteBytes(&composite_stream_,
-               glyph.composite_data,
-               glyph.composite_data_size);
+    composite_stream_.PutBytes(glyph.composite_data,
+                               glyph.composite_data_size);
     if (glyph.have_instructions) {
       WriteInstructions(glyph);
     }
@@ -178,10 +291,10 @@ class GlyfEncoder {
 
   void WriteBbox(int glyph_id, const Glyph& glyph) {
     bbox_bitmap_[glyph_id >> 3] |= 0x80 >> (glyph_id & 7);
-    WriteUShort(&bbox_stream_, glyph.x_min);
-    WriteUShort(&bbox_stream_, glyph.y_min);
-    WriteUShort(&bbox_stream_, glyph.x_max);
-    WriteUShort(&bbox_stream_, glyph.y_max);
+    bbox_stream_.Put16(glyph.x_min);
+    bbox_stream_.Put16(glyph.y_min);
+    bbox_stream_.Put16(glyph.x_max);
+    bbox_stream_.Put16(glyph.y_max);
   }
 
   void WriteTriplet(bool on_curve, int x, int y) {
@@ -192,36 +305,36 @@ class GlyfEncoder {
     int y_sign_bit = (y < 0) ? 0 : 1;
     int xy_sign_bits = x_sign_bit + 2 * y_sign_bit;
     if (x == 0 && abs_y < 1280) {
-      flag_byte_stream_.push_back(on_curve_bit +
-                                  ((abs_y & 0xf00) >> 7) + y_sign_bit);
-      glyph_stream_.push_back(abs_y & 0xff);
+      flag_byte_stream_.Put8(on_curve_bit +
+                             ((abs_y & 0xf00) >> 7) + y_sign_bit);
+      glyph_stream_.Put8(abs_y & 0xff);
     } else if (y == 0 && abs_x < 1280) {
-      flag_byte_stream_.push_back(on_curve_bit + 10 +
-                                  ((abs_x & 0xf00) >> 7) + x_sign_bit);
-      glyph_stream_.push_back(abs_x & 0xff);
+      flag_byte_stream_.Put8(on_curve_bit + 10 +
+                             ((abs_x & 0xf00) >> 7) + x_sign_bit);
+      glyph_stream_.Put8(abs_x & 0xff);
     } else if (abs_x < 65 && abs_y < 65) {
-      flag_byte_stream_.push_back(on_curve_bit + 20 +
-                                  ((abs_x - 1) & 0x30) +
-                                  (((abs_y - 1) & 0x30) >> 2) +
-                                  xy_sign_bits);
-      glyph_stream_.push_back((((abs_x - 1) & 0xf) << 4) | ((abs_y - 1) & 0xf));
+      flag_byte_stream_.Put8(on_curve_bit + 20 +
+                             ((abs_x - 1) & 0x30) +
+                             (((abs_y - 1) & 0x30) >> 2) +
+                             xy_sign_bits);
+      glyph_stream_.Put8((((abs_x - 1) & 0xf) << 4) | ((abs_y - 1) & 0xf));
     } else if (abs_x < 769 && abs_y < 769) {
-      flag_byte_stream_.push_back(on_curve_bit + 84 +
-                                  12 * (((abs_x - 1) & 0x300) >> 8) +
-                                  (((abs_y - 1) & 0x300) >> 6) + xy_sign_bits);
-      glyph_stream_.push_back((abs_x - 1) & 0xff);
-      glyph_stream_.push_back((abs_y - 1) & 0xff);
+      flag_byte_stream_.Put8(on_curve_bit + 84 +
+                             12 * (((abs_x - 1) & 0x300) >> 8) +
+                             (((abs_y - 1) & 0x300) >> 6) + xy_sign_bits);
+      glyph_stream_.Put8((abs_x - 1) & 0xff);
+      glyph_stream_.Put8((abs_y - 1) & 0xff);
     } else if (abs_x < 4096 && abs_y < 4096) {
-      flag_byte_stream_.push_back(on_curve_bit + 120 + xy_sign_bits);
-      glyph_stream_.push_back(abs_x >> 4);
-      glyph_stream_.push_back(((abs_x & 0xf) << 4) | (abs_y >> 8));
-      glyph_stream_.push_back(abs_y & 0xff);
+      flag_byte_stream_.Put8(on_curve_bit + 120 + xy_sign_bits);
+      glyph_stream_.Put8(abs_x >> 4);
+      glyph_stream_.Put8(((abs_x & 0xf) << 4) | (abs_y >> 8));
+      glyph_stream_.Put8(abs_y & 0xff);
     } else {
-      flag_byte_stream_.push_back(on_curve_bit + 124 + xy_sign_bits);
-      glyph_stream_.push_back(abs_x >> 8);
-      glyph_stream_.push_back(abs_x & 0xff);
-      glyph_stream_.push_back(abs_y >> 8);
-      glyph_stream_.push_back(abs_y & 0xff);
+      flag_byte_stream_.Put8(on_curve_bit + 124 + xy_sign_bits);
+      glyph_stream_.Put8(abs_x >> 8);
+      glyph_stream_.Put8(abs_x & 0xff);
+      glyph_stream_.Put8(abs_y >> 8);
+      glyph_stream_.Put8(abs_y & 0xff);
     }
   }
 
@@ -231,19 +344,53 @@ class GlyfEncoder {
     }
   }
 
-  std::vector<uint8_t> n_contour_stream_;
-  std::vector<uint8_t> n_points_stream_;
-  std::vector<uint8_t> flag_byte_stream_;
-  std::vector<uint8_t> composite_stream_;
+  StreamBuilder n_contour_stream_;
+  StreamBuilder n_points_stream_;
+  StreamBuilder flag_byte_stream_;
+  StreamBuilder composite_stream_;
   std::vector<uint8_t> bbox_bitmap_;
-  std::vector<uint8_t> bbox_stream_;
-  std::vector<uint8_t> glyph_stream_;
-  std::vector<uint8_t> instruction_stream_;
+  StreamBuilder bbox_stream_;
+  StreamBuilder glyph_stream_;
+  StreamBuilder instruction_stream_;
   std::vector<uint8_t> overlap_bitmap_;
   int n_glyphs_;
 };
 
-}  // namespace
+GlyfTransformer::GlyfTransformer(int num_glyphs, size_t glyf_length)
+    : encoder_(new GlyfEncoder(num_glyphs, glyf_length)) {}
+
+GlyfTransformer::~GlyfTransformer() {}
+
+void GlyfTransformer::AddGlyph(int glyph_id, const Glyph& glyph) {
+  encoder_->Encode(glyph_id, glyph);
+}
+
+void GlyfTransformer::AddGlyph(int glyph_id, const Glyph& glyph,
+                               EncodedGlyph* encoded) {
+  encoder_->Encode(glyph_id, glyph, encoded);
+}
+
+void GlyfTransformer::AddEncodedGlyph(int glyph_id,
+                                      const EncodedGlyph& encoded) {
+  encoder_->Add(glyph_id, encoded);
+}
+
+void GlyfTransformer::Finish(int index_format, Font* font) {
+  font->AddTable(kGlyfTableTag ^ 0x80808080);
+  Font::Table* transformed_loca = font->AddTable(kLocaTableTag ^ 0x80808080);
+  Font::Table* transformed_glyf = font->FindTable(kGlyfTableTag ^ 0x80808080);
+
+  encoder_->GetTransformedGlyfBytes(&transformed_glyf->buffer);
+  transformed_glyf->buffer[7] = index_format;
+
+  transformed_glyf->tag = kGlyfTableTag ^ 0x80808080;
+  transformed_glyf->length = transformed_glyf->buffer.size();
+  transformed_glyf->data = transformed_glyf->buffer.data();
+
+  transformed_loca->tag = kLocaTableTag ^ 0x80808080;
+  transformed_loca->length = 0;
+  transformed_loca->data = NULL;
+}
 
 bool TransformGlyfAndLocaTables(Font* font) {
   // no transform for CFF
@@ -266,36 +413,24 @@ bool TransformGlyfAndLocaTables(Font* font) {
     return true;
   }
 
-  Font::Table* transformed_glyf = &font->tables[kGlyfTableTag ^ 0x80808080];
-  Font::Table* transformed_loca = &font->tables[kLocaTableTag ^ 0x80808080];
-
   int num_glyphs = NumGlyphs(*font);
-  GlyfEncoder encoder(num_glyphs);
+  GlyfTransformer transformer(num_glyphs, glyf_table->length);
+  Glyph glyph;
   for (int i = 0; i < num_glyphs; ++i) {
-    Glyph glyph;
     const uint8_t* glyph_data;
     size_t glyph_size;
     if (!GetGlyphData(*font, i, &glyph_data, &glyph_size) ||
-        (glyph_size > 0 && !ReadGlyph(glyph_data, glyph_size, &glyph))) {
+        !ReadGlyph(glyph_data, glyph_size, &glyph)) {
       return FONT_COMPRESSION_FAILURE();
     }
-    encoder.Encode(i, glyph);
+    transformer.AddGlyph(i, glyph);
   }
-  encoder.GetTransformedGlyfBytes(&transformed_glyf->buffer);
 
   const Font::Table* head_table = font->FindTable(kHeadTableTag);
   if (head_table == NULL || head_table->length < 52) {
     return FONT_COMPRESSION_FAILURE();
   }
-  transformed_glyf->buffer[7] = head_table->data[51];  // index_format
-
-  transformed_glyf->tag = kGlyfTableTag ^ 0x80808080;
-  transformed_glyf->length = transformed_glyf->buffer.size();
-  transformed_glyf->data = transformed_glyf->buffer.data();
-
-  transformed_loca->tag = kLocaTableTag ^ 0x80808080;
-  transformed_loca->length = 0;
-  transformed_loca->data = NULL;
+  transformer.Finish(head_table->data[51], font);  // index_format
 
   return true;
 }
@@ -329,54 +464,60 @@ bool TransformHmtxTable(Font* font) {
     return FONT_COMPRESSION_FAILURE();
   }
 
-  int num_glyphs = NumGlyphs(*font);
+  const int num_glyphs = NumGlyphs(*font);
+  if (num_hmetrics > num_glyphs) {
+    return true;
+  }
+  const size_t num_monospace = num_glyphs - num_hmetrics;
 
-  // Most fonts can be transformed; assume it's a go until proven otherwise
-  std::vector<uint16_t> advance_widths;
-  std::vector<int16_t> proportional_lsbs;
-  std::vector<int16_t> monospace_lsbs;
+  Buffer hmtx_buf(hmtx_table->data, hmtx_table->length);
+  UncheckedCursor hmtx_in;
+  if (!hmtx_buf.ReadSpan(4 * num_hmetrics + 2 * num_monospace, &hmtx_in)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+
+  // The transformed table is written in the same pass that reads hmtx,
+  // assuming every array is kept: flags, advance widths, proportional lsbs
+  // and monospace lsbs. The lsbs that match xMin are cut out at the end.
+  std::vector<uint8_t> transformed(1 + 4 * num_hmetrics + 2 * num_monospace);
+  uint8_t* dst = transformed.data();
+  size_t advance_width_offset = 1;
+  size_t lsb_offset = 1 + 2 * num_hmetrics;
 
+  // Most fonts can be transformed; assume it's a go until proven otherwise
   bool remove_proportional_lsb = true;
-  bool remove_monospace_lsb = (num_glyphs - num_hmetrics) > 0;
+  bool remove_monospace_lsb = num_monospace > 0;
 
-  Buffer hmtx_buf(hmtx_table->data, hmtx_table->length);
   for (int i = 0; i < num_glyphs; i++) {
-    Glyph glyph;
     const uint8_t* glyph_data;
     size_t glyph_size;
-    if (!GetGlyphData(*font, i, &glyph_data, &glyph_size) ||
-        (glyph_size > 0 && !ReadGlyph(glyph_data, glyph_size, &glyph))) {
+    if (!GetGlyphData(*font, i, &glyph_data, &glyph_size)) {
       return FONT_COMPRESSION_FAILURE();
     }
-
-    uint16_t advance_width = 0;
-    int16_t lsb = 0;
-
-    if (i < num_hmetrics) {
-      // [0, num_hmetrics) are proportional hMetrics
-      if (!hmtx_buf.ReadU16(&advance_width)) {
-        return FONT_COMPRESSION_FAILURE();
-      }
-
-      if (!hmtx_buf.ReadS16(&lsb)) {
+    // xMin is all we need, straight from the glyph header.
+    int16_t x_min = 0;
+    if (glyph_size > 0) {
+      Buffer glyph_buf(glyph_data, glyph_size);
+      if (!glyph_buf.Skip(2) || !glyph_buf.ReadS16(&x_min)) {
         return FONT_COMPRESSION_FAILURE();
       }
+    }
 
-      if (glyph_size > 0 && glyph.x_min != lsb) {
+    if (i < num_hmetrics) {
+      // [0, num_hmetrics) are proportional hMetrics
+      Store16(hmtx_in.ReadU16(), &advance_width_offset, dst);
+      const int16_t lsb = hmtx_in.ReadS16();
+      Store16(lsb, &lsb_offset, dst);
+      if (glyph_size > 0 && x_min != lsb) {
         remove_proportional_lsb = false;
       }
-
-      advance_widths.push_back(advance_width);
-      proportional_lsbs.push_back(lsb);
     } else {
       // [num_hmetrics, num_glyphs) are monospace leftSideBearing's
-      if (!hmtx_buf.ReadS16(&lsb)) {
-        return FONT_COMPRESSION_FAILURE();
-      }
-      if (glyph_size > 0 && glyph.x_min != lsb) {
+      const int16_t lsb = hmtx_in.ReadS16();
+      Store16(lsb, &lsb_offset, dst);
+      if (glyph_size > 0 && x_min != lsb) {
         remove_monospace_lsb = false;
       }
-      monospace_lsbs.push_back(lsb);
     }
 
     // If we know we can't optimize, bail out completely
@@ -385,39 +526,23 @@ bool TransformHmtxTable(Font* font) {
     }
   }
 
-  Font::Table* transformed_hmtx = &font->tables[kHmtxTableTag ^ 0x80808080];
-
   uint8_t flags = 0;
-  size_t transformed_size = 1 + 2 * advance_widths.size();
-  if (remove_proportional_lsb) {
-    flags |= 1;
-  } else {
-    transformed_size += 2 * proportional_lsbs.size();
-  }
+  size_t transformed_size = transformed.size();
   if (remove_monospace_lsb) {
     flags |= 1 << 1;
-  } else {
-    transformed_size += 2 * monospace_lsbs.size();
-  }
-
-  transformed_hmtx->buffer.reserve(transformed_size);
-  std::vector<uint8_t>* out = &transformed_hmtx->buffer;
-  WriteBytes(out, &flags, 1);
-  for (uint16_t advance_width : advance_widths) {
-    WriteUShort(out, advance_width);
+    transformed_size -= 2 * num_monospace;
   }
-
-  if (!remove_proportional_lsb) {
-    for (int16_t lsb : proportional_lsbs) {
-      WriteUShort(out, lsb);
-    }
-  }
-  if (!remove_monospace_lsb) {
-    for (int16_t lsb : monospace_lsbs) {
-      WriteUShort(out, lsb);
-    }
+  if (remove_proportional_lsb) {
+    flags |= 1;
+    transformed_size -= 2 * num_hmetrics;
+    std::memmove(dst + 1 + 2 * num_hmetrics, dst + 1 + 4 * num_hmetrics,
+                 transformed_size - 1 - 2 * num_hmetrics);
   }
+  transformed[0] = flags;
+  transformed.resize(transformed_size);
 
+  Font::Table* transformed_hmtx = font->AddTable(kHmtxTableTag ^ 0x80808080);
+  transformed_hmtx->buffer.swap(transformed);
   transformed_hmtx->tag = kHmtxTableTag ^ 0x80808080;
   transformed_hmtx->flag_byte = 1 << 6;
   transformed_hmtx->length = transformed_hmtx->buffer.size();
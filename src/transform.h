@@ -9,10 +9,58 @@
 #ifndef WOFF2_TRANSFORM_H_
 #define WOFF2_TRANSFORM_H_
 
+#include <memory>
+#include <vector>
+
 #include "./font.h"
+#include <woff2/stats.h>
 
 namespace woff2 {
 
+class Glyph;
+class GlyfEncoder;
+
+// What one glyph adds to the transformed glyf table, so that the same glyph
+// can be added again without parsing it.
+struct EncodedGlyph {
+  EncodedGlyph() : stream_sizes(), has_bbox(false), overlap_simple(false) {}
+
+  // The bytes added to each substream, one after the other in the order of
+  // the header: nContour, nPoints, flag, glyph, composite, bbox and
+  // instruction.
+  std::vector<uint8_t> bytes;
+  uint32_t stream_sizes[kWOFF2GlyfSubStreams];
+  bool has_bbox;        // the glyph's bit in the bbox bitmap
+  bool overlap_simple;  // and in the overlap bitmap
+};
+
+// Builds the transformed glyf table one glyph at a time, for callers that go
+// over the glyphs of the font anyway.
+class GlyfTransformer {
+ public:
+  // glyf_length, the length of the glyf table, is used to size the
+  // substreams up front.
+  GlyfTransformer(int num_glyphs, size_t glyf_length);
+  ~GlyfTransformer();
+
+  // Adds the glyph with the given index. Glyphs have to be added in order.
+  void AddGlyph(int glyph_id, const Glyph& glyph);
+  // Same, also recording what the glyph added in *encoded.
+  void AddGlyph(int glyph_id, const Glyph& glyph, EncodedGlyph* encoded);
+  // Adds a glyph recorded by the above, under any index.
+  void AddEncodedGlyph(int glyph_id, const EncodedGlyph& encoded);
+
+  // Adds the transformed glyf and loca tables to the font, as
+  // TransformGlyfAndLocaTables() does.
+  void Finish(int index_format, Font* font);
+
+ private:
+  GlyfTransformer(const GlyfTransformer&);
+  void operator=(const GlyfTransformer&);
+
+  std::unique_ptr<GlyfEncoder> encoder_;
+};
+
 // Adds the transformed versions of the glyf and loca tables to the font. The
 // transformed loca table has zero length. The tag of the transformed tables is
 // derived from the original tag by flipping the MSBs of every byte.
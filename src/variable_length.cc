@@ -8,6 +8,8 @@
 
 #include "./variable_length.h"
 
+#include "./port.h"
+
 namespace woff2 {
 
 size_t Size255UShort(uint16_t value) {
@@ -39,57 +41,129 @@ void Write255UShort(std::vector<uint8_t>* out, int value) {
 }
 
 void Store255UShort(int val, size_t* offset, uint8_t* dst) {
-  std::vector<uint8_t> packed;
-  Write255UShort(&packed, val);
-  for (uint8_t packed_byte : packed) {
-    dst[(*offset)++] = packed_byte;
+  if (val < 253) {
+    dst[(*offset)++] = val;
+  } else if (val < 506) {
+    dst[(*offset)++] = 255;
+    dst[(*offset)++] = val - 253;
+  } else if (val < 762) {
+    dst[(*offset)++] = 254;
+    dst[(*offset)++] = val - 506;
+  } else {
+    dst[(*offset)++] = 253;
+    dst[(*offset)++] = val >> 8;
+    dst[(*offset)++] = val & 0xff;
   }
 }
 
+namespace {
+
+const uint8_t kWordCode = 253;
+const uint8_t kOneMoreByteCode2 = 254;
+const uint8_t kOneMoreByteCode1 = 255;
+const unsigned int kLowestUCode = 253;
+
+// Decodes the 255UInt16 at the start of the avail bytes at data. Returns how
+// many bytes it took, 0 if it runs past the end.
 // Based on section 6.1.1 of MicroType Express draft spec
-bool Read255UShort(Buffer* buf, unsigned int* value) {
-  static const int kWordCode = 253;
-  static const int kOneMoreByteCode2 = 254;
-  static const int kOneMoreByteCode1 = 255;
-  static const int kLowestUCode = 253;
-  uint8_t code = 0;
-  if (!buf->ReadU8(&code)) {
-    return FONT_COMPRESSION_FAILURE();
+inline size_t Decode255UShort(const uint8_t* data, size_t avail,
+                              unsigned int* value) {
+  if (PREDICT_FALSE(avail == 0)) {
+    return 0;
+  }
+  const uint8_t code = data[0];
+  if (code < kLowestUCode) {
+    *value = code;
+    return 1;
   }
   if (code == kWordCode) {
-    uint16_t result = 0;
-    if (!buf->ReadU16(&result)) {
-      return FONT_COMPRESSION_FAILURE();
+    if (PREDICT_FALSE(avail < 3)) {
+      return 0;
     }
-    *value = result;
-    return true;
-  } else if (code == kOneMoreByteCode1) {
-    uint8_t result = 0;
-    if (!buf->ReadU8(&result)) {
-      return FONT_COMPRESSION_FAILURE();
+    *value = static_cast<unsigned int>(data[1]) << 8 | data[2];
+    return 3;
+  }
+  if (PREDICT_FALSE(avail < 2)) {
+    return 0;
+  }
+  if (code == kOneMoreByteCode1) {
+    *value = data[1] + kLowestUCode;
+  } else {  // kOneMoreByteCode2
+    *value = data[1] + kLowestUCode * 2;
+  }
+  return 2;
+}
+
+template <bool kStoreValues>
+bool Read255UShortRun(Buffer* buf, size_t n, unsigned int* values,
+                      uint64_t* total) {
+  const uint8_t* data = buf->buffer() + buf->offset();
+  const size_t avail = buf->length() - buf->offset();
+  uint64_t sum = 0;
+  if (n <= avail) {
+    // Nearly always every value fits in one byte. Neither loop exits early,
+    // so both vectorize.
+    unsigned int escapes = 0;
+    for (size_t i = 0; i < n; ++i) {
+      escapes |= data[i] >= kLowestUCode;
+    }
+    if (escapes == 0) {
+      for (size_t i = 0; i < n; ++i) {
+        if (kStoreValues) {
+          values[i] = data[i];
+        }
+        sum += data[i];
+      }
+      buf->set_offset(buf->offset() + n);
+      *total = sum;
+      return true;
     }
-    *value = result + kLowestUCode;
-    return true;
-  } else if (code == kOneMoreByteCode2) {
-    uint8_t result = 0;
-    if (!buf->ReadU8(&result)) {
+  }
+  size_t pos = 0;
+  for (size_t i = 0; i < n; ++i) {
+    unsigned int value = 0;
+    const size_t size = Decode255UShort(data + pos, avail - pos, &value);
+    if (PREDICT_FALSE(size == 0)) {
       return FONT_COMPRESSION_FAILURE();
     }
-    *value = result + kLowestUCode * 2;
-    return true;
-  } else {
-    *value = code;
-    return true;
+    if (kStoreValues) {
+      values[i] = value;
+    }
+    sum += value;
+    pos += size;
   }
+  buf->set_offset(buf->offset() + pos);
+  *total = sum;
+  return true;
+}
+
+}  // namespace
+
+bool Read255UShort(Buffer* buf, unsigned int* value) {
+  const size_t size = Decode255UShort(buf->buffer() + buf->offset(),
+                                      buf->length() - buf->offset(), value);
+  if (PREDICT_FALSE(size == 0)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  buf->set_offset(buf->offset() + size);
+  return true;
+}
+
+bool Read255UShortN(Buffer* buf, size_t n, unsigned int* values,
+                    uint64_t* total) {
+  if (values == NULL) {
+    return Read255UShortRun<false>(buf, n, NULL, total);
+  }
+  return Read255UShortRun<true>(buf, n, values, total);
 }
 
 bool ReadBase128(Buffer* buf, uint32_t* value) {
+  const uint8_t* data = buf->buffer() + buf->offset();
+  const size_t avail = buf->length() - buf->offset();
   uint32_t result = 0;
-  for (size_t i = 0; i < 5; ++i) {
-    uint8_t code = 0;
-    if (!buf->ReadU8(&code)) {
-      return FONT_COMPRESSION_FAILURE();
-    }
+  // Make sure not to exceed the size bound
+  for (size_t i = 0; i < 5 && i < avail; ++i) {
+    const uint8_t code = data[i];
     // Leading zeros are invalid.
     if (i == 0 && code == 0x80) {
       return FONT_COMPRESSION_FAILURE();
@@ -101,10 +175,10 @@ bool ReadBase128(Buffer* buf, uint32_t* value) {
     result = (result << 7) | (code & 0x7f);
     if ((code & 0x80) == 0) {
       *value = result;
+      buf->set_offset(buf->offset() + i + 1);
       return true;
     }
   }
-  // Make sure not to exceed the size bound
   return FONT_COMPRESSION_FAILURE();
 }
 
@@ -17,6 +17,10 @@ namespace woff2 {
 
 size_t Size255UShort(uint16_t value);
 bool Read255UShort(Buffer* buf, unsigned int* value);
+// Reads n consecutive values into values and adds them up into *total.
+// values may be NULL when only the total is needed.
+bool Read255UShortN(Buffer* buf, size_t n, unsigned int* values,
+                    uint64_t* total);
 void Write255UShort(std::vector<uint8_t>* out, int value);
 void Store255UShort(int val, size_t* offset, uint8_t* dst);
 
@@ -0,0 +1,605 @@
+/* Copyright 2026 Google Inc. All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+*/
+
+/* Benchmark for the encoder and decoder: runs each font through every stage
+   of the pipeline separately and reports timings as JSON. */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <brotli/decode.h>
+#include <brotli/encode.h>
+#include "./batch.h"
+#include "./file.h"
+#include "./font.h"
+#include "./normalize.h"
+#include "./table_tags.h"
+#include "./transform.h"
+#include <woff2/decode.h>
+#include <woff2/encode.h>
+#include <woff2/output.h>
+
+namespace {
+
+// Allocation counters, bumped by the operator new below. Brotli allocates
+// with malloc, in the library as in the brotli_* stages, so what it
+// allocates internally is left out of every stage alike.
+std::atomic<size_t> g_allocs(0);
+std::atomic<size_t> g_alloc_bytes(0);
+
+void* CountedAlloc(size_t size) {
+  g_allocs.fetch_add(1, std::memory_order_relaxed);
+  g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+  return malloc(size);
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+  void* p = CountedAlloc(size ? size : 1);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+namespace {
+
+using woff2::Font;
+using woff2::FontCollection;
+
+struct BenchConfig {
+  int warmup = 1;
+  int reps = 5;
+  woff2::WOFF2Params params;
+};
+
+struct StageResult {
+  std::string name;
+  size_t bytes;                 // processed per run, for MB/s
+  std::vector<double> ns;       // one sample per repetition, sorted
+  // Most made by one repetition, excluding Brotli internals.
+  size_t allocs;
+  size_t alloc_bytes;
+  size_t output_bytes;          // produced per run, by encode stages only
+};
+
+struct FontResult {
+  std::string file;
+  size_t size;
+  int glyphs;
+  bool ok;
+  std::vector<StageResult> stages;
+};
+
+// Runs setup and then body, untimed warmup times and then timed reps
+// times. setup prepares a fresh input for body and is never timed. Returns
+// false if body fails.
+bool RunStage(const BenchConfig& config, const char* name, size_t bytes,
+              const std::function<bool()>& setup,
+              const std::function<bool()>& body, FontResult* font) {
+  StageResult stage;
+  stage.name = name;
+  stage.bytes = bytes;
+  stage.allocs = 0;
+  stage.alloc_bytes = 0;
+  stage.output_bytes = 0;
+  stage.ns.reserve(config.reps);
+  for (int i = 0; i < config.warmup + config.reps; ++i) {
+    if (!setup()) {
+      return false;
+    }
+    const size_t allocs = g_allocs.load();
+    const size_t alloc_bytes = g_alloc_bytes.load();
+    auto start = std::chrono::steady_clock::now();
+    const bool ok = body();
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    // Before anything the bench itself allocates.
+    const size_t run_allocs = g_allocs.load() - allocs;
+    const size_t run_alloc_bytes = g_alloc_bytes.load() - alloc_bytes;
+    if (!ok) {
+      fprintf(stderr, "%s failed on %s\n", name, font->file.c_str());
+      return false;
+    }
+    if (i >= config.warmup) {
+      stage.ns.push_back(elapsed.count());
+      stage.allocs = std::max(stage.allocs, run_allocs);
+      stage.alloc_bytes = std::max(stage.alloc_bytes, run_alloc_bytes);
+    }
+  }
+  std::sort(stage.ns.begin(), stage.ns.end());
+  font->stages.push_back(stage);
+  return true;
+}
+
+bool NoSetup() { return true; }
+
+bool ReadAndNormalize(const woff2::InputFile& input, FontCollection* fonts) {
+  *fonts = FontCollection();
+  return woff2::ReadFontCollection(input.data(), input.size(), fonts) &&
+         woff2::NormalizeFontCollection(fonts);
+}
+
+bool TransformGlyf(FontCollection* fonts) {
+  for (auto& font : fonts->fonts) {
+    if (!woff2::TransformGlyfAndLocaTables(&font)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Concatenates the tables the way ConvertTTFToWOFF2 lays them out for
+// Brotli.
+std::vector<uint8_t> BrotliInput(const FontCollection& fonts) {
+  std::vector<uint8_t> out;
+  for (const auto& font : fonts.fonts) {
+    for (const auto tag : font.OutputOrderedTags()) {
+      const Font::Table& original = *font.FindTable(tag);
+      if (original.IsReused() || (tag & 0x80808080)) {
+        continue;
+      }
+      const Font::Table* table = font.FindTable(tag ^ 0x80808080);
+      if (table == NULL) {
+        table = &original;
+      }
+      out.insert(out.end(), table->data, table->data + table->length);
+    }
+  }
+  return out;
+}
+
+bool BrotliEncode(const std::vector<uint8_t>& in, int quality,
+                  std::vector<uint8_t>* out) {
+  BrotliEncoderState* s =
+      BrotliEncoderCreateInstance(NULL, NULL, NULL);
+  if (s == NULL) {
+    return false;
+  }
+  BrotliEncoderSetParameter(s, BROTLI_PARAM_QUALITY, quality);
+  BrotliEncoderSetParameter(s, BROTLI_PARAM_MODE, BROTLI_MODE_FONT);
+  BrotliEncoderSetParameter(s, BROTLI_PARAM_SIZE_HINT, in.size());
+  out->resize(BrotliEncoderMaxCompressedSize(in.size()));
+  size_t available_in = in.size();
+  const uint8_t* next_in = in.data();
+  size_t available_out = out->size();
+  uint8_t* next_out = out->data();
+  const bool ok = BrotliEncoderCompressStream(
+      s, BROTLI_OPERATION_FINISH, &available_in, &next_in, &available_out,
+      &next_out, NULL) && BrotliEncoderIsFinished(s);
+  BrotliEncoderDestroyInstance(s);
+  out->resize(out->size() - available_out);
+  return ok;
+}
+
+bool BrotliDecode(const std::vector<uint8_t>& in, std::vector<uint8_t>* out) {
+  BrotliDecoderState* s =
+      BrotliDecoderCreateInstance(NULL, NULL, NULL);
+  if (s == NULL) {
+    return false;
+  }
+  size_t available_in = in.size();
+  const uint8_t* next_in = in.data();
+  size_t available_out = out->size();
+  uint8_t* next_out = out->data();
+  const BrotliDecoderResult result = BrotliDecoderDecompressStream(
+      s, &available_in, &next_in, &available_out, &next_out, NULL);
+  BrotliDecoderDestroyInstance(s);
+  return result == BROTLI_DECODER_RESULT_SUCCESS && available_out == 0;
+}
+
+// Adds glyf and hmtx reconstruction stages, timed by the decoder itself
+// through WOFF2Stats as they are file-local to it.
+void RunReconstructStages(const BenchConfig& config, const uint8_t* data,
+                          size_t length, FontResult* font) {
+  static const struct {
+    const char* name;
+    uint32_t tag;
+  } kStages[] = {{"reconstruct_glyf", woff2::kGlyfTableTag},
+                 {"reconstruct_hmtx", woff2::kHmtxTableTag}};
+  woff2::WOFF2Stats stats;
+  woff2::WOFF2DecodeParams params;
+  params.stats = &stats;
+  std::string ttf;
+  StageResult stages[2];
+  for (int i = 0; i < config.warmup + config.reps; ++i) {
+    ttf.clear();
+    woff2::WOFF2StringOut out(&ttf);
+    if (!woff2::ConvertWOFF2ToTTF(data, length, &out, params)) {
+      return;
+    }
+    if (i < config.warmup) {
+      continue;
+    }
+    for (int k = 0; k < 2; ++k) {
+      double ns = 0;
+      size_t bytes = 0;
+      for (const woff2::WOFF2TableStats& table : stats.tables) {
+        if (table.tag == kStages[k].tag) {
+          ns += table.ns;
+          bytes += table.length;
+        }
+      }
+      stages[k].ns.push_back(ns);
+      stages[k].bytes = bytes;
+    }
+  }
+  for (int k = 0; k < 2; ++k) {
+    if (stages[k].bytes == 0) {
+      continue;  // table absent or not transformed
+    }
+    stages[k].name = kStages[k].name;
+    stages[k].allocs = 0;  // not measured per table
+    stages[k].alloc_bytes = 0;
+    stages[k].output_bytes = 0;
+    std::sort(stages[k].ns.begin(), stages[k].ns.end());
+    font->stages.push_back(stages[k]);
+  }
+}
+
+bool BenchFont(const BenchConfig& config, const std::string& filename,
+               FontResult* result) {
+  result->file = filename;
+  result->size = 0;
+  result->glyphs = 0;
+  result->ok = false;
+  woff2::InputFile input(filename);
+  if (!input.ok()) {
+    fprintf(stderr, "Can't read %s\n", filename.c_str());
+    return false;
+  }
+  result->size = input.size();
+
+  FontCollection fonts;
+  if (!ReadAndNormalize(input, &fonts)) {
+    fprintf(stderr, "Can't parse %s\n", filename.c_str());
+    return false;
+  }
+  for (const auto& font : fonts.fonts) {
+    result->glyphs += woff2::NumGlyphs(font);
+  }
+
+  // Encoder stages, each on a freshly prepared collection.
+  if (!RunStage(config, "read", input.size(),
+                [&fonts] { fonts = FontCollection(); return true; },
+                [&] {
+                  return woff2::ReadFontCollection(input.data(), input.size(),
+                                                   &fonts);
+                }, result) ||
+      !RunStage(config, "normalize", input.size(),
+                [&] {
+                  fonts = FontCollection();
+                  return woff2::ReadFontCollection(input.data(), input.size(),
+                                                   &fonts);
+                },
+                [&fonts] { return woff2::NormalizeFontCollection(&fonts); },
+                result) ||
+      !RunStage(config, "transform", input.size(),
+                [&] { return ReadAndNormalize(input, &fonts); },
+                [&fonts] { return TransformGlyf(&fonts); }, result) ||
+      !RunStage(config, "normalize_transform", input.size(),
+                [&] {
+                  fonts = FontCollection();
+                  return woff2::ReadFontCollection(input.data(), input.size(),
+                                                   &fonts);
+                },
+                [&fonts] {
+                  return woff2::NormalizeFontCollection(&fonts, 1, true);
+                }, result)) {
+    return false;
+  }
+
+  std::vector<uint8_t> brotli_in = BrotliInput(fonts);
+  std::vector<uint8_t> brotli_out;
+  std::vector<uint8_t> woff2_out(
+      woff2::MaxWOFF2CompressedSize(input.data(), input.size()));
+  size_t woff2_size = 0;
+  if (!RunStage(config, "brotli_encode", brotli_in.size(), NoSetup,
+                [&] {
+                  return BrotliEncode(brotli_in, config.params.brotli_quality,
+                                      &brotli_out);
+                }, result) ||
+      !RunStage(config, "encode", input.size(), NoSetup,
+                [&] {
+                  woff2_size = woff2_out.size();
+                  return woff2::ConvertTTFToWOFF2(
+                      input.data(), input.size(), woff2_out.data(),
+                      &woff2_size, config.params);
+                }, result)) {
+    return false;
+  }
+  result->stages.back().output_bytes = woff2_size;
+  // The latency profile, for its time against the size it gives away.
+  const woff2::WOFF2Params fast_params = woff2::FastWOFF2Params();
+  std::vector<uint8_t> fast_out(woff2_out.size());
+  size_t fast_size = 0;
+  if (!RunStage(config, "encode_fast", input.size(), NoSetup,
+                [&] {
+                  fast_size = fast_out.size();
+                  return woff2::ConvertTTFToWOFF2(
+                      input.data(), input.size(), fast_out.data(),
+                      &fast_size, fast_params);
+                }, result)) {
+    return false;
+  }
+  result->stages.back().output_bytes = fast_size;
+  // The same, re-encoding a font with all of its glyphs in the cache, as a
+  // font editor previewing an edit outside glyf would.
+  woff2::WOFF2EncodeCache encode_cache(64 << 20);
+  woff2::WOFF2Params cached_params = fast_params;
+  cached_params.cache = &encode_cache;
+  auto cached_encode = [&] {
+    fast_size = fast_out.size();
+    return woff2::ConvertTTFToWOFF2(input.data(), input.size(),
+                                    fast_out.data(), &fast_size,
+                                    cached_params);
+  };
+  if (!RunStage(config, "encode_fast_cached", input.size(),
+                [&] {
+                  return encode_cache.Stats().entries > 0 || cached_encode();
+                },
+                cached_encode, result)) {
+    return false;
+  }
+  result->stages.back().output_bytes = fast_size;
+
+  // Decoder stages, on what the encoder produced.
+  std::vector<uint8_t> decoded(brotli_in.size());
+  const size_t ttf_size = std::min(
+      woff2::ComputeWOFF2FinalSize(woff2_out.data(), woff2_size),
+      woff2::kDefaultMaxSize);
+  std::string ttf;
+  ttf.reserve(ttf_size);
+  if (!RunStage(config, "brotli_decode", brotli_in.size(), NoSetup,
+                [&] { return BrotliDecode(brotli_out, &decoded); }, result) ||
+      !RunStage(config, "decode", ttf_size,
+                [&ttf] { ttf.clear(); return true; },
+                [&] {
+                  woff2::WOFF2StringOut out(&ttf);
+                  return woff2::ConvertWOFF2ToTTF(woff2_out.data(),
+                                                  woff2_size, &out);
+                }, result)) {
+    return false;
+  }
+  // In slices of the size an event loop would allow between polls.
+  if (!RunStage(config, "decode_stepped", ttf_size,
+                [&ttf] { ttf.clear(); return true; },
+                [&] {
+                  woff2::WOFF2StringOut out(&ttf);
+                  woff2::WOFF2StreamDecoder decoder(&out);
+                  if (!decoder.Append(woff2_out.data(), woff2_size)) {
+                    return false;
+                  }
+                  woff2::WOFF2StreamDecoder::StepResult step;
+                  do {
+                    step = decoder.Step(16 << 10, 256);
+                  } while (step == woff2::WOFF2StreamDecoder::kMoreWork);
+                  return step == woff2::WOFF2StreamDecoder::kDone &&
+                      decoder.Finish();
+                }, result)) {
+    return false;
+  }
+#ifdef WOFF2_HAVE_MMAP
+  // Untransformed tables by reference, the font out in one writev.
+  woff2::WOFF2Decoder decoder;
+  woff2::WOFF2GatherOut gather;
+  std::vector<woff2::WOFF2Span> spans;
+  const int null_fd = open("/dev/null", O_WRONLY);
+  const bool gather_ok = null_fd >= 0 &&
+      RunStage(config, "decode_gather", ttf_size,
+               [&gather] { gather.Clear(); return true; },
+               [&] {
+                 if (!decoder.Decode(woff2_out.data(), woff2_size, &gather)) {
+                   return false;
+                 }
+                 gather.Spans(&spans);
+                 return woff2::WriteSpans(null_fd, spans);
+               }, result);
+  if (null_fd >= 0) {
+    close(null_fd);
+  }
+  if (!gather_ok) {
+    return false;
+  }
+#endif
+  // A font seen before: hashing and comparing the input, no decoding.
+  woff2::WOFF2DecodeCache cache(2 * (woff2_size + ttf_size));
+  auto cached_decode = [&] {
+    return cache.Decode(woff2_out.data(), woff2_size) != NULL;
+  };
+  if (!RunStage(config, "decode_cache_hit", ttf_size, cached_decode,
+                cached_decode, result)) {
+    return false;
+  }
+  // Admission checks: the header and directories only.
+  woff2::WOFF2ProbeInfo probe;
+  std::vector<woff2::WOFF2TableEntry> entries(0xFFFF);
+  auto probe_font = [&] {
+    return woff2::WOFF2Probe(woff2_out.data(), woff2_size, &probe,
+                             entries.data(), entries.size());
+  };
+  if (!RunStage(config, "probe", woff2_size, NoSetup, probe_font, result)) {
+    return false;
+  }
+  RunReconstructStages(config, woff2_out.data(), woff2_size, result);
+  result->ok = true;
+  return true;
+}
+
+std::string JsonString(const std::string& s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+// Nearest-rank percentile of sorted samples.
+double Percentile(const std::vector<double>& sorted, double p) {
+  size_t rank = static_cast<size_t>(p / 100 * sorted.size() + 0.5);
+  return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+void PrintStage(const StageResult& stage, int glyphs) {
+  const double median_s = Percentile(stage.ns, 50) / 1e9;
+  printf("      {\"name\": %s, \"bytes\": %zu, \"ns\": {\"min\": %.0f, "
+         "\"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"max\": %.0f}, "
+         "\"mb_per_s\": %.2f, \"glyphs_per_s\": %.0f, "
+         "\"allocs_excl_brotli\": %zu, \"alloc_bytes_excl_brotli\": %zu, "
+         "\"output_bytes\": %zu}",
+         JsonString(stage.name).c_str(), stage.bytes,
+         stage.ns.front(), Percentile(stage.ns, 50), Percentile(stage.ns, 90),
+         Percentile(stage.ns, 99), stage.ns.back(),
+         stage.bytes / median_s / (1 << 20), glyphs / median_s, stage.allocs,
+         stage.alloc_bytes, stage.output_bytes);
+}
+
+// Prints a corpus total, whose ns holds the sum of the per-font medians.
+void PrintTotal(const StageResult& total, int glyphs) {
+  const double s = total.ns[0] / 1e9;
+  printf("    {\"name\": %s, \"bytes\": %zu, \"p50_ns_sum\": %.0f, "
+         "\"mb_per_s\": %.2f, \"glyphs_per_s\": %.0f, "
+         "\"allocs_excl_brotli\": %zu, \"alloc_bytes_excl_brotli\": %zu, "
+         "\"output_bytes\": %zu}",
+         JsonString(total.name).c_str(), total.bytes, total.ns[0],
+         total.bytes / s / (1 << 20), glyphs / s, total.allocs,
+         total.alloc_bytes, total.output_bytes);
+}
+
+void PrintJson(const BenchConfig& config,
+               const std::vector<FontResult>& results) {
+  printf("{\n  \"config\": {\"warmup\": %d, \"reps\": %d, \"quality\": %d, "
+         "\"chunk_size\": %zu, \"threads\": %d},\n  \"fonts\": [",
+         config.warmup, config.reps, config.params.brotli_quality,
+         config.params.compression_chunk_size, config.params.num_threads);
+  // Corpus totals: sum of medians per stage over the fonts that passed.
+  std::vector<StageResult> totals;
+  int total_glyphs = 0;
+  const char* sep = "";
+  for (const FontResult& font : results) {
+    printf("%s\n    {\"file\": %s, \"size\": %zu, \"glyphs\": %d, "
+           "\"ok\": %s, \"stages\": [",
+           sep, JsonString(font.file).c_str(), font.size, font.glyphs,
+           font.ok ? "true" : "false");
+    sep = ",";
+    const char* stage_sep = "";
+    for (const StageResult& stage : font.stages) {
+      printf("%s\n", stage_sep);
+      PrintStage(stage, font.glyphs);
+      stage_sep = ",";
+    }
+    printf("]}");
+    if (!font.ok) {
+      continue;
+    }
+    total_glyphs += font.glyphs;
+    for (const StageResult& stage : font.stages) {
+      size_t i = 0;
+      while (i < totals.size() && totals[i].name != stage.name) {
+        ++i;
+      }
+      if (i == totals.size()) {
+        StageResult total;
+        total.name = stage.name;
+        total.bytes = 0;
+        total.ns.assign(1, 0);
+        total.allocs = 0;
+        total.alloc_bytes = 0;
+        total.output_bytes = 0;
+        totals.push_back(total);
+      }
+      totals[i].bytes += stage.bytes;
+      totals[i].ns[0] += Percentile(stage.ns, 50);
+      totals[i].allocs += stage.allocs;
+      totals[i].alloc_bytes += stage.alloc_bytes;
+      totals[i].output_bytes += stage.output_bytes;
+    }
+  }
+  printf("\n  ],\n  \"totals\": [");
+  sep = "";
+  for (const StageResult& total : totals) {
+    printf("%s\n", sep);
+    PrintTotal(total, total_glyphs);
+    sep = ",";
+  }
+  printf("\n  ]\n}\n");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  BenchConfig config;
+  std::vector<std::string> files;
+  for (int arg = 1; arg < argc; ++arg) {
+    const char* flag = argv[arg];
+    if (strncmp(flag, "--warmup=", 9) == 0) {
+      config.warmup = atoi(flag + 9);
+    } else if (strncmp(flag, "--reps=", 7) == 0) {
+      config.reps = std::max(1, atoi(flag + 7));
+    } else if (strncmp(flag, "--quality=", 10) == 0) {
+      config.params.brotli_quality = atoi(flag + 10);
+    } else if (strncmp(flag, "--chunk_size=", 13) == 0) {
+      config.params.compression_chunk_size = strtoul(flag + 13, NULL, 10);
+    } else if (strncmp(flag, "--threads=", 10) == 0) {
+      config.params.num_threads = atoi(flag + 10);
+    } else if (strncmp(flag, "--batch=", 8) == 0) {
+      if (!woff2::ListBatchInputs(flag + 8, {".ttf", ".otf", ".ttc"},
+                                  &files)) {
+        fprintf(stderr, "Can't read %s\n", flag + 8);
+        return 1;
+      }
+    } else if (strncmp(flag, "--", 2) == 0) {
+      fprintf(stderr, "Unknown flag %s\n", flag);
+      return 1;
+    } else {
+      files.push_back(flag);
+    }
+  }
+  if (files.empty()) {
+    fprintf(stderr, "Usage: %s [--warmup=N] [--reps=N] [--quality=N] "
+            "[--chunk_size=BYTES] [--threads=N] [--batch=DIR_OR_MANIFEST] "
+            "[FILE...]\n"
+            "Times read, normalize, transform, normalize_transform, "
+            "brotli_encode,\nencode, encode_fast, encode_fast_cached, "
+            "brotli_decode, decode, decode_stepped,\ndecode_gather, "
+            "decode_cache_hit and probe for each font and prints\nthe "
+            "results as JSON. Allocations are counted through operator new, "
+            "excluding\nBrotli internals in every stage.\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<FontResult> results(files.size());
+  bool ok = true;
+  for (size_t i = 0; i < files.size(); ++i) {
+    fprintf(stderr, "%s\n", files[i].c_str());
+    ok &= BenchFont(config, files[i], &results[i]);
+  }
+  PrintJson(config, results);
+  return ok ? 0 : 1;
+}
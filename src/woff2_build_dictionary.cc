@@ -0,0 +1,244 @@
+/* Copyright 2026 Google Inc. All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+*/
+
+/* A commandline tool for building a Brotli dictionary for a font family,
+   from the tables its fonts have in common. */
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "./batch.h"
+#include "./file.h"
+#include "./font.h"
+#include "./normalize.h"
+#include <woff2/encode.h>
+
+namespace {
+
+// A table as the encoder compresses it, transformed if it would be, and how
+// many of the fonts have it.
+struct Candidate {
+  uint32_t tag;
+  std::string data;
+  size_t fonts;
+  size_t first_seen;
+};
+
+// Parses a comma separated list of tags; short ones are padded with spaces,
+// as in "cvt".
+bool ParseTags(const char* list, std::vector<uint32_t>* tags) {
+  std::string rest(list);
+  while (!rest.empty()) {
+    const size_t comma = rest.find(',');
+    std::string name = rest.substr(0, comma);
+    rest = comma == std::string::npos ? "" : rest.substr(comma + 1);
+    if (name.empty() || name.size() > 4) {
+      return false;
+    }
+    name.resize(4, ' ');
+    uint32_t tag = 0;
+    for (char c : name) {
+      tag = (tag << 8) | static_cast<uint8_t>(c);
+    }
+    tags->push_back(tag);
+  }
+  return true;
+}
+
+// Adds the tables of the font in filename to candidates, counting each
+// distinct one once per file.
+bool AddFont(const std::string& filename, const std::vector<uint32_t>& tags,
+             std::map<std::string, Candidate>* candidates) {
+  woff2::InputFile input(filename);
+  if (!input.ok()) {
+    fprintf(stderr, "Can't read %s\n", filename.c_str());
+    return false;
+  }
+  woff2::FontCollection font_collection;
+  woff2::GlyfNormalization glyf;
+  glyf.transform = true;
+  if (!woff2::ReadFontCollection(input.data(), input.size(),
+                                 &font_collection) ||
+      !woff2::NormalizeFontCollection(&font_collection, 1, glyf)) {
+    fprintf(stderr, "Can't parse %s\n", filename.c_str());
+    return false;
+  }
+  std::vector<Candidate*> seen;
+  for (const auto& font : font_collection.fonts) {
+    for (const auto tag : font.OutputOrderedTags()) {
+      const woff2::Font::Table& original = *font.FindTable(tag);
+      if (original.IsReused() ||
+          (!tags.empty() &&
+           std::find(tags.begin(), tags.end(), tag) == tags.end())) {
+        continue;
+      }
+      const woff2::Font::Table* table = font.FindTable(tag ^ 0x80808080);
+      if (table == NULL) {
+        table = &original;
+      }
+      if (table->length == 0) {
+        continue;
+      }
+      std::string data(reinterpret_cast<const char*>(table->data),
+                       table->length);
+      // Keyed by tag and content, so the same bytes under two tags, like an
+      // empty-ish table, stay apart.
+      std::string key(reinterpret_cast<const char*>(&tag), sizeof(tag));
+      key += data;
+      auto found = candidates->find(key);
+      if (found == candidates->end()) {
+        Candidate candidate = {tag, data, 0, candidates->size()};
+        found = candidates->insert(std::make_pair(key, candidate)).first;
+      }
+      if (std::find(seen.begin(), seen.end(), &found->second) == seen.end()) {
+        seen.push_back(&found->second);
+        ++found->second.fonts;
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  size_t size = woff2::kMaxDictionarySize;
+  int quality = 11;
+  int window = 22;
+  std::vector<uint32_t> tags;
+  std::string batch;
+  int arg = 1;
+  for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; ++arg) {
+    const char* flag = argv[arg];
+    if (strncmp(flag, "--size=", 7) == 0) {
+      size = strtoul(flag + 7, NULL, 10);
+    } else if (strncmp(flag, "--quality=", 10) == 0) {
+      quality = atoi(flag + 10);
+    } else if (strncmp(flag, "--window=", 9) == 0) {
+      window = atoi(flag + 9);
+    } else if (strncmp(flag, "--tags=", 7) == 0) {
+      if (!ParseTags(flag + 7, &tags)) {
+        fprintf(stderr, "Bad tag list %s\n", flag + 7);
+        return 1;
+      }
+    } else if (strncmp(flag, "--batch=", 8) == 0) {
+      batch = flag + 8;
+    } else {
+      fprintf(stderr, "Unknown flag %s\n", flag);
+      return 1;
+    }
+  }
+
+  std::vector<std::string> files;
+  if (arg < argc) {
+    files.assign(argv + arg + 1, argv + argc);
+  }
+  if (!batch.empty() &&
+      !woff2::ListBatchInputs(batch, {".ttf", ".otf", ".ttc"}, &files)) {
+    fprintf(stderr, "Can't read %s\n", batch.c_str());
+    return 1;
+  }
+  if (arg >= argc || files.size() < 2 || size == 0 ||
+      size > woff2::kMaxDictionarySize) {
+    fprintf(stderr, "Usage: %s [--size=BYTES] [--quality=N] [--window=N] "
+            "[--tags=TAG,...]\n"
+            "         OUTPUT FONT FONT... | [--batch=DIR_OR_MANIFEST] OUTPUT\n"
+            "  --size     most bytes of font data to keep, at most and by "
+            "default\n"
+            "             64 KiB; every decode decompresses them again\n"
+            "  --quality  Brotli quality of the fonts compressed with the\n"
+            "             dictionary, 11 by default\n"
+            "  --window   Brotli window of those fonts, 22 by default; it "
+            "must cover\n"
+            "             the dictionary and the font data\n"
+            "  --tags     only keep these tables, such as cmap,GSUB,name\n"
+            "  --batch    read every font in a directory, or every file "
+            "listed one\n"
+            "             per line in a manifest\n",
+            argv[0]);
+    return 1;
+  }
+  const std::string output = argv[arg];
+
+  std::map<std::string, Candidate> candidates;
+  for (const std::string& filename : files) {
+    if (!AddFont(filename, tags, &candidates)) {
+      return 1;
+    }
+  }
+
+  // Only tables several fonts share save anything; one font's own tables
+  // would just be decompressed along with every other font. Those most
+  // fonts share, and then the largest, are kept first and end up last in
+  // the dictionary, closest to the font data, where Brotli reaches them
+  // with the shortest distances.
+  std::vector<const Candidate*> order;
+  for (const auto& entry : candidates) {
+    if (entry.second.fonts >= 2) {
+      order.push_back(&entry.second);
+    }
+  }
+  std::sort(order.begin(), order.end(),
+            [](const Candidate* a, const Candidate* b) {
+              if (a->fonts != b->fonts) {
+                return a->fonts > b->fonts;
+              }
+              if (a->data.size() != b->data.size()) {
+                return a->data.size() > b->data.size();
+              }
+              return a->first_seen < b->first_seen;
+            });
+  std::vector<const Candidate*> picked;
+  size_t picked_size = 0;
+  for (const Candidate* candidate : order) {
+    if (picked_size + candidate->data.size() <= size) {
+      picked.push_back(candidate);
+      picked_size += candidate->data.size();
+    }
+  }
+  if (order.empty()) {
+    fprintf(stderr, "No table is shared by two of the fonts.\n");
+    return 1;
+  }
+  if (picked.empty()) {
+    fprintf(stderr, "No shared table fits in %zu bytes.\n", size);
+    return 1;
+  }
+  std::string data;
+  data.reserve(picked_size);
+  for (auto it = picked.rbegin(); it != picked.rend(); ++it) {
+    data += (*it)->data;
+  }
+
+  std::shared_ptr<const woff2::WOFF2Dictionary> dictionary =
+      woff2::CreateWOFF2Dictionary(
+          reinterpret_cast<const uint8_t*>(data.data()), data.size(),
+          quality, window);
+  if (!dictionary) {
+    fprintf(stderr, "Can't build the dictionary.\n");
+    return 1;
+  }
+  const std::string serialized = dictionary->Serialize();
+  if (!woff2::WriteFileContent(output, serialized.data(),
+                               serialized.size())) {
+    fprintf(stderr, "Can't write %s\n", output.c_str());
+    return 1;
+  }
+  fprintf(stdout, "%zu tables from %zu fonts, %zu bytes, id %04x\n",
+          picked.size(), files.size(), data.size(), dictionary->id());
+  for (const Candidate* candidate : picked) {
+    fprintf(stdout, "  %c%c%c%c %8zu bytes in %zu fonts\n",
+            (candidate->tag >> 24) & 0xFF, (candidate->tag >> 16) & 0xFF,
+            (candidate->tag >> 8) & 0xFF, candidate->tag & 0xFF,
+            candidate->data.size(), candidate->fonts);
+  }
+  return 0;
+}
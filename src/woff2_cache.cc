@@ -0,0 +1,241 @@
+/* Copyright 2026 Google Inc. All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+*/
+
+/* In-memory cache of decoded WOFF2 fonts. */
+
+#include <woff2/decode.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include "./hash.h"
+#include "./port.h"
+
+namespace woff2 {
+
+namespace {
+
+// Power of two, so that a shard is picked with a mask.
+const size_t kNumShards = 16;
+
+// Rough bookkeeping cost of an entry on top of its two buffers.
+const size_t kEntryOverhead = 128;
+
+struct CachedFont {
+  std::string input;  // to confirm hits
+  std::shared_ptr<const std::string> font;
+};
+
+}  // namespace
+
+struct WOFF2DecodeCache::State {
+  struct Entry {
+    uint64_t hash;
+    uint64_t last_used;  // tick of clock when it was last handed out
+    size_t bytes;
+    std::shared_ptr<const CachedFont> cached;
+  };
+
+  // Each shard keeps its entries in use order, most recent first.
+  struct Shard {
+    Shard() : hits(0), misses(0), evictions(0) {}
+
+    std::mutex mutex;
+    std::list<Entry> lru;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> evictions;
+
+    // Takes the entry out; the caller holds mutex.
+    void Erase(std::list<Entry>::iterator it, std::atomic<size_t>* bytes) {
+      *bytes -= it->bytes;
+      index.erase(it->hash);
+      lru.erase(it);
+    }
+  };
+
+  State(size_t max_bytes, const WOFF2DecodeParams& decode_params)
+      : params(decode_params), max_bytes(max_bytes), bytes(0), clock(0) {
+    params.stats = NULL;
+    seed = static_cast<uint64_t>(
+        std::chrono::steady_clock::now().time_since_epoch().count()) ^
+        reinterpret_cast<uintptr_t>(this);
+  }
+
+  Shard& ShardFor(uint64_t hash) {
+    return shards[(hash >> 32) & (kNumShards - 1)];
+  }
+
+  std::shared_ptr<const std::string> Lookup(const uint8_t* data,
+                                            size_t length, uint64_t hash);
+  void Insert(uint64_t hash, const std::shared_ptr<const CachedFont>& cached,
+              size_t entry_bytes);
+  void Trim();
+
+  WOFF2DecodeParams params;
+  const size_t max_bytes;
+  uint64_t seed;
+  std::atomic<size_t> bytes;
+  std::atomic<uint64_t> clock;
+  Shard shards[kNumShards];
+};
+
+std::shared_ptr<const std::string> WOFF2DecodeCache::State::Lookup(
+    const uint8_t* data, size_t length, uint64_t hash) {
+  Shard& shard = ShardFor(hash);
+  std::shared_ptr<const CachedFont> cached;
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(hash);
+    if (found == shard.index.end()) {
+      return NULL;
+    }
+    std::list<Entry>::iterator it = found->second;
+    it->last_used = ++clock;
+    shard.lru.splice(shard.lru.begin(), shard.lru, it);
+    cached = it->cached;
+  }
+  // Compared outside the lock; the entry can't go away while we hold it.
+  if (PREDICT_FALSE(cached->input.size() != length ||
+                    std::memcmp(cached->input.data(), data, length) != 0)) {
+    return NULL;
+  }
+  return cached->font;
+}
+
+void WOFF2DecodeCache::State::Insert(
+    uint64_t hash, const std::shared_ptr<const CachedFont>& cached,
+    size_t entry_bytes) {
+  Shard& shard = ShardFor(hash);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // Another thread may have decoded the same font meanwhile, or a
+    // different one with the same hash; the latest wins either way.
+    auto found = shard.index.find(hash);
+    if (found != shard.index.end()) {
+      shard.Erase(found->second, &bytes);
+    }
+    Entry entry;
+    entry.hash = hash;
+    entry.last_used = ++clock;
+    entry.bytes = entry_bytes;
+    entry.cached = cached;
+    shard.lru.push_front(entry);
+    shard.index[hash] = shard.lru.begin();
+    bytes += entry_bytes;
+  }
+  Trim();
+}
+
+// Evicts the least recently used entry of all shards until everything fits.
+// Only one shard is locked at a time, so the oldest entry may have been used
+// again by the time it is evicted; that only costs a decode.
+void WOFF2DecodeCache::State::Trim() {
+  while (bytes > max_bytes) {
+    size_t oldest_shard = kNumShards;
+    uint64_t oldest = std::numeric_limits<uint64_t>::max();
+    for (size_t i = 0; i < kNumShards; ++i) {
+      std::lock_guard<std::mutex> lock(shards[i].mutex);
+      if (!shards[i].lru.empty() && shards[i].lru.back().last_used < oldest) {
+        oldest = shards[i].lru.back().last_used;
+        oldest_shard = i;
+      }
+    }
+    if (oldest_shard == kNumShards) {
+      return;
+    }
+    Shard& shard = shards[oldest_shard];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (!shard.lru.empty()) {
+      shard.Erase(std::prev(shard.lru.end()), &bytes);
+      ++shard.evictions;
+    }
+  }
+}
+
+WOFF2DecodeCache::WOFF2DecodeCache(size_t max_bytes)
+    : state_(new State(max_bytes, WOFF2DecodeParams())) {}
+
+WOFF2DecodeCache::WOFF2DecodeCache(size_t max_bytes,
+                                   const WOFF2DecodeParams& params)
+    : state_(new State(max_bytes, params)) {}
+
+WOFF2DecodeCache::~WOFF2DecodeCache() {}
+
+std::shared_ptr<const std::string> WOFF2DecodeCache::Decode(
+    const uint8_t* data, size_t length) {
+  State* state = state_.get();
+  const uint64_t hash = HashBytes(data, length, state->seed);
+  State::Shard& shard = state->ShardFor(hash);
+  std::shared_ptr<const std::string> font = state->Lookup(data, length, hash);
+  if (font) {
+    ++shard.hits;
+    return font;
+  }
+  ++shard.misses;
+
+  // Decoded outside any lock. Threads missing on the same font at once
+  // all decode it; only one copy stays.
+  WOFF2SharedOut out;
+  if (!ConvertWOFF2ToTTF(data, length, &out, state->params)) {
+    return NULL;
+  }
+  std::shared_ptr<CachedFont> cached = std::make_shared<CachedFont>();
+  cached->font = out.Release();
+  const size_t entry_bytes = length + cached->font->size() + kEntryOverhead;
+  if (entry_bytes <= state->max_bytes) {
+    cached->input.assign(reinterpret_cast<const char*>(data), length);
+    state->Insert(hash, cached, entry_bytes);
+  }
+  return cached->font;
+}
+
+bool WOFF2DecodeCache::Decode(const uint8_t* data, size_t length,
+                              WOFF2Out* out) {
+  std::shared_ptr<const std::string> font = Decode(data, length);
+  if (!font) {
+    return false;
+  }
+  out->SizeHint(out->Size() + font->size());
+  return out->Write(font->data(), font->size());
+}
+
+void WOFF2DecodeCache::Clear() {
+  State* state = state_.get();
+  for (size_t i = 0; i < kNumShards; ++i) {
+    State::Shard& shard = state->shards[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    while (!shard.lru.empty()) {
+      shard.Erase(shard.lru.begin(), &state->bytes);
+    }
+  }
+}
+
+WOFF2CacheStats WOFF2DecodeCache::Stats() const {
+  State* state = state_.get();
+  WOFF2CacheStats stats;
+  for (size_t i = 0; i < kNumShards; ++i) {
+    State::Shard& shard = state->shards[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    stats.hits += shard.hits;
+    stats.misses += shard.misses;
+    stats.evictions += shard.evictions;
+    stats.entries += shard.lru.size();
+  }
+  stats.bytes = state->bytes;
+  return stats;
+}
+
+} // namespace woff2
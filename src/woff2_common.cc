@@ -7,32 +7,148 @@
 /* Helpers common across multiple parts of woff2 */
 
 #include <algorithm>
+#include <atomic>
+#include <system_error>
+#include <thread>
+#include <vector>
 
 #include "./woff2_common.h"
 
 #include "./port.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WOFF2_X86_DISPATCH 1
+#include <immintrin.h>
+#else
+#define WOFF2_X86_DISPATCH 0
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define WOFF2_NEON 1
+#include <arm_neon.h>
+#else
+#define WOFF2_NEON 0
+#endif
+
 namespace woff2 {
 
+namespace {
+
+typedef uint32_t (*ULongSumFunc)(const uint8_t* buf, size_t size);
+
+// The vector versions add byte-swapped 32-bit lanes, then fold the lanes and
+// hand the tail (always starting on a 4-byte boundary) to the scalar version.
+// Addition is mod 2^32 in every lane, so the result is identical.
+
+#if WOFF2_X86_DISPATCH
 
-uint32_t ComputeULongSum(const uint8_t* buf, size_t size) {
-  uint32_t checksum = 0;
-  size_t aligned_size = size & ~3;
-  for (size_t i = 0; i < aligned_size; i += 4) {
-    checksum +=
-        (buf[i] << 24) | (buf[i + 1] << 16) | (buf[i + 2] << 8) | buf[i + 3];
+__attribute__((target("sse4.1")))
+uint32_t ComputeULongSumSSE41(const uint8_t* buf, size_t size) {
+  const __m128i bswap32 =
+      _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  __m128i sum0 = _mm_setzero_si128();
+  __m128i sum1 = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i));
+    __m128i v1 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i + 16));
+    sum0 = _mm_add_epi32(sum0, _mm_shuffle_epi8(v0, bswap32));
+    sum1 = _mm_add_epi32(sum1, _mm_shuffle_epi8(v1, bswap32));
   }
+  if (i + 16 <= size) {
+    __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i));
+    sum0 = _mm_add_epi32(sum0, _mm_shuffle_epi8(v0, bswap32));
+    i += 16;
+  }
+  __m128i sum = _mm_add_epi32(sum0, sum1);
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  return static_cast<uint32_t>(_mm_cvtsi128_si32(sum)) +
+         ComputeULongSumScalar(buf + i, size - i);
+}
 
-  // treat size not aligned on 4 as if it were padded to 4 with 0's
-  if (size != aligned_size) {
-    uint32_t v = 0;
-    for (size_t i = aligned_size; i < size; ++i) {
-      v |= buf[i] << (24 - 8 * (i & 3));
-    }
-    checksum += v;
+__attribute__((target("avx2")))
+uint32_t ComputeULongSumAVX2(const uint8_t* buf, size_t size) {
+  // pshufb works within 128-bit halves, which is all a 32-bit swap needs.
+  const __m256i bswap32 = _mm256_setr_epi8(
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  __m256i sum0 = _mm256_setzero_si256();
+  __m256i sum1 = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    __m256i v0 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + i));
+    __m256i v1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + i + 32));
+    sum0 = _mm256_add_epi32(sum0, _mm256_shuffle_epi8(v0, bswap32));
+    sum1 = _mm256_add_epi32(sum1, _mm256_shuffle_epi8(v1, bswap32));
+  }
+  if (i + 32 <= size) {
+    __m256i v0 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + i));
+    sum0 = _mm256_add_epi32(sum0, _mm256_shuffle_epi8(v0, bswap32));
+    i += 32;
+  }
+  sum0 = _mm256_add_epi32(sum0, sum1);
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(sum0),
+                              _mm256_extracti128_si256(sum0, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  return static_cast<uint32_t>(_mm_cvtsi128_si32(sum)) +
+         ComputeULongSumScalar(buf + i, size - i);
+}
+
+#endif  // WOFF2_X86_DISPATCH
+
+#if WOFF2_NEON
+
+uint32_t ComputeULongSumNEON(const uint8_t* buf, size_t size) {
+  uint32x4_t sum0 = vdupq_n_u32(0);
+  uint32x4_t sum1 = vdupq_n_u32(0);
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    uint8x16_t v0 = vrev32q_u8(vld1q_u8(buf + i));
+    uint8x16_t v1 = vrev32q_u8(vld1q_u8(buf + i + 16));
+    sum0 = vaddq_u32(sum0, vreinterpretq_u32_u8(v0));
+    sum1 = vaddq_u32(sum1, vreinterpretq_u32_u8(v1));
+  }
+  if (i + 16 <= size) {
+    uint8x16_t v0 = vrev32q_u8(vld1q_u8(buf + i));
+    sum0 = vaddq_u32(sum0, vreinterpretq_u32_u8(v0));
+    i += 16;
+  }
+  return vaddvq_u32(vaddq_u32(sum0, sum1)) +
+         ComputeULongSumScalar(buf + i, size - i);
+}
+
+#endif  // WOFF2_NEON
+
+}  // namespace
+
+std::vector<ULongSumVariant> ULongSumVariants() {
+  std::vector<ULongSumVariant> variants;
+  variants.push_back({"scalar", ComputeULongSumScalar});
+#if WOFF2_X86_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.1")) {
+    variants.push_back({"sse4.1", ComputeULongSumSSE41});
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    variants.push_back({"avx2", ComputeULongSumAVX2});
   }
+#endif
+#if WOFF2_NEON
+  variants.push_back({"neon", ComputeULongSumNEON});
+#endif
+  return variants;
+}
 
-  return checksum;
+uint32_t ComputeULongSumDispatch(const uint8_t* buf, size_t size) {
+  // Picked once, on first use.
+  static const ULongSumFunc sum = ULongSumVariants().back().sum;
+  return sum(buf, size);
 }
 
 size_t CollectionHeaderSize(uint32_t header_version, uint32_t num_fonts) {
@@ -47,4 +163,76 @@ size_t CollectionHeaderSize(uint32_t header_version, uint32_t num_fonts) {
   return size;
 }
 
+void ResetStats(WOFF2Stats* stats) {
+  std::vector<WOFF2TableStats> tables;
+  tables.swap(stats->tables);
+  *stats = WOFF2Stats();
+  tables.clear();
+  tables.swap(stats->tables);
+}
+
+void CountTransformedGlyf(const uint8_t* data, size_t length,
+                          WOFF2Stats* stats) {
+  // version, options, numGlyphs, indexFormat, then the substream sizes.
+  const size_t header_size = 8 + 4 * kWOFF2GlyfSubStreams;
+  if (length < header_size) {
+    return;
+  }
+  const size_t num_glyphs = (data[4] << 8) | data[5];
+  size_t sizes[kWOFF2GlyfSubStreams];
+  size_t total = 0;
+  for (int i = 0; i < kWOFF2GlyfSubStreams; ++i) {
+    const uint8_t* p = data + 8 + 4 * i;
+    sizes[i] = (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) |
+               (p[2] << 8) | p[3];
+    total += sizes[i];
+  }
+  if (total > length - header_size || sizes[0] < 2 * num_glyphs) {
+    return;
+  }
+  for (int i = 0; i < kWOFF2GlyfSubStreams; ++i) {
+    stats->glyf_substream_bytes[i] += sizes[i];
+  }
+  stats->glyphs += num_glyphs;
+  // One flag byte per point.
+  stats->points += sizes[2];
+  const uint8_t* n_contours = data + header_size;
+  for (size_t i = 0; i < num_glyphs; ++i) {
+    const int16_t n = (n_contours[2 * i] << 8) | n_contours[2 * i + 1];
+    if (n > 0) {
+      ++stats->simple_glyphs;
+      stats->contours += n;
+    } else if (n == 0) {
+      ++stats->empty_glyphs;
+    } else {
+      ++stats->composite_glyphs;
+    }
+  }
+}
+
+void ParallelFor(size_t n, int num_threads,
+                 const std::function<void(size_t)>& task) {
+  unsigned int threads_wanted = num_threads > 0 ?
+      num_threads : std::thread::hardware_concurrency();
+  threads_wanted = std::min<size_t>(std::max(1u, threads_wanted), n);
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < n; i = next++) {
+      task(i);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned int t = 1; t < threads_wanted; ++t) {
+    try {
+      threads.emplace_back(worker);
+    } catch (const std::system_error&) {
+      break;  // carry on with the threads we have
+    }
+  }
+  worker();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
 } // namespace woff2
@@ -12,7 +12,12 @@
 #include <stddef.h>
 #include <inttypes.h>
 
+#include <chrono>
+#include <functional>
 #include <string>
+#include <vector>
+
+#include <woff2/stats.h>
 
 namespace woff2 {
 
@@ -26,6 +31,7 @@ static const uint32_t kTtcFontFlavor = 0x74746366;
 
 static const size_t kSfntHeaderSize = 12;
 static const size_t kSfntEntrySize = 16;
+static const size_t kWoff2HeaderSize = 48;
 
 struct Point {
   int x;
@@ -56,8 +62,92 @@ struct Table {
 // True Type Collections
 size_t CollectionHeaderSize(uint32_t header_version, uint32_t num_fonts);
 
-// Compute checksum over size bytes of buf
-uint32_t ComputeULongSum(const uint8_t* buf, size_t size);
+// Plain C++ version of ComputeULongSum, the reference for the vector ones.
+inline uint32_t ComputeULongSumScalar(const uint8_t* buf, size_t size) {
+  uint32_t checksum = 0;
+  size_t aligned_size = size & ~3;
+  for (size_t i = 0; i < aligned_size; i += 4) {
+    checksum +=
+        (buf[i] << 24) | (buf[i + 1] << 16) | (buf[i + 2] << 8) | buf[i + 3];
+  }
+
+  // treat size not aligned on 4 as if it were padded to 4 with 0's
+  if (size != aligned_size) {
+    uint32_t v = 0;
+    for (size_t i = aligned_size; i < size; ++i) {
+      v |= buf[i] << (24 - 8 * (i & 3));
+    }
+    checksum += v;
+  }
+
+  return checksum;
+}
+
+// Buffers this small, such as the smallest glyphs, are summed inline: the
+// vector versions don't win back the call through a function pointer and
+// their setup, and the AVX2 one has no full block to add.
+const size_t kMinVectorULongSumSize = 32;
+
+// ComputeULongSum with the fastest implementation the CPU supports,
+// whatever the size.
+uint32_t ComputeULongSumDispatch(const uint8_t* buf, size_t size);
+
+// Compute checksum over size bytes of buf. Uses the fastest implementation
+// the CPU supports.
+inline uint32_t ComputeULongSum(const uint8_t* buf, size_t size) {
+  if (size < kMinVectorULongSumSize) {
+    return ComputeULongSumScalar(buf, size);
+  }
+  return ComputeULongSumDispatch(buf, size);
+}
+
+// One implementation of ComputeULongSum, for checksum_bench.
+struct ULongSumVariant {
+  const char* name;
+  uint32_t (*sum)(const uint8_t* buf, size_t size);
+};
+
+// The implementations the CPU supports, slowest first; ComputeULongSum uses
+// the last one.
+std::vector<ULongSumVariant> ULongSumVariants();
+
+// Adds the time from construction to destruction to *ns. Does nothing,
+// not even read the clock, when ns is NULL.
+class StageTimer {
+ public:
+  explicit StageTimer(uint64_t* ns) : ns_(ns) {
+    if (ns_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+  ~StageTimer() {
+    if (ns_) {
+      *ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start_).count();
+    }
+  }
+
+ private:
+  StageTimer(const StageTimer&) = delete;
+  StageTimer& operator=(const StageTimer&) = delete;
+
+  uint64_t* ns_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Clears stats for a new conversion, keeping the memory of stats->tables.
+void ResetStats(WOFF2Stats* stats);
+
+// Adds the glyph counts and substream sizes of a transformed glyf table to
+// stats. Ignores tables too short to hold what they claim.
+void CountTransformedGlyf(const uint8_t* data, size_t length,
+                          WOFF2Stats* stats);
+
+// Runs task(i) for every 0 <= i < n on up to num_threads threads, 0 meaning
+// one per hardware thread, the calling thread included. Returns once all
+// tasks are done. Falls back to fewer threads if they can't be started.
+void ParallelFor(size_t n, int num_threads,
+                 const std::function<void(size_t)>& task);
 
 } // namespace woff2
 
@@ -6,38 +6,250 @@
 
 /* A commandline tool for compressing ttf format files to woff2. */
 
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "./batch.h"
 #include "file.h"
 #include <woff2/encode.h>
 
+namespace {
 
-int main(int argc, char **argv) {
-  if (argc != 2) {
-    fprintf(stderr, "One argument, the input filename, must be provided.\n");
-    return 1;
+// Compresses the font into output, which holds *output_size bytes. Updates
+// *output_size to the compressed size and returns the time taken in *ms.
+bool Compress(const woff2::InputFile& input, const woff2::WOFF2Params& params,
+              uint8_t* output, size_t* output_size, double* ms) {
+  auto start = std::chrono::steady_clock::now();
+  if (!woff2::ConvertTTFToWOFF2(input.data(), input.size(),
+                                output, output_size, params)) {
+    return false;
   }
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  *ms = elapsed.count();
+  return true;
+}
 
-  std::string filename(argv[1]);
+void PrintStats(const woff2::WOFF2Stats& stats) {
+  const double ms = 1e-6;
+  fprintf(stdout, "  parse %.2f ms, normalize and transform %.2f ms, "
+          "brotli %.2f ms, total %.2f ms\n",
+          stats.parse_ns * ms, stats.normalize_ns * ms,
+          stats.brotli_ns * ms, stats.total_ns * ms);
+  fprintf(stdout, "  %zu glyphs: %zu simple, %zu composite, %zu empty; "
+          "%zu contours, %zu points\n",
+          stats.glyphs, stats.simple_glyphs, stats.composite_glyphs,
+          stats.empty_glyphs, stats.contours, stats.points);
+  static const char* const kSubStreams[woff2::kWOFF2GlyfSubStreams] = {
+    "nContour", "nPoints", "flag", "glyph", "composite", "bbox",
+    "instruction"};
+  fprintf(stdout, "  glyf substreams:");
+  for (int i = 0; i < woff2::kWOFF2GlyfSubStreams; ++i) {
+    fprintf(stdout, " %s %zu", kSubStreams[i], stats.glyf_substream_bytes[i]);
+  }
+  fprintf(stdout, "\n");
+}
+
+// Compresses filename into a .woff2 next to it. With verbose, reports the
+// compressed size, the autotuner's choice and, with print_stats, where the
+// time went; with compare, the gain over one-stream compression.
+bool CompressFile(const std::string& filename, woff2::WOFF2Params params,
+                  bool verbose, bool print_stats, bool compare,
+                  woff2::BatchFileResult* result) {
+  woff2::WOFF2AutotuneResult autotune;
+  if (params.autotune_budget_ms > 0) {
+    params.autotune_result = &autotune;
+  }
+  woff2::WOFF2Stats stats;
+  if (verbose) {
+    params.stats = &stats;
+  }
   std::string outfilename = filename.substr(0, filename.find_last_of(".")) + ".woff2";
-  fprintf(stdout, "Processing %s => %s\n",
-    filename.c_str(), outfilename.c_str());
-  std::string input = woff2::GetFileContent(filename);
+  if (verbose) {
+    fprintf(stdout, "Processing %s => %s\n",
+      filename.c_str(), outfilename.c_str());
+  }
+  woff2::InputFile input(filename);
+  if (!input.ok()) {
+    fprintf(stderr, "Can't read %s\n", filename.c_str());
+    return false;
+  }
+
+  // Compress straight into the mapped output file, then trim it.
+  const size_t max_size =
+      woff2::MaxWOFF2CompressedSize(input.data(), input.size());
+  woff2::WOFF2FileOut out(outfilename, max_size);
+  out.SetMaxSize(max_size);
+  uint8_t* output = out.Extend(max_size);
+  size_t output_size = max_size;
+  double ms;
+  if (output == NULL ||
+      !Compress(input, params, output, &output_size, &ms)) {
+    fprintf(stderr, "Compression failed.\n");
+    out.Discard();
+    return false;
+  }
+  out.Truncate(output_size);
+  if (verbose) {
+    if (stats.brotli_chunks > 1) {
+      fprintf(stdout, "Compressed %zu to %zu in %zu chunks.\n",
+              stats.brotli_uncompressed_bytes, stats.brotli_compressed_bytes,
+              stats.brotli_chunks);
+    } else {
+      fprintf(stdout, "Compressed %zu to %zu.\n",
+              stats.brotli_uncompressed_bytes, stats.brotli_compressed_bytes);
+    }
+    if (print_stats) {
+      PrintStats(stats);
+    }
+  }
+  if (verbose && params.autotune_budget_ms > 0) {
+    for (const auto& trial : autotune.trials) {
+      fprintf(stdout, "  q%-2d %zu -> %zu bytes in %.0f ms, ~%.0f ms for all\n",
+              trial.brotli_quality, autotune.sample_size,
+              trial.compressed_size, trial.ms, trial.predicted_ms);
+    }
+    fprintf(stdout, "Picked quality %d, window %d after %.0f ms; "
+            "compressed in %.0f ms\n", autotune.brotli_quality,
+            autotune.brotli_window, autotune.tune_ms, autotune.compress_ms);
+  }
+  if (compare) {
+    woff2::WOFF2Params single_params = params;
+    single_params.compression_chunk_size = 0;
+    single_params.autotune_result = NULL;
+    single_params.stats = NULL;
+    std::vector<uint8_t> single(max_size);
+    size_t single_size = max_size;
+    double single_ms;
+    if (!Compress(input, single_params, single.data(), &single_size,
+                  &single_ms)) {
+      fprintf(stderr, "Compression failed.\n");
+      out.Discard();
+      return false;
+    }
+    fprintf(stdout, "one stream: %zu bytes in %.0f ms\n"
+            "chunked:    %zu bytes in %.0f ms (%+.2f%% size, %.2fx speed)\n",
+            single_size, single_ms, output_size, ms,
+            100.0 * output_size / single_size - 100.0, single_ms / ms);
+  }
 
-  const uint8_t* input_data = reinterpret_cast<const uint8_t*>(input.data());
-  size_t output_size = woff2::MaxWOFF2CompressedSize(input_data, input.size());
-  std::string output(output_size, 0);
-  uint8_t* output_data = reinterpret_cast<uint8_t*>(&output[0]);
+  if (!out.Close()) {
+    fprintf(stderr, "Can't write %s\n", outfilename.c_str());
+    return false;
+  }
+  result->input_size = input.size();
+  result->output_size = output_size;
+  return true;
+}
+
+}  // namespace
 
+int main(int argc, char **argv) {
   woff2::WOFF2Params params;
-  if (!woff2::ConvertTTFToWOFF2(input_data, input.size(),
-                                output_data, &output_size, params)) {
-    fprintf(stderr, "Compression failed.\n");
+  bool compare = false;
+  bool print_stats = false;
+  std::shared_ptr<const woff2::WOFF2Dictionary> dictionary;
+  std::string batch;
+  int jobs = 0;
+  int arg = 1;
+  for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; ++arg) {
+    const char* flag = argv[arg];
+    if (strncmp(flag, "--chunk_size=", 13) == 0) {
+      params.compression_chunk_size = strtoul(flag + 13, NULL, 10);
+    } else if (strncmp(flag, "--threads=", 10) == 0) {
+      params.num_threads = atoi(flag + 10);
+    } else if (strncmp(flag, "--quality=", 10) == 0) {
+      params.brotli_quality = atoi(flag + 10);
+    } else if (strcmp(flag, "--fast") == 0) {
+      const woff2::WOFF2Params fast = woff2::FastWOFF2Params();
+      params.brotli_quality = fast.brotli_quality;
+      params.brotli_window_fit = fast.brotli_window_fit;
+    } else if (strcmp(flag, "--normalized") == 0) {
+      params.glyf_normalized = true;
+    } else if (strncmp(flag, "--dictionary=", 13) == 0) {
+      woff2::InputFile file(flag + 13);
+      if (file.ok()) {
+        dictionary = woff2::WOFF2Dictionary::Parse(file.data(), file.size());
+      }
+      if (!dictionary) {
+        fprintf(stderr, "Can't read the dictionary %s\n", flag + 13);
+        return 1;
+      }
+      params.dictionary = dictionary.get();
+    } else if (strncmp(flag, "--autotune_ms=", 14) == 0) {
+      params.autotune_budget_ms = atof(flag + 14);
+    } else if (strcmp(flag, "--compare") == 0) {
+      compare = true;
+    } else if (strcmp(flag, "--stats") == 0) {
+      print_stats = true;
+    } else if (strncmp(flag, "--batch=", 8) == 0) {
+      batch = flag + 8;
+    } else if (strncmp(flag, "--jobs=", 7) == 0) {
+      jobs = atoi(flag + 7);
+    } else {
+      fprintf(stderr, "Unknown flag %s\n", flag);
+      return 1;
+    }
+  }
+  // The dictionary fixes the Brotli settings and needs a single stream.
+  if (params.dictionary != NULL &&
+      (params.autotune_budget_ms > 0 || params.compression_chunk_size != 0)) {
+    fprintf(stderr, "--dictionary can't be combined with --autotune_ms or "
+            "--chunk_size.\n");
     return 1;
   }
-  output.resize(output_size);
 
-  woff2::SetFileContents(outfilename, output.begin(), output.end());
+  if (!batch.empty()) {
+    if (arg != argc || compare) {
+      fprintf(stderr, "No filename or --compare may be given with --batch.\n");
+      return 1;
+    }
+    std::vector<std::string> files;
+    if (!woff2::ListBatchInputs(batch, {".ttf", ".otf", ".ttc"}, &files)) {
+      fprintf(stderr, "Can't read %s\n", batch.c_str());
+      return 1;
+    }
+    const size_t failures = woff2::RunBatch(files, jobs,
+        [&params](size_t, const std::string& filename,
+                  woff2::BatchFileResult* result) {
+          return CompressFile(filename, params, false, false, false, result);
+        });
+    return failures == 0 ? 0 : 1;
+  }
+
+  if (argc - arg != 1) {
+    fprintf(stderr, "Usage: %s [--quality=N] [--fast] [--normalized] "
+            "[--autotune_ms=MS]\n"
+            "         [--dictionary=FILE] [--chunk_size=BYTES] [--threads=N] "
+            "[--compare]\n"
+            "         [--stats] FILE\n"
+            "       %s [options] --batch=DIR_OR_MANIFEST [--jobs=N]\n"
+            "  --quality     Brotli quality, the highest one when autotuning\n"
+            "  --fast        low latency settings; a later --quality wins\n"
+            "  --normalized  the glyphs are normalized already, as in fonts\n"
+            "                decoded from WOFF2\n"
+            "  --dictionary  compress with a dictionary from "
+            "woff2_build_dictionary;\n"
+            "                the file only decodes with it\n"
+            "  --autotune_ms pick the quality that fits this time budget\n"
+            "  --chunk_size  compress in independent chunks of this size\n"
+            "  --threads     threads for chunked compression, 0 for all\n"
+            "  --compare     also compress as one stream and report the "
+            "difference\n"
+            "  --stats       report time per stage and glyph counts\n"
+            "  --batch       compress every font in a directory, or every "
+            "file listed\n"
+            "                one per line in a manifest\n"
+            "  --jobs        worker threads for --batch, 0 for all\n",
+            argv[0], argv[0]);
+    return 1;
+  }
 
-  return 0;
+  woff2::BatchFileResult result;
+  return CompressFile(argv[arg], params, true, print_stats, compare, &result)
+      ? 0 : 1;
 }
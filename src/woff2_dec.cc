@@ -10,17 +10,22 @@
 
 #include <stdlib.h>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <complex>
+#include <cstddef>
 #include <cstring>
 #include <limits>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <vector>
-#include <map>
 #include <memory>
 #include <utility>
 
 #include <brotli/decode.h>
 #include "./buffer.h"
+#include "./glyph_decode.h"
 #include "./port.h"
 #include "./round.h"
 #include "./store_bytes.h"
@@ -62,6 +67,16 @@ const size_t kCompositeGlyphBegin = 10;
 // Largest glyph ever observed was 72k bytes
 const size_t kDefaultGlyphBuf = 5120;
 
+const int kNumGlyfSubStreams = 7;
+
+// Below this many glyphs per thread a parallel glyf rebuild is not worth
+// the prepass and the thread startup.
+const unsigned int kMinGlyphsPerThread = 1024;
+
+// WOFF2GlyphAccessor notes the substream positions every this many glyphs,
+// so reaching any glyph skips at most this many.
+const unsigned int kGlyphCheckpointInterval = 64;
+
 // Over 14k test fonts the max compression ratio seen to date was ~20.
 // >100 suggests you wrote a bad uncompressed size.
 const float kMaxPlausibleCompressionRatio = 100.0;
@@ -78,6 +93,7 @@ struct WOFF2Header {
   uint32_t flavor;
   uint32_t header_version;
   uint16_t num_tables;
+  uint16_t dictionary_id;  // the reserved field; see SelectDictionary
   uint64_t compressed_offset;
   uint32_t compressed_length;
   uint32_t uncompressed_size;
@@ -94,21 +110,55 @@ struct WOFF2FontInfo {
   uint16_t index_format;
   uint16_t num_hmetrics;
   std::vector<int16_t> x_mins;
-  std::map<uint32_t, uint32_t> table_entry_by_tag;
+  // (tag, offset of the table entry in the output), sorted by tag.
+  std::vector<std::pair<uint32_t, uint32_t> > table_entry_by_tag;
 };
 
 // Accumulates metadata as we rebuild the font
 struct RebuildMetadata {
   uint32_t header_checksum;  // set by WriteHeaders
   std::vector<WOFF2FontInfo> font_infos;
-  // checksums for tables that have been written.
-  // (tag, src_offset) => checksum. Need both because 0-length loca.
-  std::map<std::pair<uint32_t, uint32_t>, uint32_t> checksums;
+  // Tables are identified by (tag, src_offset); need both because 0-length
+  // loca. Each distinct pair gets a slot, indexed like WOFF2Header::tables.
+  std::vector<uint32_t> checksum_slots;
+  // checksums for tables that have been written, by slot.
+  std::vector<uint32_t> checksums;
+  std::vector<uint8_t> checksum_written;
+  // WriteHeaders scratch space, kept to reuse its memory.
+  std::vector<std::pair<uint64_t, uint32_t> > sort_buf;
 };
 
-int WithSign(int flag, int baseval) {
-  // Precondition: 0 <= baseval < 65536 (to avoid integer overflow)
-  return (flag & 1) ? baseval : -baseval;
+// Finds the output offset of the table entry for tag.
+bool FindTableEntry(const WOFF2FontInfo& info, uint32_t tag,
+                    uint32_t* offset) {
+  auto it = std::lower_bound(info.table_entry_by_tag.begin(),
+                             info.table_entry_by_tag.end(),
+                             std::make_pair(tag, static_cast<uint32_t>(0)));
+  if (PREDICT_FALSE(it == info.table_entry_by_tag.end() || it->first != tag)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  *offset = it->second;
+  return true;
+}
+
+// Sorts (tag, offset) entries by tag, keeping only the last entry added for
+// each tag.
+void SortTableEntries(std::vector<std::pair<uint32_t, uint32_t> >* entries) {
+  // Stable, so equal tags stay in the order they were added.
+  std::stable_sort(entries->begin(), entries->end(),
+                   [](const std::pair<uint32_t, uint32_t>& a,
+                      const std::pair<uint32_t, uint32_t>& b) {
+                     return a.first < b.first;
+                   });
+  size_t n = 0;
+  for (size_t i = 0; i < entries->size(); ++i) {
+    if (n > 0 && (*entries)[n - 1].first == (*entries)[i].first) {
+      (*entries)[n - 1] = (*entries)[i];
+    } else {
+      (*entries)[n++] = (*entries)[i];
+    }
+  }
+  entries->resize(n);
 }
 
 bool _SafeIntAddition(int a, int b, int* result) {
@@ -121,89 +171,212 @@ bool _SafeIntAddition(int a, int b, int* result) {
   return true;
 }
 
+// How the triplet of one flag value is coded. The data bytes are read as
+// one big-endian number; each coordinate delta is a bit field of it plus a
+// base, with a sign.
+struct TripletEncoding {
+  unsigned int n_data_bytes;
+  unsigned int x_shift;
+  unsigned int x_mask;
+  int x_base;
+  int x_sign;  // 0 for positive, -1 for negative
+  unsigned int y_shift;
+  unsigned int y_mask;
+  int y_base;
+  int y_sign;
+};
+
+// The encodings of the 128 flag values, from the WOFF2 spec.
+struct TripletTable {
+  TripletTable() {
+    for (int flag = 0; flag < 128; ++flag) {
+      TripletEncoding& e = encodings[flag];
+      e = TripletEncoding();
+      // Bit 0 gives the sign of the first coordinate present, bit 1 that of
+      // y when both are.
+      e.x_sign = (flag & 1) ? 0 : -1;
+      e.y_sign = (flag & 2) ? 0 : -1;
+      if (flag < 10) {
+        e.n_data_bytes = 1;
+        e.y_mask = 0xff;
+        e.y_base = (flag & 14) << 7;
+        e.y_sign = e.x_sign;
+      } else if (flag < 20) {
+        e.n_data_bytes = 1;
+        e.x_mask = 0xff;
+        e.x_base = ((flag - 10) & 14) << 7;
+      } else if (flag < 84) {
+        const int b0 = flag - 20;
+        e.n_data_bytes = 1;
+        e.x_shift = 4;
+        e.x_mask = 0x0f;
+        e.x_base = 1 + (b0 & 0x30);
+        e.y_mask = 0x0f;
+        e.y_base = 1 + ((b0 & 0x0c) << 2);
+      } else if (flag < 120) {
+        const int b0 = flag - 84;
+        e.n_data_bytes = 2;
+        e.x_shift = 8;
+        e.x_mask = 0xff;
+        e.x_base = 1 + ((b0 / 12) << 8);
+        e.y_mask = 0xff;
+        e.y_base = 1 + (((b0 % 12) >> 2) << 8);
+      } else if (flag < 124) {
+        e.n_data_bytes = 3;
+        e.x_shift = 12;
+        e.x_mask = 0xfff;
+        e.y_mask = 0xfff;
+      } else {
+        e.n_data_bytes = 4;
+        e.x_shift = 16;
+        e.x_mask = 0xffff;
+        e.y_mask = 0xffff;
+      }
+    }
+  }
+
+  TripletEncoding encodings[128];
+};
+
+const TripletEncoding* TripletEncodings() {
+  static const TripletTable table;
+  return table.encodings;
+}
+
+// Deltas are below 65536 in magnitude, so coordinates can't overflow an int
+// within this many points.
+const unsigned int kMaxUncheckedPoints = 32768;
+
+}  // namespace
+
 bool TripletDecode(const uint8_t* flags_in, const uint8_t* in, size_t in_size,
     unsigned int n_points, Point* result, size_t* in_bytes_consumed) {
+  const TripletEncoding* encodings = TripletEncodings();
   int x = 0;
   int y = 0;
 
   if (PREDICT_FALSE(n_points > in_size)) {
     return FONT_COMPRESSION_FAILURE();
   }
-  unsigned int triplet_index = 0;
+  const bool checked = n_points >= kMaxUncheckedPoints;
+  size_t triplet_index = 0;
 
   for (unsigned int i = 0; i < n_points; ++i) {
-    uint8_t flag = flags_in[i];
-    bool on_curve = !(flag >> 7);
-    flag &= 0x7f;
-    unsigned int n_data_bytes;
-    if (flag < 84) {
-      n_data_bytes = 1;
-    } else if (flag < 120) {
-      n_data_bytes = 2;
-    } else if (flag < 124) {
-      n_data_bytes = 3;
-    } else {
-      n_data_bytes = 4;
-    }
-    if (PREDICT_FALSE(triplet_index + n_data_bytes > in_size ||
-        triplet_index + n_data_bytes < triplet_index)) {
-      return FONT_COMPRESSION_FAILURE();
-    }
-    int dx, dy;
-    if (flag < 10) {
-      dx = 0;
-      dy = WithSign(flag, ((flag & 14) << 7) + in[triplet_index]);
-    } else if (flag < 20) {
-      dx = WithSign(flag, (((flag - 10) & 14) << 7) + in[triplet_index]);
-      dy = 0;
-    } else if (flag < 84) {
-      int b0 = flag - 20;
-      int b1 = in[triplet_index];
-      dx = WithSign(flag, 1 + (b0 & 0x30) + (b1 >> 4));
-      dy = WithSign(flag >> 1, 1 + ((b0 & 0x0c) << 2) + (b1 & 0x0f));
-    } else if (flag < 120) {
-      int b0 = flag - 84;
-      dx = WithSign(flag, 1 + ((b0 / 12) << 8) + in[triplet_index]);
-      dy = WithSign(flag >> 1,
-                    1 + (((b0 % 12) >> 2) << 8) + in[triplet_index + 1]);
-    } else if (flag < 124) {
-      int b2 = in[triplet_index + 1];
-      dx = WithSign(flag, (in[triplet_index] << 4) + (b2 >> 4));
-      dy = WithSign(flag >> 1, ((b2 & 0x0f) << 8) + in[triplet_index + 2]);
+    const uint8_t flag = flags_in[i];
+    const TripletEncoding& e = encodings[flag & 0x7f];
+    const unsigned int n_data_bytes = e.n_data_bytes;
+    const size_t available = in_size - triplet_index;
+    if (PREDICT_FALSE(n_data_bytes > available)) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    const uint8_t* data = in + triplet_index;
+    uint32_t bits;
+    if (PREDICT_TRUE(available >= 4)) {
+      bits = (static_cast<uint32_t>(data[0]) << 24) | (data[1] << 16) |
+             (data[2] << 8) | data[3];
+      bits >>= 32 - 8 * n_data_bytes;
     } else {
-      dx = WithSign(flag, (in[triplet_index] << 8) + in[triplet_index + 1]);
-      dy = WithSign(flag >> 1,
-          (in[triplet_index + 2] << 8) + in[triplet_index + 3]);
+      bits = 0;
+      for (unsigned int k = 0; k < n_data_bytes; ++k) {
+        bits = (bits << 8) | data[k];
+      }
     }
     triplet_index += n_data_bytes;
-    if (!_SafeIntAddition(x, dx, &x)) {
-      return false;
-    }
-    if (!_SafeIntAddition(y, dy, &y)) {
-      return false;
+    const int dx = ((static_cast<int>((bits >> e.x_shift) & e.x_mask) +
+                     e.x_base) ^ e.x_sign) - e.x_sign;
+    const int dy = ((static_cast<int>((bits >> e.y_shift) & e.y_mask) +
+                     e.y_base) ^ e.y_sign) - e.y_sign;
+    if (PREDICT_FALSE(checked)) {
+      if (!_SafeIntAddition(x, dx, &x)) {
+        return false;
+      }
+      if (!_SafeIntAddition(y, dy, &y)) {
+        return false;
+      }
+    } else {
+      x += dx;
+      y += dy;
     }
-    *result++ = {x, y, on_curve};
+    *result++ = {x, y, !(flag >> 7)};
   }
   *in_bytes_consumed = triplet_index;
   return true;
 }
 
+namespace {
+
+// Size of the flag, x and y arrays StorePoints writes for the points, for
+// when the quick bound doesn't fit the buffer.
+size_t PointDataSize(unsigned int n_points, const Point* points,
+                     bool has_overlap_bit) {
+  int last_flag = -1;
+  int repeat_count = 0;
+  int last_x = 0;
+  int last_y = 0;
+  size_t size = 0;
+  for (unsigned int i = 0; i < n_points; ++i) {
+    const int dx = points[i].x - last_x;
+    const int dy = points[i].y - last_y;
+    size += (dx != 0) + (dx <= -256 || dx >= 256);
+    size += (dy != 0) + (dy <= -256 || dy >= 256);
+    int flag = (points[i].on_curve ? kGlyfOnCurve : 0) |
+        (has_overlap_bit && i == 0 ? kOverlapSimple : 0);
+    flag |= dx == 0 ? kGlyfThisXIsSame : dx > -256 && dx < 256 ?
+        kGlyfXShort | (dx > 0 ? kGlyfThisXIsSame : 0) : 0;
+    flag |= dy == 0 ? kGlyfThisYIsSame : dy > -256 && dy < 256 ?
+        kGlyfYShort | (dy > 0 ? kGlyfThisYIsSame : 0) : 0;
+    if (flag == last_flag && repeat_count != 255) {
+      size += repeat_count == 0;
+      repeat_count++;
+    } else {
+      size++;
+      repeat_count = 0;
+    }
+    last_flag = flag;
+    last_x = points[i].x;
+    last_y = points[i].y;
+  }
+  return size;
+}
+
+}  // namespace
+
 // This function stores just the point data. On entry, dst points to the
-// beginning of a simple glyph. Returns true on success.
+// beginning of a simple glyph. coords is scratch space for 4 * n_points
+// bytes. The flags go straight to dst while the x and y arrays are built in
+// coords, all in one pass, and then copied after the flags. A point takes
+// at most 5 bytes, so the size is checked once up front rather than per
+// byte. If compute_bbox is set, the bounding box of the points is stored in
+// the glyph header as well. Returns true on success.
 bool StorePoints(unsigned int n_points, const Point* points,
                  unsigned int n_contours, unsigned int instruction_length,
-                 bool has_overlap_bit, uint8_t* dst, size_t dst_size,
-                 size_t* glyph_size) {
+                 bool has_overlap_bit, bool compute_bbox, uint8_t* coords,
+                 uint8_t* dst, size_t dst_size, size_t* glyph_size) {
   // I believe that n_contours < 65536, in which case this is safe. However, a
   // comment and/or an assert would be good.
-  unsigned int flag_offset = kEndPtsOfContoursOffset + 2 * n_contours + 2 +
+  const size_t flag_offset = kEndPtsOfContoursOffset + 2 * n_contours + 2 +
     instruction_length;
+  if (PREDICT_FALSE(flag_offset > dst_size ||
+                    5 * static_cast<uint64_t>(n_points) >
+                        dst_size - flag_offset) &&
+      PREDICT_FALSE(flag_offset + PointDataSize(n_points, points,
+                                                has_overlap_bit) >
+                    dst_size)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+
+  uint8_t* flag_dst = dst + flag_offset;
+  uint8_t* x_dst = coords;
+  uint8_t* y_dst = coords + 2 * static_cast<size_t>(n_points);
+  uint8_t* const y_start = y_dst;
   int last_flag = -1;
   int repeat_count = 0;
   int last_x = 0;
   int last_y = 0;
-  unsigned int x_bytes = 0;
-  unsigned int y_bytes = 0;
+  int x_min = n_points > 0 ? points[0].x : 0;
+  int y_min = n_points > 0 ? points[0].y : 0;
+  int x_max = x_min;
+  int y_max = y_min;
 
   for (unsigned int i = 0; i < n_points; ++i) {
     const Point& point = points[i];
@@ -212,118 +385,72 @@ bool StorePoints(unsigned int n_points, const Point* points,
       flag |= kOverlapSimple;
     }
 
-    int dx = point.x - last_x;
-    int dy = point.y - last_y;
+    const int dx = point.x - last_x;
+    const int dy = point.y - last_y;
     if (dx == 0) {
       flag |= kGlyfThisXIsSame;
     } else if (dx > -256 && dx < 256) {
       flag |= kGlyfXShort | (dx > 0 ? kGlyfThisXIsSame : 0);
-      x_bytes += 1;
+      *x_dst++ = std::abs(dx);
     } else {
-      x_bytes += 2;
+      // will always fit for valid input, but overflow is harmless
+      x_dst[0] = dx >> 8;
+      x_dst[1] = dx;
+      x_dst += 2;
     }
     if (dy == 0) {
       flag |= kGlyfThisYIsSame;
     } else if (dy > -256 && dy < 256) {
       flag |= kGlyfYShort | (dy > 0 ? kGlyfThisYIsSame : 0);
-      y_bytes += 1;
+      *y_dst++ = std::abs(dy);
     } else {
-      y_bytes += 2;
+      y_dst[0] = dy >> 8;
+      y_dst[1] = dy;
+      y_dst += 2;
     }
 
     if (flag == last_flag && repeat_count != 255) {
-      dst[flag_offset - 1] |= kGlyfRepeat;
-      repeat_count++;
-    } else {
-      if (repeat_count != 0) {
-        if (PREDICT_FALSE(flag_offset >= dst_size)) {
-          return FONT_COMPRESSION_FAILURE();
-        }
-        dst[flag_offset++] = repeat_count;
-      }
-      if (PREDICT_FALSE(flag_offset >= dst_size)) {
-        return FONT_COMPRESSION_FAILURE();
+      if (repeat_count == 0) {
+        flag_dst[-1] |= kGlyfRepeat;
+        ++flag_dst;
       }
-      dst[flag_offset++] = flag;
+      flag_dst[-1] = ++repeat_count;
+    } else {
+      *flag_dst++ = flag;
       repeat_count = 0;
     }
     last_x = point.x;
     last_y = point.y;
     last_flag = flag;
-  }
 
-  if (repeat_count != 0) {
-    if (PREDICT_FALSE(flag_offset >= dst_size)) {
-      return FONT_COMPRESSION_FAILURE();
+    if (compute_bbox) {
+      x_min = std::min(point.x, x_min);
+      x_max = std::max(point.x, x_max);
+      y_min = std::min(point.y, y_min);
+      y_max = std::max(point.y, y_max);
     }
-    dst[flag_offset++] = repeat_count;
-  }
-  unsigned int xy_bytes = x_bytes + y_bytes;
-  if (PREDICT_FALSE(xy_bytes < x_bytes ||
-      flag_offset + xy_bytes < flag_offset ||
-      flag_offset + xy_bytes > dst_size)) {
-    return FONT_COMPRESSION_FAILURE();
   }
 
-  int x_offset = flag_offset;
-  int y_offset = flag_offset + x_bytes;
-  last_x = 0;
-  last_y = 0;
-  for (unsigned int i = 0; i < n_points; ++i) {
-    int dx = points[i].x - last_x;
-    if (dx == 0) {
-      // pass
-    } else if (dx > -256 && dx < 256) {
-      dst[x_offset++] = std::abs(dx);
-    } else {
-      // will always fit for valid input, but overflow is harmless
-      x_offset = Store16(dst, x_offset, dx);
-    }
-    last_x += dx;
-    int dy = points[i].y - last_y;
-    if (dy == 0) {
-      // pass
-    } else if (dy > -256 && dy < 256) {
-      dst[y_offset++] = std::abs(dy);
-    } else {
-      y_offset = Store16(dst, y_offset, dy);
-    }
-    last_y += dy;
+  const size_t x_bytes = x_dst - coords;
+  const size_t y_bytes = y_dst - y_start;
+  if (x_bytes > 0) {
+    std::memcpy(flag_dst, coords, x_bytes);
   }
-  *glyph_size = y_offset;
-  return true;
-}
-
-// Compute the bounding box of the coordinates, and store into a glyf buffer.
-// A precondition is that there are at least 10 bytes available.
-// dst should point to the beginning of a 'glyf' record.
-void ComputeBbox(unsigned int n_points, const Point* points, uint8_t* dst) {
-  int x_min = 0;
-  int y_min = 0;
-  int x_max = 0;
-  int y_max = 0;
-
-  if (n_points > 0) {
-    x_min = points[0].x;
-    x_max = points[0].x;
-    y_min = points[0].y;
-    y_max = points[0].y;
+  if (y_bytes > 0) {
+    std::memcpy(flag_dst + x_bytes, y_start, y_bytes);
   }
-  for (unsigned int i = 1; i < n_points; ++i) {
-    int x = points[i].x;
-    int y = points[i].y;
-    x_min = std::min(x, x_min);
-    x_max = std::max(x, x_max);
-    y_min = std::min(y, y_min);
-    y_max = std::max(y, y_max);
+  if (compute_bbox) {
+    size_t offset = 2;
+    offset = Store16(dst, offset, x_min);
+    offset = Store16(dst, offset, y_min);
+    offset = Store16(dst, offset, x_max);
+    offset = Store16(dst, offset, y_max);
   }
-  size_t offset = 2;
-  offset = Store16(dst, offset, x_min);
-  offset = Store16(dst, offset, y_min);
-  offset = Store16(dst, offset, x_max);
-  offset = Store16(dst, offset, y_max);
+  *glyph_size = (flag_dst - dst) + x_bytes + y_bytes;
+  return true;
 }
 
+namespace {
 
 bool SizeOfComposite(Buffer composite_stream, size_t* size,
                      bool* have_instructions) {
@@ -360,329 +487,892 @@ bool SizeOfComposite(Buffer composite_stream, size_t* size,
   return true;
 }
 
+const uint8_t kZeroes[3] = {0, 0, 0};
+
 bool Pad4(WOFF2Out* out) {
-  uint8_t zeroes[] = {0, 0, 0};
   if (PREDICT_FALSE(out->Size() + 3 < out->Size())) {
     return FONT_COMPRESSION_FAILURE();
   }
   uint32_t pad_bytes = Round4(out->Size()) - out->Size();
   if (pad_bytes > 0) {
-    if (PREDICT_FALSE(!out->Write(&zeroes, pad_bytes))) {
+    if (PREDICT_FALSE(!out->Write(kZeroes, pad_bytes))) {
       return FONT_COMPRESSION_FAILURE();
     }
   }
   return true;
 }
 
+// Writes a table built from 16 and 32-bit values straight to the output
+// through a small buffer, checksumming as it goes, so tables like loca and
+// hmtx never need a full-size staging copy. Given the exact size of the
+// table, it writes in place into memory the output reserves, if it can.
+class TableWriter {
+ public:
+  explicit TableWriter(WOFF2Out* out)
+      : out_(out), dst_(buf_), capacity_(sizeof(buf_)), reserved_(false),
+        used_(0), checksum_(0), ok_(true) {}
+
+  TableWriter(WOFF2Out* out, size_t size) : TableWriter(out) {
+    uint8_t* reserved = out->Reserve(size);
+    if (reserved != NULL) {
+      dst_ = reserved;
+      capacity_ = size;
+      reserved_ = true;
+    }
+  }
+
+  void Store16(int value) {
+    if (PREDICT_FALSE(used_ + 2 > capacity_) && !Flush()) {
+      return;
+    }
+    used_ = woff2::Store16(dst_, used_, value);
+  }
+
+  void StoreU32(uint32_t value) {
+    if (PREDICT_FALSE(used_ + 4 > capacity_) && !Flush()) {
+      return;
+    }
+    used_ = woff2::StoreU32(dst_, used_, value);
+  }
+
+  // Writes what is left. Returns false if any write failed, or if a
+  // reserved table didn't come out at the size given.
+  bool Finish(uint32_t* checksum) {
+    checksum_ += ComputeULongSum(dst_, used_);
+    if (reserved_) {
+      ok_ &= used_ == capacity_;
+    } else if (used_ > 0) {
+      ok_ &= out_->Write(dst_, used_);
+    }
+    used_ = 0;
+    *checksum = checksum_;
+    return ok_;
+  }
+
+ private:
+  // Writes the whole 4-byte words buffered, so checksums of the pieces add
+  // up to that of the table. Reserved memory can't be made room in.
+  bool Flush() {
+    if (PREDICT_FALSE(reserved_)) {
+      ok_ = false;
+      return false;
+    }
+    const size_t n = used_ & ~3;
+    checksum_ += ComputeULongSum(buf_, n);
+    ok_ &= out_->Write(buf_, n);
+    std::memmove(buf_, buf_ + n, used_ - n);
+    used_ -= n;
+    return true;
+  }
+
+  WOFF2Out* out_;
+  uint8_t buf_[4096];
+  uint8_t* dst_;  // buf_ or reserved output memory
+  size_t capacity_;
+  bool reserved_;
+  size_t used_;
+  uint32_t checksum_;
+  bool ok_;
+};
+
 // Build TrueType loca table
 bool StoreLoca(const std::vector<uint32_t>& loca_values, int index_format,
                uint32_t* checksum, WOFF2Out* out) {
   // TODO(user) figure out what index format to use based on whether max
   // offset fits into uint16_t or not
   const uint64_t loca_size = loca_values.size();
-  const uint64_t offset_size = index_format ? 4 : 2;
   if (PREDICT_FALSE((loca_size << 2) >> 2 != loca_size)) {
     return FONT_COMPRESSION_FAILURE();
   }
-  std::vector<uint8_t> loca_content(loca_size * offset_size);
-  uint8_t* dst = &loca_content[0];
-  size_t offset = 0;
+  TableWriter writer(out, loca_size * (index_format ? 4 : 2));
   for (size_t i = 0; i < loca_values.size(); ++i) {
     uint32_t value = loca_values[i];
     if (index_format) {
-      offset = StoreU32(dst, offset, value);
+      writer.StoreU32(value);
     } else {
-      offset = Store16(dst, offset, value >> 1);
+      writer.Store16(value >> 1);
     }
   }
-  *checksum = ComputeULongSum(&loca_content[0], loca_content.size());
-  if (PREDICT_FALSE(!out->Write(&loca_content[0], loca_content.size()))) {
+  if (PREDICT_FALSE(!writer.Finish(checksum))) {
     return FONT_COMPRESSION_FAILURE();
   }
   return true;
 }
 
-// Reconstruct entire glyf table based on transformed original
-bool ReconstructGlyf(const uint8_t* data, Table* glyf_table,
-                     uint32_t* glyf_checksum, Table * loca_table,
-                     uint32_t* loca_checksum, WOFF2FontInfo* info,
-                     WOFF2Out* out) {
-  static const int kNumSubStreams = 7;
-  Buffer file(data, glyf_table->transform_length);
-  uint16_t version;
-  std::vector<std::pair<const uint8_t*, size_t> > substreams(kNumSubStreams);
-  const size_t glyf_start = out->Size();
+// Read positions in the substreams of a transformed glyf table.
+struct GlyfStreams {
+  explicit GlyfStreams(const std::pair<const uint8_t*, size_t>* substreams)
+      : n_contour_stream(substreams[0].first, substreams[0].second),
+        n_points_stream(substreams[1].first, substreams[1].second),
+        flag_stream(substreams[2].first, substreams[2].second),
+        glyph_stream(substreams[3].first, substreams[3].second),
+        composite_stream(substreams[4].first, substreams[4].second),
+        bbox_stream(substreams[5].first, substreams[5].second),
+        instruction_stream(substreams[6].first, substreams[6].second) {}
 
-  if (PREDICT_FALSE(!file.ReadU16(&version))) {
-    return FONT_COMPRESSION_FAILURE();
+  Buffer* stream(int i) {
+    Buffer* streams[kNumGlyfSubStreams] = {
+      &n_contour_stream, &n_points_stream, &flag_stream, &glyph_stream,
+      &composite_stream, &bbox_stream, &instruction_stream
+    };
+    return streams[i];
   }
 
-  uint16_t flags;
-  if (PREDICT_FALSE(!file.ReadU16(&flags))) {
-    return FONT_COMPRESSION_FAILURE();
+  void Tell(size_t* offsets) {
+    for (int i = 0; i < kNumGlyfSubStreams; ++i) {
+      offsets[i] = stream(i)->offset();
+    }
   }
-  bool has_overlap_bitmap = (flags & FLAG_OVERLAP_SIMPLE_BITMAP);
 
-  if (PREDICT_FALSE(!file.ReadU16(&info->num_glyphs) ||
-      !file.ReadU16(&info->index_format))) {
-    return FONT_COMPRESSION_FAILURE();
+  // Only valid on freshly constructed streams.
+  bool Seek(const size_t* offsets) {
+    for (int i = 0; i < kNumGlyfSubStreams; ++i) {
+      if (PREDICT_FALSE(!stream(i)->Skip(offsets[i]))) {
+        return FONT_COMPRESSION_FAILURE();
+      }
+    }
+    return true;
   }
 
-  // https://dev.w3.org/webfonts/WOFF2/spec/#conform-mustRejectLoca
-  // dst_length here is origLength in the spec
-  uint32_t expected_loca_dst_length = (info->index_format ? 4 : 2)
-    * (static_cast<uint32_t>(info->num_glyphs) + 1);
-  if (PREDICT_FALSE(loca_table->dst_length != expected_loca_dst_length)) {
-    return FONT_COMPRESSION_FAILURE();
-  }
+  Buffer n_contour_stream;
+  Buffer n_points_stream;
+  Buffer flag_stream;
+  Buffer glyph_stream;
+  Buffer composite_stream;
+  Buffer bbox_stream;
+  Buffer instruction_stream;
+};
 
-  unsigned int offset = (2 + kNumSubStreams) * 4;
-  if (PREDICT_FALSE(offset > glyf_table->transform_length)) {
-    return FONT_COMPRESSION_FAILURE();
-  }
-  // Invariant from here on: data_size >= offset
-  for (int i = 0; i < kNumSubStreams; ++i) {
-    uint32_t substream_size;
-    if (PREDICT_FALSE(!file.ReadU32(&substream_size))) {
-      return FONT_COMPRESSION_FAILURE();
-    }
-    if (PREDICT_FALSE(substream_size > glyf_table->transform_length - offset)) {
-      return FONT_COMPRESSION_FAILURE();
-    }
-    substreams[i] = std::make_pair(data + offset, substream_size);
-    offset += substream_size;
+// Per-glyph bitmaps of a transformed glyf table.
+struct GlyfBitmaps {
+  const uint8_t* bbox_bitmap;
+  const uint8_t* overlap_bitmap;  // nullptr if absent
+
+  bool HasBbox(unsigned int i) const {
+    return bbox_bitmap[i >> 3] & (0x80 >> (i & 7));
   }
-  Buffer n_contour_stream(substreams[0].first, substreams[0].second);
-  Buffer n_points_stream(substreams[1].first, substreams[1].second);
-  Buffer flag_stream(substreams[2].first, substreams[2].second);
-  Buffer glyph_stream(substreams[3].first, substreams[3].second);
-  Buffer composite_stream(substreams[4].first, substreams[4].second);
-  Buffer bbox_stream(substreams[5].first, substreams[5].second);
-  Buffer instruction_stream(substreams[6].first, substreams[6].second);
 
-  const uint8_t* overlap_bitmap = nullptr;
-  unsigned int overlap_bitmap_length = 0;
-  if (has_overlap_bitmap) {
-    overlap_bitmap_length = (info->num_glyphs + 7) >> 3;
-    overlap_bitmap = data + offset;
-    if (PREDICT_FALSE(overlap_bitmap_length >
-                           glyf_table->transform_length - offset)) {
-      return FONT_COMPRESSION_FAILURE();
-    }
+  bool HasOverlapBit(unsigned int i) const {
+    return overlap_bitmap && overlap_bitmap[i >> 3] & (0x80 >> (i & 7));
   }
+};
+
+// Temp buffers reused from one glyph to the next.
+struct GlyphScratch {
+  GlyphScratch()
+      : glyph_buf_size(kDefaultGlyphBuf),
+        glyph_buf(new uint8_t[kDefaultGlyphBuf]), points_size(0) {}
 
-  std::vector<uint32_t> loca_values(info->num_glyphs + 1);
+  size_t glyph_buf_size;
+  std::unique_ptr<uint8_t[]> glyph_buf;
   std::vector<unsigned int> n_points_vec;
   std::unique_ptr<Point[]> points;
-  size_t points_size = 0;
-  const uint8_t* bbox_bitmap = bbox_stream.buffer();
-  // Safe because num_glyphs is bounded
-  unsigned int bitmap_length = ((info->num_glyphs + 31) >> 5) << 2;
-  if (!bbox_stream.Skip(bitmap_length)) {
+  std::unique_ptr<uint8_t[]> coords;  // 4 bytes per point, for StorePoints
+  size_t points_size;
+};
+
+// Rebuilds glyph i into scratch->glyph_buf from the current positions in
+// the substreams, and advances them past it.
+bool DecodeGlyph(unsigned int i, const GlyfBitmaps& bitmaps,
+                 GlyfStreams* streams, GlyphScratch* scratch,
+                 size_t* glyph_size_out, int16_t* x_min) {
+  size_t glyph_size = 0;
+  uint16_t n_contours = 0;
+  const bool have_bbox = bitmaps.HasBbox(i);
+  if (PREDICT_FALSE(!streams->n_contour_stream.ReadU16(&n_contours))) {
     return FONT_COMPRESSION_FAILURE();
   }
 
-  // Temp buffer for glyph's.
-  size_t glyph_buf_size = kDefaultGlyphBuf;
-  std::unique_ptr<uint8_t[]> glyph_buf(new uint8_t[glyph_buf_size]);
-
-  info->x_mins.resize(info->num_glyphs);
-  for (unsigned int i = 0; i < info->num_glyphs; ++i) {
-    size_t glyph_size = 0;
-    uint16_t n_contours = 0;
-    bool have_bbox = false;
-    if (bbox_bitmap[i >> 3] & (0x80 >> (i & 7))) {
-      have_bbox = true;
-    }
-    if (PREDICT_FALSE(!n_contour_stream.ReadU16(&n_contours))) {
+  if (n_contours == 0xffff) {
+    // composite glyph
+    bool have_instructions = false;
+    unsigned int instruction_size = 0;
+    if (PREDICT_FALSE(!have_bbox)) {
+      // composite glyphs must have an explicit bbox
       return FONT_COMPRESSION_FAILURE();
     }
 
-    if (n_contours == 0xffff) {
-      // composite glyph
-      bool have_instructions = false;
-      unsigned int instruction_size = 0;
-      if (PREDICT_FALSE(!have_bbox)) {
-        // composite glyphs must have an explicit bbox
+    size_t composite_size;
+    if (PREDICT_FALSE(!SizeOfComposite(streams->composite_stream,
+                                       &composite_size, &have_instructions))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    if (have_instructions) {
+      if (PREDICT_FALSE(!Read255UShort(&streams->glyph_stream,
+                                       &instruction_size))) {
         return FONT_COMPRESSION_FAILURE();
       }
+    }
 
-      size_t composite_size;
-      if (PREDICT_FALSE(!SizeOfComposite(composite_stream, &composite_size,
-                                         &have_instructions))) {
-        return FONT_COMPRESSION_FAILURE();
-      }
-      if (have_instructions) {
-        if (PREDICT_FALSE(!Read255UShort(&glyph_stream, &instruction_size))) {
-          return FONT_COMPRESSION_FAILURE();
-        }
-      }
+    size_t size_needed = 12 + composite_size + instruction_size;
+    if (PREDICT_FALSE(scratch->glyph_buf_size < size_needed)) {
+      scratch->glyph_buf.reset(new uint8_t[size_needed]);
+      scratch->glyph_buf_size = size_needed;
+    }
+    uint8_t* glyph_buf = scratch->glyph_buf.get();
 
-      size_t size_needed = 12 + composite_size + instruction_size;
-      if (PREDICT_FALSE(glyph_buf_size < size_needed)) {
-        glyph_buf.reset(new uint8_t[size_needed]);
-        glyph_buf_size = size_needed;
-      }
+    glyph_size = Store16(glyph_buf, glyph_size, n_contours);
+    if (PREDICT_FALSE(!streams->bbox_stream.Read(glyph_buf + glyph_size, 8))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    glyph_size += 8;
 
-      glyph_size = Store16(glyph_buf.get(), glyph_size, n_contours);
-      if (PREDICT_FALSE(!bbox_stream.Read(glyph_buf.get() + glyph_size, 8))) {
+    if (PREDICT_FALSE(!streams->composite_stream.Read(glyph_buf + glyph_size,
+          composite_size))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    glyph_size += composite_size;
+    if (have_instructions) {
+      glyph_size = Store16(glyph_buf, glyph_size, instruction_size);
+      if (PREDICT_FALSE(!streams->instruction_stream.Read(
+            glyph_buf + glyph_size, instruction_size))) {
         return FONT_COMPRESSION_FAILURE();
       }
-      glyph_size += 8;
+      glyph_size += instruction_size;
+    }
+  } else if (n_contours > 0) {
+    // simple glyph
+    std::vector<unsigned int>& n_points_vec = scratch->n_points_vec;
+    if (n_points_vec.size() < n_contours) {
+      n_points_vec.resize(n_contours);
+    }
+    uint64_t n_points_sum;
+    if (PREDICT_FALSE(!Read255UShortN(&streams->n_points_stream, n_contours,
+                                      n_points_vec.data(), &n_points_sum) ||
+                      n_points_sum >= (1 << 27))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    const unsigned int total_n_points = n_points_sum;
+    Buffer& flag_stream = streams->flag_stream;
+    Buffer& glyph_stream = streams->glyph_stream;
+    unsigned int flag_size = total_n_points;
+    if (PREDICT_FALSE(
+        flag_size > flag_stream.length() - flag_stream.offset())) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    const uint8_t* flags_buf = flag_stream.buffer() + flag_stream.offset();
+    const uint8_t* triplet_buf = glyph_stream.buffer() +
+      glyph_stream.offset();
+    size_t triplet_size = glyph_stream.length() - glyph_stream.offset();
+    size_t triplet_bytes_consumed = 0;
+    if (scratch->points_size < total_n_points) {
+      scratch->points_size = total_n_points;
+      scratch->points.reset(new Point[total_n_points]);
+      scratch->coords.reset(new uint8_t[4 * total_n_points]);
+    }
+    Point* points = scratch->points.get();
+    if (PREDICT_FALSE(!TripletDecode(flags_buf, triplet_buf, triplet_size,
+        total_n_points, points, &triplet_bytes_consumed))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    if (PREDICT_FALSE(!flag_stream.Skip(flag_size))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    if (PREDICT_FALSE(!glyph_stream.Skip(triplet_bytes_consumed))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    unsigned int instruction_size;
+    if (PREDICT_FALSE(!Read255UShort(&glyph_stream, &instruction_size))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
 
-      if (PREDICT_FALSE(!composite_stream.Read(glyph_buf.get() + glyph_size,
-            composite_size))) {
-        return FONT_COMPRESSION_FAILURE();
-      }
-      glyph_size += composite_size;
-      if (have_instructions) {
-        glyph_size = Store16(glyph_buf.get(), glyph_size, instruction_size);
-        if (PREDICT_FALSE(!instruction_stream.Read(glyph_buf.get() + glyph_size,
-              instruction_size))) {
-          return FONT_COMPRESSION_FAILURE();
-        }
-        glyph_size += instruction_size;
-      }
-    } else if (n_contours > 0) {
-      // simple glyph
-      n_points_vec.clear();
-      unsigned int total_n_points = 0;
-      unsigned int n_points_contour;
-      for (unsigned int j = 0; j < n_contours; ++j) {
-        if (PREDICT_FALSE(
-            !Read255UShort(&n_points_stream, &n_points_contour))) {
-          return FONT_COMPRESSION_FAILURE();
-        }
-        n_points_vec.push_back(n_points_contour);
-        if (PREDICT_FALSE(total_n_points + n_points_contour < total_n_points)) {
-          return FONT_COMPRESSION_FAILURE();
-        }
-        total_n_points += n_points_contour;
-      }
-      unsigned int flag_size = total_n_points;
-      if (PREDICT_FALSE(
-          flag_size > flag_stream.length() - flag_stream.offset())) {
-        return FONT_COMPRESSION_FAILURE();
-      }
-      const uint8_t* flags_buf = flag_stream.buffer() + flag_stream.offset();
-      const uint8_t* triplet_buf = glyph_stream.buffer() +
-        glyph_stream.offset();
-      size_t triplet_size = glyph_stream.length() - glyph_stream.offset();
-      size_t triplet_bytes_consumed = 0;
-      if (points_size < total_n_points) {
-        points_size = total_n_points;
-        points.reset(new Point[points_size]);
-      }
-      if (PREDICT_FALSE(!TripletDecode(flags_buf, triplet_buf, triplet_size,
-          total_n_points, points.get(), &triplet_bytes_consumed))) {
-        return FONT_COMPRESSION_FAILURE();
-      }
-      if (PREDICT_FALSE(!flag_stream.Skip(flag_size))) {
-        return FONT_COMPRESSION_FAILURE();
-      }
-      if (PREDICT_FALSE(!glyph_stream.Skip(triplet_bytes_consumed))) {
-        return FONT_COMPRESSION_FAILURE();
-      }
-      unsigned int instruction_size;
-      if (PREDICT_FALSE(!Read255UShort(&glyph_stream, &instruction_size))) {
-        return FONT_COMPRESSION_FAILURE();
-      }
+    if (PREDICT_FALSE(instruction_size >= (1 << 30))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    size_t size_needed = 12 + 2 * n_contours + 5 * total_n_points
+                         + instruction_size;
+    if (PREDICT_FALSE(scratch->glyph_buf_size < size_needed)) {
+      scratch->glyph_buf.reset(new uint8_t[size_needed]);
+      scratch->glyph_buf_size = size_needed;
+    }
+    uint8_t* glyph_buf = scratch->glyph_buf.get();
 
-      if (PREDICT_FALSE(total_n_points >= (1 << 27)
-                        || instruction_size >= (1 << 30))) {
+    glyph_size = Store16(glyph_buf, glyph_size, n_contours);
+    // Without an explicit bbox, StorePoints computes it.
+    if (have_bbox) {
+      if (PREDICT_FALSE(!streams->bbox_stream.Read(glyph_buf + glyph_size,
+                                                   8))) {
         return FONT_COMPRESSION_FAILURE();
       }
-      size_t size_needed = 12 + 2 * n_contours + 5 * total_n_points
-                           + instruction_size;
-      if (PREDICT_FALSE(glyph_buf_size < size_needed)) {
-        glyph_buf.reset(new uint8_t[size_needed]);
-        glyph_buf_size = size_needed;
-      }
-
-      glyph_size = Store16(glyph_buf.get(), glyph_size, n_contours);
-      if (have_bbox) {
-        if (PREDICT_FALSE(!bbox_stream.Read(glyph_buf.get() + glyph_size, 8))) {
-          return FONT_COMPRESSION_FAILURE();
-        }
-      } else {
-        ComputeBbox(total_n_points, points.get(), glyph_buf.get());
-      }
-      glyph_size = kEndPtsOfContoursOffset;
-      int end_point = -1;
-      for (unsigned int contour_ix = 0; contour_ix < n_contours; ++contour_ix) {
-        end_point += n_points_vec[contour_ix];
-        if (PREDICT_FALSE(end_point >= 65536)) {
-          return FONT_COMPRESSION_FAILURE();
-        }
-        glyph_size = Store16(glyph_buf.get(), glyph_size, end_point);
-      }
-
-      glyph_size = Store16(glyph_buf.get(), glyph_size, instruction_size);
-      if (PREDICT_FALSE(!instruction_stream.Read(glyph_buf.get() + glyph_size,
-                                                 instruction_size))) {
+    }
+    glyph_size = kEndPtsOfContoursOffset;
+    int end_point = -1;
+    for (unsigned int contour_ix = 0; contour_ix < n_contours; ++contour_ix) {
+      end_point += n_points_vec[contour_ix];
+      if (PREDICT_FALSE(end_point >= 65536)) {
         return FONT_COMPRESSION_FAILURE();
       }
-      glyph_size += instruction_size;
+      glyph_size = Store16(glyph_buf, glyph_size, end_point);
+    }
 
-      bool has_overlap_bit =
-          has_overlap_bitmap && overlap_bitmap[i >> 3] & (0x80 >> (i & 7));
+    glyph_size = Store16(glyph_buf, glyph_size, instruction_size);
+    if (PREDICT_FALSE(!streams->instruction_stream.Read(glyph_buf + glyph_size,
+                                                        instruction_size))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    glyph_size += instruction_size;
 
-      if (PREDICT_FALSE(!StorePoints(
-              total_n_points, points.get(), n_contours, instruction_size,
-              has_overlap_bit, glyph_buf.get(), glyph_buf_size, &glyph_size))) {
-        return FONT_COMPRESSION_FAILURE();
-      }
-    } else {
-      // n_contours == 0; empty glyph. Must NOT have a bbox.
-      if (PREDICT_FALSE(have_bbox)) {
+    if (PREDICT_FALSE(!StorePoints(
+            total_n_points, points, n_contours, instruction_size,
+            bitmaps.HasOverlapBit(i), !have_bbox, scratch->coords.get(),
+            glyph_buf, scratch->glyph_buf_size, &glyph_size))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+  } else {
+    // n_contours == 0; empty glyph. Must NOT have a bbox.
+    if (PREDICT_FALSE(have_bbox)) {
 #ifdef FONT_COMPRESSION_BIN
-        fprintf(stderr, "Empty glyph has a bbox\n");
+      fprintf(stderr, "Empty glyph has a bbox\n");
 #endif
-        return FONT_COMPRESSION_FAILURE();
-      }
-    }
-
-    loca_values[i] = out->Size() - glyf_start;
-    if (PREDICT_FALSE(!out->Write(glyph_buf.get(), glyph_size))) {
       return FONT_COMPRESSION_FAILURE();
     }
+  }
 
-    // TODO(user) Old code aligned glyphs ... but do we actually need to?
-    if (PREDICT_FALSE(!Pad4(out))) {
+  // We may need x_min to reconstruct 'hmtx'
+  if (n_contours > 0) {
+    Buffer x_min_buf(scratch->glyph_buf.get() + 2, 2);
+    if (PREDICT_FALSE(!x_min_buf.ReadS16(x_min))) {
       return FONT_COMPRESSION_FAILURE();
     }
+  }
+  *glyph_size_out = glyph_size;
+  return true;
+}
 
-    *glyf_checksum += ComputeULongSum(glyph_buf.get(), glyph_size);
+// Advances the substreams past glyph i the way DecodeGlyph would, without
+// decoding any points. Triplet sizes only depend on the flags, so this is
+// much cheaper than decoding and lets glyph ranges be rebuilt independently.
+bool SkipGlyph(unsigned int i, const GlyfBitmaps& bitmaps,
+               GlyfStreams* streams) {
+  uint16_t n_contours = 0;
+  const bool have_bbox = bitmaps.HasBbox(i);
+  if (PREDICT_FALSE(!streams->n_contour_stream.ReadU16(&n_contours))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
 
-    // We may need x_min to reconstruct 'hmtx'
-    if (n_contours > 0) {
-      Buffer x_min_buf(glyph_buf.get() + 2, 2);
-      if (PREDICT_FALSE(!x_min_buf.ReadS16(&info->x_mins[i]))) {
+  unsigned int instruction_size = 0;
+  if (n_contours == 0xffff) {
+    bool have_instructions = false;
+    size_t composite_size;
+    if (PREDICT_FALSE(!have_bbox ||
+                      !SizeOfComposite(streams->composite_stream,
+                                       &composite_size, &have_instructions) ||
+                      !streams->composite_stream.Skip(composite_size))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    if (have_instructions) {
+      if (PREDICT_FALSE(!Read255UShort(&streams->glyph_stream,
+                                       &instruction_size))) {
         return FONT_COMPRESSION_FAILURE();
       }
     }
+  } else if (n_contours > 0) {
+    uint64_t total_n_points;
+    Buffer& flag_stream = streams->flag_stream;
+    if (PREDICT_FALSE(!Read255UShortN(&streams->n_points_stream, n_contours,
+                                      NULL, &total_n_points) ||
+        total_n_points > flag_stream.length() - flag_stream.offset())) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    const uint8_t* flags = flag_stream.buffer() + flag_stream.offset();
+    const TripletEncoding* encodings = TripletEncodings();
+    size_t triplet_bytes = 0;
+    for (unsigned int j = 0; j < total_n_points; ++j) {
+      triplet_bytes += encodings[flags[j] & 0x7f].n_data_bytes;
+    }
+    if (PREDICT_FALSE(!flag_stream.Skip(total_n_points) ||
+                      !streams->glyph_stream.Skip(triplet_bytes) ||
+                      !Read255UShort(&streams->glyph_stream,
+                                     &instruction_size))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+  } else if (PREDICT_FALSE(have_bbox)) {
+    return FONT_COMPRESSION_FAILURE();
   }
 
-  // glyf_table dst_offset was set by ReconstructFont
-  glyf_table->dst_length = out->Size() - glyf_table->dst_offset;
-  loca_table->dst_offset = out->Size();
-  // loca[n] will be equal the length of the glyph data ('glyf') table
-  loca_values[info->num_glyphs] = glyf_table->dst_length;
-  if (PREDICT_FALSE(!StoreLoca(loca_values, info->index_format, loca_checksum,
-      out))) {
+  if (have_bbox && PREDICT_FALSE(!streams->bbox_stream.Skip(8))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  if (PREDICT_FALSE(!streams->instruction_stream.Skip(instruction_size))) {
     return FONT_COMPRESSION_FAILURE();
   }
-  loca_table->dst_length = out->Size() - loca_table->dst_offset;
-
   return true;
 }
 
-Table* FindTable(std::vector<Table*>* tables, uint32_t tag) {
-  for (Table* table : *tables) {
-    if (table->tag == tag) {
-      return table;
-    }
-  }
+// A run of consecutive glyphs rebuilt by one thread into its own buffer.
+struct GlyphRange {
+  unsigned int begin;
+  unsigned int end;
+  size_t stream_offsets[kNumGlyfSubStreams];  // substream positions at begin
+  std::vector<uint8_t> data;  // the glyphs, each padded to 4 bytes
+  std::vector<uint32_t> glyph_offsets;  // offset of each glyph within data
+  uint32_t checksum;
+  bool ok;
+};
+
+bool DecodeGlyphRange(const std::pair<const uint8_t*, size_t>* substreams,
+                      const GlyfBitmaps& bitmaps, GlyphScratch* scratch,
+                      WOFF2FontInfo* info, GlyphRange* range) {
+  GlyfStreams streams(substreams);
+  if (PREDICT_FALSE(!streams.Seek(range->stream_offsets))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  range->glyph_offsets.resize(range->end - range->begin);
+  range->checksum = 0;
+  for (unsigned int i = range->begin; i < range->end; ++i) {
+    size_t glyph_size;
+    if (PREDICT_FALSE(!DecodeGlyph(i, bitmaps, &streams, scratch, &glyph_size,
+                                   &info->x_mins[i]))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    const uint8_t* glyph_buf = scratch->glyph_buf.get();
+    range->glyph_offsets[i - range->begin] = range->data.size();
+    range->data.insert(range->data.end(), glyph_buf, glyph_buf + glyph_size);
+    range->data.resize(Round4(range->data.size()));
+    range->checksum += ComputeULongSum(glyph_buf, glyph_size);
+  }
+  return true;
+}
+
+// Rebuilds all glyphs on up to num_threads threads. The substreams are
+// walked once up front to find where each range starts; the ranges are then
+// decoded concurrently and written out in order.
+bool DecodeGlyphsParallel(const std::pair<const uint8_t*, size_t>* substreams,
+                          const GlyfBitmaps& bitmaps, GlyfStreams* streams,
+                          unsigned int num_threads, WOFF2FontInfo* info,
+                          uint32_t* glyf_checksum,
+                          std::vector<uint32_t>* loca_values,
+                          size_t glyf_start, WOFF2Out* out) {
+  const unsigned int num_glyphs = info->num_glyphs;
+  // A few ranges per thread evens out glyphs of very different complexity.
+  const unsigned int num_ranges = std::min(num_threads * 4, num_glyphs);
+  std::vector<GlyphRange> ranges(num_ranges);
+  unsigned int i = 0;
+  for (unsigned int r = 0; r < num_ranges; ++r) {
+    GlyphRange& range = ranges[r];
+    range.begin = i;
+    range.end = static_cast<uint64_t>(num_glyphs) * (r + 1) / num_ranges;
+    range.ok = false;
+    streams->Tell(range.stream_offsets);
+    for (; i < range.end; ++i) {
+      if (PREDICT_FALSE(!SkipGlyph(i, bitmaps, streams))) {
+        return FONT_COMPRESSION_FAILURE();
+      }
+    }
+  }
+
+  std::atomic<unsigned int> next_range(0);
+  auto worker = [&]() {
+    GlyphScratch scratch;
+    for (unsigned int r = next_range++; r < num_ranges; r = next_range++) {
+      ranges[r].ok = DecodeGlyphRange(substreams, bitmaps, &scratch, info,
+                                      &ranges[r]);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned int t = 1; t < num_threads; ++t) {
+    try {
+      threads.emplace_back(worker);
+    } catch (const std::system_error&) {
+      break;  // carry on with the threads we have
+    }
+  }
+  worker();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  for (const GlyphRange& range : ranges) {
+    if (PREDICT_FALSE(!range.ok)) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    const size_t range_start = out->Size() - glyf_start;
+    for (unsigned int i = range.begin; i < range.end; ++i) {
+      (*loca_values)[i] = range_start + range.glyph_offsets[i - range.begin];
+    }
+    if (!range.data.empty() &&
+        PREDICT_FALSE(!out->Write(&range.data[0], range.data.size()))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    *glyf_checksum += range.checksum;
+  }
+  return true;
+}
+
+// Number of threads worth using to rebuild a glyf table.
+unsigned int GlyfThreads(const WOFF2DecodeParams& params,
+                         unsigned int num_glyphs) {
+  unsigned int num_threads = params.num_threads > 0 ?
+      params.num_threads : std::thread::hardware_concurrency();
+  return std::max(1u, std::min(num_threads, num_glyphs / kMinGlyphsPerThread));
+}
+
+// Recycles the memory Brotli asks for, so a decoder reused for many fonts
+// stops going to malloc once it has seen its largest window.
+class BrotliPool {
+ public:
+  BrotliPool() {}
+  ~BrotliPool() { Release(); }
+
+  static void* Alloc(void* opaque, size_t size);
+  static void Free(void* opaque, void* address);
+
+  // Returns all pooled blocks to the system.
+  void Release();
+
+ private:
+  BrotliPool(const BrotliPool&) = delete;
+  BrotliPool& operator=(const BrotliPool&) = delete;
+
+  // Every block starts with its usable size, padded to keep alignment.
+  static const size_t kHeaderSize = alignof(std::max_align_t);
+
+  std::vector<uint8_t*> free_blocks_;
+};
+
+void* BrotliPool::Alloc(void* opaque, size_t size) {
+  BrotliPool* pool = static_cast<BrotliPool*>(opaque);
+  // Best fit, so a small table never takes the ring buffer's block.
+  size_t best = pool->free_blocks_.size();
+  size_t best_size = std::numeric_limits<size_t>::max();
+  for (size_t i = 0; i < pool->free_blocks_.size(); ++i) {
+    size_t block_size;
+    memcpy(&block_size, pool->free_blocks_[i], sizeof(block_size));
+    if (block_size >= size && block_size < best_size) {
+      best = i;
+      best_size = block_size;
+    }
+  }
+  uint8_t* block;
+  if (best < pool->free_blocks_.size()) {
+    block = pool->free_blocks_[best];
+    pool->free_blocks_[best] = pool->free_blocks_.back();
+    pool->free_blocks_.pop_back();
+  } else {
+    if (PREDICT_FALSE(size > std::numeric_limits<size_t>::max() -
+                             kHeaderSize)) {
+      return NULL;
+    }
+    block = static_cast<uint8_t*>(malloc(kHeaderSize + size));
+    if (PREDICT_FALSE(block == NULL)) {
+      return NULL;
+    }
+    memcpy(block, &size, sizeof(size));
+  }
+  return block + kHeaderSize;
+}
+
+void BrotliPool::Free(void* opaque, void* address) {
+  if (address == NULL) {
+    return;
+  }
+  BrotliPool* pool = static_cast<BrotliPool*>(opaque);
+  pool->free_blocks_.push_back(static_cast<uint8_t*>(address) - kHeaderSize);
+}
+
+void BrotliPool::Release() {
+  for (uint8_t* block : free_blocks_) {
+    free(block);
+  }
+  std::vector<uint8_t*>().swap(free_blocks_);
+}
+
+// glyf and loca of a font of a collection, rebuilt ahead of the other
+// tables on a thread of their own. They don't depend on where they end up
+// in the output: loca offsets are relative to glyf, and glyf always starts
+// 4-aligned.
+struct PrebuiltGlyf {
+  PrebuiltGlyf() : ready(false), glyf_checksum(0), loca_checksum(0) {}
+
+  bool ready;
+  std::string data;  // glyf, then loca
+  Table glyf_table;  // with dst_offset 0
+  Table loca_table;
+  uint32_t glyf_checksum;
+  uint32_t loca_checksum;
+  WOFF2FontInfo info;  // num_glyphs, index_format and x_mins
+};
+
+// Settings and buffers used while decoding. WOFF2Decoder keeps one alive
+// between fonts so that the buffers are only allocated once.
+struct DecodeContext {
+  explicit DecodeContext(const WOFF2DecodeParams& params)
+      : params(params), brotli_pool(NULL), reference_tables(false) {}
+
+  // Gets ready for the next font, keeping allocated memory.
+  void Clear();
+
+  WOFF2DecodeParams params;
+  WOFF2Header hdr;
+  RebuildMetadata metadata;
+  std::vector<uint8_t> uncompressed_buf;
+  GlyphScratch glyph_scratch;
+  std::vector<uint32_t> loca_values;
+  // By font index, for collections rebuilt on several threads.
+  std::vector<PrebuiltGlyf> prebuilt_glyf;
+  BrotliPool* brotli_pool;  // NULL to let Brotli use malloc
+  // Whether untransformed tables go to WOFF2Out::WriteReference, for when
+  // uncompressed_buf outlives the output's use of it.
+  bool reference_tables;
+};
+
+void DecodeContext::Clear() {
+  for (WOFF2FontInfo& info : metadata.font_infos) {
+    info.num_glyphs = 0;
+    info.index_format = 0;
+    info.num_hmetrics = 0;
+    info.x_mins.clear();
+    info.table_entry_by_tag.clear();
+  }
+  prebuilt_glyf.clear();
+}
+
+// Header of a transformed glyf table and where its substreams are.
+struct TransformedGlyf {
+  uint16_t num_glyphs;
+  uint16_t index_format;
+  std::pair<const uint8_t*, size_t> substreams[kNumGlyfSubStreams];
+  GlyfBitmaps bitmaps;
+  // Size of the bbox bitmap at the start of the bbox substream.
+  size_t bbox_bitmap_length;
+};
+
+// Parses the header of the transformed glyf table in data and checks that
+// all the substreams and bitmaps fit.
+bool ReadTransformedGlyf(const uint8_t* data, size_t length,
+                         TransformedGlyf* glyf) {
+  Buffer file(data, length);
+  uint16_t version;
+  if (PREDICT_FALSE(!file.ReadU16(&version))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+
+  uint16_t flags;
+  if (PREDICT_FALSE(!file.ReadU16(&flags))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  bool has_overlap_bitmap = (flags & FLAG_OVERLAP_SIMPLE_BITMAP);
+
+  if (PREDICT_FALSE(!file.ReadU16(&glyf->num_glyphs) ||
+      !file.ReadU16(&glyf->index_format))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+
+  unsigned int offset = (2 + kNumGlyfSubStreams) * 4;
+  if (PREDICT_FALSE(offset > length)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  // Invariant from here on: data_size >= offset
+  for (int i = 0; i < kNumGlyfSubStreams; ++i) {
+    uint32_t substream_size;
+    if (PREDICT_FALSE(!file.ReadU32(&substream_size))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    if (PREDICT_FALSE(substream_size > length - offset)) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    glyf->substreams[i] = std::make_pair(data + offset, substream_size);
+    offset += substream_size;
+  }
+
+  glyf->bitmaps.overlap_bitmap = nullptr;
+  if (has_overlap_bitmap) {
+    unsigned int overlap_bitmap_length = (glyf->num_glyphs + 7) >> 3;
+    glyf->bitmaps.overlap_bitmap = data + offset;
+    if (PREDICT_FALSE(overlap_bitmap_length > length - offset)) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+  }
+
+  glyf->bitmaps.bbox_bitmap = glyf->substreams[5].first;
+  // Safe because num_glyphs is bounded
+  glyf->bbox_bitmap_length = ((glyf->num_glyphs + 31) >> 5) << 2;
+  if (PREDICT_FALSE(glyf->bbox_bitmap_length > glyf->substreams[5].second)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  return true;
+}
+
+// Reads the header of the transformed glyf table in data, checks loca
+// against it and sizes the per-glyph state.
+bool BeginGlyf(const uint8_t* data, const Table& glyf_table,
+               const Table& loca_table, WOFF2FontInfo* info,
+               DecodeContext* ctx, TransformedGlyf* glyf) {
+  if (PREDICT_FALSE(!ReadTransformedGlyf(data, glyf_table.transform_length,
+                                         glyf))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  info->num_glyphs = glyf->num_glyphs;
+  info->index_format = glyf->index_format;
+
+  // https://dev.w3.org/webfonts/WOFF2/spec/#conform-mustRejectLoca
+  // dst_length here is origLength in the spec
+  uint32_t expected_loca_dst_length = (info->index_format ? 4 : 2)
+    * (static_cast<uint32_t>(info->num_glyphs) + 1);
+  if (PREDICT_FALSE(loca_table.dst_length != expected_loca_dst_length)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  ctx->loca_values.resize(info->num_glyphs + 1);
+  info->x_mins.resize(info->num_glyphs);
+  return true;
+}
+
+// Rebuilds glyph i at the end of out, the glyf table starting at glyf_start.
+bool WriteGlyph(unsigned int i, const GlyfBitmaps& bitmaps,
+                GlyfStreams* streams, size_t glyf_start, WOFF2FontInfo* info,
+                DecodeContext* ctx, uint32_t* glyf_checksum, WOFF2Out* out) {
+  GlyphScratch& scratch = ctx->glyph_scratch;
+  size_t glyph_size = 0;
+  if (PREDICT_FALSE(!DecodeGlyph(i, bitmaps, streams, &scratch, &glyph_size,
+                                 &info->x_mins[i]))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+
+  ctx->loca_values[i] = out->Size() - glyf_start;
+  // TODO(user) Old code aligned glyphs ... but do we actually need to?
+  const size_t glyph_end = out->Size() + glyph_size;
+  const WOFF2Span pieces[2] = {{scratch.glyph_buf.get(), glyph_size},
+                               {kZeroes, Round4(glyph_end) - glyph_end}};
+  if (PREDICT_FALSE(!out->WriteV(pieces, 2))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+
+  *glyf_checksum += ComputeULongSum(scratch.glyph_buf.get(), glyph_size);
+  return true;
+}
+
+// Writes loca once all the glyphs are out.
+bool FinishGlyf(Table* glyf_table, Table* loca_table,
+                uint32_t* loca_checksum, const WOFF2FontInfo& info,
+                DecodeContext* ctx, WOFF2Out* out) {
+  // glyf_table dst_offset was set by ReconstructNextTable
+  glyf_table->dst_length = out->Size() - glyf_table->dst_offset;
+  loca_table->dst_offset = out->Size();
+  // loca[n] will be equal the length of the glyph data ('glyf') table
+  ctx->loca_values[info.num_glyphs] = glyf_table->dst_length;
+  if (PREDICT_FALSE(!StoreLoca(ctx->loca_values, info.index_format,
+                               loca_checksum, out))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  loca_table->dst_length = out->Size() - loca_table->dst_offset;
+  return true;
+}
+
+// Reconstruct entire glyf table based on transformed original
+bool ReconstructGlyf(const uint8_t* data, Table* glyf_table,
+                     uint32_t* glyf_checksum, Table * loca_table,
+                     uint32_t* loca_checksum, WOFF2FontInfo* info,
+                     DecodeContext* ctx, WOFF2Out* out) {
+  const size_t glyf_start = out->Size();
+  TransformedGlyf glyf;
+  if (PREDICT_FALSE(!BeginGlyf(data, *glyf_table, *loca_table, info, ctx,
+                               &glyf))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+
+  const std::pair<const uint8_t*, size_t>* substreams = glyf.substreams;
+  const GlyfBitmaps& bitmaps = glyf.bitmaps;
+  GlyfStreams streams(substreams);
+  if (!streams.bbox_stream.Skip(glyf.bbox_bitmap_length)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+
+  const unsigned int num_threads = GlyfThreads(ctx->params, info->num_glyphs);
+  // Ranges are padded on their own, so the table must start 4-aligned.
+  if (num_threads > 1 && glyf_start % 4 == 0) {
+    if (PREDICT_FALSE(!DecodeGlyphsParallel(substreams, bitmaps, &streams,
+                                            num_threads, info, glyf_checksum,
+                                            &ctx->loca_values, glyf_start,
+                                            out))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+  } else {
+    for (unsigned int i = 0; i < info->num_glyphs; ++i) {
+      if (PREDICT_FALSE(!WriteGlyph(i, bitmaps, &streams, glyf_start, info,
+                                    ctx, glyf_checksum, out))) {
+        return FONT_COMPRESSION_FAILURE();
+      }
+    }
+  }
+
+  return FinishGlyf(glyf_table, loca_table, loca_checksum, *info, ctx, out);
+}
+
+// Where a glyf table rebuilt a few glyphs at a time stands.
+struct GlyfProgress {
+  GlyfProgress(const TransformedGlyf& transformed, size_t start)
+      : glyf(transformed), streams(glyf.substreams), next_glyph(0),
+        glyf_start(start) {}
+
+  TransformedGlyf glyf;
+  GlyfStreams streams;
+  unsigned int next_glyph;
+  size_t glyf_start;
+};
+
+// Work left to a WOFF2StreamDecoder::Step() call: bytes to decompress or
+// write, and glyphs to rebuild.
+struct WorkBudget {
+  size_t bytes;
+  size_t glyphs;
+
+  bool Exhausted() const { return bytes == 0 || glyphs == 0; }
+  void SpendBytes(size_t n) { bytes -= std::min(bytes, n); }
+};
+
+// As ReconstructGlyf, rebuilding glyphs until the budget runs out. *progress
+// keeps the place from one call to the next, starting from NULL; *done is
+// set once glyf and loca are complete.
+bool ReconstructGlyfSlice(const uint8_t* data, Table* glyf_table,
+                          uint32_t* glyf_checksum, Table* loca_table,
+                          uint32_t* loca_checksum, WOFF2FontInfo* info,
+                          DecodeContext* ctx, WorkBudget* budget,
+                          std::unique_ptr<GlyfProgress>* progress,
+                          bool* done, WOFF2Out* out) {
+  *done = false;
+  if (!*progress) {
+    TransformedGlyf transformed;
+    if (PREDICT_FALSE(!BeginGlyf(data, *glyf_table, *loca_table, info, ctx,
+                                 &transformed))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    progress->reset(new GlyfProgress(transformed, out->Size()));
+    if (!(*progress)->streams.bbox_stream.Skip(
+            transformed.bbox_bitmap_length)) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+  }
+  GlyfProgress* glyf = progress->get();
+  while (glyf->next_glyph < info->num_glyphs) {
+    if (budget->Exhausted()) {
+      return true;
+    }
+    const size_t size_before = out->Size();
+    if (PREDICT_FALSE(!WriteGlyph(glyf->next_glyph, glyf->glyf.bitmaps,
+                                  &glyf->streams, glyf->glyf_start, info, ctx,
+                                  glyf_checksum, out))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    ++glyf->next_glyph;
+    --budget->glyphs;
+    budget->SpendBytes(out->Size() - size_before);
+  }
+  if (PREDICT_FALSE(!FinishGlyf(glyf_table, loca_table, loca_checksum, *info,
+                                ctx, out))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  budget->SpendBytes(loca_table->dst_length);
+  progress->reset();
+  *done = true;
+  return true;
+}
+
+Table* FindTable(std::vector<Table*>* tables, uint32_t tag) {
+  for (Table* table : *tables) {
+    if (table->tag == tag) {
+      return table;
+    }
+  }
   return NULL;
 }
 
@@ -712,8 +1402,6 @@ bool ReconstructTransformedHmtx(const uint8_t* transformed_buf,
     return FONT_COMPRESSION_FAILURE();
   }
 
-  std::vector<uint16_t> advance_widths;
-  std::vector<int16_t> lsbs;
   bool has_proportional_lsbs = (hmtx_flags & 1) == 0;
   bool has_monospace_lsbs = (hmtx_flags & 2) == 0;
 
@@ -743,125 +1431,177 @@ bool ReconstructTransformedHmtx(const uint8_t* transformed_buf,
     return FONT_COMPRESSION_FAILURE();
   }
 
-  for (uint16_t i = 0; i < num_hmetrics; i++) {
-    uint16_t advance_width;
-    if (PREDICT_FALSE(!hmtx_buff_in.ReadU16(&advance_width))) {
-      return FONT_COMPRESSION_FAILURE();
-    }
-    advance_widths.push_back(advance_width);
+  // Everything left is fixed size, so check the bounds once.
+  const size_t hmtx_size = 2 * num_hmetrics +
+      (has_proportional_lsbs ? 2 * num_hmetrics : 0) +
+      (has_monospace_lsbs ? 2 * (num_glyphs - num_hmetrics) : 0);
+  UncheckedCursor hmtx_in;
+  if (PREDICT_FALSE(!hmtx_buff_in.ReadSpan(hmtx_size, &hmtx_in))) {
+    return FONT_COMPRESSION_FAILURE();
   }
 
-  for (uint16_t i = 0; i < num_hmetrics; i++) {
-    int16_t lsb;
-    if (has_proportional_lsbs) {
-      if (PREDICT_FALSE(!hmtx_buff_in.ReadS16(&lsb))) {
-        return FONT_COMPRESSION_FAILURE();
-      }
-    } else {
-      lsb = x_mins[i];
-    }
-    lsbs.push_back(lsb);
+  // Advance widths and lsbs come from separate arrays in the transformed
+  // table and are interleaved in a single pass.
+  UncheckedCursor lsbs = hmtx_in;
+  lsbs.Skip(2 * num_hmetrics);
+  TableWriter writer(out, 2 * num_hmetrics + 2 * num_glyphs);
+  for (uint32_t i = 0; i < num_hmetrics; i++) {
+    writer.Store16(hmtx_in.ReadU16());
+    writer.Store16(has_proportional_lsbs ? lsbs.ReadS16() : x_mins[i]);
   }
-
-  for (uint16_t i = num_hmetrics; i < num_glyphs; i++) {
-    int16_t lsb;
-    if (has_monospace_lsbs) {
-      if (PREDICT_FALSE(!hmtx_buff_in.ReadS16(&lsb))) {
-        return FONT_COMPRESSION_FAILURE();
-      }
-    } else {
-      lsb = x_mins[i];
-    }
-    lsbs.push_back(lsb);
+  for (uint32_t i = num_hmetrics; i < num_glyphs; i++) {
+    writer.Store16(has_monospace_lsbs ? lsbs.ReadS16() : x_mins[i]);
+  }
+  if (PREDICT_FALSE(!writer.Finish(checksum))) {
+    return FONT_COMPRESSION_FAILURE();
   }
 
-  // bake me a shiny new hmtx table
-  uint32_t hmtx_output_size = 2 * num_glyphs + 2 * num_hmetrics;
-  std::vector<uint8_t> hmtx_table(hmtx_output_size);
-  uint8_t* dst = &hmtx_table[0];
-  size_t dst_offset = 0;
-  for (uint32_t i = 0; i < num_glyphs; i++) {
-    if (i < num_hmetrics) {
-      Store16(advance_widths[i], &dst_offset, dst);
+  return true;
+}
+
+// Runs the dictionary's stream prefix through the decoder, dropping the
+// output, so that the font data can carry on from there.
+bool DecompressDictionary(BrotliDecoderState* state,
+                          const WOFF2Dictionary& dictionary) {
+  size_t available_in = dictionary.prefix().size();
+  const uint8_t* next_in =
+      reinterpret_cast<const uint8_t*>(dictionary.prefix().data());
+  size_t dropped = 0;
+  for (;;) {
+    size_t available_out = 0;
+    BrotliDecoderResult result = BrotliDecoderDecompressStream(
+        state, &available_in, &next_in, &available_out, NULL, NULL);
+    size_t size = 0;
+    BrotliDecoderTakeOutput(state, &size);
+    dropped += size;
+    if (result == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT &&
+        !BrotliDecoderHasMoreOutput(state)) {
+      break;
+    }
+    if (PREDICT_FALSE(result != BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT)) {
+      return FONT_COMPRESSION_FAILURE();
     }
-    Store16(lsbs[i], &dst_offset, dst);
   }
-
-  *checksum = ComputeULongSum(&hmtx_table[0], hmtx_output_size);
-  if (PREDICT_FALSE(!out->Write(&hmtx_table[0], hmtx_output_size))) {
+  if (PREDICT_FALSE(available_in != 0 ||
+                    dropped != dictionary.data().size())) {
     return FONT_COMPRESSION_FAILURE();
   }
+  return true;
+}
 
+// Finds the dictionary the font was compressed with. The reserved field of
+// the header is only read as a dictionary id when the caller gave one:
+// other encoders may leave anything there, and such files decoded before
+// dictionaries existed. So without given, *dictionary is NULL and a font
+// that needs one fails in Brotli. Returns false if the font was compressed
+// with a different dictionary than given.
+bool SelectDictionary(const WOFF2Header& hdr, const WOFF2Dictionary* given,
+                      const WOFF2Dictionary** dictionary) {
+  *dictionary = NULL;
+  if (given == NULL || hdr.dictionary_id == 0) {
+    return true;
+  }
+  if (PREDICT_FALSE(given->id() != hdr.dictionary_id)) {
+#ifdef FONT_COMPRESSION_BIN
+    fprintf(stderr, "Needs dictionary %04x, not %04x\n", hdr.dictionary_id,
+            given->id());
+#endif
+    return FONT_COMPRESSION_FAILURE();
+  }
+  *dictionary = given;
   return true;
 }
 
 bool Woff2Uncompress(uint8_t* dst_buf, size_t dst_size,
-  const uint8_t* src_buf, size_t src_size) {
-  size_t uncompressed_size = dst_size;
-  BrotliDecoderResult result = BrotliDecoderDecompress(
-      src_size, src_buf, &uncompressed_size, dst_buf);
+  const uint8_t* src_buf, size_t src_size, BrotliPool* pool,
+  const WOFF2Dictionary* dictionary) {
+  if (pool == NULL && dictionary == NULL) {
+    size_t uncompressed_size = dst_size;
+    BrotliDecoderResult result = BrotliDecoderDecompress(
+        src_size, src_buf, &uncompressed_size, dst_buf);
+    if (PREDICT_FALSE(result != BROTLI_DECODER_RESULT_SUCCESS ||
+                      uncompressed_size != dst_size)) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    return true;
+  }
+
+  // Brotli has no way to reset a decoder, but with pooled memory a fresh
+  // instance costs next to nothing.
+  BrotliDecoderState* state = pool != NULL
+      ? BrotliDecoderCreateInstance(BrotliPool::Alloc, BrotliPool::Free, pool)
+      : BrotliDecoderCreateInstance(NULL, NULL, NULL);
+  if (PREDICT_FALSE(state == NULL)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  if (dictionary != NULL && !DecompressDictionary(state, *dictionary)) {
+    BrotliDecoderDestroyInstance(state);
+    return FONT_COMPRESSION_FAILURE();
+  }
+  size_t available_in = src_size;
+  size_t available_out = dst_size;
+  BrotliDecoderResult result = BrotliDecoderDecompressStream(
+      state, &available_in, &src_buf, &available_out, &dst_buf, NULL);
+  BrotliDecoderDestroyInstance(state);
   if (PREDICT_FALSE(result != BROTLI_DECODER_RESULT_SUCCESS ||
-                    uncompressed_size != dst_size)) {
+                    available_out != 0)) {
     return FONT_COMPRESSION_FAILURE();
   }
   return true;
 }
 
-bool ReadTableDirectory(Buffer* file, std::vector<Table>* tables,
-    size_t num_tables) {
-  uint32_t src_offset = 0;
-  for (size_t i = 0; i < num_tables; ++i) {
-    Table* table = &(*tables)[i];
-    uint8_t flag_byte;
-    if (PREDICT_FALSE(!file->ReadU8(&flag_byte))) {
+// Reads the next entry of the table directory; its data starts at
+// *src_offset of the decompressed stream, which moves past it.
+bool ReadTableEntry(Buffer* file, uint32_t* src_offset, Table* table) {
+  uint8_t flag_byte;
+  if (PREDICT_FALSE(!file->ReadU8(&flag_byte))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  uint32_t tag;
+  if ((flag_byte & 0x3f) == 0x3f) {
+    if (PREDICT_FALSE(!file->ReadU32(&tag))) {
       return FONT_COMPRESSION_FAILURE();
     }
-    uint32_t tag;
-    if ((flag_byte & 0x3f) == 0x3f) {
-      if (PREDICT_FALSE(!file->ReadU32(&tag))) {
-        return FONT_COMPRESSION_FAILURE();
-      }
-    } else {
-      tag = kKnownTags[flag_byte & 0x3f];
-    }
-    uint32_t flags = 0;
-    uint8_t xform_version = (flag_byte >> 6) & 0x03;
+  } else {
+    tag = kKnownTags[flag_byte & 0x3f];
+  }
+  uint32_t flags = 0;
+  uint8_t xform_version = (flag_byte >> 6) & 0x03;
 
-    // 0 means xform for glyph/loca, non-0 for others
-    if (tag == kGlyfTableTag || tag == kLocaTableTag) {
-      if (xform_version == 0) {
-        flags |= kWoff2FlagsTransform;
-      }
-    } else if (xform_version != 0) {
+  // 0 means xform for glyph/loca, non-0 for others
+  if (tag == kGlyfTableTag || tag == kLocaTableTag) {
+    if (xform_version == 0) {
       flags |= kWoff2FlagsTransform;
     }
-    flags |= xform_version;
+  } else if (xform_version != 0) {
+    flags |= kWoff2FlagsTransform;
+  }
+  flags |= xform_version;
 
-    uint32_t dst_length;
-    if (PREDICT_FALSE(!ReadBase128(file, &dst_length))) {
+  uint32_t dst_length;
+  if (PREDICT_FALSE(!ReadBase128(file, &dst_length))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  uint32_t transform_length = dst_length;
+  if ((flags & kWoff2FlagsTransform) != 0) {
+    if (PREDICT_FALSE(!ReadBase128(file, &transform_length))) {
       return FONT_COMPRESSION_FAILURE();
     }
-    uint32_t transform_length = dst_length;
-    if ((flags & kWoff2FlagsTransform) != 0) {
-      if (PREDICT_FALSE(!ReadBase128(file, &transform_length))) {
-        return FONT_COMPRESSION_FAILURE();
-      }
-      if (PREDICT_FALSE(tag == kLocaTableTag && transform_length)) {
-        return FONT_COMPRESSION_FAILURE();
-      }
-    }
-    if (PREDICT_FALSE(src_offset + transform_length < src_offset)) {
+    if (PREDICT_FALSE(tag == kLocaTableTag && transform_length)) {
       return FONT_COMPRESSION_FAILURE();
     }
-    table->src_offset = src_offset;
-    table->src_length = transform_length;
-    src_offset += transform_length;
-
-    table->tag = tag;
-    table->flags = flags;
-    table->transform_length = transform_length;
-    table->dst_length = dst_length;
   }
+  if (PREDICT_FALSE(*src_offset + transform_length < *src_offset)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  table->src_offset = *src_offset;
+  table->src_length = transform_length;
+  *src_offset += transform_length;
+
+  table->tag = tag;
+  table->flags = flags;
+  table->transform_length = transform_length;
+  table->dst_length = dst_length;
   return true;
 }
 
@@ -904,6 +1644,59 @@ uint64_t ComputeOffsetToFirstTable(const WOFF2Header& hdr) {
   return offset;
 }
 
+// Upper bound on the size of the glyf table rebuilt from a transformed one,
+// padding included, read off the substream sizes in its header. Every glyph
+// takes at most a 10 byte header, 2 bytes of instruction length and 3 of
+// padding; each contour needs at least one nPoints byte for 2 bytes of
+// endPtsOfContours, and each point has one flag byte and becomes at most a
+// flag and two 16-bit coordinates. Returns 0 if the header is invalid.
+uint64_t GlyfSizeBound(const uint8_t* data, size_t length) {
+  Buffer file(data, length);
+  uint16_t num_glyphs;
+  uint32_t sizes[kWOFF2GlyfSubStreams];
+  if (!file.Skip(4) || !file.ReadU16(&num_glyphs) || !file.Skip(2)) {
+    return 0;
+  }
+  uint64_t total = 0;
+  for (int i = 0; i < kWOFF2GlyfSubStreams; ++i) {
+    if (!file.ReadU32(&sizes[i])) {
+      return 0;
+    }
+    total += sizes[i];
+  }
+  if (total > length - file.offset()) {
+    return 0;
+  }
+  // nContour, nPoints, flag, glyph, composite, bbox, instruction.
+  return 15 * static_cast<uint64_t>(num_glyphs) + 2 * uint64_t{sizes[1]} +
+      5 * uint64_t{sizes[2]} + sizes[4] + sizes[6];
+}
+
+// Bytes the tables take in the rebuilt font, padding included. Exact for
+// everything but a transformed glyf, whose size is only known once every
+// glyph is decoded; given the decompressed table data, that gets the bound
+// computed by GlyfSizeBound, otherwise the original length recorded in the
+// table directory.
+uint64_t TablesSizeBound(const WOFF2Header& hdr, const uint8_t* transformed,
+                         size_t transformed_length) {
+  uint64_t size = 0;
+  for (const auto& table : hdr.tables) {
+    uint64_t table_size = Round4(static_cast<uint64_t>(table.dst_length));
+    if (table.tag == kGlyfTableTag &&
+        (table.flags & kWoff2FlagsTransform) && transformed != NULL &&
+        table.src_offset <= transformed_length &&
+        table.src_length <= transformed_length - table.src_offset) {
+      const uint64_t bound = GlyfSizeBound(transformed + table.src_offset,
+                                           table.src_length);
+      if (bound != 0) {
+        table_size = bound;
+      }
+    }
+    size += table_size;
+  }
+  return size;
+}
+
 std::vector<Table*> Tables(WOFF2Header* hdr, size_t font_index) {
   std::vector<Table*> tables;
   if (PREDICT_FALSE(hdr->header_version)) {
@@ -918,22 +1711,121 @@ std::vector<Table*> Tables(WOFF2Header* hdr, size_t font_index) {
   return tables;
 }
 
-// Offset tables assumed to have been written in with 0's initially.
-// WOFF2Header isn't const so we can use [] instead of at() (which upsets FF)
-bool ReconstructFont(uint8_t* transformed_buf,
-                     const uint32_t transformed_buf_size,
-                     RebuildMetadata* metadata,
-                     WOFF2Header* hdr,
-                     size_t font_index,
-                     WOFF2Out* out) {
-  size_t dest_offset = out->Size();
-  uint8_t table_entry[12];
-  WOFF2FontInfo* info = &metadata->font_infos[font_index];
-  std::vector<Table*> tables = Tables(hdr, font_index);
+// Rebuilds the transformed glyf tables of the fonts of a collection into
+// ctx->prebuilt_glyf, a font per thread. Each distinct glyf is built for the
+// first font using it, the one ReconstructNextTable writes it for. Fonts
+// whose glyf isn't ready are left to ReconstructGlyf, which also reports
+// any error.
+void PrebuildGlyfTables(const uint8_t* transformed_buf,
+                        uint32_t transformed_buf_size,
+                        const RebuildMetadata& metadata, WOFF2Header* hdr,
+                        DecodeContext* ctx) {
+  ctx->prebuilt_glyf.clear();
+  const unsigned int num_threads = ctx->params.num_threads > 0 ?
+      ctx->params.num_threads : std::thread::hardware_concurrency();
+  if (!hdr->header_version || num_threads < 2) {
+    return;
+  }
+
+  std::vector<size_t> fonts;
+  std::vector<char> slot_seen(metadata.checksums.size(), false);
+  for (size_t i = 0; i < hdr->ttc_fonts.size(); ++i) {
+    std::vector<Table*> tables = Tables(hdr, i);
+    const Table* glyf_table = FindTable(&tables, kGlyfTableTag);
+    if (glyf_table == NULL || FindTable(&tables, kLocaTableTag) == NULL ||
+        !(glyf_table->flags & kWoff2FlagsTransform)) {
+      continue;
+    }
+    const uint32_t slot = metadata.checksum_slots[glyf_table - &hdr->tables[0]];
+    if (!slot_seen[slot]) {
+      slot_seen[slot] = true;
+      fonts.push_back(i);
+    }
+  }
+  if (fonts.size() < 2) {
+    return;
+  }
+
+  ctx->prebuilt_glyf.resize(hdr->ttc_fonts.size());
+  WOFF2DecodeParams params;
+  ParallelFor(fonts.size(), num_threads, [&](size_t k) {
+    std::vector<Table*> tables = Tables(hdr, fonts[k]);
+    PrebuiltGlyf& prebuilt = ctx->prebuilt_glyf[fonts[k]];
+    prebuilt.glyf_table = *FindTable(&tables, kGlyfTableTag);
+    prebuilt.loca_table = *FindTable(&tables, kLocaTableTag);
+    const Table& glyf_table = prebuilt.glyf_table;
+    if (static_cast<uint64_t>(glyf_table.src_offset) + glyf_table.src_length >
+        transformed_buf_size) {
+      return;
+    }
+    prebuilt.glyf_table.dst_offset = 0;
+    DecodeContext thread_ctx(params);
+    WOFF2StringOut out(&prebuilt.data);
+    prebuilt.ready = ReconstructGlyf(
+        transformed_buf + glyf_table.src_offset, &prebuilt.glyf_table,
+        &prebuilt.glyf_checksum, &prebuilt.loca_table, &prebuilt.loca_checksum,
+        &prebuilt.info, &thread_ctx, &out);
+    prebuilt.data.resize(out.Size());
+  });
+}
+
+// Writes the glyf and loca tables PrebuildGlyfTables made for the font.
+bool WritePrebuiltGlyf(PrebuiltGlyf* prebuilt, Table* glyf_table,
+                       uint32_t* glyf_checksum, Table* loca_table,
+                       uint32_t* loca_checksum, WOFF2FontInfo* info,
+                       WOFF2Out* out) {
+  if (!prebuilt->data.empty() &&
+      PREDICT_FALSE(!out->Write(prebuilt->data.data(),
+                                prebuilt->data.size()))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  glyf_table->dst_length = prebuilt->glyf_table.dst_length;
+  loca_table->dst_offset = glyf_table->dst_offset +
+                           prebuilt->loca_table.dst_offset;
+  loca_table->dst_length = prebuilt->loca_table.dst_length;
+  *glyf_checksum = prebuilt->glyf_checksum;
+  *loca_checksum = prebuilt->loca_checksum;
+  info->num_glyphs = prebuilt->info.num_glyphs;
+  info->index_format = prebuilt->info.index_format;
+  info->x_mins.swap(prebuilt->info.x_mins);
+  std::string().swap(prebuilt->data);
+  prebuilt->ready = false;
+  return true;
+}
+
+// Progress through the tables of a single font being rebuilt.
+struct FontRebuildState {
+  std::vector<Table*> tables;
+  std::vector<uint32_t> checksum_slots;  // for each of tables
+  size_t next_table;
+  uint32_t font_checksum;
+  uint32_t loca_checksum;
+
+  // The next table, when rebuilt over several calls with a budget.
+  bool table_started;
+  uint32_t table_checksum;
+  size_t table_written;  // of an untransformed table
+  uint64_t table_ns;     // spent on it by earlier calls, for stats
+  std::unique_ptr<GlyfProgress> glyf;
+};
+
+// Prepares state to rebuild font font_index table by table.
+bool BeginFont(RebuildMetadata* metadata, WOFF2Header* hdr, size_t font_index,
+               FontRebuildState* state) {
+  state->tables = Tables(hdr, font_index);
+  state->checksum_slots.clear();
+  for (const Table* table : state->tables) {
+    state->checksum_slots.push_back(
+        metadata->checksum_slots[table - &hdr->tables[0]]);
+  }
+  state->next_table = 0;
+  state->loca_checksum = 0;
+  state->table_started = false;
+  state->glyf.reset();
 
   // 'glyf' without 'loca' doesn't make sense
-  const Table* glyf_table = FindTable(&tables, kGlyfTableTag);
-  const Table* loca_table = FindTable(&tables, kLocaTableTag);
+  const Table* glyf_table = FindTable(&state->tables, kGlyfTableTag);
+  const Table* loca_table = FindTable(&state->tables, kLocaTableTag);
   if (PREDICT_FALSE(static_cast<bool>(glyf_table) !=
                     static_cast<bool>(loca_table))) {
 #ifdef FONT_COMPRESSION_BIN
@@ -952,26 +1844,47 @@ bool ReconstructFont(uint8_t* transformed_buf,
     }
   }
 
-  uint32_t font_checksum = metadata->header_checksum;
+  state->font_checksum = metadata->header_checksum;
   if (hdr->header_version) {
-    font_checksum = hdr->ttc_fonts[font_index].header_checksum;
+    state->font_checksum = hdr->ttc_fonts[font_index].header_checksum;
   }
+  return true;
+}
 
-  uint32_t loca_checksum = 0;
-  for (size_t i = 0; i < tables.size(); i++) {
-    Table& table = *tables[i];
+// Rebuilds the next table of the font, state->tables[state->next_table].
+// Offset tables assumed to have been written in with 0's initially. With a
+// budget, stops once it runs out, leaving the table to the next call:
+// untransformed tables are written a slice of bytes at a time, glyf a few
+// glyphs at a time, and state->next_table only moves once it is complete.
+bool ReconstructNextTable(uint8_t* transformed_buf,
+                          const uint32_t transformed_buf_size,
+                          RebuildMetadata* metadata,
+                          size_t font_index,
+                          DecodeContext* ctx,
+                          FontRebuildState* state,
+                          WorkBudget* budget,
+                          WOFF2Out* out) {
+  WOFF2Stats* const stats = ctx->params.stats;
+  std::chrono::steady_clock::time_point start;
+  if (stats) {
+    start = std::chrono::steady_clock::now();
+  }
+  uint8_t table_entry[12];
+  WOFF2FontInfo* info = &metadata->font_infos[font_index];
+  const uint32_t checksum_slot = state->checksum_slots[state->next_table];
+  Table& table = *state->tables[state->next_table];
 
-    std::pair<uint32_t, uint32_t> checksum_key = {table.tag, table.src_offset};
-    bool reused = metadata->checksums.find(checksum_key)
-               != metadata->checksums.end();
+  bool reused = metadata->checksum_written[checksum_slot];
+  const bool first_call = !state->table_started;
+  if (first_call) {
     if (PREDICT_FALSE(font_index == 0 && reused)) {
       return FONT_COMPRESSION_FAILURE();
     }
 
     // TODO(user) a collection with optimized hmtx that reused glyf/loca
     // would fail. We don't optimize hmtx for collections yet.
-    if (PREDICT_FALSE(static_cast<uint64_t>(table.src_offset) + table.src_length
-        > transformed_buf_size)) {
+    if (PREDICT_FALSE(static_cast<uint64_t>(table.src_offset) +
+                      table.src_length > transformed_buf_size)) {
       return FONT_COMPRESSION_FAILURE();
     }
 
@@ -981,10 +1894,17 @@ bool ReconstructFont(uint8_t* transformed_buf,
         return FONT_COMPRESSION_FAILURE();
       }
     }
+    state->table_started = true;
+    state->table_checksum = 0;
+    state->table_written = 0;
+    state->table_ns = 0;
+  }
 
-    uint32_t checksum = 0;
-    if (!reused) {
-      if ((table.flags & kWoff2FlagsTransform) != kWoff2FlagsTransform) {
+  uint32_t& checksum = state->table_checksum;
+  bool done = true;
+  if (!reused) {
+    if ((table.flags & kWoff2FlagsTransform) != kWoff2FlagsTransform) {
+      if (first_call) {
         if (table.tag == kHeadTableTag) {
           if (PREDICT_FALSE(table.src_length < 12)) {
             return FONT_COMPRESSION_FAILURE();
@@ -992,254 +1912,320 @@ bool ReconstructFont(uint8_t* transformed_buf,
           // checkSumAdjustment = 0
           StoreU32(transformed_buf + table.src_offset, 8, 0);
         }
-        table.dst_offset = dest_offset;
-        checksum = ComputeULongSum(transformed_buf + table.src_offset,
-                                   table.src_length);
-        if (PREDICT_FALSE(!out->Write(transformed_buf + table.src_offset,
-            table.src_length))) {
-          return FONT_COMPRESSION_FAILURE();
+        table.dst_offset = out->Size();
+      }
+      const uint8_t* src = transformed_buf + table.src_offset +
+          state->table_written;
+      size_t n = table.src_length - state->table_written;
+      // Slices are whole words, so their checksums add up to the table's.
+      // head is patched once the font is complete, so it is always copied,
+      // in one go.
+      if (budget != NULL && table.tag != kHeadTableTag) {
+        n = std::min(n, Round4(std::max<size_t>(budget->bytes, 1)));
+        budget->SpendBytes(n);
+      }
+      checksum += ComputeULongSum(src, n);
+      const bool ok = ctx->reference_tables && table.tag != kHeadTableTag ?
+          out->WriteReference(src, n) : out->Write(src, n);
+      if (PREDICT_FALSE(!ok)) {
+        return FONT_COMPRESSION_FAILURE();
+      }
+      state->table_written += n;
+      done = state->table_written == table.src_length;
+    } else {
+      if (table.tag == kGlyfTableTag) {
+        if (first_call) {
+          table.dst_offset = out->Size();
         }
-      } else {
-        if (table.tag == kGlyfTableTag) {
-          table.dst_offset = dest_offset;
 
-          Table* loca_table = FindTable(&tables, kLocaTableTag);
-          if (PREDICT_FALSE(!ReconstructGlyf(transformed_buf + table.src_offset,
-              &table, &checksum, loca_table, &loca_checksum, info, out))) {
+        Table* loca_table = FindTable(&state->tables, kLocaTableTag);
+        PrebuiltGlyf* prebuilt = font_index < ctx->prebuilt_glyf.size() ?
+            &ctx->prebuilt_glyf[font_index] : NULL;
+        if (prebuilt != NULL && prebuilt->ready &&
+            table.dst_offset % 4 == 0) {
+          if (PREDICT_FALSE(!WritePrebuiltGlyf(prebuilt, &table, &checksum,
+              loca_table, &state->loca_checksum, info, out))) {
             return FONT_COMPRESSION_FAILURE();
           }
-        } else if (table.tag == kLocaTableTag) {
-          // All the work was done by ReconstructGlyf. We already know checksum.
-          checksum = loca_checksum;
-        } else if (table.tag == kHmtxTableTag) {
-          table.dst_offset = dest_offset;
-          // Tables are sorted so all the info we need has been gathered.
-          if (PREDICT_FALSE(!ReconstructTransformedHmtx(
-              transformed_buf + table.src_offset, table.src_length,
-              info->num_glyphs, info->num_hmetrics, info->x_mins, &checksum,
-              out))) {
+        } else if (budget != NULL) {
+          if (PREDICT_FALSE(!ReconstructGlyfSlice(
+              transformed_buf + table.src_offset, &table, &checksum,
+              loca_table, &state->loca_checksum, info, ctx, budget,
+              &state->glyf, &done, out))) {
             return FONT_COMPRESSION_FAILURE();
           }
-        } else {
-          return FONT_COMPRESSION_FAILURE();  // transform unknown
+        } else if (PREDICT_FALSE(!ReconstructGlyf(
+            transformed_buf + table.src_offset, &table, &checksum, loca_table,
+            &state->loca_checksum, info, ctx, out))) {
+          return FONT_COMPRESSION_FAILURE();
         }
+        if (stats && done) {
+          CountTransformedGlyf(transformed_buf + table.src_offset,
+                               table.transform_length, stats);
+        }
+      } else if (table.tag == kLocaTableTag) {
+        // All the work was done by ReconstructGlyf. We already know checksum.
+        checksum = state->loca_checksum;
+      } else if (table.tag == kHmtxTableTag) {
+        table.dst_offset = out->Size();
+        // Tables are sorted so all the info we need has been gathered.
+        if (PREDICT_FALSE(!ReconstructTransformedHmtx(
+            transformed_buf + table.src_offset, table.src_length,
+            info->num_glyphs, info->num_hmetrics, info->x_mins, &checksum,
+            out))) {
+          return FONT_COMPRESSION_FAILURE();
+        }
+        if (budget != NULL) {
+          budget->SpendBytes(table.dst_length);
+        }
+      } else {
+        return FONT_COMPRESSION_FAILURE();  // transform unknown
       }
-      metadata->checksums[checksum_key] = checksum;
-    } else {
-      checksum = metadata->checksums[checksum_key];
     }
-    font_checksum += checksum;
-
-    // update the table entry with real values.
-    StoreU32(table_entry, 0, checksum);
-    StoreU32(table_entry, 4, table.dst_offset);
-    StoreU32(table_entry, 8, table.dst_length);
-    if (PREDICT_FALSE(!out->Write(table_entry,
-        info->table_entry_by_tag[table.tag] + 4, 12))) {
-      return FONT_COMPRESSION_FAILURE();
+    if (!done) {
+      if (stats) {
+        state->table_ns +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+      }
+      return true;
     }
+    metadata->checksums[checksum_slot] = checksum;
+    metadata->checksum_written[checksum_slot] = true;
+  } else {
+    checksum = metadata->checksums[checksum_slot];
+  }
+  state->next_table++;
+  state->table_started = false;
+  state->font_checksum += checksum;
+
+  // update the table entry with real values.
+  StoreU32(table_entry, 0, checksum);
+  StoreU32(table_entry, 4, table.dst_offset);
+  StoreU32(table_entry, 8, table.dst_length);
+  uint32_t table_entry_offset;
+  if (PREDICT_FALSE(!FindTableEntry(*info, table.tag, &table_entry_offset) ||
+      !out->Write(table_entry, table_entry_offset + 4, 12))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
 
-    // We replaced 0's. Update overall checksum.
-    font_checksum += ComputeULongSum(table_entry, 12);
+  // We replaced 0's. Update overall checksum.
+  state->font_checksum += ComputeULongSum(table_entry, 12);
 
-    if (PREDICT_FALSE(!Pad4(out))) {
-      return FONT_COMPRESSION_FAILURE();
-    }
+  if (PREDICT_FALSE(!Pad4(out))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
 
-    if (PREDICT_FALSE(static_cast<uint64_t>(table.dst_offset + table.dst_length)
-        > out->Size())) {
-      return FONT_COMPRESSION_FAILURE();
-    }
-    dest_offset = out->Size();
+  if (PREDICT_FALSE(static_cast<uint64_t>(table.dst_offset + table.dst_length)
+      > out->Size())) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  if (stats && !reused) {
+    const uint64_t ns = state->table_ns +
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    stats->reconstruct_ns += ns;
+    stats->tables.push_back(WOFF2TableStats{table.tag, ns, table.dst_length});
   }
+  return true;
+}
 
+// Completes a font once all its tables have been rebuilt.
+bool FinishFont(FontRebuildState* state, WOFF2Out* out) {
   // Update 'head' checkSumAdjustment. We already set it to 0 and summed font.
-  Table* head_table = FindTable(&tables, kHeadTableTag);
+  Table* head_table = FindTable(&state->tables, kHeadTableTag);
   if (head_table) {
     if (PREDICT_FALSE(head_table->dst_length < 12)) {
       return FONT_COMPRESSION_FAILURE();
     }
     uint8_t checksum_adjustment[4];
-    StoreU32(checksum_adjustment, 0, 0xB1B0AFBA - font_checksum);
+    StoreU32(checksum_adjustment, 0, 0xB1B0AFBA - state->font_checksum);
     if (PREDICT_FALSE(!out->Write(checksum_adjustment,
                                   head_table->dst_offset + 8, 4))) {
       return FONT_COMPRESSION_FAILURE();
     }
   }
-
   return true;
 }
 
-bool ReadWOFF2Header(const uint8_t* data, size_t length, WOFF2Header* hdr) {
-  Buffer file(data, length);
-
-  uint32_t signature;
-  if (PREDICT_FALSE(!file.ReadU32(&signature) || signature != kWoff2Signature ||
-      !file.ReadU32(&hdr->flavor))) {
-    return FONT_COMPRESSION_FAILURE();
-  }
-
-  // TODO(user): Should call IsValidVersionTag() here.
-
-  uint32_t reported_length;
-  if (PREDICT_FALSE(
-      !file.ReadU32(&reported_length) || length != reported_length)) {
+// WOFF2Header isn't const so we can use [] instead of at() (which upsets FF)
+bool ReconstructFont(uint8_t* transformed_buf,
+                     const uint32_t transformed_buf_size,
+                     RebuildMetadata* metadata,
+                     WOFF2Header* hdr,
+                     size_t font_index,
+                     DecodeContext* ctx,
+                     WOFF2Out* out) {
+  FontRebuildState state;
+  if (PREDICT_FALSE(!BeginFont(metadata, hdr, font_index, &state))) {
     return FONT_COMPRESSION_FAILURE();
   }
-  if (PREDICT_FALSE(!file.ReadU16(&hdr->num_tables) || !hdr->num_tables)) {
-    return FONT_COMPRESSION_FAILURE();
+  while (state.next_table < state.tables.size()) {
+    if (PREDICT_FALSE(!ReconstructNextTable(transformed_buf,
+                                            transformed_buf_size, metadata,
+                                            font_index, ctx, &state, NULL,
+                                            out))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
   }
+  return FinishFont(&state, out);
+}
 
-  // We don't care about these fields of the header:
-  //   uint16_t reserved
-  //   uint32_t total_sfnt_size, we don't believe this, will compute later
-  if (PREDICT_FALSE(!file.Skip(6))) {
+// Reads the fixed part of the header, checking that the metadata and private
+// data blocks it points to are within the file; see
+// https://www.w3.org/TR/WOFF2/#woff20Header
+bool ReadFixedHeader(Buffer* file, size_t length, WOFF2ProbeInfo* info) {
+  UncheckedCursor header;
+  if (PREDICT_FALSE(!file->ReadSpan(kWoff2HeaderSize, &header))) {
     return FONT_COMPRESSION_FAILURE();
   }
-  if (PREDICT_FALSE(!file.ReadU32(&hdr->compressed_length))) {
+
+  if (PREDICT_FALSE(header.ReadU32() != kWoff2Signature)) {
     return FONT_COMPRESSION_FAILURE();
   }
-  // We don't care about these fields of the header:
-  //   uint16_t major_version, minor_version
-  if (PREDICT_FALSE(!file.Skip(2 * 2))) {
+  info->flavor = header.ReadU32();
+
+  // TODO(user): Should call IsValidVersionTag() here.
+
+  info->length = header.ReadU32();
+  if (PREDICT_FALSE(info->length != length)) {
     return FONT_COMPRESSION_FAILURE();
   }
-  uint32_t meta_offset;
-  uint32_t meta_length;
-  uint32_t meta_length_orig;
-  if (PREDICT_FALSE(!file.ReadU32(&meta_offset) ||
-      !file.ReadU32(&meta_length) ||
-      !file.ReadU32(&meta_length_orig))) {
+  info->num_tables = header.ReadU16();
+  if (PREDICT_FALSE(!info->num_tables)) {
     return FONT_COMPRESSION_FAILURE();
   }
-  if (meta_offset) {
-    if (PREDICT_FALSE(
-        meta_offset >= length || length - meta_offset < meta_length)) {
+
+  info->dictionary_id = header.ReadU16();
+  // The decoder doesn't believe this, it computes the size later.
+  info->total_sfnt_size = header.ReadU32();
+  info->compressed_length = header.ReadU32();
+  info->major_version = header.ReadU16();
+  info->minor_version = header.ReadU16();
+  info->meta_offset = header.ReadU32();
+  info->meta_length = header.ReadU32();
+  info->meta_orig_length = header.ReadU32();
+  info->priv_offset = header.ReadU32();
+  info->priv_length = header.ReadU32();
+
+  if (info->meta_offset) {
+    if (PREDICT_FALSE(info->meta_offset >= length ||
+                      length - info->meta_offset < info->meta_length)) {
       return FONT_COMPRESSION_FAILURE();
     }
   }
-  uint32_t priv_offset;
-  uint32_t priv_length;
-  if (PREDICT_FALSE(!file.ReadU32(&priv_offset) ||
-      !file.ReadU32(&priv_length))) {
-    return FONT_COMPRESSION_FAILURE();
-  }
-  if (priv_offset) {
-    if (PREDICT_FALSE(
-        priv_offset >= length || length - priv_offset < priv_length)) {
+  if (info->priv_offset) {
+    if (PREDICT_FALSE(info->priv_offset >= length ||
+                      length - info->priv_offset < info->priv_length)) {
       return FONT_COMPRESSION_FAILURE();
     }
   }
-  hdr->tables.resize(hdr->num_tables);
-  if (PREDICT_FALSE(!ReadTableDirectory(
-          &file, &hdr->tables, hdr->num_tables))) {
+  return true;
+}
+
+// Reads the collection header that follows the table directory of a
+// collection, with the table indices of each font, of which there are
+// num_tables; tag_at(i) gives the tag of the i-th. The fonts are kept in
+// fonts unless it is NULL.
+template <typename TagAt>
+bool ReadCollectionDirectory(Buffer* file, size_t num_tables, TagAt tag_at,
+                             uint32_t* header_version, uint32_t* num_fonts,
+                             std::vector<TtcFont>* fonts) {
+  if (PREDICT_FALSE(!file->ReadU32(header_version))) {
     return FONT_COMPRESSION_FAILURE();
   }
-
-  // Before we sort for output the last table end is the uncompressed size.
-  Table& last_table = hdr->tables.back();
-  hdr->uncompressed_size = last_table.src_offset + last_table.src_length;
-  if (PREDICT_FALSE(hdr->uncompressed_size < last_table.src_offset)) {
+  if (PREDICT_FALSE(*header_version != 0x00010000
+                 && *header_version != 0x00020000)) {
     return FONT_COMPRESSION_FAILURE();
   }
+  if (PREDICT_FALSE(!Read255UShort(file, num_fonts) || !*num_fonts)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  if (fonts) {
+    fonts->resize(*num_fonts);
+  }
 
-  hdr->header_version = 0;
-
-  if (hdr->flavor == kTtcFontFlavor) {
-    if (PREDICT_FALSE(!file.ReadU32(&hdr->header_version))) {
+  for (uint32_t i = 0; i < *num_fonts; i++) {
+    TtcFont* ttc_font = fonts ? &(*fonts)[i] : NULL;
+    uint32_t num_font_tables, flavor;
+    if (PREDICT_FALSE(!Read255UShort(file, &num_font_tables) ||
+                      !num_font_tables)) {
       return FONT_COMPRESSION_FAILURE();
     }
-    if (PREDICT_FALSE(hdr->header_version != 0x00010000
-                   && hdr->header_version != 0x00020000)) {
+    if (PREDICT_FALSE(!file->ReadU32(&flavor))) {
       return FONT_COMPRESSION_FAILURE();
     }
-    uint32_t num_fonts;
-    if (PREDICT_FALSE(!Read255UShort(&file, &num_fonts) || !num_fonts)) {
-      return FONT_COMPRESSION_FAILURE();
+    if (ttc_font) {
+      ttc_font->flavor = flavor;
+      ttc_font->table_indices.resize(num_font_tables);
     }
-    hdr->ttc_fonts.resize(num_fonts);
 
-    for (uint32_t i = 0; i < num_fonts; i++) {
-      TtcFont& ttc_font = hdr->ttc_fonts[i];
-      uint32_t num_tables;
-      if (PREDICT_FALSE(!Read255UShort(&file, &num_tables) || !num_tables)) {
+    unsigned int glyf_idx = 0;
+    unsigned int loca_idx = 0;
+
+    for (uint32_t j = 0; j < num_font_tables; j++) {
+      unsigned int table_idx;
+      if (PREDICT_FALSE(!Read255UShort(file, &table_idx)) ||
+          table_idx >= num_tables) {
         return FONT_COMPRESSION_FAILURE();
       }
-      if (PREDICT_FALSE(!file.ReadU32(&ttc_font.flavor))) {
-        return FONT_COMPRESSION_FAILURE();
+      if (ttc_font) {
+        ttc_font->table_indices[j] = table_idx;
       }
 
-      ttc_font.table_indices.resize(num_tables);
-
-
-      unsigned int glyf_idx = 0;
-      unsigned int loca_idx = 0;
-
-      for (uint32_t j = 0; j < num_tables; j++) {
-        unsigned int table_idx;
-        if (PREDICT_FALSE(!Read255UShort(&file, &table_idx)) ||
-            table_idx >= hdr->tables.size()) {
-          return FONT_COMPRESSION_FAILURE();
-        }
-        ttc_font.table_indices[j] = table_idx;
-
-        const Table& table = hdr->tables[table_idx];
-        if (table.tag == kLocaTableTag) {
-          loca_idx = table_idx;
-        }
-        if (table.tag == kGlyfTableTag) {
-          glyf_idx = table_idx;
-        }
-
+      const uint32_t tag = tag_at(table_idx);
+      if (tag == kLocaTableTag) {
+        loca_idx = table_idx;
+      }
+      if (tag == kGlyfTableTag) {
+        glyf_idx = table_idx;
       }
+    }
 
-      // if we have both glyf and loca make sure they are consecutive
-      // if we have just one we'll reject the font elsewhere
-      if (glyf_idx > 0 || loca_idx > 0) {
-        if (PREDICT_FALSE(glyf_idx > loca_idx || loca_idx - glyf_idx != 1)) {
+    // if we have both glyf and loca make sure they are consecutive
+    // if we have just one we'll reject the font elsewhere
+    if (glyf_idx > 0 || loca_idx > 0) {
+      if (PREDICT_FALSE(glyf_idx > loca_idx || loca_idx - glyf_idx != 1)) {
 #ifdef FONT_COMPRESSION_BIN
-        fprintf(stderr, "TTC font %d has non-consecutive glyf/loca\n", i);
+      fprintf(stderr, "TTC font %d has non-consecutive glyf/loca\n", i);
 #endif
-          return FONT_COMPRESSION_FAILURE();
-        }
+        return FONT_COMPRESSION_FAILURE();
       }
     }
   }
+  return true;
+}
 
-  const uint64_t first_table_offset = ComputeOffsetToFirstTable(*hdr);
-
-  hdr->compressed_offset = file.offset();
-  if (PREDICT_FALSE(hdr->compressed_offset >
-                    std::numeric_limits<uint32_t>::max())) {
-    return FONT_COMPRESSION_FAILURE();
-  }
-  uint64_t src_offset = Round4(hdr->compressed_offset + hdr->compressed_length);
-  uint64_t dst_offset = first_table_offset;
-
-
+// Checks that the compressed data, which starts right after the directories,
+// and the metadata and private data blocks follow each other to the end of
+// the file.
+bool CheckBlockLayout(const WOFF2ProbeInfo& info, size_t length) {
+  uint64_t src_offset = Round4(static_cast<uint64_t>(info.compressed_offset) +
+                               info.compressed_length);
   if (PREDICT_FALSE(src_offset > length)) {
 #ifdef FONT_COMPRESSION_BIN
-    fprintf(stderr, "offset fail; src_offset %" PRIu64 " length %lu "
-      "dst_offset %" PRIu64 "\n",
-      src_offset, length, dst_offset);
+    fprintf(stderr, "offset fail; src_offset %" PRIu64 " length %lu\n",
+      src_offset, length);
 #endif
     return FONT_COMPRESSION_FAILURE();
   }
-  if (meta_offset) {
-    if (PREDICT_FALSE(src_offset != meta_offset)) {
+  if (info.meta_offset) {
+    if (PREDICT_FALSE(src_offset != info.meta_offset)) {
       return FONT_COMPRESSION_FAILURE();
     }
-    src_offset = Round4(meta_offset + meta_length);
+    src_offset = Round4(static_cast<uint64_t>(info.meta_offset) +
+                        info.meta_length);
     if (PREDICT_FALSE(src_offset > std::numeric_limits<uint32_t>::max())) {
       return FONT_COMPRESSION_FAILURE();
     }
   }
 
-  if (priv_offset) {
-    if (PREDICT_FALSE(src_offset != priv_offset)) {
+  if (info.priv_offset) {
+    if (PREDICT_FALSE(src_offset != info.priv_offset)) {
       return FONT_COMPRESSION_FAILURE();
     }
-    src_offset = Round4(priv_offset + priv_length);
+    src_offset = Round4(static_cast<uint64_t>(info.priv_offset) +
+                        info.priv_length);
     if (PREDICT_FALSE(src_offset > std::numeric_limits<uint32_t>::max())) {
       return FONT_COMPRESSION_FAILURE();
     }
@@ -1248,13 +2234,78 @@ bool ReadWOFF2Header(const uint8_t* data, size_t length, WOFF2Header* hdr) {
   if (PREDICT_FALSE(src_offset != Round4(length))) {
     return FONT_COMPRESSION_FAILURE();
   }
-
   return true;
 }
 
-// Write everything before the actual table data
+// Parses the header and table directory of a WOFF2 file of length bytes. Only
+// the first available bytes, which must cover everything up to the compressed
+// data, need be present in data.
+bool ReadWOFF2Header(const uint8_t* data, size_t available, size_t length,
+                     WOFF2Header* hdr) {
+  Buffer file(data, std::min(available, length));
+  WOFF2ProbeInfo info;
+  if (PREDICT_FALSE(!ReadFixedHeader(&file, length, &info))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  hdr->flavor = info.flavor;
+  hdr->num_tables = info.num_tables;
+  hdr->dictionary_id = info.dictionary_id;
+  hdr->compressed_length = info.compressed_length;
+
+  hdr->tables.resize(hdr->num_tables);
+  uint32_t src_offset = 0;
+  for (Table& table : hdr->tables) {
+    if (PREDICT_FALSE(!ReadTableEntry(&file, &src_offset, &table))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+  }
+  // Before we sort for output the last table end is the uncompressed size.
+  hdr->uncompressed_size = src_offset;
+
+  hdr->header_version = 0;
+  if (hdr->flavor == kTtcFontFlavor) {
+    uint32_t num_fonts;
+    if (PREDICT_FALSE(!ReadCollectionDirectory(
+            &file, hdr->tables.size(),
+            [hdr](size_t i) { return hdr->tables[i].tag; },
+            &hdr->header_version, &num_fonts, &hdr->ttc_fonts))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+  }
+
+  hdr->compressed_offset = file.offset();
+  if (PREDICT_FALSE(hdr->compressed_offset >
+                    std::numeric_limits<uint32_t>::max())) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  info.compressed_offset = hdr->compressed_offset;
+  return CheckBlockLayout(info, length);
+}
+
+// Write everything before the actual table data. tables_size is the expected
+// size of the table data, so out can be sized for the whole font at once.
 bool WriteHeaders(const uint8_t* data, size_t length, RebuildMetadata* metadata,
-                  WOFF2Header* hdr, WOFF2Out* out) {
+                  WOFF2Header* hdr, uint64_t tables_size, WOFF2Out* out) {
+  // Give each distinct (tag, src_offset) its own checksum slot.
+  std::vector<std::pair<uint64_t, uint32_t> >& keys = metadata->sort_buf;
+  keys.clear();
+  for (uint32_t i = 0; i < hdr->tables.size(); ++i) {
+    const Table& table = hdr->tables[i];
+    keys.push_back(std::make_pair(
+        static_cast<uint64_t>(table.tag) << 32 | table.src_offset, i));
+  }
+  std::sort(keys.begin(), keys.end());
+  metadata->checksum_slots.resize(keys.size());
+  uint32_t num_slots = 0;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (i == 0 || keys[i].first != keys[i - 1].first) {
+      ++num_slots;
+    }
+    metadata->checksum_slots[keys[i].second] = num_slots - 1;
+  }
+  metadata->checksums.assign(num_slots, 0);
+  metadata->checksum_written.assign(num_slots, 0);
+
   std::vector<uint8_t> output(ComputeOffsetToFirstTable(*hdr), 0);
 
   // Re-order tables in output (OTSpec) order
@@ -1262,10 +2313,12 @@ bool WriteHeaders(const uint8_t* data, size_t length, RebuildMetadata* metadata,
   if (hdr->header_version) {
     // collection; we have to sort the table offset vector in each font
     for (auto& ttc_font : hdr->ttc_fonts) {
-      std::map<uint32_t, uint16_t> sorted_index_by_tag;
+      std::vector<std::pair<uint32_t, uint32_t> > sorted_index_by_tag;
       for (auto table_index : ttc_font.table_indices) {
-        sorted_index_by_tag[hdr->tables[table_index].tag] = table_index;
+        sorted_index_by_tag.push_back(
+            std::make_pair(hdr->tables[table_index].tag, table_index));
       }
+      SortTableEntries(&sorted_index_by_tag);
       uint16_t index = 0;
       for (auto& i : sorted_index_by_tag) {
         ttc_font.table_indices[index++] = i.second;
@@ -1311,9 +2364,11 @@ bool WriteHeaders(const uint8_t* data, size_t length, RebuildMetadata* metadata,
 
       for (const auto table_index : ttc_font.table_indices) {
         uint32_t tag = hdr->tables[table_index].tag;
-        metadata->font_infos[i].table_entry_by_tag[tag] = offset;
+        metadata->font_infos[i].table_entry_by_tag.push_back(
+            std::make_pair(tag, offset));
         offset = StoreTableEntry(result, offset, tag);
       }
+      SortTableEntries(&metadata->font_infos[i].table_entry_by_tag);
 
       ttc_font.header_checksum = ComputeULongSum(&output[ttc_font.dst_offset],
                                                  offset - ttc_font.dst_offset);
@@ -1322,11 +2377,15 @@ bool WriteHeaders(const uint8_t* data, size_t length, RebuildMetadata* metadata,
     metadata->font_infos.resize(1);
     offset = StoreOffsetTable(result, offset, hdr->flavor, hdr->num_tables);
     for (uint16_t i = 0; i < hdr->num_tables; ++i) {
-      metadata->font_infos[0].table_entry_by_tag[sorted_tables[i].tag] = offset;
+      metadata->font_infos[0].table_entry_by_tag.push_back(
+          std::make_pair(sorted_tables[i].tag, static_cast<uint32_t>(offset)));
       offset = StoreTableEntry(result, offset, sorted_tables[i].tag);
     }
+    SortTableEntries(&metadata->font_infos[0].table_entry_by_tag);
   }
 
+  out->SizeHint(std::min<uint64_t>(output.size() + tables_size,
+                                   std::numeric_limits<size_t>::max()));
   if (PREDICT_FALSE(!out->Write(&output[0], output.size()))) {
     return FONT_COMPRESSION_FAILURE();
   }
@@ -1334,6 +2393,94 @@ bool WriteHeaders(const uint8_t* data, size_t length, RebuildMetadata* metadata,
   return true;
 }
 
+// Decodes a whole font held in memory. ctx must be clear.
+bool DecodeFont(const uint8_t* data, size_t length, DecodeContext* ctx,
+                WOFF2Out* out) {
+  RebuildMetadata& metadata = ctx->metadata;
+  WOFF2Header& hdr = ctx->hdr;
+  WOFF2Stats* const stats = ctx->params.stats;
+  size_t reallocations = 0;
+  if (stats) {
+    ResetStats(stats);
+    stats->input_bytes = length;
+    reallocations = out->Reallocations();
+  }
+  StageTimer total_timer(stats ? &stats->total_ns : NULL);
+  {
+    StageTimer timer(stats ? &stats->parse_ns : NULL);
+    if (!ReadWOFF2Header(data, length, length, &hdr)) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+  }
+
+  const WOFF2Dictionary* dictionary;
+  if (!SelectDictionary(hdr, ctx->params.dictionary, &dictionary)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+
+  // The dictionary counts as input; the font data may be made almost
+  // entirely of references into it.
+  const size_t input_length =
+      length + (dictionary != NULL ? dictionary->data().size() : 0);
+  const float compression_ratio =
+      (float) hdr.uncompressed_size / input_length;
+  if (compression_ratio > kMaxPlausibleCompressionRatio) {
+#ifdef FONT_COMPRESSION_BIN
+    fprintf(stderr, "Implausible compression ratio %.01f\n", compression_ratio);
+#endif
+    return FONT_COMPRESSION_FAILURE();
+  }
+
+  const uint8_t* src_buf = data + hdr.compressed_offset;
+  if (PREDICT_FALSE(hdr.uncompressed_size < 1)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  // Fully overwritten by Brotli, so stale contents don't matter.
+  std::vector<uint8_t>& uncompressed_buf = ctx->uncompressed_buf;
+  uncompressed_buf.resize(hdr.uncompressed_size);
+  {
+    StageTimer timer(stats ? &stats->brotli_ns : NULL);
+    if (PREDICT_FALSE(!Woff2Uncompress(&uncompressed_buf[0],
+                                       hdr.uncompressed_size, src_buf,
+                                       hdr.compressed_length,
+                                       ctx->brotli_pool, dictionary))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+  }
+
+  // Headers go out once the tables are decompressed, so the glyf size bound
+  // can be read from the transformed table.
+  {
+    StageTimer timer(stats ? &stats->parse_ns : NULL);
+    if (!WriteHeaders(data, length, &metadata, &hdr,
+                      TablesSizeBound(hdr, &uncompressed_buf[0],
+                                      hdr.uncompressed_size), out)) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+  }
+
+  {
+    StageTimer timer(stats ? &stats->reconstruct_ns : NULL);
+    PrebuildGlyfTables(&uncompressed_buf[0], hdr.uncompressed_size, metadata,
+                       &hdr, ctx);
+  }
+  for (size_t i = 0; i < metadata.font_infos.size(); i++) {
+    if (PREDICT_FALSE(!ReconstructFont(&uncompressed_buf[0],
+                                       hdr.uncompressed_size,
+                                       &metadata, &hdr, i, ctx, out))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+  }
+
+  if (stats) {
+    stats->brotli_compressed_bytes = hdr.compressed_length;
+    stats->brotli_uncompressed_bytes = hdr.uncompressed_size;
+    stats->output_bytes = out->Size();
+    stats->output_reallocations = out->Reallocations() - reallocations;
+  }
+  return true;
+}
+
 }  // namespace
 
 size_t ComputeWOFF2FinalSize(const uint8_t* data, size_t length) {
@@ -1347,6 +2494,49 @@ size_t ComputeWOFF2FinalSize(const uint8_t* data, size_t length) {
   return total_length;
 }
 
+bool WOFF2Probe(const uint8_t* data, size_t length, WOFF2ProbeInfo* info,
+                WOFF2TableEntry* tables, size_t max_tables) {
+  Buffer file(data, length);
+  if (PREDICT_FALSE(!ReadFixedHeader(&file, length, info))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  if (PREDICT_FALSE(info->num_tables > max_tables)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+
+  uint32_t src_offset = 0;
+  for (size_t i = 0; i < info->num_tables; ++i) {
+    Table table;
+    if (PREDICT_FALSE(!ReadTableEntry(&file, &src_offset, &table))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    WOFF2TableEntry& entry = tables[i];
+    entry.tag = table.tag;
+    entry.transform_version = table.flags & 0x03;
+    entry.transformed = (table.flags & kWoff2FlagsTransform) != 0;
+    entry.orig_length = table.dst_length;
+    entry.transform_length = table.transform_length;
+  }
+  info->uncompressed_size = src_offset;
+
+  info->collection_version = 0;
+  info->num_fonts = 1;
+  if (info->flavor == kTtcFontFlavor) {
+    if (PREDICT_FALSE(!ReadCollectionDirectory(
+            &file, info->num_tables,
+            [tables](size_t i) { return tables[i].tag; },
+            &info->collection_version, &info->num_fonts, NULL))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+  }
+
+  if (PREDICT_FALSE(file.offset() > std::numeric_limits<uint32_t>::max())) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  info->compressed_offset = file.offset();
+  return CheckBlockLayout(*info, length);
+}
+
 bool ConvertWOFF2ToTTF(uint8_t *result, size_t result_length,
                        const uint8_t *data, size_t length) {
   WOFF2MemoryOut out(result, result_length);
@@ -1355,44 +2545,686 @@ bool ConvertWOFF2ToTTF(uint8_t *result, size_t result_length,
 
 bool ConvertWOFF2ToTTF(const uint8_t* data, size_t length,
                        WOFF2Out* out) {
-  RebuildMetadata metadata;
-  WOFF2Header hdr;
-  if (!ReadWOFF2Header(data, length, &hdr)) {
-    return FONT_COMPRESSION_FAILURE();
+  return ConvertWOFF2ToTTF(data, length, out, WOFF2DecodeParams());
+}
+
+bool ConvertWOFF2ToTTF(const uint8_t* data, size_t length,
+                       WOFF2Out* out, const WOFF2DecodeParams& params) {
+  DecodeContext ctx(params);
+  return DecodeFont(data, length, &ctx, out);
+}
+
+struct WOFF2Decoder::State {
+  explicit State(const WOFF2DecodeParams& params) : ctx(params) {
+    ctx.brotli_pool = &brotli_pool;
+  }
+
+  BrotliPool brotli_pool;
+  DecodeContext ctx;
+};
+
+WOFF2Decoder::WOFF2Decoder() : state_(new State(WOFF2DecodeParams())) {}
+
+WOFF2Decoder::WOFF2Decoder(const WOFF2DecodeParams& params)
+    : state_(new State(params)) {}
+
+WOFF2Decoder::~WOFF2Decoder() {}
+
+bool WOFF2Decoder::Decode(const uint8_t* data, size_t length,
+                          WOFF2Out* out) {
+  state_->ctx.Clear();
+  state_->ctx.reference_tables = true;
+  return DecodeFont(data, length, &state_->ctx, out);
+}
+
+size_t WOFF2Decoder::DecodeBatch(WOFF2DecodeJob* jobs, size_t num_jobs) {
+  // Each font reuses the buffers of the one before, so nothing can be
+  // referenced.
+  state_->ctx.reference_tables = false;
+  size_t num_ok = 0;
+  for (size_t i = 0; i < num_jobs; ++i) {
+    WOFF2DecodeJob& job = jobs[i];
+    state_->ctx.Clear();
+    job.ok = DecodeFont(job.data, job.length, &state_->ctx, job.out);
+    num_ok += job.ok;
+  }
+  return num_ok;
+}
+
+void WOFF2Decoder::Reset() {
+  state_.reset(new State(state_->ctx.params));
+}
+
+struct WOFF2StreamDecoder::State {
+  enum Phase {
+    kReadingHeader,
+    kDecompressing,
+    kSkippingTrailer,  // after the compressed data, up to the file length
+    kFailed,
+  };
+
+  State(WOFF2Out* out, const WOFF2DecodeParams& params)
+      : out(out), ctx(params), phase(kReadingHeader), consumed(0),
+        length(0), decompressed(0), compressed_remaining(0), brotli(NULL),
+        stream_done(false), font_index(0), font_started(false),
+        reallocations(0), queued_offset(0), stepping(false) {
+    if (params.stats) {
+      ResetStats(params.stats);
+      reallocations = out->Reallocations();
+    }
+  }
+
+  ~State() {
+    if (brotli) {
+      BrotliDecoderDestroyInstance(brotli);
+    }
   }
 
-  if (!WriteHeaders(data, length, &metadata, &hdr, out)) {
+  bool Fail() {
+    phase = kFailed;
     return FONT_COMPRESSION_FAILURE();
   }
 
-  const float compression_ratio = (float) hdr.uncompressed_size / length;
+  // Tries to parse the header from the first available bytes of the file.
+  // Returns false on error; *parsed tells whether there was enough data.
+  bool ParseHeader(const uint8_t* data, size_t available, bool* parsed);
+
+  // Feeds compressed data to Brotli, rebuilding tables as they complete.
+  // With a budget, stops once it runs out; *used, if given, is set to the
+  // bytes of data that need not be passed again.
+  bool Decompress(const uint8_t* data, size_t n, WorkBudget* budget,
+                  size_t* used);
+
+  // Rebuilds every pending table whose source data is fully decompressed,
+  // or as many as the budget allows.
+  bool RebuildReadyTables(WorkBudget* budget);
+
+  // Called once every table has been written.
+  void Complete();
+
+  // End of the source data of the next table to rebuild; the uncompressed
+  // size once all tables are done.
+  uint64_t NextTableEnd() const;
+
+  WOFF2Out* out;
+  DecodeContext ctx;
+  Phase phase;
+  uint64_t consumed;  // bytes of the file seen so far
+  uint32_t length;    // file length from the header, 0 until known
+  std::vector<uint8_t> header_buf;
+  size_t decompressed;
+  uint32_t compressed_remaining;
+  BrotliDecoderState* brotli;
+  bool stream_done;  // Brotli has produced everything
+  size_t font_index;
+  bool font_started;
+  FontRebuildState font;
+  // out->Reallocations() when decoding started, for stats.
+  size_t reallocations;
+  // Input given to Append() and not yet used by Step(), from queued_offset.
+  std::vector<uint8_t> queued;
+  size_t queued_offset;
+  bool stepping;  // Append() was called
+};
+
+bool WOFF2StreamDecoder::State::ParseHeader(const uint8_t* data,
+                                            size_t available, bool* parsed) {
+  StageTimer timer(ctx.params.stats ? &ctx.params.stats->parse_ns : NULL);
+  *parsed = false;
+  if (length == 0) {
+    Buffer file(data, available);
+    uint32_t signature;
+    if (!file.ReadU32(&signature) || !file.Skip(4) ||
+        !file.ReadU32(&length)) {
+      return true;
+    }
+    if (PREDICT_FALSE(signature != kWoff2Signature || length == 0)) {
+      return Fail();
+    }
+  }
+  if (PREDICT_FALSE(consumed > length)) {
+    return Fail();
+  }
+  if (!ReadWOFF2Header(data, available, length, &ctx.hdr)) {
+    // Only fatal once there is nothing left to wait for.
+    return available < length ? true : Fail();
+  }
+  *parsed = true;
+  const WOFF2Dictionary* dictionary;
+  if (!SelectDictionary(ctx.hdr, ctx.params.dictionary, &dictionary)) {
+    return Fail();
+  }
+
+  // Nothing is decompressed yet, so glyf is sized from the directory.
+  if (!WriteHeaders(data, available, &ctx.metadata, &ctx.hdr,
+                    TablesSizeBound(ctx.hdr, NULL, 0), out)) {
+    return Fail();
+  }
+
+  // The dictionary counts as input, as in DecodeFont.
+  const size_t input_length =
+      length + (dictionary != NULL ? dictionary->data().size() : 0);
+  const float compression_ratio =
+      (float) ctx.hdr.uncompressed_size / input_length;
   if (compression_ratio > kMaxPlausibleCompressionRatio) {
 #ifdef FONT_COMPRESSION_BIN
     fprintf(stderr, "Implausible compression ratio %.01f\n", compression_ratio);
 #endif
+    return Fail();
+  }
+
+  if (PREDICT_FALSE(ctx.hdr.uncompressed_size < 1)) {
+    return Fail();
+  }
+  ctx.uncompressed_buf.resize(ctx.hdr.uncompressed_size);
+  brotli = BrotliDecoderCreateInstance(NULL, NULL, NULL);
+  if (PREDICT_FALSE(brotli == NULL)) {
+    return Fail();
+  }
+  // The font data continues the dictionary's stream.
+  if (dictionary != NULL && !DecompressDictionary(brotli, *dictionary)) {
+    return Fail();
+  }
+  compressed_remaining = ctx.hdr.compressed_length;
+  phase = kDecompressing;
+  return true;
+}
+
+uint64_t WOFF2StreamDecoder::State::NextTableEnd() const {
+  if (font_started && font.next_table < font.tables.size()) {
+    const Table* table = font.tables[font.next_table];
+    return std::min(static_cast<uint64_t>(table->src_offset) +
+                        table->src_length,
+                    static_cast<uint64_t>(ctx.uncompressed_buf.size()));
+  }
+  return ctx.uncompressed_buf.size();
+}
+
+bool WOFF2StreamDecoder::State::RebuildReadyTables(WorkBudget* budget) {
+  while (font_index < ctx.metadata.font_infos.size()) {
+    if (!font_started) {
+      if (PREDICT_FALSE(!BeginFont(&ctx.metadata, &ctx.hdr, font_index,
+                                   &font))) {
+        return FONT_COMPRESSION_FAILURE();
+      }
+      font_started = true;
+    }
+    while (font.next_table < font.tables.size()) {
+      // Tables reaching past the end are rejected by ReconstructNextTable
+      // once everything has been decompressed.
+      if (NextTableEnd() > decompressed ||
+          (budget != NULL && budget->Exhausted())) {
+        return true;
+      }
+      if (PREDICT_FALSE(!ReconstructNextTable(&ctx.uncompressed_buf[0],
+                                              ctx.uncompressed_buf.size(),
+                                              &ctx.metadata, font_index,
+                                              &ctx, &font, budget, out))) {
+        return FONT_COMPRESSION_FAILURE();
+      }
+      if (font.table_started) {
+        return true;  // out of budget half way through
+      }
+    }
+    if (PREDICT_FALSE(!FinishFont(&font, out))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    font_index++;
+    font_started = false;
+  }
+  return true;
+}
+
+bool WOFF2StreamDecoder::State::Decompress(const uint8_t* data, size_t n,
+                                           WorkBudget* budget, size_t* used) {
+  WOFF2Stats* const stats = ctx.params.stats;
+  size_t available_in = std::min<size_t>(n, compressed_remaining);
+  const uint8_t* next_in = data;
+  while (!stream_done) {
+    if (PREDICT_FALSE(!RebuildReadyTables(budget))) {
+      return Fail();
+    }
+    if (budget != NULL && budget->Exhausted()) {
+      break;
+    }
+    // Stop at the end of the next table so it can be written out right away.
+    size_t available_out = NextTableEnd() - decompressed;
+    if (budget != NULL) {
+      available_out = std::min(available_out, budget->bytes);
+    }
+    uint8_t* next_out = &ctx.uncompressed_buf[decompressed];
+    const size_t in_before = available_in;
+    BrotliDecoderResult result;
+    {
+      StageTimer timer(stats ? &stats->brotli_ns : NULL);
+      result = BrotliDecoderDecompressStream(
+          brotli, &available_in, &next_in, &available_out, &next_out, NULL);
+    }
+    compressed_remaining -= in_before - available_in;
+    const size_t produced = next_out - &ctx.uncompressed_buf[decompressed];
+    decompressed += produced;
+    if (budget != NULL) {
+      budget->SpendBytes(produced);
+    }
+
+    if (result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT) {
+      if (PREDICT_FALSE(decompressed == ctx.uncompressed_buf.size())) {
+        return Fail();  // more data than the header promised
+      }
+      continue;
+    }
+    if (result == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT) {
+      if (PREDICT_FALSE(compressed_remaining == 0)) {
+        return Fail();  // truncated stream
+      }
+      if (PREDICT_FALSE(!RebuildReadyTables(budget))) {
+        return Fail();
+      }
+      break;
+    }
+    if (PREDICT_FALSE(result != BROTLI_DECODER_RESULT_SUCCESS ||
+                      decompressed != ctx.uncompressed_buf.size())) {
+      return Fail();
+    }
+    stream_done = true;
+  }
+  if (used) {
+    // Past the compressed data there is only the rest of the file.
+    *used = compressed_remaining == 0 ? n : next_in - data;
+  }
+  if (!stream_done) {
+    return true;
+  }
+
+  if (PREDICT_FALSE(!RebuildReadyTables(budget))) {
+    return Fail();
+  }
+  if (font_index == ctx.metadata.font_infos.size()) {
+    Complete();
+  } else if (PREDICT_FALSE(budget == NULL)) {
+    return Fail();
+  }
+  return true;
+}
+
+void WOFF2StreamDecoder::State::Complete() {
+  WOFF2Stats* const stats = ctx.params.stats;
+  if (stats) {
+    stats->brotli_compressed_bytes = ctx.hdr.compressed_length;
+    stats->brotli_uncompressed_bytes = ctx.hdr.uncompressed_size;
+    stats->output_bytes = out->Size();
+    stats->output_reallocations = out->Reallocations() - reallocations;
+  }
+  // Everything has been written; only the rest of the file remains.
+  BrotliDecoderDestroyInstance(brotli);
+  brotli = NULL;
+  std::vector<uint8_t>().swap(ctx.uncompressed_buf);
+  std::vector<uint8_t>().swap(queued);
+  queued_offset = 0;
+  phase = kSkippingTrailer;
+}
+
+WOFF2StreamDecoder::WOFF2StreamDecoder(WOFF2Out* out)
+    : state_(new State(out, WOFF2DecodeParams())) {}
+
+WOFF2StreamDecoder::WOFF2StreamDecoder(WOFF2Out* out,
+                                       const WOFF2DecodeParams& params)
+    : state_(new State(out, params)) {}
+
+WOFF2StreamDecoder::~WOFF2StreamDecoder() {}
+
+bool WOFF2StreamDecoder::Write(const uint8_t* data, size_t length) {
+  State* state = state_.get();
+  WOFF2Stats* const stats = state->ctx.params.stats;
+  StageTimer timer(stats ? &stats->total_ns : NULL);
+  if (stats) {
+    stats->input_bytes += length;
+  }
+  if (state->phase == State::kFailed) {
     return FONT_COMPRESSION_FAILURE();
   }
+  if (PREDICT_FALSE(state->stepping)) {
+    return state->Fail();  // the input belongs to Append()
+  }
+  state->consumed += length;
+  if (state->length != 0 && state->consumed > state->length) {
+    return state->Fail();
+  }
 
-  const uint8_t* src_buf = data + hdr.compressed_offset;
-  std::vector<uint8_t> uncompressed_buf(hdr.uncompressed_size);
-  if (PREDICT_FALSE(hdr.uncompressed_size < 1)) {
+  if (state->phase == State::kReadingHeader) {
+    // Parse straight from the caller's data if nothing is buffered yet.
+    const bool buffered = !state->header_buf.empty();
+    if (buffered) {
+      state->header_buf.insert(state->header_buf.end(), data, data + length);
+    }
+    const uint8_t* header = buffered ? &state->header_buf[0] : data;
+    const size_t available = buffered ? state->header_buf.size() : length;
+    bool parsed;
+    if (!state->ParseHeader(header, available, &parsed)) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    if (!parsed) {
+      if (!buffered) {
+        state->header_buf.assign(data, data + length);
+      }
+      return true;
+    }
+    // The rest of what we have is compressed data.
+    const size_t offset = state->ctx.hdr.compressed_offset;
+    if (!state->Decompress(header + offset, available - offset, NULL,
+                           NULL)) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    std::vector<uint8_t>().swap(state->header_buf);
+    return true;
+  }
+
+  if (state->phase == State::kDecompressing) {
+    return state->Decompress(data, length, NULL, NULL);
+  }
+  return true;
+}
+
+bool WOFF2StreamDecoder::Append(const uint8_t* data, size_t length) {
+  State* state = state_.get();
+  WOFF2Stats* const stats = state->ctx.params.stats;
+  if (stats) {
+    stats->input_bytes += length;
+  }
+  if (state->phase == State::kFailed) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  if (PREDICT_FALSE(!state->stepping && state->consumed != 0)) {
+    return state->Fail();  // the input belongs to Write()
+  }
+  state->stepping = true;
+  state->consumed += length;
+  if (state->length != 0 && state->consumed > state->length) {
+    return state->Fail();
+  }
+  if (state->phase != State::kSkippingTrailer) {
+    state->queued.insert(state->queued.end(), data, data + length);
+  }
+  return true;
+}
+
+WOFF2StreamDecoder::StepResult WOFF2StreamDecoder::Step(size_t max_bytes,
+                                                        size_t max_glyphs) {
+  State* state = state_.get();
+  WOFF2Stats* const stats = state->ctx.params.stats;
+  StageTimer timer(stats ? &stats->total_ns : NULL);
+  if (state->phase == State::kReadingHeader) {
+    bool parsed = false;
+    if (!state->queued.empty() &&
+        !state->ParseHeader(&state->queued[0], state->queued.size(),
+                            &parsed)) {
+      return kFailed;
+    }
+    if (!parsed) {
+      return kNeedsInput;
+    }
+    state->queued_offset = state->ctx.hdr.compressed_offset;
+  }
+  if (state->phase == State::kDecompressing) {
+    WorkBudget budget = {std::max<size_t>(max_bytes, 1),
+                         std::max<size_t>(max_glyphs, 1)};
+    const size_t offset = std::min(state->queued_offset, state->queued.size());
+    size_t used = 0;
+    if (!state->Decompress(state->queued.data() + offset,
+                           state->queued.size() - offset, &budget, &used)) {
+      return kFailed;
+    }
+    if (state->phase == State::kDecompressing) {
+      state->queued_offset = offset + used;
+      // Dropped once half of it is used, so that small steps over a large
+      // queue don't keep moving the rest.
+      if (state->queued_offset >= state->queued.size() - state->queued_offset) {
+        state->queued.erase(state->queued.begin(),
+                            state->queued.begin() + state->queued_offset);
+        state->queued_offset = 0;
+      }
+      return budget.Exhausted() ? kMoreWork : kNeedsInput;
+    }
+  }
+  return state->phase == State::kFailed ? kFailed : kDone;
+}
+
+bool WOFF2StreamDecoder::Finish() {
+  State* state = state_.get();
+  if (state->phase != State::kSkippingTrailer ||
+      state->consumed != state->length) {
+    return state->Fail();
+  }
+  return true;
+}
+
+struct WOFF2GlyphAccessor::State {
+  State() : num_glyphs(0), transformed(false), next_glyph(0),
+            glyf_data(NULL), glyf_length(0) {}
+
+  // Forgets the open font, keeping allocated memory.
+  void Clear() {
+    num_glyphs = 0;
+    streams.reset();
+    loca.clear();
+    checkpoints.clear();
+  }
+
+  bool OpenTransformed(const Table& glyf_table, const Table& loca_table);
+  bool OpenUntransformed(const Table& glyf_table, const Table& loca_table,
+                         const Table& head_table, const Table& maxp_table);
+
+  WOFF2Header hdr;
+  std::vector<uint8_t> uncompressed_buf;
+  unsigned int num_glyphs;
+  bool transformed;
+
+  // Transformed glyf: the substreams, with their positions at every
+  // kGlyphCheckpointInterval-th glyph, and streams positioned at
+  // next_glyph.
+  TransformedGlyf glyf;
+  std::vector<size_t> checkpoints;
+  std::unique_ptr<GlyfStreams> streams;
+  unsigned int next_glyph;
+  GlyphScratch scratch;
+
+  // Untransformed glyf: the table as is and its loca offsets.
+  const uint8_t* glyf_data;
+  size_t glyf_length;
+  std::vector<uint32_t> loca;
+};
+
+bool WOFF2GlyphAccessor::State::OpenTransformed(const Table& glyf_table,
+                                                const Table& loca_table) {
+  const uint8_t* data = uncompressed_buf.data() + glyf_table.src_offset;
+  if (PREDICT_FALSE(!ReadTransformedGlyf(data, glyf_table.transform_length,
+                                         &glyf))) {
     return FONT_COMPRESSION_FAILURE();
   }
-  if (PREDICT_FALSE(!Woff2Uncompress(&uncompressed_buf[0],
-                                     hdr.uncompressed_size, src_buf,
-                                     hdr.compressed_length))) {
+  // https://dev.w3.org/webfonts/WOFF2/spec/#conform-mustRejectLoca
+  uint32_t expected_loca_dst_length = (glyf.index_format ? 4 : 2)
+    * (static_cast<uint32_t>(glyf.num_glyphs) + 1);
+  if (PREDICT_FALSE(loca_table.dst_length != expected_loca_dst_length)) {
     return FONT_COMPRESSION_FAILURE();
   }
 
-  for (size_t i = 0; i < metadata.font_infos.size(); i++) {
-    if (PREDICT_FALSE(!ReconstructFont(&uncompressed_buf[0],
-                                       hdr.uncompressed_size,
-                                       &metadata, &hdr, i, out))) {
+  // One pass over the glyphs, as for a parallel rebuild, both checks that
+  // the substreams hold all of them and finds the checkpoints.
+  GlyfStreams walk(glyf.substreams);
+  if (PREDICT_FALSE(!walk.bbox_stream.Skip(glyf.bbox_bitmap_length))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  checkpoints.resize(kNumGlyfSubStreams *
+      ((glyf.num_glyphs + kGlyphCheckpointInterval - 1) /
+       kGlyphCheckpointInterval));
+  for (unsigned int i = 0; i < glyf.num_glyphs; ++i) {
+    if (i % kGlyphCheckpointInterval == 0) {
+      walk.Tell(&checkpoints[kNumGlyfSubStreams * (i /
+                                                   kGlyphCheckpointInterval)]);
+    }
+    if (PREDICT_FALSE(!SkipGlyph(i, glyf.bitmaps, &walk))) {
       return FONT_COMPRESSION_FAILURE();
     }
   }
+  num_glyphs = glyf.num_glyphs;
+  // Forces a seek on the first glyph.
+  next_glyph = num_glyphs;
+  return true;
+}
 
+bool WOFF2GlyphAccessor::State::OpenUntransformed(const Table& glyf_table,
+                                                  const Table& loca_table,
+                                                  const Table& head_table,
+                                                  const Table& maxp_table) {
+  Buffer head(uncompressed_buf.data() + head_table.src_offset,
+              head_table.src_length);
+  Buffer maxp(uncompressed_buf.data() + maxp_table.src_offset,
+              maxp_table.src_length);
+  uint16_t index_format;
+  uint16_t maxp_num_glyphs;
+  if (PREDICT_FALSE(!head.Skip(50) || !head.ReadU16(&index_format) ||
+                    !maxp.Skip(4) || !maxp.ReadU16(&maxp_num_glyphs))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  Buffer file(uncompressed_buf.data() + loca_table.src_offset,
+              loca_table.src_length);
+  loca.resize(maxp_num_glyphs + 1);
+  for (uint32_t& offset : loca) {
+    uint16_t offset16;
+    if (index_format) {
+      if (PREDICT_FALSE(!file.ReadU32(&offset))) {
+        return FONT_COMPRESSION_FAILURE();
+      }
+    } else {
+      if (PREDICT_FALSE(!file.ReadU16(&offset16))) {
+        return FONT_COMPRESSION_FAILURE();
+      }
+      offset = 2 * static_cast<uint32_t>(offset16);
+    }
+  }
+  glyf_data = uncompressed_buf.data() + glyf_table.src_offset;
+  glyf_length = glyf_table.src_length;
+  num_glyphs = maxp_num_glyphs;
   return true;
 }
 
+WOFF2GlyphAccessor::WOFF2GlyphAccessor() : state_(new State()) {}
+
+WOFF2GlyphAccessor::~WOFF2GlyphAccessor() {}
+
+bool WOFF2GlyphAccessor::Open(const uint8_t* data, size_t length) {
+  return Open(data, length, 0);
+}
+
+bool WOFF2GlyphAccessor::Open(const uint8_t* data, size_t length,
+                              size_t font_index) {
+  State* state = state_.get();
+  state->Clear();
+  WOFF2Header& hdr = state->hdr;
+  if (!ReadWOFF2Header(data, length, length, &hdr)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  // The accessor takes no dictionary, so, as in SelectDictionary, the
+  // reserved field is ignored.
+  if (PREDICT_FALSE(hdr.header_version ? font_index >= hdr.ttc_fonts.size()
+                                       : font_index != 0)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+
+  const float compression_ratio = (float) hdr.uncompressed_size / length;
+  if (PREDICT_FALSE(compression_ratio > kMaxPlausibleCompressionRatio ||
+                    hdr.uncompressed_size < 1)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  state->uncompressed_buf.resize(hdr.uncompressed_size);
+  if (PREDICT_FALSE(!Woff2Uncompress(&state->uncompressed_buf[0],
+                                     hdr.uncompressed_size,
+                                     data + hdr.compressed_offset,
+                                     hdr.compressed_length, NULL, NULL))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+
+  std::vector<Table*> tables = Tables(&hdr, font_index);
+  const Table* glyf_table = FindTable(&tables, kGlyfTableTag);
+  const Table* loca_table = FindTable(&tables, kLocaTableTag);
+  if (PREDICT_FALSE(glyf_table == NULL || loca_table == NULL)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  state->transformed = (glyf_table->flags & kWoff2FlagsTransform) != 0;
+  if (PREDICT_FALSE(state->transformed !=
+                    ((loca_table->flags & kWoff2FlagsTransform) != 0))) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  bool ok;
+  if (state->transformed) {
+    ok = state->OpenTransformed(*glyf_table, *loca_table);
+  } else {
+    const Table* head_table = FindTable(&tables, kHeadTableTag);
+    const Table* maxp_table = FindTable(&tables, kMaxpTableTag);
+    ok = head_table != NULL && maxp_table != NULL &&
+         state->OpenUntransformed(*glyf_table, *loca_table, *head_table,
+                                  *maxp_table);
+  }
+  if (PREDICT_FALSE(!ok)) {
+    state->Clear();
+    return FONT_COMPRESSION_FAILURE();
+  }
+  return true;
+}
+
+size_t WOFF2GlyphAccessor::NumGlyphs() const {
+  return state_->num_glyphs;
+}
+
+bool WOFF2GlyphAccessor::GetGlyph(unsigned int glyph_id, WOFF2Out* out) {
+  State* state = state_.get();
+  if (PREDICT_FALSE(glyph_id >= state->num_glyphs)) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+
+  if (!state->transformed) {
+    const uint32_t begin = state->loca[glyph_id];
+    const uint32_t end = state->loca[glyph_id + 1];
+    if (PREDICT_FALSE(begin > end || end > state->glyf_length)) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    return end == begin ||
+        out->Write(state->glyf_data + begin, end - begin);
+  }
+
+  // Carry on from the last glyph if it is close enough ahead, else start
+  // from the checkpoint before glyph_id.
+  if (glyph_id < state->next_glyph ||
+      glyph_id - state->next_glyph >= kGlyphCheckpointInterval) {
+    const unsigned int checkpoint = glyph_id / kGlyphCheckpointInterval;
+    state->streams.reset(new GlyfStreams(state->glyf.substreams));
+    state->next_glyph = state->num_glyphs;
+    if (PREDICT_FALSE(!state->streams->Seek(
+            &state->checkpoints[kNumGlyfSubStreams * checkpoint]))) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    state->next_glyph = checkpoint * kGlyphCheckpointInterval;
+  }
+  const GlyfBitmaps& bitmaps = state->glyf.bitmaps;
+  GlyfStreams* streams = state->streams.get();
+  for (; state->next_glyph < glyph_id; ++state->next_glyph) {
+    if (PREDICT_FALSE(!SkipGlyph(state->next_glyph, bitmaps, streams))) {
+      state->next_glyph = state->num_glyphs;
+      return FONT_COMPRESSION_FAILURE();
+    }
+  }
+
+  size_t glyph_size = 0;
+  int16_t x_min;
+  if (PREDICT_FALSE(!DecodeGlyph(glyph_id, bitmaps, streams, &state->scratch,
+                                 &glyph_size, &x_min))) {
+    // The substreams are left at some unknown position.
+    state->next_glyph = state->num_glyphs;
+    return FONT_COMPRESSION_FAILURE();
+  }
+  ++state->next_glyph;
+  return glyph_size == 0 ||
+      out->Write(state->scratch.glyph_buf.get(), glyph_size);
+}
+
 } // namespace woff2
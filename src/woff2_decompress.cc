@@ -7,35 +7,165 @@
 /* A very simple commandline tool for decompressing woff2 format files to true
    type font files. */
 
+#include <cstdlib>
+#include <cstring>
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "./batch.h"
 #include "./file.h"
 #include <woff2/decode.h>
 
+namespace {
 
-int main(int argc, char **argv) {
-  if (argc != 2) {
-    fprintf(stderr, "One argument, the input filename, must be provided.\n");
-    return 1;
+// Without a dictionary, the decoder ignores the reserved field of the
+// header, so a font compressed with one only fails to decompress. Says what
+// the field may mean.
+void ExplainFailure(const woff2::InputFile& input) {
+  woff2::WOFF2ProbeInfo info;
+  std::vector<woff2::WOFF2TableEntry> tables(0xFFFF);
+  if (woff2::WOFF2Probe(input.data(), input.size(), &info, tables.data(),
+                        tables.size()) &&
+      info.dictionary_id != 0) {
+    fprintf(stderr, "The reserved field of the header is %04x: if the file "
+            "was compressed with\n"
+            "a dictionary, give it with --dictionary.\n", info.dictionary_id);
   }
+}
 
-  std::string filename(argv[1]);
+// Decompresses filename into a .ttf next to it. With has_dictionary unset,
+// explains failures that may be down to a missing dictionary.
+bool DecompressFile(woff2::WOFF2Decoder* decoder, bool has_dictionary,
+                    const std::string& filename,
+                    woff2::BatchFileResult* result) {
   std::string outfilename = filename.substr(0, filename.find_last_of(".")) + ".ttf";
 
-  // Note: update woff2_dec_fuzzer_new_entry.cc if this pattern changes.
-  std::string input = woff2::GetFileContent(filename);
-  const uint8_t* raw_input = reinterpret_cast<const uint8_t*>(input.data());
-  std::string output(
-      std::min(woff2::ComputeWOFF2FinalSize(raw_input, input.size()),
-               woff2::kDefaultMaxSize),
-      0);
-  woff2::WOFF2StringOut out(&output);
+  // Note: update convert_woff2ttf_fuzzer_new_entry.cc if this pattern changes.
+  woff2::InputFile input(filename);
+  if (!input.ok()) {
+    fprintf(stderr, "Can't read %s\n", filename.c_str());
+    return false;
+  }
+  woff2::WOFF2FileOut out(outfilename,
+      std::min(woff2::ComputeWOFF2FinalSize(input.data(), input.size()),
+               woff2::kDefaultMaxSize));
 
-  const bool ok = woff2::ConvertWOFF2ToTTF(raw_input, input.size(), &out);
+  if (!decoder->Decode(input.data(), input.size(), &out)) {
+    out.Discard();
+    if (!has_dictionary) {
+      ExplainFailure(input);
+    }
+    return false;
+  }
+  result->input_size = input.size();
+  result->output_size = out.Size();
+  return out.Close();
+}
 
-  if (ok) {
-    woff2::SetFileContents(outfilename, output.begin(),
-        output.begin() + out.Size());
+void PrintStats(const woff2::WOFF2Stats& stats) {
+  const double ms = 1e-6;
+  fprintf(stdout, "parse %.2f ms, brotli %.2f ms, reconstruct %.2f ms, "
+          "total %.2f ms\n", stats.parse_ns * ms, stats.brotli_ns * ms,
+          stats.reconstruct_ns * ms, stats.total_ns * ms);
+  for (const woff2::WOFF2TableStats& table : stats.tables) {
+    fprintf(stdout, "  %c%c%c%c %8zu bytes %8.3f ms\n",
+            (table.tag >> 24) & 0xFF, (table.tag >> 16) & 0xFF,
+            (table.tag >> 8) & 0xFF, table.tag & 0xFF, table.length,
+            table.ns * ms);
+  }
+  fprintf(stdout, "%zu glyphs: %zu simple, %zu composite, %zu empty; "
+          "%zu contours, %zu points\n",
+          stats.glyphs, stats.simple_glyphs, stats.composite_glyphs,
+          stats.empty_glyphs, stats.contours, stats.points);
+  fprintf(stdout, "%zu -> %zu -> %zu bytes, %zu output reallocations\n",
+          stats.brotli_compressed_bytes, stats.brotli_uncompressed_bytes,
+          stats.output_bytes, stats.output_reallocations);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  std::string batch;
+  int jobs = 0;
+  bool print_stats = false;
+  woff2::WOFF2DecodeParams params;
+  std::shared_ptr<const woff2::WOFF2Dictionary> dictionary;
+  int arg = 1;
+  for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; ++arg) {
+    const char* flag = argv[arg];
+    if (strncmp(flag, "--batch=", 8) == 0) {
+      batch = flag + 8;
+    } else if (strncmp(flag, "--jobs=", 7) == 0) {
+      jobs = atoi(flag + 7);
+    } else if (strcmp(flag, "--stats") == 0) {
+      print_stats = true;
+    } else if (strncmp(flag, "--dictionary=", 13) == 0) {
+      woff2::InputFile file(flag + 13);
+      if (file.ok()) {
+        dictionary = woff2::WOFF2Dictionary::Parse(file.data(), file.size());
+      }
+      if (!dictionary) {
+        fprintf(stderr, "Can't read the dictionary %s\n", flag + 13);
+        return 1;
+      }
+      params.dictionary = dictionary.get();
+    } else {
+      fprintf(stderr, "Unknown flag %s\n", flag);
+      return 1;
+    }
+  }
+
+  if (!batch.empty()) {
+    if (arg != argc) {
+      fprintf(stderr, "No filename may be given with --batch.\n");
+      return 1;
+    }
+    std::vector<std::string> files;
+    if (!woff2::ListBatchInputs(batch, {".woff2"}, &files)) {
+      fprintf(stderr, "Can't read %s\n", batch.c_str());
+      return 1;
+    }
+    // One decoder per worker, so buffers are reused from font to font.
+    std::vector<std::unique_ptr<woff2::WOFF2Decoder>> decoders;
+    for (size_t i = 0; i < woff2::BatchWorkers(jobs, files.size()); ++i) {
+      decoders.emplace_back(new woff2::WOFF2Decoder(params));
+    }
+    const size_t failures = woff2::RunBatch(files, jobs,
+        [&decoders, &dictionary](size_t worker, const std::string& filename,
+                                 woff2::BatchFileResult* result) {
+          return DecompressFile(decoders[worker].get(), dictionary != NULL,
+                                filename, result);
+        });
+    return failures == 0 ? 0 : 1;
+  }
+
+  if (argc - arg != 1) {
+    fprintf(stderr, "One argument, the input filename, must be provided.\n"
+            "Usage: %s [--stats] [--dictionary=FILE] FILE\n"
+            "       %s [--dictionary=FILE] --batch=DIR_OR_MANIFEST "
+            "[--jobs=N]\n"
+            "  --stats       report time per stage and table\n"
+            "  --dictionary  the dictionary the files were compressed with\n"
+            "  --batch       decompress every .woff2 in a directory, or every "
+            "file\n"
+            "                listed one per line in a manifest\n"
+            "  --jobs        worker threads for --batch, 0 for all\n",
+            argv[0], argv[0]);
+    return 1;
+  }
+
+  woff2::WOFF2Stats stats;
+  if (print_stats) {
+    params.stats = &stats;
+  }
+  woff2::WOFF2Decoder decoder(params);
+  woff2::BatchFileResult result;
+  if (!DecompressFile(&decoder, dictionary != NULL, argv[arg], &result)) {
+    return 1;
+  }
+  if (print_stats) {
+    PrintStats(stats);
   }
-  return ok ? 0 : 1;
+  return 0;
 }
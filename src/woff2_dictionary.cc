@@ -0,0 +1,103 @@
+/* Copyright 2026 Google Inc. All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+*/
+
+/* Brotli dictionaries shared by the WOFF2 files of a closed deployment. */
+
+#include <woff2/dictionary.h>
+
+#include "./buffer.h"
+#include "./port.h"
+#include "./store_bytes.h"
+
+namespace woff2 {
+
+namespace {
+
+// File layout, big-endian like the rest of the format:
+//   uint32 signature, 'w2dc'
+//   uint8  Brotli quality
+//   uint8  Brotli window
+//   uint16 reserved, 0
+//   uint32 data length
+//   uint32 prefix length
+//   data, then prefix
+const uint32_t kDictionarySignature = 0x77326463;
+const size_t kDictionaryHeaderSize = 16;
+
+// The valid ranges, as in Brotli's encode.h; not included here, the common
+// library doesn't link Brotli.
+const int kMaxQuality = 11;
+const int kMinWindow = 10;
+const int kMaxWindow = 24;
+
+// FNV-1a over the settings and the prefix, which determine what a font
+// compressed with the dictionary decodes to, folded to 16 bits.
+uint16_t DictionaryId(const std::string& prefix, int quality, int window) {
+  uint32_t hash = 2166136261u;
+  auto add = [&hash](uint8_t byte) {
+    hash = (hash ^ byte) * 16777619u;
+  };
+  add(quality);
+  add(window);
+  for (char c : prefix) {
+    add(static_cast<uint8_t>(c));
+  }
+  const uint16_t id = (hash >> 16) ^ (hash & 0xffff);
+  return id != 0 ? id : 1;
+}
+
+}  // namespace
+
+WOFF2Dictionary::WOFF2Dictionary(const std::string& data,
+                                 const std::string& prefix,
+                                 int brotli_quality, int brotli_window)
+    : data_(data), prefix_(prefix), brotli_quality_(brotli_quality),
+      brotli_window_(brotli_window),
+      id_(DictionaryId(prefix, brotli_quality, brotli_window)) {}
+
+std::shared_ptr<const WOFF2Dictionary> WOFF2Dictionary::Parse(
+    const uint8_t* data, size_t length) {
+  Buffer file(data, length);
+  uint32_t signature, data_length, prefix_length;
+  uint8_t quality, window;
+  uint16_t reserved;
+  if (!file.ReadU32(&signature) || !file.ReadU8(&quality) ||
+      !file.ReadU8(&window) || !file.ReadU16(&reserved) ||
+      !file.ReadU32(&data_length) || !file.ReadU32(&prefix_length)) {
+    return NULL;
+  }
+  if (PREDICT_FALSE(signature != kDictionarySignature || reserved != 0 ||
+                    quality > kMaxQuality || window < kMinWindow ||
+                    window > kMaxWindow || data_length == 0 ||
+                    data_length > kMaxDictionarySize ||
+                    prefix_length == 0 ||
+                    length - kDictionaryHeaderSize !=
+                        static_cast<uint64_t>(data_length) + prefix_length)) {
+    return NULL;
+  }
+  const char* bytes = reinterpret_cast<const char*>(data) +
+      kDictionaryHeaderSize;
+  return std::make_shared<WOFF2Dictionary>(
+      std::string(bytes, data_length),
+      std::string(bytes + data_length, prefix_length), quality, window);
+}
+
+std::string WOFF2Dictionary::Serialize() const {
+  std::string out(kDictionaryHeaderSize, '\0');
+  uint8_t* header = reinterpret_cast<uint8_t*>(&out[0]);
+  size_t offset = 0;
+  StoreU32(kDictionarySignature, &offset, header);
+  header[offset++] = brotli_quality_;
+  header[offset++] = brotli_window_;
+  Store16(0, &offset, header);
+  StoreU32(data_.size(), &offset, header);
+  StoreU32(prefix_.size(), &offset, header);
+  out += data_;
+  out += prefix_;
+  return out;
+}
+
+} // namespace woff2
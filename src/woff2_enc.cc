@@ -9,15 +9,21 @@
 #include <woff2/encode.h>
 
 #include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <complex>
 #include <cstring>
 #include <limits>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <vector>
 
 #include <brotli/encode.h>
 #include "./buffer.h"
 #include "./font.h"
+#include "./glyph_cache.h"
 #include "./normalize.h"
 #include "./round.h"
 #include "./store_bytes.h"
@@ -31,32 +37,361 @@ namespace woff2 {
 
 namespace {
 
-const size_t kWoff2HeaderSize = 48;
 const size_t kWoff2EntrySize = 20;
 
+// Brotli quality of FastWOFF2Params(). 0 and 1 use Brotli's one and two
+// pass compressors; 2 is the first with a proper match finder, and makes
+// fonts 15-20% smaller in about twice the time. Past 3 each step costs much
+// more than it saves.
+const int kFastBrotliQuality = 2;
+
+// The autotuner's trial compressions use at most this much of the font...
+const size_t kAutotuneSampleSize = 256 << 10;
+// ...and stop once they have used this share of the budget.
+const double kAutotuneSampleShare = 0.25;
+
+// Brotli settings for the font data.
+struct BrotliSettings {
+  int quality;
+  int window;   // lgwin
+  int lgblock;  // 0 lets Brotli choose
+};
+
+// Creates an encoder for a stream that starts stream_offset bytes into the
+// data. Returns NULL if a setting is rejected.
+BrotliEncoderState* CreateEncoder(const BrotliSettings& settings,
+                                  BrotliEncoderMode mode,
+                                  size_t stream_offset) {
+  BrotliEncoderState* state = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+  if (state == NULL) {
+    return NULL;
+  }
+  bool ok =
+      BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY,
+                                settings.quality) &&
+      BrotliEncoderSetParameter(state, BROTLI_PARAM_LGWIN, settings.window) &&
+      BrotliEncoderSetParameter(state, BROTLI_PARAM_MODE, mode);
+  if (ok && settings.lgblock != 0) {
+    ok = BrotliEncoderSetParameter(state, BROTLI_PARAM_LGBLOCK,
+                                   settings.lgblock);
+  }
+  if (ok && stream_offset != 0) {
+    ok = BrotliEncoderSetParameter(state, BROTLI_PARAM_STREAM_OFFSET,
+                                   stream_offset);
+  }
+  if (!ok) {
+    BrotliEncoderDestroyInstance(state);
+    return NULL;
+  }
+  return state;
+}
+
 bool Compress(const uint8_t* data, const size_t len, uint8_t* result,
-              uint32_t* result_len, BrotliEncoderMode mode, int quality) {
+              uint32_t* result_len, BrotliEncoderMode mode,
+              const BrotliSettings& settings) {
   size_t compressed_len = *result_len;
-  if (BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, mode, len, data,
-                            &compressed_len, result) == 0) {
+  if (settings.lgblock == 0) {
+    if (BrotliEncoderCompress(settings.quality, settings.window, mode, len,
+                              data, &compressed_len, result) == 0) {
+      return false;
+    }
+    *result_len = compressed_len;
+    return true;
+  }
+
+  // The one-shot API has no way to set lgblock.
+  BrotliEncoderState* state = CreateEncoder(settings, mode, 0);
+  if (state == NULL) {
+    return false;
+  }
+  size_t available_in = len;
+  size_t available_out = compressed_len;
+  bool ok = BrotliEncoderCompressStream(state, BROTLI_OPERATION_FINISH,
+                                        &available_in, &data,
+                                        &available_out, &result, NULL) &&
+            BrotliEncoderIsFinished(state);
+  BrotliEncoderDestroyInstance(state);
+  if (!ok) {
     return false;
   }
-  *result_len = compressed_len;
+  *result_len = compressed_len - available_out;
   return true;
 }
 
 bool Woff2Compress(const uint8_t* data, const size_t len,
                    uint8_t* result, uint32_t* result_len,
-                   int quality) {
+                   const BrotliSettings& settings) {
   return Compress(data, len, result, result_len,
-                  BROTLI_MODE_FONT, quality);
+                  BROTLI_MODE_FONT, settings);
+}
+
+// Compresses data[start, start + len) of a larger stream into out. Every
+// chunk after the first is encoded at its stream offset, so it has no stream
+// header and can be appended to the output of the chunks before it; all but
+// the last are flushed to a byte boundary instead of being finished.
+bool CompressChunk(const uint8_t* data, size_t start, size_t len,
+                   bool is_last, const BrotliSettings& settings,
+                   std::vector<uint8_t>* out) {
+  // Every chunk must agree on the parameters the stream header implies.
+  BrotliEncoderState* state = CreateEncoder(settings, BROTLI_MODE_FONT,
+                                            start);
+  if (state == NULL) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  const BrotliEncoderOperation op =
+      is_last ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_FLUSH;
+  size_t available_in = len;
+  const uint8_t* next_in = data + start;
+  size_t used = 0;
+  bool ok = true;
+  out->resize(BrotliEncoderMaxCompressedSize(len));
+  while (ok) {
+    if (out->size() == used) {
+      out->resize(2 * out->size());
+    }
+    size_t available_out = out->size() - used;
+    uint8_t* next_out = &(*out)[used];
+    ok = BrotliEncoderCompressStream(state, op, &available_in, &next_in,
+                                     &available_out, &next_out, NULL);
+    used = out->size() - available_out;
+    if (is_last ? BrotliEncoderIsFinished(state) :
+        available_in == 0 && !BrotliEncoderHasMoreOutput(state)) {
+      break;
+    }
+  }
+  BrotliEncoderDestroyInstance(state);
+  if (!ok) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  out->resize(used);
+  return true;
+}
+
+// Compresses data into a single Brotli stream made of independently encoded
+// chunks of chunk_size bytes, num_threads of them at a time. The chunks
+// cannot refer back into each other, which costs some compression, but the
+// output only depends on chunk_size. *result_len is the room in result on
+// entry and the compressed size on exit.
+bool Woff2CompressChunked(const uint8_t* data, const size_t len,
+                          size_t chunk_size, int num_threads,
+                          const BrotliSettings& settings,
+                          uint8_t* result, uint32_t* result_len) {
+  const size_t num_chunks = std::max<size_t>(1,
+      (len + chunk_size - 1) / chunk_size);
+  std::vector<std::vector<uint8_t> > chunks(num_chunks);
+  std::vector<char> chunk_ok(num_chunks, false);
+
+  std::atomic<size_t> next_chunk(0);
+  auto worker = [&]() {
+    for (size_t i = next_chunk++; i < num_chunks; i = next_chunk++) {
+      const size_t start = i * chunk_size;
+      chunk_ok[i] = CompressChunk(data, start,
+                                  std::min(chunk_size, len - start),
+                                  i + 1 == num_chunks, settings, &chunks[i]);
+    }
+  };
+  unsigned int threads_wanted = num_threads > 0 ?
+      num_threads : std::thread::hardware_concurrency();
+  threads_wanted = std::min<size_t>(std::max(1u, threads_wanted), num_chunks);
+  std::vector<std::thread> threads;
+  for (unsigned int t = 1; t < threads_wanted; ++t) {
+    try {
+      threads.emplace_back(worker);
+    } catch (const std::system_error&) {
+      break;  // carry on with the threads we have
+    }
+  }
+  worker();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  size_t total = 0;
+  for (size_t i = 0; i < num_chunks; ++i) {
+    if (!chunk_ok[i]) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    total += chunks[i].size();
+  }
+  if (total > *result_len) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  size_t offset = 0;
+  for (const auto& chunk : chunks) {
+    StoreBytes(chunk.data(), chunk.size(), &offset, result);
+  }
+  *result_len = total;
+  return true;
+}
+
+// Feeds the dictionary data to the encoder and flushes it, leaving the
+// stream where the fonts compressed with the dictionary carry on. The output
+// is appended to prefix or, when expected is set, checked against it: a
+// different build of Brotli may compress the dictionary differently, and
+// the font data would not decode on top of the stored prefix.
+bool CompressDictionary(BrotliEncoderState* state, const std::string& data,
+                        const std::string* expected, std::string* prefix) {
+  size_t available_in = data.size();
+  const uint8_t* next_in = reinterpret_cast<const uint8_t*>(data.data());
+  size_t produced = 0;
+  for (;;) {
+    size_t available_out = 0;
+    if (!BrotliEncoderCompressStream(state, BROTLI_OPERATION_FLUSH,
+                                     &available_in, &next_in,
+                                     &available_out, NULL, NULL)) {
+      return FONT_COMPRESSION_FAILURE();
+    }
+    size_t size = 0;
+    const uint8_t* output = BrotliEncoderTakeOutput(state, &size);
+    if (expected != NULL) {
+      if (size > expected->size() - produced ||
+          memcmp(output, expected->data() + produced, size) != 0) {
+#ifdef FONT_COMPRESSION_BIN
+        fprintf(stderr, "This Brotli doesn't match the dictionary.\n");
+#endif
+        return FONT_COMPRESSION_FAILURE();
+      }
+    } else {
+      prefix->append(reinterpret_cast<const char*>(output), size);
+    }
+    produced += size;
+    if (available_in == 0 && !BrotliEncoderHasMoreOutput(state)) {
+      break;
+    }
+  }
+  return expected == NULL || produced == expected->size();
+}
+
+// Compresses data as the continuation of the dictionary's stream; result
+// gets the continuation only.
+bool Woff2CompressWithDictionary(const WOFF2Dictionary& dictionary,
+                                 const uint8_t* data, const size_t len,
+                                 uint8_t* result, uint32_t* result_len) {
+  const BrotliSettings settings = {dictionary.brotli_quality(),
+                                   dictionary.brotli_window(), 0};
+  BrotliEncoderState* state = CreateEncoder(settings, BROTLI_MODE_FONT, 0);
+  if (state == NULL) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  size_t available_in = len;
+  size_t available_out = *result_len;
+  bool ok = CompressDictionary(state, dictionary.data(),
+                               &dictionary.prefix(), NULL) &&
+            BrotliEncoderCompressStream(state, BROTLI_OPERATION_FINISH,
+                                        &available_in, &data,
+                                        &available_out, &result, NULL) &&
+            BrotliEncoderIsFinished(state);
+  BrotliEncoderDestroyInstance(state);
+  if (!ok) {
+    return FONT_COMPRESSION_FAILURE();
+  }
+  *result_len -= available_out;
+  return true;
 }
 
 bool TextCompress(const uint8_t* data, const size_t len,
                   uint8_t* result, uint32_t* result_len,
                   int quality) {
+  BrotliSettings settings = {quality, BROTLI_DEFAULT_WINDOW, 0};
   return Compress(data, len, result, result_len,
-                  BROTLI_MODE_TEXT, quality);
+                  BROTLI_MODE_TEXT, settings);
+}
+
+// Smallest window that covers len bytes, within the range Brotli accepts
+// without large-window mode.
+int CoveringWindow(size_t len) {
+  int window = BROTLI_MIN_WINDOW_BITS;
+  while (window < BROTLI_MAX_WINDOW_BITS &&
+         (static_cast<size_t>(1) << window) - 16 < len) {
+    ++window;
+  }
+  return window;
+}
+
+// Picks the Brotli quality for the font data by compressing a sample of it
+// at increasing qualities, up to settings->quality. Each trial is skipped,
+// along with the ones after it, if its expected cost would overrun the share
+// of the budget set aside for trials or could not fit the whole font in the
+// budget anyway. The best compressing quality whose time, extrapolated to
+// the whole font, fits what is left of the budget wins. A sample says
+// nothing about matches beyond its own size, so the window is not sampled:
+// it is widened to cover the whole input instead.
+void AutotuneBrotli(const uint8_t* data, size_t len, double budget_ms,
+                    BrotliSettings* settings, WOFF2AutotuneResult* result) {
+  // Rough cost of each quality relative to the first, used to guess how
+  // long the next trial takes from the last one.
+  static const struct {
+    int quality;
+    double relative_cost;
+  } kTrials[] = {{5, 1}, {7, 1.6}, {9, 3.5}, {10, 40}, {11, 100}};
+  const size_t sample_len = std::min(len, kAutotuneSampleSize);
+  // glyf makes up the middle of most fonts, and most of their size.
+  const uint8_t* sample = data + (len - sample_len) / 2;
+  std::vector<uint8_t> sample_out(BrotliEncoderMaxCompressedSize(sample_len));
+
+  const auto start = std::chrono::steady_clock::now();
+  auto elapsed_ms = [&start]() {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+  };
+  BrotliSettings trial_settings = *settings;
+  trial_settings.window = std::max(settings->window, CoveringWindow(len));
+  const double scale =
+      static_cast<double>(len) / std::max<size_t>(sample_len, 1);
+  std::vector<WOFF2AutotuneTrial> trials;
+  double last_ms_per_cost = 0;
+  for (const auto& candidate : kTrials) {
+    const int quality = candidate.quality;
+    if (quality > settings->quality) {
+      break;
+    }
+    if (!trials.empty()) {
+      const double expected_ms = last_ms_per_cost * candidate.relative_cost;
+      const double elapsed = elapsed_ms();
+      if (elapsed + expected_ms > budget_ms * kAutotuneSampleShare ||
+          elapsed + expected_ms * (1 + scale) > budget_ms) {
+        break;
+      }
+    }
+    trial_settings.quality = quality;
+    uint32_t compressed_len = sample_out.size();
+    const double trial_start_ms = elapsed_ms();
+    if (!Woff2Compress(sample, sample_len, sample_out.data(),
+                       &compressed_len, trial_settings)) {
+      break;
+    }
+    WOFF2AutotuneTrial trial;
+    trial.brotli_quality = quality;
+    trial.compressed_size = compressed_len;
+    trial.ms = elapsed_ms() - trial_start_ms;
+    trial.predicted_ms = trial.ms * scale;
+    trials.push_back(trial);
+    last_ms_per_cost = trial.ms / candidate.relative_cost;
+  }
+
+  const double remaining_ms = budget_ms - elapsed_ms();
+  const WOFF2AutotuneTrial* best = NULL;
+  for (const WOFF2AutotuneTrial& trial : trials) {
+    if (trial.predicted_ms <= remaining_ms &&
+        (best == NULL || trial.compressed_size < best->compressed_size)) {
+      best = &trial;
+    }
+  }
+  if (best == NULL && !trials.empty()) {
+    best = &trials[0];  // nothing fits; go as fast as we tried
+  }
+  if (best != NULL) {
+    settings->quality = best->brotli_quality;
+    settings->window = trial_settings.window;
+  }
+
+  if (result != NULL) {
+    result->brotli_quality = settings->quality;
+    result->brotli_window = settings->window;
+    result->sample_size = sample_len;
+    result->tune_ms = elapsed_ms();
+    result->trials.swap(trials);
+  }
 }
 
 int KnownTableIndex(uint32_t tag) {
@@ -91,12 +426,12 @@ size_t TableEntrySize(const Table& table) {
   return size;
 }
 
-size_t ComputeWoff2Length(const FontCollection& font_collection,
-                          const std::vector<Table>& tables,
-                          std::map<std::pair<uint32_t, uint32_t>, uint16_t>
-                            index_by_tag_offset,
-                          size_t compressed_data_length,
-                          size_t extended_metadata_length) {
+// Size of everything before the compressed data: the header, the table
+// directory and, for collections, the collection directory.
+size_t ComputeWoff2HeaderSize(const FontCollection& font_collection,
+                              const std::vector<Table>& tables,
+                              std::map<std::pair<uint32_t, uint32_t>, uint16_t>
+                                index_by_tag_offset) {
   size_t size = kWoff2HeaderSize;
 
   for (const auto& table : tables) {
@@ -111,9 +446,8 @@ size_t ComputeWoff2Length(const FontCollection& font_collection,
     size += 4 * font_collection.fonts.size();  // UInt32 flavor for each
 
     for (const auto& font : font_collection.fonts) {
-      size += Size255UShort(font.tables.size());  // 255UInt16 numTables
-      for (const auto& entry : font.tables) {
-        const Font::Table& table = entry.second;
+      size += Size255UShort(font.Tables().size());  // 255UInt16 numTables
+      for (const Font::Table& table : font.Tables()) {
         // no collection entry for xform table
         if (table.tag & 0x80808080) continue;
 
@@ -124,8 +458,13 @@ size_t ComputeWoff2Length(const FontCollection& font_collection,
     }
   }
 
+  return size;
+}
+
+size_t ComputeWoff2Length(size_t header_size, size_t compressed_data_length,
+                          size_t extended_metadata_length) {
   // compressed data
-  size += compressed_data_length;
+  size_t size = header_size + compressed_data_length;
   size = Round4(size);
 
   size += extended_metadata_length;
@@ -135,8 +474,7 @@ size_t ComputeWoff2Length(const FontCollection& font_collection,
 size_t ComputeUncompressedLength(const Font& font) {
   // sfnt header + offset table
   size_t size = 12 + 16 * font.num_tables;
-  for (const auto& entry : font.tables) {
-    const Font::Table& table = entry.second;
+  for (const Font::Table& table : font.Tables()) {
     if (table.tag & 0x80808080) continue;  // xform tables don't stay
     if (table.IsReused()) continue;  // don't have to pay twice
     size += Round4(table.length);
@@ -158,8 +496,7 @@ size_t ComputeUncompressedLength(const FontCollection& font_collection) {
 
 size_t ComputeTotalTransformLength(const Font& font) {
   size_t total = 0;
-  for (const auto& i : font.tables) {
-    const Font::Table& table = i.second;
+  for (const Font::Table& table : font.Tables()) {
     if (table.IsReused()) {
       continue;
     }
@@ -174,6 +511,40 @@ size_t ComputeTotalTransformLength(const Font& font) {
 
 }  // namespace
 
+std::shared_ptr<const WOFF2Dictionary> CreateWOFF2Dictionary(
+    const uint8_t* data, size_t length, int brotli_quality,
+    int brotli_window) {
+  // Brotli would clamp settings out of range, unlike the ones stored.
+  if (length == 0 || length > kMaxDictionarySize ||
+      brotli_quality < BROTLI_MIN_QUALITY ||
+      brotli_quality > BROTLI_MAX_QUALITY ||
+      brotli_window < BROTLI_MIN_WINDOW_BITS ||
+      brotli_window > BROTLI_MAX_WINDOW_BITS) {
+    return NULL;
+  }
+  const BrotliSettings settings = {brotli_quality, brotli_window, 0};
+  BrotliEncoderState* state = CreateEncoder(settings, BROTLI_MODE_FONT, 0);
+  if (state == NULL) {
+    return NULL;
+  }
+  const std::string contents(reinterpret_cast<const char*>(data), length);
+  std::string prefix;
+  const bool ok = CompressDictionary(state, contents, NULL, &prefix);
+  BrotliEncoderDestroyInstance(state);
+  if (!ok) {
+    return NULL;
+  }
+  return std::make_shared<WOFF2Dictionary>(contents, prefix, brotli_quality,
+                                           brotli_window);
+}
+
+WOFF2Params FastWOFF2Params() {
+  WOFF2Params params;
+  params.brotli_quality = kFastBrotliQuality;
+  params.brotli_window_fit = true;
+  return params;
+}
+
 size_t MaxWOFF2CompressedSize(const uint8_t* data, size_t length) {
   return MaxWOFF2CompressedSize(data, length, "");
 }
@@ -187,23 +558,6 @@ size_t MaxWOFF2CompressedSize(const uint8_t* data, size_t length,
   return length + 1024 + extended_metadata.length();
 }
 
-uint32_t CompressedBufferSize(uint32_t original_size) {
-  return 1.2 * original_size + 10240;
-}
-
-bool TransformFontCollection(FontCollection* font_collection) {
-  for (auto& font : font_collection->fonts) {
-    if (!TransformGlyfAndLocaTables(&font)) {
-#ifdef FONT_COMPRESSION_BIN
-      fprintf(stderr, "glyf/loca transformation failed.\n");
-#endif
-      return FONT_COMPRESSION_FAILURE();
-    }
-  }
-
-  return true;
-}
-
 bool ConvertTTFToWOFF2(const uint8_t *data, size_t length,
                        uint8_t *result, size_t *result_length) {
   WOFF2Params params;
@@ -214,90 +568,223 @@ bool ConvertTTFToWOFF2(const uint8_t *data, size_t length,
 bool ConvertTTFToWOFF2(const uint8_t *data, size_t length,
                        uint8_t *result, size_t *result_length,
                        const WOFF2Params& params) {
+  WOFF2Stats* const stats = params.stats;
+  if (stats) {
+    ResetStats(stats);
+    stats->input_bytes = length;
+  }
+  StageTimer total_timer(stats ? &stats->total_ns : NULL);
+
   FontCollection font_collection;
-  if (!ReadFontCollection(data, length, &font_collection)) {
+  {
+    StageTimer timer(stats ? &stats->parse_ns : NULL);
+    if (!ReadFontCollection(data, length, &font_collection)) {
 #ifdef FONT_COMPRESSION_BIN
-    fprintf(stderr, "Parsing of the input font failed.\n");
+      fprintf(stderr, "Parsing of the input font failed.\n");
 #endif
-    return FONT_COMPRESSION_FAILURE();
+      return FONT_COMPRESSION_FAILURE();
+    }
   }
 
-  if (!NormalizeFontCollection(&font_collection)) {
-    return FONT_COMPRESSION_FAILURE();
+  {
+    // With transforms on, glyf and loca are transformed in the same pass
+    // over the glyphs that normalizes them.
+    StageTimer timer(stats ? &stats->normalize_ns : NULL);
+    GlyfNormalization glyf;
+    glyf.transform = params.allow_transforms;
+    glyf.normalized = params.glyf_normalized;
+    glyf.transform_min_size = params.glyf_transform_min_size;
+    if (params.cache != NULL && !params.glyf_normalized) {
+      glyf.cache = params.cache->glyphs_.get();
+      glyf.cache->BeginConversion();
+    }
+    const bool normalized = NormalizeFontCollection(
+        &font_collection, params.num_threads, glyf);
+    if (glyf.cache != NULL) {
+      glyf.cache->Trim();
+    }
+    if (!normalized) {
+      return FONT_COMPRESSION_FAILURE();
+    }
   }
 
-  if (params.allow_transforms && !TransformFontCollection(&font_collection)) {
-    return FONT_COMPRESSION_FAILURE();
-  } else {
-    // glyf/loca use 11 to flag "not transformed"
-    for (auto& font : font_collection.fonts) {
-      Font::Table* glyf_table = font.FindTable(kGlyfTableTag);
-      Font::Table* loca_table = font.FindTable(kLocaTableTag);
-      if (glyf_table) {
-        glyf_table->flag_byte |= 0xc0;
+  // glyf/loca use 11 to flag "not transformed"; transformed ones take their
+  // flags from the transformed tables.
+  for (auto& font : font_collection.fonts) {
+    Font::Table* glyf_table = font.FindTable(kGlyfTableTag);
+    Font::Table* loca_table = font.FindTable(kLocaTableTag);
+    if (glyf_table) {
+      glyf_table->flag_byte |= 0xc0;
+    }
+    if (loca_table) {
+      loca_table->flag_byte |= 0xc0;
+    }
+  }
+  if (stats) {
+    for (const auto& font : font_collection.fonts) {
+      const Font::Table* glyf = font.FindTable(kGlyfTableTag ^ 0x80808080);
+      if (glyf != NULL && !glyf->IsReused()) {
+        CountTransformedGlyf(glyf->data, glyf->length, stats);
       }
-      if (loca_table) {
-        loca_table->flag_byte |= 0xc0;
+    }
+  }
+
+  // The table directory only depends on the fonts, so it is laid out before
+  // compressing and the compressed data can go straight into the result
+  // after it.
+  std::vector<Table> tables;
+  std::map<std::pair<uint32_t, uint32_t>, uint16_t> index_by_tag_offset;
+
+  for (const auto& font : font_collection.fonts) {
+
+    for (const auto tag : font.OutputOrderedTags()) {
+      const Font::Table& src_table = *font.FindTable(tag);
+      if (src_table.IsReused()) {
+        continue;
       }
+
+      std::pair<uint32_t, uint32_t> tag_offset(src_table.tag, src_table.offset);
+      if (index_by_tag_offset.find(tag_offset) == index_by_tag_offset.end()) {
+        index_by_tag_offset[tag_offset] = tables.size();
+      } else {
+        return false;
+      }
+
+      Table table;
+      table.tag = src_table.tag;
+      table.flags = src_table.flag_byte;
+      table.src_length = src_table.length;
+      table.transform_length = src_table.length;
+      const Font::Table* transformed_table =
+          font.FindTable(src_table.tag ^ 0x80808080);
+      if (transformed_table != NULL) {
+        table.flags = transformed_table->flag_byte;
+        table.flags |= kWoff2FlagsTransform;
+        table.transform_length = transformed_table->length;
+      }
+      tables.push_back(table);
     }
   }
 
-  // Although the compressed size of each table in the final woff2 file won't
-  // be larger than its transform_length, we have to allocate a large enough
-  // buffer for the compressor, since the compressor can potentially increase
-  // the size. If the compressor overflows this, it should return false and
-  // then this function will also return false.
+  const size_t header_size = ComputeWoff2HeaderSize(font_collection, tables,
+      index_by_tag_offset);
+  if (header_size > *result_length) {
+#ifdef FONT_COMPRESSION_BIN
+    fprintf(stderr, "Result allocation was too small (%zd vs %zd bytes).\n",
+           *result_length, header_size);
+#endif
+    return FONT_COMPRESSION_FAILURE();
+  }
 
   size_t total_transform_length = 0;
   for (const auto& font : font_collection.fonts) {
     total_transform_length += ComputeTotalTransformLength(font);
   }
-  size_t compression_buffer_size = CompressedBufferSize(total_transform_length);
-  std::vector<uint8_t> compression_buf(compression_buffer_size);
-  uint32_t total_compressed_length = compression_buffer_size;
 
-  // Collect all transformed data into one place in output order.
+  // Collect all transformed data into one place in output order. Tables
+  // built by normalization or the transforms are let go as they're copied,
+  // only their lengths are needed from here on.
   std::vector<uint8_t> transform_buf(total_transform_length);
   size_t transform_offset = 0;
-  for (const auto& font : font_collection.fonts) {
+  for (auto& font : font_collection.fonts) {
     for (const auto tag : font.OutputOrderedTags()) {
-      const Font::Table& original = font.tables.at(tag);
+      Font::Table& original = *font.FindTable(tag);
       if (original.IsReused()) continue;
       if (tag & 0x80808080) continue;
-      const Font::Table* table_to_store = font.FindTable(tag ^ 0x80808080);
+      Font::Table* table_to_store = font.FindTable(tag ^ 0x80808080);
       if (table_to_store == NULL) table_to_store = &original;
 
       StoreBytes(table_to_store->data, table_to_store->length,
                  &transform_offset, &transform_buf[0]);
+      for (Font::Table* table : {&original, table_to_store}) {
+        if (!table->buffer.empty()) {
+          std::vector<uint8_t>().swap(table->buffer);
+          table->data = NULL;
+          table->data_dropped = true;
+        }
+      }
     }
   }
 
-  // Compress all transformed data in one stream.
-  if (!Woff2Compress(transform_buf.data(), total_transform_length,
-                     &compression_buf[0],
-                     &total_compressed_length,
-                     params.brotli_quality)) {
+  const WOFF2Dictionary* const dictionary = params.dictionary;
+  const bool autotune = params.autotune_budget_ms > 0 && dictionary == NULL;
+  BrotliSettings settings = {params.brotli_quality, params.brotli_window,
+                             params.brotli_lgblock};
+  if (params.brotli_window_fit) {
+    settings.window = std::min(settings.window,
+                               CoveringWindow(total_transform_length));
+  }
+  if (autotune) {
+    AutotuneBrotli(transform_buf.data(), total_transform_length,
+                   params.autotune_budget_ms, &settings,
+                   params.autotune_result);
+  }
+
+  // Compress all transformed data in one stream, into the result after the
+  // directory.
+  const auto compress_start = std::chrono::steady_clock::now();
+  uint32_t total_compressed_length = std::min<size_t>(
+      *result_length - header_size, std::numeric_limits<uint32_t>::max());
+  const bool chunked = dictionary == NULL &&
+      params.compression_chunk_size > 0 &&
+      total_transform_length > params.compression_chunk_size;
+  bool compressed;
+  if (dictionary != NULL) {
+    compressed = Woff2CompressWithDictionary(*dictionary, transform_buf.data(),
+                                             total_transform_length,
+                                             result + header_size,
+                                             &total_compressed_length);
+  } else if (chunked) {
+    compressed = Woff2CompressChunked(transform_buf.data(),
+                                      total_transform_length,
+                                      params.compression_chunk_size,
+                                      params.num_threads,
+                                      settings,
+                                      result + header_size,
+                                      &total_compressed_length);
+  } else {
+    compressed = Woff2Compress(transform_buf.data(), total_transform_length,
+                               result + header_size,
+                               &total_compressed_length,
+                               settings);
+  }
+  if (!compressed) {
 #ifdef FONT_COMPRESSION_BIN
     fprintf(stderr, "Compression of combined table failed.\n");
 #endif
     return FONT_COMPRESSION_FAILURE();
   }
+  std::vector<uint8_t>().swap(transform_buf);
 
-#ifdef FONT_COMPRESSION_BIN
-  fprintf(stderr, "Compressed %zu to %u.\n", total_transform_length,
-          total_compressed_length);
-#endif
+  const auto compress_time = std::chrono::steady_clock::now() - compress_start;
+  if (autotune && params.autotune_result != NULL) {
+    params.autotune_result->compress_ms =
+        std::chrono::duration<double, std::milli>(compress_time).count();
+  }
+  if (stats) {
+    stats->brotli_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(compress_time)
+            .count();
+    stats->brotli_uncompressed_bytes = total_transform_length;
+    stats->brotli_compressed_bytes = total_compressed_length;
+    stats->brotli_chunks = chunked
+        ? (total_transform_length + params.compression_chunk_size - 1) /
+              params.compression_chunk_size
+        : 1;
+  }
 
-  // Compress the extended metadata
+  // Compress the extended metadata, into the result after the font data.
   // TODO(user): how does this apply to collections
-  uint32_t compressed_metadata_buf_length =
-    CompressedBufferSize(params.extended_metadata.length());
-  std::vector<uint8_t> compressed_metadata_buf(compressed_metadata_buf_length);
-
+  const size_t metadata_offset = Round4(header_size + total_compressed_length);
+  uint32_t compressed_metadata_buf_length = 0;
   if (params.extended_metadata.length() > 0) {
+    compressed_metadata_buf_length = metadata_offset < *result_length
+        ? std::min<size_t>(*result_length - metadata_offset,
+                           std::numeric_limits<uint32_t>::max())
+        : 0;
     if (!TextCompress((const uint8_t*)params.extended_metadata.data(),
                       params.extended_metadata.length(),
-                      compressed_metadata_buf.data(),
+                      result + metadata_offset,
                       &compressed_metadata_buf_length,
                       params.brotli_quality)) {
 #ifdef FONT_COMPRESSION_BIN
@@ -305,50 +792,10 @@ bool ConvertTTFToWOFF2(const uint8_t *data, size_t length,
 #endif
       return FONT_COMPRESSION_FAILURE();
     }
-  } else {
-    compressed_metadata_buf_length = 0;
   }
 
-  std::vector<Table> tables;
-  std::map<std::pair<uint32_t, uint32_t>, uint16_t> index_by_tag_offset;
-
-  for (const auto& font : font_collection.fonts) {
-
-    for (const auto tag : font.OutputOrderedTags()) {
-      const Font::Table& src_table = font.tables.at(tag);
-      if (src_table.IsReused()) {
-        continue;
-      }
-
-      std::pair<uint32_t, uint32_t> tag_offset(src_table.tag, src_table.offset);
-      if (index_by_tag_offset.find(tag_offset) == index_by_tag_offset.end()) {
-        index_by_tag_offset[tag_offset] = tables.size();
-      } else {
-        return false;
-      }
-
-      Table table;
-      table.tag = src_table.tag;
-      table.flags = src_table.flag_byte;
-      table.src_length = src_table.length;
-      table.transform_length = src_table.length;
-      const uint8_t* transformed_data = src_table.data;
-      const Font::Table* transformed_table =
-          font.FindTable(src_table.tag ^ 0x80808080);
-      if (transformed_table != NULL) {
-        table.flags = transformed_table->flag_byte;
-        table.flags |= kWoff2FlagsTransform;
-        table.transform_length = transformed_table->length;
-        transformed_data = transformed_table->data;
-
-      }
-      tables.push_back(table);
-    }
-  }
-
-  size_t woff2_length = ComputeWoff2Length(font_collection, tables,
-      index_by_tag_offset, total_compressed_length,
-      compressed_metadata_buf_length);
+  size_t woff2_length = ComputeWoff2Length(header_size,
+      total_compressed_length, compressed_metadata_buf_length);
   if (woff2_length > *result_length) {
 #ifdef FONT_COMPRESSION_BIN
     fprintf(stderr, "Result allocation was too small (%zd vs %zd bytes).\n",
@@ -357,6 +804,9 @@ bool ConvertTTFToWOFF2(const uint8_t *data, size_t length,
     return FONT_COMPRESSION_FAILURE();
   }
   *result_length = woff2_length;
+  if (stats) {
+    stats->output_bytes = woff2_length;
+  }
 
   size_t offset = 0;
 
@@ -369,7 +819,8 @@ bool ConvertTTFToWOFF2(const uint8_t *data, size_t length,
   }
   StoreU32(woff2_length, &offset, result);
   Store16(tables.size(), &offset, result);
-  Store16(0, &offset, result);  // reserved
+  // reserved, the dictionary id for files that need one
+  Store16(dictionary != NULL ? dictionary->id() : 0, &offset, result);
   // totalSfntSize
   StoreU32(ComputeUncompressedLength(font_collection), &offset, result);
   StoreU32(total_compressed_length, &offset, result);  // totalCompressedSize
@@ -404,16 +855,14 @@ bool ConvertTTFToWOFF2(const uint8_t *data, size_t length,
     for (const Font& font : font_collection.fonts) {
 
       uint16_t num_tables = 0;
-      for (const auto& entry : font.tables) {
-        const Font::Table& table = entry.second;
+      for (const Font::Table& table : font.Tables()) {
         if (table.tag & 0x80808080) continue;  // don't write xform tables
         num_tables++;
       }
       Store255UShort(num_tables, &offset, result);
 
       StoreU32(font.flavor, &offset, result);
-      for (const auto& entry : font.tables) {
-        const Font::Table& table = entry.second;
+      for (const Font::Table& table : font.Tables()) {
         if (table.tag & 0x80808080) continue;  // don't write xform tables
 
         // for reused tables, only the original has an updated offset
@@ -437,13 +886,20 @@ fprintf(stderr, "Missing table index for offset 0x%08x\n",
     }
   }
 
-  // compressed data format (http://www.w3.org/TR/WOFF2/#table_format)
-
-  StoreBytes(&compression_buf[0], total_compressed_length, &offset, result);
-  offset = Round4(offset);
-
-  StoreBytes(compressed_metadata_buf.data(), compressed_metadata_buf_length,
-             &offset, result);
+  // compressed data format (http://www.w3.org/TR/WOFF2/#table_format),
+  // already in place
+  if (offset != header_size) {
+#ifdef FONT_COMPRESSION_BIN
+    fprintf(stderr, "Mismatch between computed and actual header length "
+            "(%zd vs %zd)\n", header_size, offset);
+#endif
+    return FONT_COMPRESSION_FAILURE();
+  }
+  offset += total_compressed_length;
+  while (offset < metadata_offset) {
+    result[offset++] = 0;
+  }
+  offset += compressed_metadata_buf_length;
 
   if (*result_length != offset) {
 #ifdef FONT_COMPRESSION_BIN
@@ -0,0 +1,91 @@
+/* Copyright 2026 Google Inc. All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+*/
+
+/* Fuzzes WOFF2GlyphAccessor against ConvertWOFF2ToTTF. */
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "./font.h"
+#include "./table_tags.h"
+#include <woff2/decode.h>
+
+namespace {
+
+// Checks that glyph is glyph_id of the decoded font, which pads glyphs to
+// four bytes.
+bool SameGlyph(const woff2::Font* font, unsigned int glyph_id,
+               const std::string& glyph) {
+  if (font == NULL) {
+    return true;
+  }
+  const uint8_t* expected;
+  size_t expected_size;
+  if (!woff2::GetGlyphData(*font, glyph_id, &expected, &expected_size) ||
+      glyph.size() > expected_size || expected_size - glyph.size() >= 4 ||
+      memcmp(glyph.data(), expected, glyph.size()) != 0) {
+    return false;
+  }
+  for (size_t i = glyph.size(); i < expected_size; ++i) {
+    if (expected[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+// Entry point for LibFuzzer. Walks the glyphs of the first font forwards and
+// backwards; where ConvertWOFF2ToTTF decodes the file, the accessor must
+// open it and hand out the same glyphs as its glyf table.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  std::string ttf;
+  woff2::WOFF2StringOut ttf_out(&ttf);
+  woff2::FontCollection decoded;
+  const woff2::Font* font = NULL;
+  if (woff2::ConvertWOFF2ToTTF(data, size, &ttf_out)) {
+    if (!woff2::ReadFontCollection(
+            reinterpret_cast<const uint8_t*>(ttf.data()), ttf_out.Size(),
+            &decoded)) {
+      abort();
+    }
+    font = &decoded.fonts[0];
+    if (font->FindTable(woff2::kGlyfTableTag) == NULL) {
+      font = NULL;  // the accessor rejects it, which is fine
+    }
+  }
+
+  woff2::WOFF2GlyphAccessor accessor;
+  if (!accessor.Open(data, size)) {
+    if (font != NULL) {
+      abort();
+    }
+    return 0;
+  }
+  const size_t num_glyphs = accessor.NumGlyphs();
+  if (font != NULL &&
+      num_glyphs != static_cast<size_t>(woff2::NumGlyphs(*font))) {
+    abort();
+  }
+  std::string glyph;
+  for (size_t i = 0; i < 2 * num_glyphs; ++i) {
+    const unsigned int glyph_id =
+        i < num_glyphs ? i : 2 * num_glyphs - 1 - i;
+    glyph.clear();
+    woff2::WOFF2StringOut out(&glyph);
+    const bool ok = accessor.GetGlyph(glyph_id, &out);
+    glyph.resize(out.Size());
+    if (font != NULL && (!ok || !SameGlyph(font, glyph_id, glyph))) {
+      abort();
+    }
+  }
+  if (accessor.GetGlyph(num_glyphs, NULL)) {
+    abort();
+  }
+  return 0;
+}
@@ -38,10 +38,13 @@ int main(int argc, char **argv) {
   std::string outfilename = filename.substr(0, filename.find_last_of(".")) + ".woff2";
   fprintf(stdout, "Processing %s => %s\n",
     filename.c_str(), outfilename.c_str());
-  std::string input = woff2::GetFileContent(filename);
+  woff2::InputFile input(filename);
+  if (!input.ok()) {
+    fprintf(stderr, "Can't read %s\n", filename.c_str());
+    return 1;
+  }
 
-  woff2::Buffer file(reinterpret_cast<const uint8_t*>(input.data()),
-    input.size());
+  woff2::Buffer file(input.data(), input.size());
 
   printf("WOFF2Header\n");
   uint32_t signature, flavor, length, totalSfntSize, totalCompressedSize;
@@ -11,7 +11,7 @@
 namespace woff2 {
 
 WOFF2StringOut::WOFF2StringOut(std::string *buf)
-    : buf_(buf), max_size_(kDefaultMaxSize), offset_(0) {}
+    : buf_(buf), max_size_(kDefaultMaxSize), offset_(0), reallocations_(0) {}
 
 bool WOFF2StringOut::Write(const void *buf, size_t n) {
   return Write(buf, offset_, n);
@@ -21,6 +21,8 @@ bool WOFF2StringOut::Write(const void *buf, size_t offset, size_t n) {
   if (offset > max_size_ || n > max_size_ - offset) {
     return false;
   }
+  const size_t capacity = buf_->capacity();
+  const bool had_data = !buf_->empty();
   if (offset == buf_->size()) {
     buf_->append(static_cast<const char*>(buf), n);
   } else {
@@ -30,10 +32,32 @@ bool WOFF2StringOut::Write(const void *buf, size_t offset, size_t n) {
     buf_->replace(offset, n, static_cast<const char*>(buf), n);
   }
   offset_ = std::max(offset_, offset + n);
+  reallocations_ += had_data && buf_->capacity() != capacity;
 
   return true;
 }
 
+void WOFF2StringOut::SizeHint(size_t size) {
+  size = std::min(size, max_size_);
+  if (size > buf_->capacity()) {
+    reallocations_ += !buf_->empty();
+    buf_->reserve(size);
+  }
+}
+
+uint8_t *WOFF2StringOut::Reserve(size_t n) {
+  if (offset_ != buf_->size() || n > max_size_ - offset_) {
+    return NULL;
+  }
+  const size_t capacity = buf_->capacity();
+  const bool had_data = !buf_->empty();
+  buf_->resize(offset_ + n);
+  reallocations_ += had_data && buf_->capacity() != capacity;
+  uint8_t *result = reinterpret_cast<uint8_t*>(&(*buf_)[0]) + offset_;
+  offset_ += n;
+  return result;
+}
+
 void WOFF2StringOut::SetMaxSize(size_t max_size) {
   max_size_ = max_size;
   if (offset_ > max_size_) {
@@ -41,6 +65,30 @@ void WOFF2StringOut::SetMaxSize(size_t max_size) {
   }
 }
 
+WOFF2SharedOut::WOFF2SharedOut()
+    : buf_(std::make_shared<std::string>()), out_(buf_.get()) {}
+
+bool WOFF2SharedOut::Write(const void *buf, size_t n) {
+  return out_.Write(buf, n);
+}
+
+bool WOFF2SharedOut::Write(const void *buf, size_t offset, size_t n) {
+  return out_.Write(buf, offset, n);
+}
+
+std::shared_ptr<const std::string> WOFF2SharedOut::Release() {
+  buf_->resize(out_.Size());
+  // Shared buffers tend to be kept around, so don't hold on to whatever
+  // SizeHint reserved.
+  buf_->shrink_to_fit();
+  std::shared_ptr<const std::string> result = std::move(buf_);
+  const size_t max_size = out_.MaxSize();
+  buf_ = std::make_shared<std::string>();
+  out_ = WOFF2StringOut(buf_.get());
+  out_.SetMaxSize(max_size);
+  return result;
+}
+
 WOFF2MemoryOut::WOFF2MemoryOut(uint8_t* buf, size_t buf_size)
   : buf_(buf),
     buf_size_(buf_size),
@@ -60,4 +108,137 @@ bool WOFF2MemoryOut::Write(const void *buf, size_t offset, size_t n) {
   return true;
 }
 
+uint8_t *WOFF2MemoryOut::Reserve(size_t n) {
+  if (n > buf_size_ - offset_) {
+    return NULL;
+  }
+  uint8_t *result = buf_ + offset_;
+  offset_ += n;
+  return result;
+}
+
+namespace {
+
+// Pieces smaller than this are cheaper to copy than to gather on their own.
+const size_t kMinReferenceSize = 256;
+
+}  // namespace
+
+WOFF2GatherOut::WOFF2GatherOut() : size_(0), max_size_(kDefaultMaxSize) {}
+
+uint8_t *WOFF2GatherOut::Append(size_t n) {
+  const size_t offset = owned_.size();
+  owned_.resize(offset + n);
+  if (!segments_.empty() && segments_.back().ref == NULL &&
+      segments_.back().offset + segments_.back().size == offset) {
+    segments_.back().size += n;
+  } else {
+    segments_.push_back(Segment{size_, n, NULL, offset});
+  }
+  size_ += n;
+  return reinterpret_cast<uint8_t*>(&owned_[0]) + offset;
+}
+
+bool WOFF2GatherOut::Write(const void *buf, size_t n) {
+  if (n > max_size_ - std::min(size_, max_size_)) {
+    return false;
+  }
+  if (n > 0) {
+    std::memcpy(Append(n), buf, n);
+  }
+  return true;
+}
+
+uint8_t *WOFF2GatherOut::Reserve(size_t n) {
+  if (n > max_size_ - std::min(size_, max_size_)) {
+    return NULL;
+  }
+  return Append(n);
+}
+
+bool WOFF2GatherOut::WriteReference(const void *buf, size_t n) {
+  if (n < kMinReferenceSize) {
+    return Write(buf, n);
+  }
+  if (n > max_size_ - std::min(size_, max_size_)) {
+    return false;
+  }
+  segments_.push_back(
+      Segment{size_, n, static_cast<const uint8_t*>(buf), 0});
+  size_ += n;
+  return true;
+}
+
+size_t WOFF2GatherOut::Own(size_t i, size_t begin, size_t n) {
+  const Segment seg = segments_[i];
+  const size_t offset = owned_.size();
+  owned_.append(reinterpret_cast<const char*>(seg.ref) + begin, n);
+  Segment pieces[3] = {
+      {seg.start, begin, seg.ref, 0},
+      {seg.start + begin, n, NULL, offset},
+      {seg.start + begin + n, seg.size - begin - n, seg.ref + begin + n, 0},
+  };
+  segments_.erase(segments_.begin() + i);
+  size_t owned_index = i;
+  for (int k = 0; k < 3; ++k) {
+    if (pieces[k].size > 0) {
+      if (k == 1) {
+        owned_index = i;
+      }
+      segments_.insert(segments_.begin() + i++, pieces[k]);
+    }
+  }
+  return owned_index;
+}
+
+bool WOFF2GatherOut::Write(const void *buf, size_t offset, size_t n) {
+  if (offset > max_size_ || n > max_size_ - offset) {
+    return false;
+  }
+  if (offset + n > size_) {
+    // Writes past the end leave zeroes in any gap, like WOFF2StringOut.
+    const size_t extra = offset + n - size_;
+    std::memset(Append(extra), 0, extra);
+  }
+  if (n == 0) {
+    return true;
+  }
+  const uint8_t *src = static_cast<const uint8_t*>(buf);
+  size_t i = std::upper_bound(segments_.begin(), segments_.end(), offset,
+                              [](size_t value, const Segment& seg) {
+                                return value < seg.start;
+                              }) - segments_.begin() - 1;
+  while (n > 0) {
+    const size_t begin = offset - segments_[i].start;
+    const size_t len = std::min(n, segments_[i].size - begin);
+    if (segments_[i].ref != NULL) {
+      i = Own(i, begin, len);
+    }
+    const Segment& seg = segments_[i];
+    std::memcpy(&owned_[seg.offset + offset - seg.start], src, len);
+    offset += len;
+    src += len;
+    n -= len;
+    ++i;
+  }
+  return true;
+}
+
+void WOFF2GatherOut::Spans(std::vector<WOFF2Span> *spans) const {
+  spans->clear();
+  for (const Segment& seg : segments_) {
+    if (seg.ref != NULL) {
+      spans->push_back(WOFF2Span{seg.ref, seg.size});
+    } else {
+      spans->push_back(WOFF2Span{owned_.data() + seg.offset, seg.size});
+    }
+  }
+}
+
+void WOFF2GatherOut::Clear() {
+  segments_.clear();
+  owned_.clear();
+  size_ = 0;
+}
+
 } // namespace woff2
@@ -0,0 +1,47 @@
+/* Copyright 2026 Google Inc. All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+*/
+
+/* Fuzzes WOFF2Probe against ConvertWOFF2ToTTF. */
+
+#include <cstdlib>
+#include <string>
+
+#include "./buffer.h"
+#include <woff2/decode.h>
+
+// Entry point for LibFuzzer. The probe must accept every file
+// ConvertWOFF2ToTTF decodes, and describe the font it decodes to.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  static woff2::WOFF2TableEntry tables[0xFFFF];
+  woff2::WOFF2ProbeInfo info;
+  const bool probe_ok = woff2::WOFF2Probe(data, size, &info, tables, 0xFFFF);
+
+  std::string ttf;
+  woff2::WOFF2StringOut out(&ttf);
+  if (!woff2::ConvertWOFF2ToTTF(data, size, &out)) {
+    return 0;
+  }
+  if (!probe_ok) {
+    abort();
+  }
+  // A single font is written with the flavor and tables of the directory.
+  woff2::Buffer font(reinterpret_cast<const uint8_t*>(ttf.data()),
+                     out.Size());
+  uint32_t flavor;
+  uint16_t num_tables;
+  if (info.num_fonts == 1 &&
+      (!font.ReadU32(&flavor) || !font.ReadU16(&num_tables) ||
+       flavor != info.flavor || num_tables != info.num_tables)) {
+    abort();
+  }
+  // The directory doesn't fit one entry fewer.
+  woff2::WOFF2ProbeInfo small;
+  if (woff2::WOFF2Probe(data, size, &small, tables, info.num_tables - 1) ||
+      small.num_tables != info.num_tables) {
+    abort();
+  }
+  return 0;
+}
@@ -0,0 +1,57 @@
+/* Copyright 2026 Google Inc. All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+*/
+
+/* Fuzzes WOFF2StreamDecoder::Append/Step against ConvertWOFF2ToTTF. */
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <woff2/decode.h>
+
+// Entry point for LibFuzzer. Appends the input in pieces and steps the
+// decoder with budgets that change from step to step, from a single byte
+// and glyph up; it must accept the same files as ConvertWOFF2ToTTF and write
+// the same fonts.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  typedef woff2::WOFF2StreamDecoder Decoder;
+  std::string expected;
+  woff2::WOFF2StringOut expected_out(&expected);
+  const bool expected_ok = woff2::ConvertWOFF2ToTTF(data, size,
+                                                    &expected_out);
+
+  static const size_t kPieces[] = {1, 7, 64, 1000};
+  static const size_t kBytes[] = {1, 3, 100, 4096, 1 << 20};
+  static const size_t kGlyphs[] = {1, 2, 64};
+  std::string actual;
+  woff2::WOFF2StringOut out(&actual);
+  Decoder decoder(&out);
+  size_t offset = 0;
+  Decoder::StepResult step = Decoder::kNeedsInput;
+  for (size_t i = 0; step != Decoder::kFailed; ++i) {
+    step = decoder.Step(kBytes[i % 5], kGlyphs[i % 3]);
+    if (step == Decoder::kMoreWork || step == Decoder::kFailed) {
+      continue;
+    }
+    if (offset == size) {
+      break;
+    }
+    // More input, also once done: the rest of the file must be appended.
+    const size_t n = std::min(kPieces[i % 4], size - offset);
+    if (!decoder.Append(data + offset, n)) {
+      step = Decoder::kFailed;
+    }
+    offset += n;
+  }
+  const bool ok = step == Decoder::kDone && decoder.Finish();
+
+  if (ok != expected_ok ||
+      (ok && (out.Size() != expected_out.Size() ||
+              memcmp(actual.data(), expected.data(), out.Size()) != 0))) {
+    abort();
+  }
+  return 0;
+}
@@ -0,0 +1,42 @@
+/* Copyright 2026 Google Inc. All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+*/
+
+/* Fuzzes WOFF2StreamDecoder::Write against ConvertWOFF2ToTTF. */
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <woff2/decode.h>
+
+// Entry point for LibFuzzer. Feeds the input to WOFF2StreamDecoder in pieces
+// of varying sizes; it must accept the same files as ConvertWOFF2ToTTF and
+// write the same fonts.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  std::string expected;
+  woff2::WOFF2StringOut expected_out(&expected);
+  const bool expected_ok = woff2::ConvertWOFF2ToTTF(data, size,
+                                                    &expected_out);
+
+  static const size_t kPieces[] = {1, 7, 64, 1000};
+  std::string actual;
+  woff2::WOFF2StringOut out(&actual);
+  woff2::WOFF2StreamDecoder decoder(&out);
+  bool ok = true;
+  for (size_t offset = 0, i = 0; ok && offset < size; ++i) {
+    const size_t n = std::min(kPieces[i % 4], size - offset);
+    ok = decoder.Write(data + offset, n);
+    offset += n;
+  }
+  ok = ok && decoder.Finish();
+
+  if (ok != expected_ok ||
+      (ok && (out.Size() != expected_out.Size() ||
+              memcmp(actual.data(), expected.data(), out.Size()) != 0))) {
+    abort();
+  }
+  return 0;
+}